@@ -8,6 +8,7 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 #include <iostream>
 #include <iomanip>
 #include <vector>
@@ -48,6 +49,21 @@
 #endif
 
 double cpuTimeUpdateTransitionMatrices, cpuTimeUpdatePartials, cpuTimeAccumulateScaleFactors, cpuTimeCalculateRootLogLikelihoods, cpuTimeTotal;
+double lastLogL;
+bool checksPassed = true;
+int instancesCreated = 0;
+
+// Checks of library features run after the timed reps, each against the plain calls
+enum SelfCheck {
+    CHECK_SNAPSHOT   = 1 << 0,
+    CHECK_CHECKPOINT = 1 << 1,
+    CHECK_PARTITIONS = 1 << 2,
+    CHECK_TREE_BATCH = 1 << 3,
+    CHECK_TREE_MODEL = 1 << 4,
+    CHECK_PLAN       = 1 << 5
+};
+
+#define BATCH_TREE_COUNT 3          // trees evaluated together by the tree batch check
 
 static unsigned int rand_state = 1;
 
@@ -113,7 +129,62 @@ double getTimeDiff(struct timeval t1,
     return ((t2.tv_sec - t1.tv_sec) + (double)(t2.tv_usec-t1.tv_usec)/1000000.0);
 }
 
-void runBeagle(int resource, 
+void reportCheck(const char* name,
+                 double expectedLogL,
+                 double logL,
+                 double tolerance) {
+    bool passed = (fabs(logL - expectedLogL) <= tolerance * fabs(expectedLogL));
+    fprintf(stdout, "check %-22s: %s (%.10f, expected %.10f)\n", name, (passed ? "ok" : "FAILED"), logL, expectedLogL);
+    if (!passed)
+        checksPassed = false;
+}
+
+double rootLogLikelihood(int instance,
+                         int rootIndex) {
+    int categoryWeightsIndex = 0;
+    int stateFrequencyIndex = 0;
+    int cumulativeScalingIndex = BEAGLE_OP_NONE;
+    double logL = 0.0;
+    if (beagleCalculateRootLogLikelihoods(instance, &rootIndex, &categoryWeightsIndex, &stateFrequencyIndex,
+                                          &cumulativeScalingIndex, 1, &logL) != BEAGLE_SUCCESS)
+        abort("unable to calculate root log likelihood");
+    return logL;
+}
+
+// Recomputes all partials, then integrates the root
+double updateRootLogLikelihood(int instance,
+                               const int* operations,
+                               int operationCount,
+                               int rootIndex) {
+    if (beagleUpdatePartials(instance, (const BeagleOperation*) operations, operationCount, BEAGLE_OP_NONE) != BEAGLE_SUCCESS)
+        abort("unable to update partials");
+    return rootLogLikelihood(instance, rootIndex);
+}
+
+double treeModelLogLikelihood(int instance) {
+    double logL = 0.0;
+    if (beagleCalculateTreeModelLogLikelihood(instance, 0, 0, 0, BEAGLE_OP_NONE, &logL) != BEAGLE_SUCCESS)
+        abort("unable to calculate tree model log likelihood");
+    return logL;
+}
+
+// Leaves the internal partials computed for edges twice as long, and the matrices as they were,
+// so that a check cannot pass on partials left over from an earlier calculation
+void clobberPartials(int instance,
+                     const int* edgeIndices,
+                     const double* edgeLengths,
+                     int edgeCount,
+                     const int* operations,
+                     int operationCount) {
+    std::vector<double> doubledEdgeLengths(edgeCount);
+    for (int j = 0; j < edgeCount; j++)
+        doubledEdgeLengths[j] = 2.0 * edgeLengths[j];
+    beagleUpdateTransitionMatrices(instance, 0, edgeIndices, NULL, NULL, &doubledEdgeLengths[0], edgeCount);
+    beagleUpdatePartials(instance, (const BeagleOperation*) operations, operationCount, BEAGLE_OP_NONE);
+    beagleUpdateTransitionMatrices(instance, 0, edgeIndices, NULL, NULL, edgeLengths, edgeCount);
+}
+
+double runBeagle(int resource, 
                int stateCount, 
                int ntaxa, 
                int nsites, 
@@ -136,16 +207,45 @@ void runBeagle(int resource,
                bool eigencomplex,
                bool ievectrans,
                bool setmatrix,
-               bool opencl)
+               bool opencl,
+               int threadCount,
+               int patternBlockSize,
+               bool threadPool,
+               bool patternMajor,
+               bool compressPatterns,
+               bool mixedPrecision,
+               const char* spillDirectory,
+               bool asynchronous,
+               int selfChecks)
 {
     
     int edgeCount = ntaxa*2-2;
     int internalCount = ntaxa-1;
     int partialCount = ((ntaxa+internalCount)-compactTipCount)*eigenCount;
     int scaleCount = ((manualScaling || dynamicScaling) ? ntaxa : 0);
+    int extraTreeCount = ((selfChecks & CHECK_TREE_BATCH) ? BATCH_TREE_COUNT - 1 : 0);
+    partialCount += extraTreeCount * internalCount; // the further trees' internal nodes
     
     BeagleInstanceDetails instDetails;
     
+    struct timeval timeCreate1, timeCreate2;
+    gettimeofday(&timeCreate1, NULL);
+
+    int matrixCount = (calcderivs ? (3*edgeCount*eigenCount) : edgeCount*eigenCount) + extraTreeCount * edgeCount;
+    long requirementFlags = (opencl ? BEAGLE_FLAG_FRAMEWORK_OPENCL : 0) |
+                (ievectrans ? BEAGLE_FLAG_INVEVEC_TRANSPOSED : BEAGLE_FLAG_INVEVEC_STANDARD) |
+                (logscalers ? BEAGLE_FLAG_SCALERS_LOG : BEAGLE_FLAG_SCALERS_RAW) |
+                (eigencomplex ? BEAGLE_FLAG_EIGEN_COMPLEX : BEAGLE_FLAG_EIGEN_REAL) |
+                (dynamicScaling ? BEAGLE_FLAG_SCALING_DYNAMIC : 0) |
+                (autoScaling ? BEAGLE_FLAG_SCALING_AUTO : 0) |
+                (requireDoublePrecision ? BEAGLE_FLAG_PRECISION_DOUBLE :
+                        (mixedPrecision ? BEAGLE_FLAG_PRECISION_MIXED : BEAGLE_FLAG_PRECISION_SINGLE)) |
+                (threadCount > 0 ? (threadPool ? BEAGLE_FLAG_THREADING_CPP : BEAGLE_FLAG_THREADING_OPENMP) : 0) |
+                (patternMajor ? BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR : 0) |
+                (asynchronous ? BEAGLE_FLAG_COMPUTATION_ASYNCH : 0) |
+                (requireSSE ? BEAGLE_FLAG_VECTOR_SSE :
+                		  (requireAVX ? BEAGLE_FLAG_VECTOR_AVX : BEAGLE_FLAG_VECTOR_NONE));
+
     // create an instance of the BEAGLE library
 	int instance = beagleCreateInstance(
 			    ntaxa,			  /**< Number of tip data elements (input) */
@@ -154,31 +254,54 @@ void runBeagle(int resource,
 				stateCount,		  /**< Number of states in the continuous-time Markov chain (input) */
 				nsites,			  /**< Number of site patterns to be handled by the instance (input) */
 				eigenCount,		          /**< Number of rate matrix eigen-decomposition buffers to allocate (input) */
-                (calcderivs ? (3*edgeCount*eigenCount) : edgeCount*eigenCount),/**< Number of rate matrix buffers (input) */
+                matrixCount,      /**< Number of rate matrix buffers (input) */
                 rateCategoryCount,/**< Number of rate categories */
                 scaleCount*eigenCount,          /**< scaling buffers */
 				&resource,		  /**< List of potential resource on which this instance is allowed (input, NULL implies no restriction */
 				1,			      /**< Length of resourceList list (input) */
                 0,         /**< Bit-flags indicating preferred implementation charactertistics, see BeagleFlags (input) */
-                (opencl ? BEAGLE_FLAG_FRAMEWORK_OPENCL : 0) |
-                (ievectrans ? BEAGLE_FLAG_INVEVEC_TRANSPOSED : BEAGLE_FLAG_INVEVEC_STANDARD) |
-                (logscalers ? BEAGLE_FLAG_SCALERS_LOG : BEAGLE_FLAG_SCALERS_RAW) |
-                (eigencomplex ? BEAGLE_FLAG_EIGEN_COMPLEX : BEAGLE_FLAG_EIGEN_REAL) |
-                (dynamicScaling ? BEAGLE_FLAG_SCALING_DYNAMIC : 0) |
-                (autoScaling ? BEAGLE_FLAG_SCALING_AUTO : 0) |
-                (requireDoublePrecision ? BEAGLE_FLAG_PRECISION_DOUBLE : BEAGLE_FLAG_PRECISION_SINGLE) |
-                (requireSSE ? BEAGLE_FLAG_VECTOR_SSE :
-                		  (requireAVX ? BEAGLE_FLAG_VECTOR_AVX : BEAGLE_FLAG_VECTOR_NONE)),	  /**< Bit-flags indicating required implementation characteristics, see BeagleFlags (input) */
+                requirementFlags,	  /**< Bit-flags indicating required implementation characteristics, see BeagleFlags (input) */
 				&instDetails);
+    gettimeofday(&timeCreate2, NULL);
     if (instance < 0) {
 	    fprintf(stderr, "Failed to obtain BEAGLE instance\n\n");
-	    return;
+	    return -1.0;
     }
+    instancesCreated++;
         
     int rNumber = instDetails.resourceNumber;
     fprintf(stdout, "Using resource %i:\n", rNumber);
     fprintf(stdout, "\tRsrc Name : %s\n",instDetails.resourceName);
     fprintf(stdout, "\tImpl Name : %s\n", instDetails.implName);    
+
+    if (threadCount > 0) {
+        if (beagleSetCPUThreadCount(instance, threadCount) != BEAGLE_SUCCESS)
+            abort("unable to set thread count");
+        fprintf(stdout, "\tThreads   : %i (%s)\n", threadCount,
+                (instDetails.flags & BEAGLE_FLAG_THREADING_CPP ? "thread pool" : "OpenMP"));
+    }
+
+    if (patternBlockSize > 0) {
+        if (beagleSetCPUPatternBlockSize(instance, patternBlockSize) != BEAGLE_SUCCESS)
+            abort("unable to set pattern block size");
+        fprintf(stdout, "\tBlock size: %i\n", patternBlockSize);
+    }
+
+    if (compressPatterns) {
+        if (beagleSetCPUPatternCompression(instance, 1) != BEAGLE_SUCCESS)
+            abort("unable to enable pattern compression");
+        fprintf(stdout, "\tPatterns  : identical columns collapsed\n");
+    }
+
+    if (spillDirectory != NULL) {
+        if (beagleSetCPUPartialsSpill(instance, spillDirectory) != BEAGLE_SUCCESS)
+            abort("unable to spill partials to a file");
+        fprintf(stdout, "\tPartials  : file in %s\n", spillDirectory);
+    }
+
+    if (asynchronous) {
+        fprintf(stdout, "\tCompute   : asynchronous\n");
+    }
     
     if (!(instDetails.flags & BEAGLE_FLAG_SCALING_AUTO))
         autoScaling = false;
@@ -527,6 +650,14 @@ void runBeagle(int resource,
                         internalCount*eigenCount,              // operationCount
                         (dynamicScaling ? internalCount : BEAGLE_OP_NONE));             // cumulative scaling index
 
+        if (asynchronous) {
+            // The update was only queued; wait for it so that the partials timing stays comparable
+            std::vector<int> destinationPartials(internalCount*eigenCount);
+            for (int j = 0; j < internalCount*eigenCount; j++)
+                destinationPartials[j] = operations[BEAGLE_OP_COUNT*j+0];
+            beagleWaitForPartials(instance, &destinationPartials[0], internalCount*eigenCount);
+        }
+
         gettimeofday(&time3, NULL);
 
         int scalingFactorsCount = internalCount;
@@ -610,10 +741,255 @@ void runBeagle(int resource,
         cpuTimeTotal = bestTimeTotal;
     }
     
+    lastLogL = logL;
+
     if (!calcderivs)
         fprintf(stdout, "logL = %.5f \n", logL);
     else
         fprintf(stdout, "logL = %.5f d1 = %.5f d2 = %.5f\n", logL, deriv1, deriv2);
+
+    if (selfChecks & CHECK_SNAPSHOT) {
+        // Change matrices and partials after a snapshot; restoring must bring both back
+        double savedLogL = updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]);
+        if (beagleSaveState(instance) != BEAGLE_SUCCESS)
+            abort("unable to save state");
+        double* changedEdgeLengths = new double[edgeCount];
+        for (int j = 0; j < edgeCount; j++)
+            changedEdgeLengths[j] = 2.0 * edgeLengths[j];
+        beagleUpdateTransitionMatrices(instance, 0, edgeIndices, NULL, NULL, changedEdgeLengths, edgeCount);
+        delete[] changedEdgeLengths;
+        double changedLogL = updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]);
+        if (changedLogL == savedLogL)
+            abort("snapshot check did not change the likelihood");
+        if (beagleRestoreState(instance) != BEAGLE_SUCCESS)
+            abort("unable to restore state");
+        reportCheck("snapshot partials", savedLogL, rootLogLikelihood(instance, rootIndices[0]), 0.0);
+        reportCheck("snapshot matrices", savedLogL,
+                    updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]), 0.0);
+    }
+
+    if (selfChecks & CHECK_CHECKPOINT) {
+        // Read a checkpoint into a second instance created with the same arguments
+        const char* checkpointFile = "genomictest.checkpoint";
+        double writtenLogL = updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]);
+        if (beagleWriteCheckpoint(instance, checkpointFile) != BEAGLE_SUCCESS)
+            abort("unable to write checkpoint");
+        BeagleInstanceDetails copyDetails;
+        int copy = beagleCreateInstance(ntaxa, partialCount, compactTipCount, stateCount, nsites, eigenCount,
+                                        matrixCount, rateCategoryCount, scaleCount*eigenCount, &resource, 1,
+                                        0, requirementFlags, &copyDetails);
+        if (copy < 0 || beagleReadCheckpoint(copy, checkpointFile) != BEAGLE_SUCCESS)
+            abort("unable to read checkpoint into a new instance");
+        reportCheck("checkpoint partials", writtenLogL, rootLogLikelihood(copy, rootIndices[0]), 0.0);
+        reportCheck("checkpoint matrices", writtenLogL,
+                    updateRootLogLikelihood(copy, operations, internalCount, rootIndices[0]), 0.0);
+        beagleFinalizeInstance(copy);
+        remove(checkpointFile);
+    }
+
+    if (selfChecks & CHECK_PARTITIONS) {
+        // Split the patterns into consecutive runs; the partitions' logLs must sum to the whole
+        double wholeLogL = updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]);
+        int partitionCount = (nsites < 3 ? nsites : 3);
+        std::vector<int> patternPartitions(nsites);
+        for (int k = 0; k < nsites; k++)
+            patternPartitions[k] = (int) ((long) k * partitionCount / nsites);
+        if (beagleSetPatternPartitions(instance, partitionCount, &patternPartitions[0]) != BEAGLE_SUCCESS)
+            abort("unable to set pattern partitions");
+        clobberPartials(instance, edgeIndices, edgeLengths, edgeCount, operations, internalCount);
+
+        std::vector<BeagleOperationByPartition> partitionOperations;
+        for (int j = 0; j < internalCount; j++) {
+            for (int p = 0; p < partitionCount; p++) {
+                const int* operation = &operations[BEAGLE_OP_COUNT*j];
+                BeagleOperationByPartition partitionOperation = {operation[0], operation[1], operation[2],
+                                                                 operation[3], operation[4], operation[5], operation[6],
+                                                                 p, BEAGLE_OP_NONE};
+                partitionOperations.push_back(partitionOperation);
+            }
+        }
+        if (beagleUpdatePartialsByPartition(instance, &partitionOperations[0], (int) partitionOperations.size()) != BEAGLE_SUCCESS)
+            abort("unable to update partials by partition");
+
+        std::vector<int> partitionRoots(partitionCount, rootIndices[0]);
+        std::vector<int> partitionIndices(partitionCount);
+        std::vector<int> zeroIndices(partitionCount, 0);
+        std::vector<int> noScaling(partitionCount, BEAGLE_OP_NONE);
+        std::vector<double> partitionLogL(partitionCount);
+        double sumLogL = 0.0;
+        for (int p = 0; p < partitionCount; p++)
+            partitionIndices[p] = p;
+        if (beagleCalculateRootLogLikelihoodsByPartition(instance, &partitionRoots[0], &zeroIndices[0], &zeroIndices[0],
+                                                         &noScaling[0], &partitionIndices[0], partitionCount, 1,
+                                                         &partitionLogL[0], &sumLogL) != BEAGLE_SUCCESS)
+            abort("unable to calculate root log likelihoods by partition");
+        double partitionSum = 0.0;
+        for (int p = 0; p < partitionCount; p++)
+            partitionSum += partitionLogL[p];
+        reportCheck("partitions sum", wholeLogL, partitionSum, 1E-10);
+        reportCheck("partitions total", wholeLogL, sumLogL, 1E-10);
+
+        std::fill(patternPartitions.begin(), patternPartitions.end(), 0);
+        beagleSetPatternPartitions(instance, 1, &patternPartitions[0]);
+    }
+
+    if (selfChecks & CHECK_TREE_BATCH) {
+        // Tree t has its tips rotated by t, edges 1 + t/2 times as long, and its own matrices and
+        // internal partials; each must give in the batch what it gives on its own
+        std::vector<int> treeEdgeIndices(BATCH_TREE_COUNT * edgeCount);
+        std::vector<double> treeEdgeLengths(BATCH_TREE_COUNT * edgeCount);
+        std::vector<int> treeOperations(BATCH_TREE_COUNT * internalCount * BEAGLE_OP_COUNT);
+        int treeRoots[BATCH_TREE_COUNT];
+        int treeOperationCounts[BATCH_TREE_COUNT];
+        int zeroIndices[BATCH_TREE_COUNT];
+        int noScaling[BATCH_TREE_COUNT];
+        for (int t = 0; t < BATCH_TREE_COUNT; t++) {
+            for (int e = 0; e < edgeCount; e++) {
+                treeEdgeIndices[t*edgeCount + e] = t*edgeCount + e;
+                treeEdgeLengths[t*edgeCount + e] = edgeLengths[e] * (1.0 + 0.5 * t);
+            }
+            for (int j = 0; j < internalCount; j++) {
+                const int* operation = &operations[BEAGLE_OP_COUNT*j];
+                int* treeOperation = &treeOperations[BEAGLE_OP_COUNT*(t*internalCount + j)];
+                treeOperation[0] = operation[0] + t*internalCount;
+                treeOperation[1] = BEAGLE_OP_NONE;
+                treeOperation[2] = BEAGLE_OP_NONE;
+                for (int c = 3; c < BEAGLE_OP_COUNT; c += 2) {
+                    treeOperation[c] = (operation[c] < ntaxa ? (operation[c] + t) % ntaxa : operation[c] + t*internalCount);
+                    treeOperation[c+1] = operation[c+1] + t*edgeCount;
+                }
+            }
+            treeRoots[t] = rootIndices[0] + t*internalCount;
+            treeOperationCounts[t] = internalCount;
+            zeroIndices[t] = 0;
+            noScaling[t] = BEAGLE_OP_NONE;
+        }
+        beagleUpdateTransitionMatrices(instance, 0, &treeEdgeIndices[0], NULL, NULL, &treeEdgeLengths[0], BATCH_TREE_COUNT * edgeCount);
+
+        double treeLogL[BATCH_TREE_COUNT];
+        for (int t = 0; t < BATCH_TREE_COUNT; t++)
+            treeLogL[t] = updateRootLogLikelihood(instance, &treeOperations[BEAGLE_OP_COUNT*t*internalCount], internalCount, treeRoots[t]);
+        clobberPartials(instance, &treeEdgeIndices[0], &treeEdgeLengths[0], BATCH_TREE_COUNT * edgeCount,
+                        &treeOperations[0], BATCH_TREE_COUNT * internalCount);
+
+        double batchLogL[BATCH_TREE_COUNT];
+        if (beagleCalculateTreeLogLikelihoods(instance, (const BeagleOperation*) &treeOperations[0], treeOperationCounts,
+                                              treeRoots, zeroIndices, zeroIndices, noScaling, BATCH_TREE_COUNT,
+                                              batchLogL) != BEAGLE_SUCCESS)
+            abort("unable to calculate tree log likelihoods");
+        for (int t = 0; t < BATCH_TREE_COUNT; t++) {
+            std::stringstream name;
+            name << "tree batch " << t;
+            reportCheck(name.str().c_str(), treeLogL[t], batchLogL[t], 0.0);
+        }
+        beagleUpdateTransitionMatrices(instance, 0, edgeIndices, NULL, NULL, edgeLengths, edgeCount);
+    }
+
+    if (selfChecks & CHECK_TREE_MODEL) {
+        // Register the tree of the operations: node i keeps its partials in buffer i and its
+        // edge's matrix in matrix i, as the operations already have it
+        int nodeCount = ntaxa + internalCount;
+        std::vector<int> parents(nodeCount, BEAGLE_OP_NONE);
+        std::vector<double> nodeEdgeLengths(nodeCount, 0.0);
+        for (int j = 0; j < internalCount; j++) {
+            parents[operations[BEAGLE_OP_COUNT*j+3]] = operations[BEAGLE_OP_COUNT*j];
+            parents[operations[BEAGLE_OP_COUNT*j+5]] = operations[BEAGLE_OP_COUNT*j];
+        }
+        for (int e = 0; e < edgeCount; e++)
+            nodeEdgeLengths[e] = edgeLengths[e];
+        double fullLogL = updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]);
+        clobberPartials(instance, edgeIndices, edgeLengths, edgeCount, operations, internalCount);
+        if (beagleSetTreeModel(instance, &parents[0], &nodeEdgeLengths[0], nodeCount) != BEAGLE_SUCCESS)
+            abort("unable to set tree model");
+        reportCheck("tree model", fullLogL, treeModelLogLikelihood(instance), 0.0);
+
+        // Lengthen the edge above tip 0, then recompute the whole tree with the plain calls
+        int editedNode = 0;
+        double editedLength = 1.5 * edgeLengths[0];
+        beagleSetTreeModelEdgeLengths(instance, &editedNode, &editedLength, 1);
+        double editedLogL = treeModelLogLikelihood(instance);
+        std::vector<double> editedEdgeLengths(edgeLengths, edgeLengths + edgeCount);
+        editedEdgeLengths[0] = editedLength;
+        beagleUpdateTransitionMatrices(instance, 0, edgeIndices, NULL, NULL, &editedEdgeLengths[0], edgeCount);
+        double expectedLogL = updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]);
+        reportCheck("tree model edge", expectedLogL, editedLogL, 0.0);
+
+        // A plain update writing a buffer of the tree must make the model recompute it
+        treeModelLogLikelihood(instance);
+        int strayOperation[BEAGLE_OP_COUNT] = {rootIndices[0], BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 1, 1};
+        beagleUpdatePartials(instance, (const BeagleOperation*) strayOperation, 1, BEAGLE_OP_NONE);
+        reportCheck("tree model after update", expectedLogL, treeModelLogLikelihood(instance), 0.0);
+
+        // Only the path from tip 0 to the root is stale after its edge changes, so recalculating
+        // must take well under the time of the whole tree, which any other write makes stale
+        int pathLength = 0;
+        for (int node = parents[0]; node != BEAGLE_OP_NONE; node = parents[node])
+            pathLength++;
+        if (pathLength < internalCount) {
+            struct timeval timeModel1, timeModel2;
+            double bestPathTime = 0.0;
+            double bestTreeTime = 0.0;
+            for (int r = 0; r < 5; r++) {
+                editedLength = (r % 2 ? 1.5 : 1.25) * edgeLengths[0];
+                beagleSetTreeModelEdgeLengths(instance, &editedNode, &editedLength, 1);
+                gettimeofday(&timeModel1, NULL);
+                treeModelLogLikelihood(instance);
+                gettimeofday(&timeModel2, NULL);
+                if (r == 0 || getTimeDiff(timeModel1, timeModel2) < bestPathTime)
+                    bestPathTime = getTimeDiff(timeModel1, timeModel2);
+
+                beagleSetCategoryRates(instance, &rates[0]);
+                gettimeofday(&timeModel1, NULL);
+                treeModelLogLikelihood(instance);
+                gettimeofday(&timeModel2, NULL);
+                if (r == 0 || getTimeDiff(timeModel1, timeModel2) < bestTreeTime)
+                    bestTreeTime = getTimeDiff(timeModel1, timeModel2);
+            }
+            // Halfway between the path's share of the internal nodes and the whole tree
+            double limit = (double) (pathLength + internalCount) / (2 * internalCount);
+            bool passed = (bestPathTime < limit * bestTreeTime);
+            fprintf(stdout, "check %-22s: %s (%d of %d nodes, %.6fs vs %.6fs for the whole tree)\n", "tree model path",
+                    (passed ? "ok" : "FAILED"), pathLength, internalCount, bestPathTime, bestTreeTime);
+            if (!passed)
+                checksPassed = false;
+        }
+        beagleUpdateTransitionMatrices(instance, 0, edgeIndices, NULL, NULL, edgeLengths, edgeCount);
+    }
+
+    if (selfChecks & CHECK_PLAN) {
+        // A plan of the operations must give what beagleUpdatePartials gives with them
+        double updateLogL = updateRootLogLikelihood(instance, operations, internalCount, rootIndices[0]);
+        int plan = beagleCreatePlan(instance, (const BeagleOperation*) operations, internalCount, BEAGLE_OP_NONE);
+        if (plan < 0)
+            abort("unable to create plan");
+        clobberPartials(instance, edgeIndices, edgeLengths, edgeCount, operations, internalCount);
+        if (beagleExecutePlan(instance, plan) != BEAGLE_SUCCESS)
+            abort("unable to execute plan");
+        reportCheck("plan", updateLogL, rootLogLikelihood(instance, rootIndices[0]), 0.0);
+
+        // and save the scheduling work of every call
+        struct timeval timePlan1, timePlan2;
+        double bestUpdateTime = 0.0;
+        double bestPlanTime = 0.0;
+        for (int r = 0; r < 20; r++) {
+            gettimeofday(&timePlan1, NULL);
+            beagleUpdatePartials(instance, (const BeagleOperation*) operations, internalCount, BEAGLE_OP_NONE);
+            rootLogLikelihood(instance, rootIndices[0]);
+            gettimeofday(&timePlan2, NULL);
+            if (r == 0 || getTimeDiff(timePlan1, timePlan2) < bestUpdateTime)
+                bestUpdateTime = getTimeDiff(timePlan1, timePlan2);
+
+            gettimeofday(&timePlan1, NULL);
+            beagleExecutePlan(instance, plan);
+            rootLogLikelihood(instance, rootIndices[0]);
+            gettimeofday(&timePlan2, NULL);
+            if (r == 0 || getTimeDiff(timePlan1, timePlan2) < bestPlanTime)
+                bestPlanTime = getTimeDiff(timePlan1, timePlan2);
+        }
+        fprintf(stdout, "plan timing: %.6fs with beagleUpdatePartials, %.6fs with beagleExecutePlan\n",
+                bestUpdateTime, bestPlanTime);
+        beagleFinalizePlan(instance, plan);
+    }
     
     std::cout.setf(std::ios::showpoint);
     std::cout.setf(std::ios::floatfield, std::ios::fixed);
@@ -644,9 +1020,17 @@ void runBeagle(int resource,
         std::cout << " rootLnL:    ";
         printTiming(bestTimeCalculateRootLogLikelihoods, timePrecision, resource, cpuTimeCalculateRootLogLikelihoods, speedupPrecision, 1, bestTimeTotal, percentPrecision);
     }
-    std::cout << "\n";
     
+    struct timeval timeFinalize1, timeFinalize2;
+    gettimeofday(&timeFinalize1, NULL);
 	beagleFinalizeInstance(instance);
+    gettimeofday(&timeFinalize2, NULL);
+
+    std::cout << "instance create: " << std::setprecision(timePrecision) << getTimeDiff(timeCreate1, timeCreate2) << "s";
+    std::cout << ", finalize: " << std::setprecision(timePrecision) << getTimeDiff(timeFinalize1, timeFinalize2) << "s\n";
+    std::cout << "\n";
+
+    return bestTimeUpdatePartials;
 }
 
 void printFlags(long inFlags) {
@@ -656,6 +1040,7 @@ void printFlags(long inFlags) {
     if (inFlags & BEAGLE_FLAG_PROCESSOR_CELL)     fprintf(stdout, " PROCESSOR_CELL");
     if (inFlags & BEAGLE_FLAG_PRECISION_DOUBLE)   fprintf(stdout, " PRECISION_DOUBLE");
     if (inFlags & BEAGLE_FLAG_PRECISION_SINGLE)   fprintf(stdout, " PRECISION_SINGLE");
+    if (inFlags & BEAGLE_FLAG_PRECISION_MIXED)    fprintf(stdout, " PRECISION_MIXED");
     if (inFlags & BEAGLE_FLAG_COMPUTATION_ASYNCH) fprintf(stdout, " COMPUTATION_ASYNCH");
     if (inFlags & BEAGLE_FLAG_COMPUTATION_SYNCH)  fprintf(stdout, " COMPUTATION_SYNCH");
     if (inFlags & BEAGLE_FLAG_EIGEN_REAL)         fprintf(stdout, " EIGEN_REAL");
@@ -671,6 +1056,8 @@ void printFlags(long inFlags) {
     if (inFlags & BEAGLE_FLAG_VECTOR_AVX)         fprintf(stdout, " VECTOR_AVX");
     if (inFlags & BEAGLE_FLAG_THREADING_NONE)     fprintf(stdout, " THREADING_NONE");
     if (inFlags & BEAGLE_FLAG_THREADING_OPENMP)   fprintf(stdout, " THREADING_OPENMP");
+    if (inFlags & BEAGLE_FLAG_THREADING_CPP)      fprintf(stdout, " THREADING_CPP");
+    if (inFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR) fprintf(stdout, " PARTIALS_PATTERN_MAJOR");
     if (inFlags & BEAGLE_FLAG_FRAMEWORK_CPU)      fprintf(stdout, " FRAMEWORK_CPU");
     if (inFlags & BEAGLE_FLAG_FRAMEWORK_CUDA)     fprintf(stdout, " FRAMEWORK_CUDA");
     if (inFlags & BEAGLE_FLAG_FRAMEWORK_OPENCL)   fprintf(stdout, " FRAMEWORK_OPENCL");
@@ -698,10 +1085,25 @@ void printResourceList() {
 
 void helpMessage() {
 	std::cerr << "Usage:\n\n";
-	std::cerr << "genomictest [--help] [--resourcelist] [--states <integer>] [--taxa <integer>] [--sites <integer>] [--rates <integer>] [--manualscale] [--autoscale] [--dynamicscale] [--rsrc <integer>] [--reps <integer>] [--doubleprecision] [--SSE] [--AVX] [--compact-tips] [--seed <integer>] [--rescale-frequency <integer>] [--full-timing] [--unrooted] [--calcderivs] [--logscalers] [--eigencount <integer>] [--eigencomplex] [--ievectrans] [--setmatrix] [--opencl]\n\n";
+	std::cerr << "genomictest [--help] [--resourcelist] [--states <integer>] [--taxa <integer>] [--sites <integer>] [--rates <integer>] [--manualscale] [--autoscale] [--dynamicscale] [--rsrc <integer>] [--reps <integer>] [--doubleprecision] [--SSE] [--AVX] [--compact-tips] [--seed <integer>] [--rescale-frequency <integer>] [--full-timing] [--unrooted] [--calcderivs] [--logscalers] [--eigencount <integer>] [--eigencomplex] [--ievectrans] [--setmatrix] [--opencl] [--threads <integer>] [--pattern-block <integer>] [--thread-scaling] [--thread-pool] [--pattern-major] [--compress-patterns] [--mixedprecision] [--partials-spill <directory>] [--async] [--check-snapshot] [--check-checkpoint] [--check-partitions] [--check-tree-batch] [--check-tree-model] [--check-plan]\n\n";
     std::cerr << "If --help is specified, this usage message is shown\n\n";
     std::cerr << "If --manualscale, --autoscale, or --dynamicscale is specified, BEAGLE will rescale the partials during computation\n\n";
     std::cerr << "If --full-timing is specified, you will see more detailed timing results (requires BEAGLE_DEBUG_SYNCH defined to report accurate values)\n\n";
+    std::cerr << "If --threads is specified, a multi-threaded CPU implementation is required and uses the given number of threads\n\n";
+    std::cerr << "If --thread-scaling is specified, each resource is run with 1, 2, 4, ... up to --threads threads and the partials speedup is reported\n\n";
+    std::cerr << "If --thread-pool is specified, threads come from a persistent per-instance pool instead of OpenMP; with --thread-scaling both are timed and compared\n\n";
+    std::cerr << "If --pattern-major is specified, the partials of all rate categories of a pattern are stored together\n\n";
+    std::cerr << "If --compress-patterns is specified, a CPU instance collapses identical site columns into one pattern\n\n";
+    std::cerr << "If --mixedprecision is specified, single precision partials are used with double precision sums and scale factors, and the logL error against double and single precision runs is reported; the exit status is nonzero if the mixed error is the larger\n\n";
+    std::cerr << "If --partials-spill is specified, a CPU instance keeps its partials in a file in the given directory instead of in memory\n\n";
+    std::cerr << "If --async is specified, partials updates are queued and run in the background (BEAGLE_FLAG_COMPUTATION_ASYNCH)\n\n";
+    std::cerr << "If --check-snapshot is specified, partials and matrices changed after beagleSaveState must give the earlier logL once beagleRestoreState is called\n\n";
+    std::cerr << "If --check-checkpoint is specified, a checkpoint written by beagleWriteCheckpoint and read into a new instance must give the same logL\n\n";
+    std::cerr << "If --check-partitions is specified, the logLs of three partitions of the patterns, updated and integrated by partition, must sum to the logL of all patterns\n\n";
+    std::cerr << "If --check-tree-batch is specified, each of three trees evaluated by beagleCalculateTreeLogLikelihoods must give the logL of its own beagleUpdatePartials and beagleCalculateRootLogLikelihoods calls\n\n";
+    std::cerr << "If --check-tree-model is specified, the tree of the operations is registered with beagleSetTreeModel; its logL must match the plain calls after an edge changes and after beagleUpdatePartials writes one of its buffers, and recomputing the path above one changed edge must take clearly less time than the whole tree\n\n";
+    std::cerr << "If --check-plan is specified, running a plan made by beagleCreatePlan must give the logL of beagleUpdatePartials with the same operations, and the best time of each is reported\n\n";
+    std::cerr << "If a --check option is specified, the exit status is nonzero when one of its checks fails\n\n";
 	std::exit(0);
 }
 
@@ -729,7 +1131,17 @@ void interpretCommandLineParameters(int argc, const char* argv[],
                                     bool* eigencomplex,
                                     bool* ievectrans,
                                     bool* setmatrix,
-                                    bool* opencl)	{
+                                    bool* opencl,
+                                    int* threadCount,
+                                    int* patternBlockSize,
+                                    bool* threadScaling,
+                                    bool* threadPool,
+                                    bool* patternMajor,
+                                    bool* compressPatterns,
+                                    bool* mixedPrecision,
+                                    const char** spillDirectory,
+                                    bool* asynchronous,
+                                    int* selfChecks)	{
     bool expecting_stateCount = false;
 	bool expecting_ntaxa = false;
 	bool expecting_nsites = false;
@@ -740,6 +1152,9 @@ void interpretCommandLineParameters(int argc, const char* argv[],
 	bool expecting_seed = false;
     bool expecting_rescaleFrequency = false;
     bool expecting_eigenCount = false;
+    bool expecting_threadCount = false;
+    bool expecting_patternBlockSize = false;
+    bool expecting_spillDirectory = false;
 	
     for (unsigned i = 1; i < argc; ++i) {
 		std::string option = argv[i];
@@ -780,6 +1195,15 @@ void interpretCommandLineParameters(int argc, const char* argv[],
         } else if (expecting_eigenCount) {
             *eigenCount = (unsigned)atoi(option.c_str());
             expecting_eigenCount = false;
+        } else if (expecting_threadCount) {
+            *threadCount = (unsigned)atoi(option.c_str());
+            expecting_threadCount = false;
+        } else if (expecting_patternBlockSize) {
+            *patternBlockSize = (unsigned)atoi(option.c_str());
+            expecting_patternBlockSize = false;
+        } else if (expecting_spillDirectory) {
+            *spillDirectory = argv[i];
+            expecting_spillDirectory = false;
         } else if (option == "--help") {
 			helpMessage();
         } else if (option == "--resourcelist") {
@@ -832,6 +1256,36 @@ void interpretCommandLineParameters(int argc, const char* argv[],
         	*setmatrix = true;
         } else if (option == "--opencl") {
         	*opencl = true;
+        } else if (option == "--threads") {
+        	expecting_threadCount = true;
+        } else if (option == "--pattern-block") {
+        	expecting_patternBlockSize = true;
+        } else if (option == "--thread-scaling") {
+        	*threadScaling = true;
+        } else if (option == "--thread-pool") {
+        	*threadPool = true;
+        } else if (option == "--pattern-major") {
+        	*patternMajor = true;
+        } else if (option == "--compress-patterns") {
+        	*compressPatterns = true;
+        } else if (option == "--mixedprecision") {
+        	*mixedPrecision = true;
+        } else if (option == "--partials-spill") {
+        	expecting_spillDirectory = true;
+        } else if (option == "--async") {
+        	*asynchronous = true;
+        } else if (option == "--check-snapshot") {
+        	*selfChecks |= CHECK_SNAPSHOT;
+        } else if (option == "--check-checkpoint") {
+        	*selfChecks |= CHECK_CHECKPOINT;
+        } else if (option == "--check-partitions") {
+        	*selfChecks |= CHECK_PARTITIONS;
+        } else if (option == "--check-tree-batch") {
+        	*selfChecks |= CHECK_TREE_BATCH;
+        } else if (option == "--check-tree-model") {
+        	*selfChecks |= CHECK_TREE_MODEL;
+        } else if (option == "--check-plan") {
+        	*selfChecks |= CHECK_PLAN;
         } else {
 			std::string msg("Unknown command line parameter \"");
 			msg.append(option);			
@@ -868,6 +1322,15 @@ void interpretCommandLineParameters(int argc, const char* argv[],
 
     if (expecting_eigenCount)
 		abort("read last command line option without finding value associated with --eigencount");
+
+    if (expecting_threadCount)
+		abort("read last command line option without finding value associated with --threads");
+
+    if (expecting_patternBlockSize)
+		abort("read last command line option without finding value associated with --pattern-block");
+
+    if (expecting_spillDirectory)
+		abort("read last command line option without finding value associated with --partials-spill");
     
 	if (*stateCount < 2)
 		abort("invalid number of states supplied on the command line");
@@ -901,6 +1364,27 @@ void interpretCommandLineParameters(int argc, const char* argv[],
     
     if (*eigencomplex && (*stateCount != 4 || *eigenCount != 1))
         abort("eigencomplex option only works with stateCount=4 and eigenCount=1");
+
+    if (*threadCount < 0)
+        abort("invalid number for threads supplied on the command line");
+
+    if (*patternBlockSize < 0)
+        abort("invalid number for pattern-block supplied on the command line");
+
+    if (*threadScaling && *threadCount < 1)
+        abort("thread-scaling option requires threads option");
+
+    if (*threadPool && *threadCount < 1)
+        abort("thread-pool option requires threads option");
+
+    if (*mixedPrecision && *requireDoublePrecision)
+        abort("mixedprecision option cannot be combined with doubleprecision option");
+
+    if (*selfChecks && (*manualScaling || *autoScaling || *dynamicScaling || *unrooted || *eigenCount != 1 || *setmatrix))
+        abort("check options require a rooted tree, a single eigen decomposition and no rescaling or setmatrix option");
+
+    if ((*selfChecks & CHECK_PARTITIONS) && *compressPatterns)
+        abort("check-partitions option cannot be combined with compress-patterns option");
 }
 
 int main( int argc, const char* argv[] )
@@ -926,6 +1410,16 @@ int main( int argc, const char* argv[] )
     bool ievectrans = false;
     bool setmatrix = false;
     bool opencl = false;
+    int threadCount = 0;
+    int patternBlockSize = 0;
+    bool threadScaling = false;
+    bool threadPool = false;
+    bool patternMajor = false;
+    bool compressPatterns = false;
+    bool mixedPrecision = false;
+    const char* spillDirectory = NULL;
+    bool asynchronous = false;
+    int selfChecks = 0;
 
     std::vector<int> rsrc;
     rsrc.push_back(-1);
@@ -934,12 +1428,17 @@ int main( int argc, const char* argv[] )
     bool fullTiming = false;
     
     int rateCategoryCount = 4;
+
+    int exitCode = 0;
     
     interpretCommandLineParameters(argc, argv, &stateCount, &ntaxa, &nsites, &manualScaling, &autoScaling,
                                    &dynamicScaling, &rateCategoryCount, &rsrc, &nreps, &fullTiming,
                                    &requireDoublePrecision, &requireSSE, &requireAVX, &compactTipCount, &randomSeed,
                                    &rescaleFrequency, &unrooted, &calcderivs, &logscalers,
-                                   &eigenCount, &eigencomplex, &ievectrans, &setmatrix, &opencl);
+                                   &eigenCount, &eigencomplex, &ievectrans, &setmatrix, &opencl,
+                                   &threadCount, &patternBlockSize, &threadScaling, &threadPool,
+                                   &patternMajor, &compressPatterns, &mixedPrecision, &spillDirectory,
+                                   &asynchronous, &selfChecks);
     
 	std::cout << "\nSimulating genomic ";
     if (stateCount == 4)
@@ -954,6 +1453,54 @@ int main( int argc, const char* argv[] )
     if(rl != NULL){
         for(int i=0; i<rl->length; i++){
             if (rsrc.size() == 1 || std::find(rsrc.begin(), rsrc.end(), i)!=rsrc.end()) {
+                if (threadScaling) {
+                    std::vector<int> threadCounts;
+                    std::vector<double> partialsTimes;
+                    std::vector<double> poolPartialsTimes;
+                    for (int t = 1; t < threadCount; t *= 2)
+                        threadCounts.push_back(t);
+                    threadCounts.push_back(threadCount);
+                    for (int t = 0; t < threadCounts.size(); t++) {
+                        partialsTimes.push_back(runBeagle(i, stateCount, ntaxa, nsites,
+                                                          manualScaling, autoScaling, dynamicScaling,
+                                                          rateCategoryCount, nreps, fullTiming,
+                                                          requireDoublePrecision, requireSSE, requireAVX,
+                                                          compactTipCount, randomSeed, rescaleFrequency,
+                                                          unrooted, calcderivs, logscalers, eigenCount,
+                                                          eigencomplex, ievectrans, setmatrix, opencl,
+                                                          threadCounts[t], patternBlockSize, false, patternMajor,
+                                                          compressPatterns, mixedPrecision, spillDirectory, asynchronous,
+                                                          selfChecks));
+                        if (threadPool)
+                            poolPartialsTimes.push_back(runBeagle(i, stateCount, ntaxa, nsites,
+                                                                  manualScaling, autoScaling, dynamicScaling,
+                                                                  rateCategoryCount, nreps, fullTiming,
+                                                                  requireDoublePrecision, requireSSE, requireAVX,
+                                                                  compactTipCount, randomSeed, rescaleFrequency,
+                                                                  unrooted, calcderivs, logscalers, eigenCount,
+                                                                  eigencomplex, ievectrans, setmatrix, opencl,
+                                                                  threadCounts[t], patternBlockSize, true, patternMajor,
+                                                                  compressPatterns, mixedPrecision, spillDirectory, asynchronous,
+                                                                  selfChecks));
+                    }
+                    if (partialsTimes[0] > 0) {
+                        std::cout << "thread scaling of partials for resource " << i << ":\n";
+                        for (int t = 0; t < threadCounts.size(); t++) {
+                            if (partialsTimes[t] > 0) {
+                                std::cout << " threads " << std::setw(3) << std::setfill(' ') << threadCounts[t] << ": ";
+                                std::cout << std::setprecision(6) << partialsTimes[t] << "s (";
+                                std::cout << std::setprecision(2) << partialsTimes[0]/partialsTimes[t] << "x)";
+                                if (threadPool && poolPartialsTimes[t] > 0) {
+                                    std::cout << ", thread pool: " << std::setprecision(6) << poolPartialsTimes[t] << "s (";
+                                    std::cout << std::setprecision(2) << partialsTimes[t]/poolPartialsTimes[t] << "x vs OpenMP)";
+                                }
+                                std::cout << "\n";
+                            }
+                        }
+                        std::cout << "\n";
+                    }
+                    continue;
+                }
                 runBeagle(i,
                           stateCount,
                           ntaxa,
@@ -977,7 +1524,47 @@ int main( int argc, const char* argv[] )
                           eigencomplex,
                           ievectrans,
                           setmatrix,
-                          opencl);
+                          opencl,
+                          threadCount,
+                          patternBlockSize,
+                          threadPool,
+                          patternMajor,
+                          compressPatterns,
+                          mixedPrecision,
+                          spillDirectory,
+                          asynchronous,
+                          selfChecks);
+                if (mixedPrecision) {
+                    double mixedLogL = lastLogL;
+                    double partialsTime[2];
+                    double referenceLogL[2];
+                    for (int d = 0; d < 2; d++) {
+                        partialsTime[d] = runBeagle(i, stateCount, ntaxa, nsites,
+                                                    manualScaling, autoScaling, dynamicScaling,
+                                                    rateCategoryCount, nreps, fullTiming,
+                                                    (d == 0), requireSSE, requireAVX,
+                                                    compactTipCount, randomSeed, rescaleFrequency,
+                                                    unrooted, calcderivs, logscalers, eigenCount,
+                                                    eigencomplex, ievectrans, setmatrix, opencl,
+                                                    threadCount, patternBlockSize, threadPool, patternMajor,
+                                                    compressPatterns, false, spillDirectory, asynchronous,
+                                                    selfChecks);
+                        referenceLogL[d] = lastLogL;
+                    }
+                    if (partialsTime[0] > 0) {
+                        std::cout << "mixed precision accuracy for resource " << i << ":\n";
+                        std::cout.setf(std::ios::scientific, std::ios::floatfield);
+                        std::cout << " |logL(mixed)  - logL(double)| = " << std::setprecision(3) << fabs(mixedLogL - referenceLogL[0]) << "\n";
+                        if (partialsTime[1] > 0)
+                            std::cout << " |logL(single) - logL(double)| = " << std::setprecision(3) << fabs(referenceLogL[1] - referenceLogL[0]) << "\n";
+                        std::cout.setf(std::ios::fixed, std::ios::floatfield);
+                        std::cout << "\n";
+                        if (partialsTime[1] > 0 && fabs(mixedLogL - referenceLogL[0]) > fabs(referenceLogL[1] - referenceLogL[0])) {
+                            fprintf(stdout, "error: mixed precision logL is further from double precision than single precision\n\n");
+                            exitCode = 1;
+                        }
+                    }
+                }
             }
         }
     } else {
@@ -990,4 +1577,15 @@ int main( int argc, const char* argv[] )
 //    fflush( stderr);
 //    getchar();
 //#endif
+
+    // Failing on some resources is expected, but not on every one tried
+    if (instancesCreated == 0) {
+        fprintf(stderr, "error: no resource offers the requested flags\n\n");
+        exitCode = 1;
+    }
+
+    if (!checksPassed)
+        exitCode = 1;
+
+    return exitCode;
 }
@@ -86,6 +86,16 @@ public:
     virtual int setPatternWeights(const double* inPatternWeights) = 0;
     
     virtual int setCategoryRates(const double* inCategoryRates) = 0;
+
+    virtual int setCategoryRatesWithIndex(int categoryRatesIndex,
+                                          const double* inCategoryRates) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setPatternPartitions(int partitionCount,
+                                     const int* inPatternPartitions) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
     
     virtual int setTransitionMatrix(int matrixIndex,
                                     const double* inMatrix,
@@ -114,10 +124,39 @@ public:
                                          const int* secondDerivativeIndices,
                                          const double* edgeLengths,
                                          int count) = 0;
+
+    virtual int updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                                           const int* categoryRateIndices,
+                                                           const int* probabilityIndices,
+                                                           const int* firstDerivativeIndices,
+                                                           const int* secondDerivativeIndices,
+                                                           const double* edgeLengths,
+                                                           int count) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
     
     virtual int updatePartials(const int* operations,
                                int operationCount,
                                int cumulativeScalingIndex) = 0;
+
+    virtual int updatePartialsByPartition(const int* operations,
+                                          int operationCount) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int createPlan(const int* operations,
+                           int operationCount,
+                           int cumulativeScaleIndex) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int executePlan(int planIndex) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int finalizePlan(int planIndex) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
     
     virtual int waitForPartials(const int* destinationPartials,
                                 int destinationPartialsCount) = 0;
@@ -131,6 +170,25 @@ public:
                                      int cumulativeScalingIndex) = 0;   
     
     virtual int resetScaleFactors(int cumulativeScalingIndex) = 0;   
+
+    virtual int accumulateScaleFactorsByPartition(const int* scalingIndices,
+                                                  int count,
+                                                  int cumulativeScalingIndex,
+                                                  int partitionIndex) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int removeScaleFactorsByPartition(const int* scalingIndices,
+                                              int count,
+                                              int cumulativeScalingIndex,
+                                              int partitionIndex) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int resetScaleFactorsByPartition(int cumulativeScalingIndex,
+                                             int partitionIndex) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
     
     virtual int copyScaleFactors(int destScalingIndex,
                                  int srcScalingIndex) = 0; 
@@ -141,6 +199,49 @@ public:
                                             const int* scalingFactorsIndices,
                                             int count,
                                             double* outSumLogLikelihood) = 0;
+
+    virtual int calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
+                                                       const int* categoryWeightsIndices,
+                                                       const int* stateFrequenciesIndices,
+                                                       const int* cumulativeScaleIndices,
+                                                       const int* partitionIndices,
+                                                       int partitionCount,
+                                                       int count,
+                                                       double* outSumLogLikelihoodByPartition,
+                                                       double* outSumLogLikelihood) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int calculateTreeLogLikelihoods(const int* operations,
+                                            const int* operationCounts,
+                                            const int* rootBufferIndices,
+                                            const int* categoryWeightsIndices,
+                                            const int* stateFrequenciesIndices,
+                                            const int* cumulativeScaleIndices,
+                                            int treeCount,
+                                            double* outLogLikelihoods) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setTreeModel(const int* parentIndices,
+                             const double* edgeLengths,
+                             int nodeCount) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setTreeModelEdgeLengths(const int* nodeIndices,
+                                        const double* edgeLengths,
+                                        int count) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int calculateTreeModelLogLikelihood(int eigenIndex,
+                                                int categoryWeightsIndex,
+                                                int stateFrequenciesIndex,
+                                                int cumulativeScaleIndex,
+                                                double* outLogLikelihood) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
     
     virtual int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
                                             const int* childBufferIndices,
@@ -159,6 +260,38 @@ public:
     
     virtual int getSiteDerivatives(double* outFirstDerivatives,
                                    double* outSecondDerivatives) = 0;
+
+    virtual int setCPUThreadCount(int threadCount) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setCPUPatternBlockSize(int patternBlockSize) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setCPUPatternCompression(int compress) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int setCPUPartialsSpill(const char* directory) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int saveState() {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int restoreState() {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int writeCheckpoint(const char* fileName) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    virtual int readCheckpoint(const char* fileName) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
 //protected:
     int resourceNumber;
 };
@@ -0,0 +1,105 @@
+/*
+ *  AVX512Definitions.h
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __AVX512Definitions__
+#define __AVX512Definitions__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <immintrin.h>
+
+/* GCC's unmasked forms of several intrinsics pass _mm512_undefined_pd() through,
+   which -Wall reports as uninitialized once inlined. The forms below write every
+   lane from defined values instead and compile to the same instructions */
+#define AVX512_ALL_LANES	((__mmask8) 0xFF)
+
+typedef double	RealType;
+typedef __m512d	V_Real;
+#define REALS_PER_VEC	8	/* number of elements per vector */
+#define VEC_LOADU(a)			_mm512_loadu_pd(a)
+#define VEC_LOADU_MASK(m, a)	_mm512_maskz_loadu_pd((m), (a))
+#define VEC_STOREU(a, b)		_mm512_storeu_pd((a), (b))
+#define VEC_STOREU_MASK(a, m, b)	_mm512_mask_storeu_pd((a), (m), (b))
+#define VEC_MULT(a, b)			_mm512_mul_pd((a), (b))
+#define VEC_DIV(a, b)			_mm512_div_pd((a), (b))
+#define VEC_MADD(a, b, c)		_mm512_fmadd_pd((a), (b), (c))
+#define VEC_SPLAT(a)			_mm512_set1_pd(a)
+#define VEC_ADD(a, b)			_mm512_add_pd(a, b)
+#define VEC_MAX(a, b)			_mm512_maskz_max_pd(AVX512_ALL_LANES, (a), (b))
+#define VEC_SETZERO()			_mm512_setzero_pd()
+#define VEC_REDUCE_ADD(a)		AVX512ReduceAdd(a)
+#define VEC_REDUCE_MAX(a)		AVX512ReduceMax(a)
+#define VEC_PERMUTE(a, imm)		_mm512_maskz_permutex_pd(AVX512_ALL_LANES, (a), (imm))
+#define VEC_INSERT_HIGH(a, b)	_mm512_maskz_insertf64x4(AVX512_ALL_LANES, (a), (b), 1)
+#define VEC_BROADCAST_HALF(a)	_mm512_maskz_broadcast_f64x4(AVX512_ALL_LANES, (a))
+
+/* Lane mask covering the first n (< REALS_PER_VEC) elements of a vector */
+#define VEC_TAIL_MASK(n)		((__mmask8) ((1 << (n)) - 1))
+
+/* Horizontal sum and maximum, combining the lanes in the order of
+   _mm512_reduce_add_pd and _mm512_reduce_max_pd */
+static inline double AVX512ReduceAdd(__m512d a) {
+    __m256d half = _mm256_add_pd(_mm512_maskz_extractf64x4_pd((__mmask8) 0x0F, a, 1),
+                                 _mm512_maskz_extractf64x4_pd((__mmask8) 0x0F, a, 0));
+    __m128d quarter = _mm_add_pd(_mm256_extractf128_pd(half, 1), _mm256_castpd256_pd128(half));
+    return _mm_cvtsd_f64(quarter) + _mm_cvtsd_f64(_mm_unpackhi_pd(quarter, quarter));
+}
+
+static inline double AVX512ReduceMax(__m512d a) {
+    __m256d half = _mm256_max_pd(_mm512_maskz_extractf64x4_pd((__mmask8) 0x0F, a, 1),
+                                 _mm512_maskz_extractf64x4_pd((__mmask8) 0x0F, a, 0));
+    __m128d quarter = _mm_max_pd(_mm256_extractf128_pd(half, 1), _mm256_castpd256_pd128(half));
+    double low = _mm_cvtsd_f64(quarter);
+    double high = _mm_cvtsd_f64(_mm_unpackhi_pd(quarter, quarter));
+    return (low > high ? low : high);
+}
+
+#if defined(__GNUC__) && defined(HAVE_CPUID_H)
+#include <cpuid.h>
+
+/* AVX-512 Foundation instructions are available and the OS saves the opmask
+   and ZMM registers */
+static inline int CPUSupportsAVX512() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_FMA))
+        return 0;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (!(ebx & bit_AVX512F))
+        return 0;
+    unsigned int xcr0Low, xcr0High;
+    __asm__ __volatile__ ("xgetbv" : "=a" (xcr0Low), "=d" (xcr0High) : "c" (0));
+    return (xcr0Low & 0xE6) == 0xE6; // XMM, YMM, opmask, ZMM_Hi256 and Hi16_ZMM state
+}
+#else
+static inline int CPUSupportsAVX512() {
+    return 1;
+}
+#endif
+
+#endif // __AVX512Definitions__
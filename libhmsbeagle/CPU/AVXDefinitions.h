@@ -49,14 +49,20 @@ typedef double VecEl_t;
 	typedef __m256d	V_Real;
 #	define REALS_PER_VEC	4	/* number of elements per vector */
 #	define VEC_LOAD(a)			_mm256_load_pd(a)
+#	define VEC_LOADU(a)			_mm256_loadu_pd(a)
 //#	define VEC_LOAD_SCALAR(a)	_mm_load1_pd(a)
 #	define VEC_STORE(a, b)		_mm256_store_pd((a), (b))
 //#   define VEC_STORE _SCALAR(a, b) _mm_store_sd((a), (b))
 #	define VEC_MULT(a, b)		_mm256_mul_pd((a), (b))
 #	define VEC_DIV(a, b)		_mm256_div_pd((a), (b))
+#if defined(BEAGLE_CPU_AVX_FMA)
+#	define VEC_MADD(a, b, c)	_mm256_fmadd_pd((a), (b), (c))
+#else
 #	define VEC_MADD(a, b, c)	_mm256_add_pd(_mm256_mul_pd((a), (b)), (c))
+#endif
 #	define VEC_SPLAT(a)			_mm256_set1_pd(a)
 #	define VEC_ADD(a, b)		_mm256_add_pd(a, b)
+#	define VEC_MAX(a, b)		_mm256_max_pd((a), (b))
 #   define VEC_SWAP(a)			_mm256_shuffle_pd(a, a, _MM_SHUFFLE2(0,1))
 # 	define VEC_SETZERO()		_mm256_setzero_pd()
 #	define VEC_SET1(a)			_mm256_set_sd((a))
@@ -78,21 +84,67 @@ typedef union 			/* for copying individual elements to and from vector floats */
 	}
 	VecUnion;
 
-#ifdef __GNUC__
-    #define cpuid(func,ax,bx,cx,dx)\
-            __asm__ __volatile__ ("cpuid":\
-            "=a" (ax), "=b" (bx), "=c" (cx), "=d" (dx) : "a" (func));
+/* Single-precision vectors, used by the float specializations */
+typedef __m256	V_Float;
+#define FLOATS_PER_VEC			8	/* number of elements per vector */
+#define VEC_LOAD_FLOAT(a)		_mm256_load_ps(a)
+#define VEC_LOADU_FLOAT(a)		_mm256_loadu_ps(a)
+#define VEC_STORE_FLOAT(a, b)	_mm256_store_ps((a), (b))
+#define VEC_STOREU_FLOAT(a, b)	_mm256_storeu_ps((a), (b))
+#define VEC_MULT_FLOAT(a, b)	_mm256_mul_ps((a), (b))
+#define VEC_DIV_FLOAT(a, b)		_mm256_div_ps((a), (b))
+#if defined(BEAGLE_CPU_AVX_FMA)
+#define VEC_MADD_FLOAT(a, b, c)	_mm256_fmadd_ps((a), (b), (c))
+#else
+#define VEC_MADD_FLOAT(a, b, c)	_mm256_add_ps(_mm256_mul_ps((a), (b)), (c))
 #endif
+#define VEC_SPLAT_FLOAT(a)		_mm256_set1_ps(a)
+#define VEC_ADD_FLOAT(a, b)		_mm256_add_ps(a, b)
+#define VEC_SETZERO_FLOAT()		_mm256_setzero_ps()
 
-#ifdef _WIN32
+#if defined(__GNUC__) && defined(HAVE_CPUID_H)
+#include <cpuid.h>
 
-#endif
+/* Reads the OS-enabled register state mask (XCR0) */
+static inline unsigned long long readXCR0() {
+    unsigned int eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((unsigned long long) edx << 32) | eax;
+}
 
-int CPUSupportsAVX() {
-    //int a,b,c,d;
-    //cpuid(0,a,b,c,d);
-    //fprintf(stderr,"a = %d\nb = %d\nc = %d\nd = %d\n",a,b,c,d);
+/* AVX instructions are available and the OS saves the YMM registers */
+static inline int CPUSupportsAVXState() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return 0;
+    return (readXCR0() & 0x6) == 0x6; // XMM and YMM state
+}
+
+/* The instruction set these kernels were compiled for: AVX, plus AVX2 and FMA
+   when built for the AVX2 plugin */
+static inline int CPUSupportsAVX() {
+    if (!CPUSupportsAVXState())
+        return 0;
+#if defined(BEAGLE_CPU_AVX_FMA)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    if (!(ecx & bit_FMA))
+        return 0;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (!(ebx & bit_AVX2))
+        return 0;
+#endif
+    return 1;
+}
+#else
+static inline int CPUSupportsAVX() {
     return 1;
 }
+#endif
 
 #endif // __AVXDefinitions__
@@ -0,0 +1,175 @@
+/*
+ *  BeagleCPU4StateAVX512Impl.h
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPU4StateAVX512Impl__
+#define __BeagleCPU4StateAVX512Impl__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPU4StateImpl.h"
+
+#include <vector>
+
+#define RESTRICT __restrict		/* may need to define this instead to 'restrict' */
+
+#define T_PAD_4_AVX512_DEFAULT 2 // Pad transition matrix with 2 rows
+#define P_PAD_4_AVX512_DEFAULT 0 // Partials padding not needed for 4 states AVX-512
+
+#define BEAGLE_CPU_4_AVX512_DOUBLE      double, T_PAD, P_PAD
+#define BEAGLE_CPU_4_AVX512_TEMPLATE    template <int T_PAD, int P_PAD>
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_TEMPLATE
+class BeagleCPU4StateAVX512Impl : public BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC> {};
+
+/*
+ * Double-precision 4-state kernels holding two patterns per 512-bit vector
+ */
+BEAGLE_CPU_4_AVX512_TEMPLATE
+class BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE> : public BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX512_DOUBLE> {
+
+protected:
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::kTipCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::gPartials;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::gTransitionMatrices;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::kPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::kPaddedPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::kExtraPatterns;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::kStateCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::gTipStates;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::kCategoryCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX512_DOUBLE>::kFlags;
+
+public:
+    virtual const char* getName();
+
+	virtual const long getFlags();
+
+protected:
+    virtual int getPaddedPatternsModulus();
+
+    virtual void rescalePartials(double* destP,
+                                 double* scaleFactors,
+                                 int startPattern,
+                                 int endPattern);
+
+    virtual void autoRescalePartials(double* destP,
+                                     signed short* scaleFactors,
+                                     int startPattern,
+                                     int endPattern);
+
+private:
+
+    virtual void calcStatesStates(double* destP,
+                                  const unsigned char* states1,
+                                  const double* matrices1,
+                                  const unsigned char* states2,
+                                  const double* matrices2,
+                                  int category,
+                                  int startPattern,
+                                  int endPattern);
+
+    virtual void calcStatesPartials(double* destP,
+                                    const unsigned char* states1,
+                                    const double* __restrict matrices1,
+                                    const double* __restrict partials2,
+                                    const double* __restrict matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
+
+    virtual void calcStatesPartialsFixedScaling(double* destP,
+                                                const unsigned char* states1,
+                                                const double* __restrict matrices1,
+                                                const double* __restrict partials2,
+                                                const double* __restrict matrices2,
+                                                const double* __restrict scaleFactors,
+                                                int category,
+                                                int startPattern,
+                                                int endPattern);
+
+    virtual void calcPartialsPartials(double* __restrict destP,
+                                      const double* __restrict partials1,
+                                      const double* __restrict matrices1,
+                                      const double* __restrict partials2,
+                                      const double* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
+                                                  const double* __restrict child0Partials,
+                                                  const double* __restrict child0TransMat,
+                                                  const double* __restrict child1Partials,
+                                                  const double* __restrict child1TransMat,
+                                                  const double* __restrict scaleFactors,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern);
+
+    // Largest partial of pattern k over all categories
+    inline double maxPatternPartials(const double* destP,
+                                     int k);
+
+    // Multiplies the partials of pattern k in every category by scale
+    inline void scalePatternPartials(double* destP,
+                                     int k,
+                                     double scale);
+
+};
+
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+class BeagleCPU4StateAVX512ImplFactory : public BeagleImplFactory {
+public:
+    virtual BeagleImpl* createImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags,
+                                   int* errorCode);
+
+    virtual const char* getName();
+    virtual const long getFlags();
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+// now include the file containing template function implementations
+#include "libhmsbeagle/CPU/BeagleCPU4StateAVX512Impl.hpp"
+
+
+#endif // __BeagleCPU4StateAVX512Impl__
@@ -0,0 +1,426 @@
+/*
+ *  BeagleCPU4StateAVX512Impl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BEAGLE_CPU_4STATE_AVX512_IMPL_HPP
+#define BEAGLE_CPU_4STATE_AVX512_IMPL_HPP
+
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateAVX512Impl.h"
+#include "libhmsbeagle/CPU/AVX512Definitions.h"
+
+#define PATTERN_PAIR_LOW	((__mmask8) 0x0F)	/* lanes of the first pattern of a pair */
+
+/* Loads the columns of a (transposed) finite-time transition matrix, one per
+   source state, as used for tip-state lookups */
+#define AVX512_PREFETCH_COLUMNS(src_m, dest_col) \
+	for (int j = 0; j < OFFSET; j++) { \
+		dest_col[j] = _mm256_setr_pd((src_m)[0*OFFSET + j], (src_m)[1*OFFSET + j], \
+		                             (src_m)[2*OFFSET + j], (src_m)[3*OFFSET + j]); \
+	}
+
+/* As above, with each column also repeated in both 256-bit halves so that
+   each vector covers two patterns */
+#define AVX512_PREFETCH_MATRIX(src_m, dest_col, dest_vm) \
+	AVX512_PREFETCH_COLUMNS(src_m, dest_col); \
+	for (int j = 0; j < OFFSET; j++) { \
+		dest_vm[j] = VEC_BROADCAST_HALF(dest_col[j]); \
+	}
+
+/* Multiplies a transposed matrix by the partials of two patterns */
+#define AVX512_SPLAT(p, j)	VEC_PERMUTE((p), _MM_SHUFFLE(j,j,j,j))
+#define AVX512_MATRIX_PARTIALS(dest, vm, p) \
+		dest = VEC_MULT(AVX512_SPLAT(p, 0), vm[0]); \
+		dest = VEC_MADD(AVX512_SPLAT(p, 1), vm[1], dest); \
+		dest = VEC_MADD(AVX512_SPLAT(p, 2), vm[2], dest); \
+		dest = VEC_MADD(AVX512_SPLAT(p, 3), vm[3], dest);
+
+/* Loads and stores the partials of a pattern pair, or of a single trailing
+   pattern in the lower half when the range has odd length */
+static inline V_Real loadPatternPair(const double* src, bool pair) {
+	return pair ? VEC_LOADU(src) : VEC_LOADU_MASK(PATTERN_PAIR_LOW, src);
+}
+
+static inline void storePatternPair(double* dest, V_Real value, bool pair) {
+	if (pair)
+		VEC_STOREU(dest, value);
+	else
+		VEC_STOREU_MASK(dest, PATTERN_PAIR_LOW, value);
+}
+
+/* Gathers the matrix columns for the observed states of a pattern pair */
+static inline V_Real statesPatternPair(const __m256d* col, const unsigned char* states, int k, bool pair) {
+	V_Real lower = _mm512_castpd256_pd512(col[BEAGLE_CPU_PACKED_TIP_STATE(states, k)]);
+	return pair ? VEC_INSERT_HIGH(lower, col[BEAGLE_CPU_PACKED_TIP_STATE(states, k + 1)]) : lower;
+}
+
+static inline V_Real scaleFactorPair(const double* scaleFactors, bool pair) {
+	V_Real lower = VEC_SPLAT(scaleFactors[0]);
+	return pair ? VEC_INSERT_HIGH(lower, _mm256_set1_pd(scaleFactors[1])) : lower;
+}
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPU4StateAVX512Name(){ return "CPU-4State-AVX512-Unknown"; };
+
+template<>
+inline const char* getBeagleCPU4StateAVX512Name<double>(){ return "CPU-4State-AVX512-Double"; };
+
+/*
+ * Calculates partial likelihoods at a node when both children have states.
+ */
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcStatesStates(double* destP,
+                                     const unsigned char* states_q,
+                                     const double* matrices_q,
+                                     const unsigned char* states_r,
+                                     const double* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	__m256d col_q[OFFSET], col_r[OFFSET];
+	AVX512_PREFETCH_COLUMNS(matrices_q + w, col_q);
+	AVX512_PREFETCH_COLUMNS(matrices_r + w, col_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+        const bool pair = (k + 1 < endPattern);
+        storePatternPair(destP + v, VEC_MULT(statesPatternPair(col_q, states_q, k, pair),
+                                             statesPatternPair(col_r, states_r, k, pair)), pair);
+        v += 8;
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when one child has states and one has partials.
+ */
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcStatesPartials(double* destP,
+                                       const unsigned char* states_q,
+                                       const double* matrices_q,
+                                       const double* partials_r,
+                                       const double* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	__m256d col_q[OFFSET], col_r[OFFSET];
+	V_Real vm_r[OFFSET];
+	AVX512_PREFETCH_COLUMNS(matrices_q + w, col_q);
+	AVX512_PREFETCH_MATRIX(matrices_r + w, col_r, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+        const bool pair = (k + 1 < endPattern);
+        V_Real vp = loadPatternPair(partials_r + v, pair);
+        V_Real destr;
+        AVX512_MATRIX_PARTIALS(destr, vm_r, vp);
+
+        storePatternPair(destP + v, VEC_MULT(statesPatternPair(col_q, states_q, k, pair), destr), pair);
+        v += 8;
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
+                                const unsigned char* states_q,
+                                const double* __restrict matrices_q,
+                                const double* __restrict partials_r,
+                                const double* __restrict matrices_r,
+                                const double* __restrict scaleFactors,
+                                int category,
+                                int startPattern,
+                                int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	__m256d col_q[OFFSET], col_r[OFFSET];
+	V_Real vm_r[OFFSET];
+	AVX512_PREFETCH_COLUMNS(matrices_q + w, col_q);
+	AVX512_PREFETCH_MATRIX(matrices_r + w, col_r, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+        const bool pair = (k + 1 < endPattern);
+        V_Real vp = loadPatternPair(partials_r + v, pair);
+        V_Real destr;
+        AVX512_MATRIX_PARTIALS(destr, vm_r, vp);
+
+        storePatternPair(destP + v, VEC_DIV(VEC_MULT(statesPatternPair(col_q, states_q, k, pair), destr),
+                                            scaleFactorPair(scaleFactors + k, pair)), pair);
+        v += 8;
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcPartialsPartials(double* destP,
+                                                  const double*  partials_q,
+                                                  const double*  matrices_q,
+                                                  const double*  partials_r,
+                                                  const double*  matrices_r,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	__m256d col_q[OFFSET], col_r[OFFSET];
+	V_Real vm_q[OFFSET], vm_r[OFFSET];
+	AVX512_PREFETCH_MATRIX(matrices_q + w, col_q, vm_q);
+	AVX512_PREFETCH_MATRIX(matrices_r + w, col_r, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+        const bool pair = (k + 1 < endPattern);
+        V_Real vpq = loadPatternPair(partials_q + v, pair);
+        V_Real vpr = loadPatternPair(partials_r + v, pair);
+
+        V_Real destq, destr;
+        AVX512_MATRIX_PARTIALS(destq, vm_q, vpq);
+        AVX512_MATRIX_PARTIALS(destr, vm_r, vpr);
+
+        storePatternPair(destP + v, VEC_MULT(destq, destr), pair);
+        v += 8;
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::calcPartialsPartialsFixedScaling(double* destP,
+		                                                        const double* partials_q,
+		                                                        const double* matrices_q,
+		                                                        const double* partials_r,
+		                                                        const double* matrices_r,
+		                                                        const double* scaleFactors,
+		                                                        int category,
+		                                                        int startPattern,
+		                                                        int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	__m256d col_q[OFFSET], col_r[OFFSET];
+	V_Real vm_q[OFFSET], vm_r[OFFSET];
+	AVX512_PREFETCH_MATRIX(matrices_q + w, col_q, vm_q);
+	AVX512_PREFETCH_MATRIX(matrices_r + w, col_r, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+        const bool pair = (k + 1 < endPattern);
+        V_Real vpq = loadPatternPair(partials_q + v, pair);
+        V_Real vpr = loadPatternPair(partials_r + v, pair);
+
+        V_Real destq, destr;
+        AVX512_MATRIX_PARTIALS(destq, vm_q, vpq);
+        AVX512_MATRIX_PARTIALS(destr, vm_r, vpr);
+
+        storePatternPair(destP + v, VEC_DIV(VEC_MULT(destq, destr),
+                                            scaleFactorPair(scaleFactors + k, pair)), pair);
+        v += 8;
+    }
+}
+
+/*
+ * A single pattern spans one 256-bit half of a vector, so the rescaling kernels
+ * work on categories in pairs: each 512-bit load takes one pattern from two categories
+ */
+BEAGLE_CPU_4_AVX512_TEMPLATE
+inline double BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::maxPatternPartials(const double* destP,
+                                                                                        int k) {
+    const double* patternP = destP + 4*k;
+    const int categoryStride = 4*kPaddedPatternCount;
+    V_Real max = VEC_SETZERO();
+    int l = 0;
+    for (; l + 1 < kCategoryCount; l += 2) {
+        V_Real pair = VEC_INSERT_HIGH(_mm512_castpd256_pd512(_mm256_loadu_pd(patternP)),
+                                      _mm256_loadu_pd(patternP + categoryStride));
+        max = VEC_MAX(pair, max);
+        patternP += 2*categoryStride;
+    }
+    if (l < kCategoryCount)
+        max = VEC_MAX(VEC_LOADU_MASK(PATTERN_PAIR_LOW, patternP), max);
+    return VEC_REDUCE_MAX(max);
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+inline void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::scalePatternPartials(double* destP,
+                                                                                        int k,
+                                                                                        double scale) {
+    double* patternP = destP + 4*k;
+    const __m256d vscale = _mm256_set1_pd(scale);
+    for (int l = 0; l < kCategoryCount; l++) {
+        _mm256_storeu_pd(patternP, _mm256_mul_pd(_mm256_loadu_pd(patternP), vscale));
+        patternP += 4*kPaddedPatternCount;
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::rescalePartials(double* destP,
+                                                                            double* scaleFactors,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+    const bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double max = maxPatternPartials(destP, k);
+        if (max == 0)
+            max = 1.0;
+
+        scalePatternPartials(destP, k, 1.0 / max);
+        scaleFactors[k] = (useLogScalars ? log(max) : max);
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+void BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::autoRescalePartials(double* destP,
+                                                                                signed short* scaleFactors,
+                                                                                int startPattern,
+                                                                                int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
+        int expMax;
+        frexp(maxPatternPartials(destP, k), &expMax);
+        scaleFactors[k] = expMax;
+
+        if (expMax != 0)
+            scalePatternPartials(destP, k, ldexp(1.0, -expMax));
+    }
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+int BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::getPaddedPatternsModulus() {
+	return 1;  // Odd pattern counts are handled with masked loads and stores
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+const char* BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::getName() {
+    return  getBeagleCPU4StateAVX512Name<double>();
+}
+
+BEAGLE_CPU_4_AVX512_TEMPLATE
+const long BeagleCPU4StateAVX512Impl<BEAGLE_CPU_4_AVX512_DOUBLE>::getFlags() {
+    return  BEAGLE_FLAG_COMPUTATION_SYNCH |
+            BEAGLE_CPU_THREADING_FLAG |
+            BEAGLE_FLAG_PROCESSOR_CPU |
+            BEAGLE_FLAG_PRECISION_DOUBLE |
+            BEAGLE_FLAG_VECTOR_AVX;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPU4StateAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    if (stateCount != 4) {
+        return NULL;
+    }
+
+    if (!CPUSupportsAVX512())
+        return NULL;
+
+    BeagleCPU4StateAVX512Impl<REALTYPE, T_PAD_4_AVX512_DEFAULT, P_PAD_4_AVX512_DEFAULT>* impl =
+    		new BeagleCPU4StateAVX512Impl<REALTYPE, T_PAD_4_AVX512_DEFAULT, P_PAD_4_AVX512_DEFAULT>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,  pluginResourceNumber, preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPU4StateAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+	return getBeagleCPU4StateAVX512Name<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+template <>
+const long BeagleCPU4StateAVX512ImplFactory<double>::getFlags() {
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
+           BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
+           BEAGLE_FLAG_PROCESSOR_CPU |
+           BEAGLE_FLAG_VECTOR_AVX |
+           BEAGLE_FLAG_PRECISION_DOUBLE |
+           BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+           BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL|
+           BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+           BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+}
+}
+
+#endif //BEAGLE_CPU_4STATE_AVX512_IMPL_HPP
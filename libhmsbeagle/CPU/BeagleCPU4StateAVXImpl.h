@@ -55,6 +55,7 @@ class BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT> : public BeagleCPU4StateImp
     
 protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kTipCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::kFlags;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gPartials;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::integrationTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gTransitionMatrices;
@@ -70,6 +71,9 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::outLogLikelihoodsTmp;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gPatternWeights;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::scalingExponentThreshhold;
+
+    typedef typename BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::LikelihoodSubset LikelihoodSubset;
     
 public:    
     virtual const char* getName();
@@ -82,43 +86,61 @@ protected:
 private:
     
 	virtual void calcStatesStates(float* destP,
-                                  const int* states1,
+                                  const unsigned char* states1,
                                   const float* matrices1,
-                                  const int* states2,
-                                  const float* matrices2);
+                                  const unsigned char* states2,
+                                  const float* matrices2,
+                                  int category,
+                                  int startPattern,
+                                  int endPattern);
     
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const float* __restrict matrices1,
                                     const float* __restrict partials2,
-                                    const float* __restrict matrices2);
+                                    const float* __restrict matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
     
     virtual void calcStatesPartialsFixedScaling(float* destP,
-                                                const int* states1,
+                                                const unsigned char* states1,
                                                 const float* __restrict matrices1,
                                                 const float* __restrict partials2,
                                                 const float* __restrict matrices2,
-                                                const float* __restrict scaleFactors);
+                                                const float* __restrict scaleFactors,
+                                                int category,
+                                                int startPattern,
+                                                int endPattern);
     
     virtual void calcPartialsPartials(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
-                                      const float* __restrict matrices2);
+                                      const float* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
                                                   const float* __restrict child0Partials,
                                                   const float* __restrict child0TransMat,
                                                   const float* __restrict child1Partials,
                                                   const float* __restrict child1TransMat,
-                                                  const float* __restrict scaleFactors);
+                                                  const float* __restrict scaleFactors,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern);
     
     virtual void calcPartialsPartialsAutoScaling(float* __restrict destP,
                                                  const float* __restrict partials1,
                                                  const float* __restrict matrices1,
                                                  const float* __restrict partials2,
                                                  const float* __restrict matrices2,
-                                                 int* activateScaling);
+                                                 int* activateScaling,
+                                                 int category,
+                                                 int startPattern,
+                                                 int endPattern);
     
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
@@ -127,6 +149,11 @@ private:
                                        const int stateFrequenciesIndex,
                                        const int scalingFactorsIndex,
                                        double* outSumLogLikelihood);
+
+    virtual void integrateSiteLikelihoodsMixed(const LikelihoodSubset& subset,
+                                               double* outSiteLikelihoods,
+                                               int startPattern,
+                                               int endPattern);
     
 };
     
@@ -145,6 +172,7 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kStateCount;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gTipStates;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kCategoryCount;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::kFlags;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gScaleBuffers;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gCategoryWeights;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gStateFrequencies;
@@ -159,47 +187,75 @@ public:
     
 protected:
     virtual int getPaddedPatternsModulus();
+
+    virtual void rescalePartials(double* destP,
+                                 double* scaleFactors,
+                                 int startPattern,
+                                 int endPattern);
+
+    virtual void autoRescalePartials(double* destP,
+                                     signed short* scaleFactors,
+                                     int startPattern,
+                                     int endPattern);
     
 private:
     
     virtual void calcStatesStates(double* destP,
-                                  const int* states1,
+                                  const unsigned char* states1,
                                   const double* matrices1,
-                                  const int* states2,
-                                  const double* matrices2);
+                                  const unsigned char* states2,
+                                  const double* matrices2,
+                                  int category,
+                                  int startPattern,
+                                  int endPattern);
     
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const double* __restrict matrices1,
                                     const double* __restrict partials2,
-                                    const double* __restrict matrices2);
+                                    const double* __restrict matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
     
     virtual void calcStatesPartialsFixedScaling(double* destP,
-                                                const int* states1,
+                                                const unsigned char* states1,
                                                 const double* __restrict matrices1,
                                                 const double* __restrict partials2,
                                                 const double* __restrict matrices2,
-                                                const double* __restrict scaleFactors);
+                                                const double* __restrict scaleFactors,
+                                                int category,
+                                                int startPattern,
+                                                int endPattern);
     
     virtual void calcPartialsPartials(double* __restrict destP,
                                       const double* __restrict partials1,
                                       const double* __restrict matrices1,
                                       const double* __restrict partials2,
-                                      const double* __restrict matrices2);
+                                      const double* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
                                                   const double* __restrict child0Partials,
                                                   const double* __restrict child0TransMat,
                                                   const double* __restrict child1Partials,
                                                   const double* __restrict child1TransMat,
-                                                  const double* __restrict scaleFactors);
+                                                  const double* __restrict scaleFactors,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern);
     
     virtual void calcPartialsPartialsAutoScaling(double* __restrict destP,
                                                  const double* __restrict partials1,
                                                  const double* __restrict matrices1,
                                                  const double* __restrict partials2,
                                                  const double* __restrict matrices2,
-                                                 int* activateScaling);
+                                                 int* activateScaling,
+                                                 int category,
+                                                 int startPattern,
+                                                 int endPattern);
     
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                        const int childBufferIndex,
@@ -208,7 +264,16 @@ private:
                                        const int stateFrequenciesIndex,
                                        const int scalingFactorsIndex,
                                        double* outSumLogLikelihood);
-    
+
+    // Largest partial of pattern k over all categories
+    inline double maxPatternPartials(const double* destP,
+                                     int k);
+
+    // Multiplies the partials of pattern k in every category by scale
+    inline void scalePatternPartials(double* destP,
+                                     int k,
+                                     double scale);
+
 };
     
     
@@ -91,16 +91,71 @@ inline V_Real pick_single(V_Real x) {
 #define AVX_PREFETCH_MATRIX(src_m1, dest_vu_m1) \
 	const double *m1 = (src_m1); \
 	for (int i = 0; i < OFFSET; i++, m1++) { \
-		dest_vu_m1[i][0].x[0] = m1[0*OFFSET]; \
-		dest_vu_m1[i][0].x[1] = m1[1*OFFSET]; \
-		dest_vu_m1[i][1].x[0] = m1[2*OFFSET]; \
-		dest_vu_m1[i][1].x[1] = m1[3*OFFSET]; \
+		dest_vu_m1[i].x[0] = m1[0*OFFSET]; \
+		dest_vu_m1[i].x[1] = m1[1*OFFSET]; \
+		dest_vu_m1[i].x[2] = m1[2*OFFSET]; \
+		dest_vu_m1[i].x[3] = m1[3*OFFSET]; \
+	}
+
+/* Multiplies a transposed matrix by the partials splatted by AVX_PREFETCH_PARTIALS */
+#define AVX_MATRIX_PARTIALS(dest, vu_m, vp) \
+		dest = VEC_MULT(vp##0, vu_m[0].vx); \
+		dest = VEC_MADD(vp##1, vu_m[1].vx, dest); \
+		dest = VEC_MADD(vp##2, vu_m[2].vx, dest); \
+		dest = VEC_MADD(vp##3, vu_m[3].vx, dest);
+
+/* Loads a (transposed) single-precision transition matrix, one column of the
+   four destination states repeated in both 128-bit lanes of an AVX vector so
+   that each vector covers two patterns */
+#define AVX_PREFETCH_MATRIX_FLOAT(src_m, dest_vm) \
+	for (int j = 0; j < OFFSET; j++) { \
+		__m128 col = _mm_setr_ps((src_m)[0*OFFSET + j], (src_m)[1*OFFSET + j], \
+		                         (src_m)[2*OFFSET + j], (src_m)[3*OFFSET + j]); \
+		dest_vm[j] = _mm256_insertf128_ps(_mm256_castps128_ps256(col), col, 1); \
 	}
 
+/* Multiplies a transposed single-precision matrix by the partials of two patterns */
+#define AVX_SPLAT_FLOAT(p, j)	_mm256_permute_ps((p), _MM_SHUFFLE(j,j,j,j))
+#define AVX_MATRIX_PARTIALS_FLOAT(dest, vm, p) \
+		dest = VEC_MULT_FLOAT(AVX_SPLAT_FLOAT(p, 0), vm[0]); \
+		dest = VEC_MADD_FLOAT(AVX_SPLAT_FLOAT(p, 1), vm[1], dest); \
+		dest = VEC_MADD_FLOAT(AVX_SPLAT_FLOAT(p, 2), vm[2], dest); \
+		dest = VEC_MADD_FLOAT(AVX_SPLAT_FLOAT(p, 3), vm[3], dest);
+
+/* Loads and stores the partials of a pattern pair, or of a single trailing
+   pattern in the lower lane when the range has odd length */
+static inline V_Float loadPatternPair(const float* src, bool pair) {
+	return pair ? VEC_LOADU_FLOAT(src) : _mm256_castps128_ps256(_mm_load_ps(src));
+}
+
+static inline void storePatternPair(float* dest, V_Float value, bool pair) {
+	if (pair)
+		VEC_STOREU_FLOAT(dest, value);
+	else
+		_mm_store_ps(dest, _mm256_castps256_ps128(value));
+}
+
+/* Gathers the matrix columns for the observed states of a pattern pair */
+static inline V_Float statesPatternPair(const V_Float* vm, const unsigned char* states, int k, bool pair) {
+	const V_Float lower = vm[BEAGLE_CPU_PACKED_TIP_STATE(states, k)];
+	return pair ? _mm256_insertf128_ps(lower, _mm256_castps256_ps128(vm[BEAGLE_CPU_PACKED_TIP_STATE(states, k + 1)]), 1)
+	            : lower;
+}
+
 namespace beagle {
 namespace cpu {
 
 
+#if defined(BEAGLE_CPU_AVX_FMA)
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPU4StateAVXName(){ return "CPU-4State-AVX2-Unknown"; };
+
+template<>
+inline const char* getBeagleCPU4StateAVXName<double>(){ return "CPU-4State-AVX2-Double"; };
+
+template<>
+inline const char* getBeagleCPU4StateAVXName<float>(){ return "CPU-4State-AVX2-Single"; };
+#else
 BEAGLE_CPU_FACTORY_TEMPLATE
 inline const char* getBeagleCPU4StateAVXName(){ return "CPU-4State-AVX-Unknown"; };
 
@@ -109,6 +164,7 @@ inline const char* getBeagleCPU4StateAVXName<double>(){ return "CPU-4State-AVX-D
 
 template<>
 inline const char* getBeagleCPU4StateAVXName<float>(){ return "CPU-4State-AVX-Single"; };
+#endif
     
 /*
  * Calculates partial likelihoods at a node when both children have states.
@@ -116,49 +172,55 @@ inline const char* getBeagleCPU4StateAVXName<float>(){ return "CPU-4State-AVX-Si
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(float* destP,
-                                     const int* states_q,
+                                     const unsigned char* states_q,
                                      const float* matrices_q,
-                                     const int* states_r,
-                                     const float* matrices_r) {
-
-									 BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(destP,
-                                     states_q,
-                                     matrices_q,
-                                     states_r,
-                                     matrices_r);
-
-									 }
+                                     const unsigned char* states_r,
+                                     const float* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+        const bool pair = (k + 1 < endPattern);
+        storePatternPair(destP + v, VEC_MULT_FLOAT(statesPatternPair(vm_q, states_q, k, pair),
+                                                   statesPatternPair(vm_r, states_r, k, pair)), pair);
+        v += 8;
+    }
+}
 
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
+                                     const unsigned char* states_q,
                                      const double* matrices_q,
-                                     const int* states_r,
-                                     const double* matrices_r) {
-
-	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
+                                     const unsigned char* states_r,
+                                     const double* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
 
-    int w = 0;
-	V_Real *destPvec = (V_Real *)destP;
+	VecUnion vu_mq[OFFSET], vu_mr[OFFSET];
 
-    for (int l = 0; l < kCategoryCount; l++) {
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
-            const int state_q = states_q[k];
-            const int state_r = states_r[k];
+        const int state_q = BEAGLE_CPU_PACKED_TIP_STATE(states_q, k);
+        const int state_r = BEAGLE_CPU_PACKED_TIP_STATE(states_r, k);
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
-
-        }
+        VEC_STORE(destP + v, VEC_MULT(vu_mq[state_q].vx, vu_mr[state_r].vx));
 
-        w += OFFSET*4;
-        if (kExtraPatterns)
-        	destPvec += kExtraPatterns * 2;
+        v += 4;
     }
 }
 
@@ -166,134 +228,137 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesStates(double* d
  * Calculates partial likelihoods at a node when one child has states and one has partials.
    AVX version
  */
+
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartials(float* destP,
-                                       const int* states_q,
+                                       const unsigned char* states_q,
                                        const float* matrices_q,
                                        const float* partials_r,
-                                       const float* matrices_r) {
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartials(
-									   destP,
-									   states_q,
-									   matrices_q,
-									   partials_r,
-									   matrices_r);
+                                       const float* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+        const bool pair = (k + 1 < endPattern);
+        V_Float vp = loadPatternPair(partials_r + v, pair);
+        V_Float destr;
+        AVX_MATRIX_PARTIALS_FLOAT(destr, vm_r, vp);
+
+        storePatternPair(destP + v, VEC_MULT_FLOAT(statesPatternPair(vm_q, states_q, k, pair), destr), pair);
+        v += 8;
+    }
 }
 
 
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
+                                       const unsigned char* states_q,
                                        const double* matrices_q,
                                        const double* partials_r,
-                                       const double* matrices_r) {
-
-    int v = 0;
-    int w = 0;
+                                       const double* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
 
-    fprintf(stderr, "Not yet implemented!\n");
-    exit(-1);
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
- 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
-	V_Real destr_01, destr_23;
-
-    for (int l = 0; l < kCategoryCount; l++) {
+ 	VecUnion vu_mq[OFFSET], vu_mr[OFFSET];
+	V_Real destr_0123;
 
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
-            const int state_q = states_q[k];
-            V_Real vp0, vp1, vp2, vp3;
-            AVX_PREFETCH_PARTIALS(vp,partials_r,v);
+        const int state_q = BEAGLE_CPU_PACKED_TIP_STATE(states_q, k);
+        V_Real vp0, vp1, vp2, vp3;
+        AVX_PREFETCH_PARTIALS(vp,partials_r,v);
 
-			destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
+        AVX_MATRIX_PARTIALS(destr_0123, vu_mr, vp);
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
+        VEC_STORE(destP + v, VEC_MULT(vu_mq[state_q].vx, destr_0123));
 
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+        v += 4;
     }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
-                                const int* states1,
-                                const float* __restrict matrices1,
-                                const float* __restrict partials2,
-                                const float* __restrict matrices2,
-                                const float* __restrict scaleFactors) {
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartialsFixedScaling(
-									   destP,
-									   states1,
-									   matrices1,
-									   partials2,
-									   matrices2,
-									   scaleFactors);
+                                const unsigned char* states_q,
+                                const float* __restrict matrices_q,
+                                const float* __restrict partials_r,
+                                const float* __restrict matrices_r,
+                                const float* __restrict scaleFactors,
+                                int category,
+                                int startPattern,
+                                int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+        const bool pair = (k + 1 < endPattern);
+        const V_Float scaleFactor = pair ?
+                _mm256_setr_ps(scaleFactors[k], scaleFactors[k], scaleFactors[k], scaleFactors[k],
+                               scaleFactors[k + 1], scaleFactors[k + 1], scaleFactors[k + 1], scaleFactors[k + 1]) :
+                VEC_SPLAT_FLOAT(scaleFactors[k]);
+
+        V_Float vp = loadPatternPair(partials_r + v, pair);
+        V_Float destr;
+        AVX_MATRIX_PARTIALS_FLOAT(destr, vm_r, vp);
+
+        storePatternPair(destP + v, VEC_DIV_FLOAT(VEC_MULT_FLOAT(statesPatternPair(vm_q, states_q, k, pair), destr),
+                                                  scaleFactor), pair);
+        v += 8;
+    }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
-                                const int* states_q,
+                                const unsigned char* states_q,
                                 const double* __restrict matrices_q,
                                 const double* __restrict partials_r,
                                 const double* __restrict matrices_r,
-                                const double* __restrict scaleFactors) {
-
+                                const double* __restrict scaleFactors,
+                                int category,
+                                int startPattern,
+                                int endPattern) {
 
-    int v = 0;
-    int w = 0;
 
- 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
-	V_Real destr_01, destr_23;
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
-    for (int l = 0; l < kCategoryCount; l++) {
+ 	VecUnion vu_mq[OFFSET], vu_mr[OFFSET];
+	V_Real destr_0123;
 
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
-        	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
+    	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
 
-            const int state_q = states_q[k];
-            V_Real vp0, vp1, vp2, vp3;
-            AVX_PREFETCH_PARTIALS(vp,partials_r,v);
+        const int state_q = BEAGLE_CPU_PACKED_TIP_STATE(states_q, k);
+        V_Real vp0, vp1, vp2, vp3;
+        AVX_PREFETCH_PARTIALS(vp,partials_r,v);
 
-			destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
+        AVX_MATRIX_PARTIALS(destr_0123, vu_mr, vp);
 
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
+        VEC_STORE(destP + v, VEC_DIV(VEC_MULT(vu_mq[state_q].vx, destr_0123), scaleFactor));
 
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+        v += 4;
     }
 }
 
@@ -302,13 +367,36 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartials(float*
                                                   const float*  partials_q,
                                                   const float*  matrices_q,
                                                   const float*  partials_r,
-                                                  const float*  matrices_r) {
+                                                  const float*  matrices_r,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartials(destP,
-                                                  partials_q,
-                                                  matrices_q,
-                                                  partials_r,
-                                                  matrices_r);
+	/* Load transition-probability matrices into vectors */
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+        const bool pair = (k + 1 < endPattern);
+        V_Float vpq = loadPatternPair(partials_q + v, pair);
+        V_Float vpr = loadPatternPair(partials_r + v, pair);
+        V_Float destq, destr;
+        AVX_MATRIX_PARTIALS_FLOAT(destq, vm_q, vpq);
+        AVX_MATRIX_PARTIALS_FLOAT(destr, vm_r, vpr);
+
+        storePatternPair(destP + v, VEC_MULT_FLOAT(destq, destr), pair);
+        v += 8;
+    }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
@@ -316,14 +404,16 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
                                                   const double*  partials_q,
                                                   const double*  matrices_q,
                                                   const double*  partials_r,
-                                                  const double*  matrices_r) {
+                                                  const double*  matrices_r,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern) {
 
-    int v = 0;
-    int w = 0;
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
     V_Real	destq_0123, destr_0123;
  	VecUnion vu_mq[OFFSET], vu_mr[OFFSET];
-	V_Real *destPvec = (V_Real *)destP;
 
 //	for (int i = 0; i < 4; ++i) {
 //		int t1 = i & 1;
@@ -331,10 +421,9 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
 //		fprintf(stderr, "%d ->  %d %d\n", i, t1, t2);
 //	}
 
-    for (int l = 0; l < kCategoryCount; l++) {
 
-		/* Load transition-probability matrices into vectors */
-    	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	/* Load transition-probability matrices into vectors */
+	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
 //    	for (int j = 0; j < 4; ++j) {
 //    		fprintf(stderr, "mq[%d]:", j);
@@ -348,15 +437,15 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
 //
 //    	fprintf(stderr,"APM\n");
 
-        for (int k = 0; k < kPatternCount; k++) {
-            
+    for (int k = startPattern; k < endPattern; k++) {
+        
 #           if 1 && !defined(_WIN32)
-            __builtin_prefetch (&partials_q[v+64]);
-            __builtin_prefetch (&partials_r[v+64]);
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
 #           endif
 
-        	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
-        	AVX_PREFETCH_PARTIALS(vpq_,partials_q,v);
+    	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
+    	AVX_PREFETCH_PARTIALS(vpq_,partials_q,v);
 
 //        	fprintf(stderr, "t:");
 //        	for (int i = 0; i < 4; ++i) {
@@ -383,24 +472,23 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
 //        	}
 //        	fprintf(stderr, "\n");
 
-        	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
-        	AVX_PREFETCH_PARTIALS(vpr_,partials_r,v);
+    	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
+    	AVX_PREFETCH_PARTIALS(vpr_,partials_r,v);
 
-        	destq_0123 = VEC_MULT(vpq_0, vu_mq[0].vx);
-        	destq_0123 = VEC_MADD(vpq_1, vu_mq[1].vx, destq_0123);
-        	destq_0123 = VEC_MADD(vpq_2, vu_mq[2].vx, destq_0123);
-        	destq_0123 = VEC_MADD(vpq_3, vu_mq[3].vx, destq_0123);
+    	destq_0123 = VEC_MULT(vpq_0, vu_mq[0].vx);
+    	destq_0123 = VEC_MADD(vpq_1, vu_mq[1].vx, destq_0123);
+    	destq_0123 = VEC_MADD(vpq_2, vu_mq[2].vx, destq_0123);
+    	destq_0123 = VEC_MADD(vpq_3, vu_mq[3].vx, destq_0123);
 
-        	destr_0123 = VEC_MULT(vpr_0, vu_mr[0].vx);
-        	destr_0123 = VEC_MADD(vpr_1, vu_mr[1].vx, destr_0123);
-        	destr_0123 = VEC_MADD(vpr_2, vu_mr[2].vx, destr_0123);
-        	destr_0123 = VEC_MADD(vpr_3, vu_mr[3].vx, destr_0123);
+    	destr_0123 = VEC_MULT(vpr_0, vu_mr[0].vx);
+    	destr_0123 = VEC_MADD(vpr_1, vu_mr[1].vx, destr_0123);
+    	destr_0123 = VEC_MADD(vpr_2, vu_mr[2].vx, destr_0123);
+    	destr_0123 = VEC_MADD(vpr_3, vu_mr[3].vx, destr_0123);
 
 //        	*destPvec = VEC_MULT(destq_0123, destr_0123); // Single store
 //        	destPvec += 1;
 
-        	VEC_STORE(destP, VEC_MULT(destq_0123, destr_0123));
-        	destP += 4;
+    	VEC_STORE(destP + v, VEC_MULT(destq_0123, destr_0123));
 
 //        	for (int i = 0; i < 4; ++i) {
 //        		fprintf(stderr, " %5.3e", ((double*)destPvec)[i]);
@@ -408,31 +496,51 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartials(doubl
 //        	fprintf(stderr, "\n");
 
 
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+        v += 4;
     }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsFixedScaling(float* destP,
-                                        const float*  child0Partials,
-                                        const float*  child0TransMat,
-                                        const float*  child1Partials,
-                                        const float*  child1TransMat,
-                                        const float*  scaleFactors) {
+                                        const float*  partials_q,
+                                        const float*  matrices_q,
+                                        const float*  partials_r,
+                                        const float*  matrices_r,
+                                        const float*  scaleFactors,
+                                        int category,
+                                        int startPattern,
+                                        int endPattern) {
 
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsFixedScaling(
-			destP,
-			child0Partials,
-			child0TransMat,
-			child1Partials,
-			child1TransMat,
-			scaleFactors);
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	/* Load transition-probability matrices into vectors */
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	AVX_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k += 2) {
+
+#           if 1 && !defined(_WIN32)
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+        const bool pair = (k + 1 < endPattern);
+        const V_Float scaleFactor = pair ?
+                _mm256_setr_ps(scaleFactors[k], scaleFactors[k], scaleFactors[k], scaleFactors[k],
+                               scaleFactors[k + 1], scaleFactors[k + 1], scaleFactors[k + 1], scaleFactors[k + 1]) :
+                VEC_SPLAT_FLOAT(scaleFactors[k]);
+
+        V_Float vpq = loadPatternPair(partials_q + v, pair);
+        V_Float vpr = loadPatternPair(partials_r + v, pair);
+        V_Float destq, destr;
+        AVX_MATRIX_PARTIALS_FLOAT(destq, vm_q, vpq);
+        AVX_MATRIX_PARTIALS_FLOAT(destr, vm_r, vpr);
+
+        storePatternPair(destP + v, VEC_DIV_FLOAT(VEC_MULT_FLOAT(destq, destr), scaleFactor), pair);
+        v += 8;
+    }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
@@ -441,86 +549,66 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsFixedS
 		                                                        const double* matrices_q,
 		                                                        const double* partials_r,
 		                                                        const double* matrices_r,
-		                                                        const double* scaleFactors) {
-
-    int v = 0;
-    int w = 0;
+		                                                        const double* scaleFactors,
+		                                                        int category,
+		                                                        int startPattern,
+		                                                        int endPattern) {
 
-    V_Real	destq_01, destq_23, destr_01, destr_23;
- 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
-	for (int l = 0; l < kCategoryCount; l++) {
+    V_Real	destq_0123, destr_0123;
+ 	VecUnion vu_mq[OFFSET], vu_mr[OFFSET];
 
-		/* Load transition-probability matrices into vectors */
-    	//AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	/* Load transition-probability matrices into vectors */
+	AVX_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
 #           if 1 && !defined(_WIN32)
-            __builtin_prefetch (&partials_q[v+64]);
-            __builtin_prefetch (&partials_r[v+64]);
-            //            __builtin_prefetch (destPvec+32,1,0);
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
 #           endif
-            
-            // Prefetch scale factor
-//            const V_Real scaleFactor = VEC_LOAD_SCALAR(scaleFactors + k);
-        	// Option below appears faster, why?
-        	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
-
-        	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
-        	AVX_PREFETCH_PARTIALS(vpq_,partials_q,v);
-
-        	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
-        	AVX_PREFETCH_PARTIALS(vpr_,partials_r,v);
-
-        	// TODO Make below into macro since this repeats from other calcPPs
-			destq_01 = VEC_MULT(vpq_0, vu_mq[0][0].vx);
-			destq_01 = VEC_MADD(vpq_1, vu_mq[1][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_2, vu_mq[2][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_3, vu_mq[3][0].vx, destq_01);
-			destq_23 = VEC_MULT(vpq_0, vu_mq[0][1].vx);
-			destq_23 = VEC_MADD(vpq_1, vu_mq[1][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_2, vu_mq[2][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_3, vu_mq[3][1].vx, destq_23);
-
-			destr_01 = VEC_MULT(vpr_0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vpr_1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vpr_0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vpr_1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_3, vu_mr[3][1].vx, destr_23);
-
-            destPvec[0] = VEC_DIV(VEC_MULT(destq_01, destr_01), scaleFactor);
-            destPvec[1] = VEC_DIV(VEC_MULT(destq_23, destr_23), scaleFactor);
-
-            destPvec += 2;
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+
+    	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
+
+    	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
+    	AVX_PREFETCH_PARTIALS(vpq_,partials_q,v);
+
+    	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
+    	AVX_PREFETCH_PARTIALS(vpr_,partials_r,v);
+
+    	AVX_MATRIX_PARTIALS(destq_0123, vu_mq, vpq_);
+    	AVX_MATRIX_PARTIALS(destr_0123, vu_mr, vpr_);
+
+        VEC_STORE(destP + v, VEC_DIV(VEC_MULT(destq_0123, destr_0123), scaleFactor));
+
+        v += 4;
     }
 }
 
-    
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
                                                          const float*  partials_q,
                                                          const float*  matrices_q,
                                                          const float*  partials_r,
                                                          const float*  matrices_r,
-                                                                 int* activateScaling) {
-    BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcPartialsPartialsAutoScaling(destP,
-                                                     partials_q,
-                                                     matrices_q,
-                                                     partials_r,
-                                                     matrices_r,
-                                                     activateScaling);
+                                                                 int* activateScaling,
+                                                                 int category,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+
+    calcPartialsPartials(destP, partials_q, matrices_q, partials_r, matrices_r,
+                         category, startPattern, endPattern);
+
+    const int u = category*4*kPaddedPatternCount + 4*startPattern;
+    const int uEnd = u + 4*(endPattern - startPattern);
+    for (int v = u; v < uEnd && *activateScaling == 0; v++) {
+        int expTmp;
+        frexp(destP[v], &expTmp);
+        if (abs(expTmp) > scalingExponentThreshhold)
+            *activateScaling = 1;
+    }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
@@ -529,14 +617,18 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsAutoSc
                                                                     const double*  matrices_q,
                                                                     const double*  partials_r,
                                                                     const double*  matrices_r,
-                                                                    int* activateScaling) {
+                                                                    int* activateScaling,
+                                                                    int category,
+                                                                    int startPattern,
+                                                                    int endPattern) {
     // TODO: implement calcPartialsPartialsAutoScaling with AVX
     BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcPartialsPartialsAutoScaling(destP,
                                                                 partials_q,
                                                                 matrices_q,
                                                                 partials_r,
                                                                 matrices_r,
-                                                                activateScaling);
+                                                                activateScaling,
+                                                                category, startPattern, endPattern);
 }
     
 BEAGLE_CPU_4_AVX_TEMPLATE
@@ -547,14 +639,160 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcEdgeLogLikelihoods(const
                                                           const int stateFrequenciesIndex,
                                                           const int scalingFactorsIndex,
                                                           double* outSumLogLikelihood) {
-    return BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcEdgeLogLikelihoods(
-                                                              parIndex,
-                                                              childIndex,
-                                                              probIndex,
-                                                              categoryWeightsIndex,
-                                                              stateFrequenciesIndex,
-                                                              scalingFactorsIndex,
-                                                              outSumLogLikelihood);
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) // Integrated in double by the base class
+        return BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcEdgeLogLikelihoods(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                                                                                   stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    assert(parIndex >= kTipCount);
+
+    const float* cl_r = gPartials[parIndex];
+    float* cl_p = integrationTmp;
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = gTipStates[childIndex];
+
+        int w = 0;
+        for(int l = 0; l < kCategoryCount; l++) {
+
+            V_Float vm[OFFSET];
+            AVX_PREFETCH_MATRIX_FLOAT(transMatrix + w, vm);
+            const V_Float vwt = VEC_SPLAT_FLOAT(wt[l]);
+
+            int v = l*4*kPaddedPatternCount;
+            for(int k = 0; k < kPatternCount; k += 2) {
+                const bool pair = (k + 1 < kPatternCount);
+                V_Float wtdPartials = VEC_MULT_FLOAT(loadPatternPair(cl_r + v, pair), vwt);
+                storePatternPair(cl_p + 4*k,
+                        VEC_MADD_FLOAT(statesPatternPair(vm, statesChild, k, pair), wtdPartials,
+                                       loadPatternPair(cl_p + 4*k, pair)), pair);
+                v += 8;
+            }
+            w += OFFSET*4;
+        }
+    } else { // Integrate against a partial at the child
+
+        const float* cl_q = gPartials[childIndex];
+        int w = 0;
+
+        for(int l = 0; l < kCategoryCount; l++) {
+
+            V_Float vm[OFFSET];
+            AVX_PREFETCH_MATRIX_FLOAT(transMatrix + w, vm);
+            const V_Float vwt = VEC_SPLAT_FLOAT(wt[l]);
+
+            int v = l*4*kPaddedPatternCount;
+            for(int k = 0; k < kPatternCount; k += 2) {
+                const bool pair = (k + 1 < kPatternCount);
+                V_Float vcl_q = loadPatternPair(cl_q + v, pair);
+                V_Float vclp;
+                AVX_MATRIX_PARTIALS_FLOAT(vclp, vm, vcl_q);
+                vclp = VEC_MULT_FLOAT(vclp, vwt);
+
+                storePatternPair(cl_p + 4*k,
+                        VEC_MADD_FLOAT(vclp, loadPatternPair(cl_r + v, pair),
+                                       loadPatternPair(cl_p + 4*k, pair)), pair);
+                v += 8;
+            }
+            w += 4*OFFSET;
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        float sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * cl_p[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = log(sumOverI);
+    }
+
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+/*
+ * Site likelihoods with double-precision sums: each pattern's single-precision
+ * partials are widened to one vector of four doubles before they are combined.
+ */
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::integrateSiteLikelihoodsMixed(const LikelihoodSubset& subset,
+                                                                                   double* outSiteLikelihoods,
+                                                                                   int startPattern,
+                                                                                   int endPattern) {
+    const float* partialsParent = subset.partialsParent;
+    const float* transMatrix = subset.transMatrix;
+    const float* wt = subset.wt;
+    const int categoryStride = kPaddedPatternCount * 4;
+
+    const V_Real freqs = _mm256_setr_pd(subset.freqs[0], subset.freqs[1], subset.freqs[2], subset.freqs[3]);
+
+    // Column j of each category's matrix in double, all four states
+    std::vector<double> columns;
+    if (transMatrix != NULL) {
+        columns.resize(kCategoryCount * OFFSET * 4);
+        for (int l = 0; l < kCategoryCount; l++)
+            for (int j = 0; j < OFFSET; j++)
+                for (int i = 0; i < 4; i++)
+                    columns[(l * OFFSET + j) * 4 + i] = transMatrix[l * OFFSET * 4 + i * OFFSET + j];
+    }
+
+    for (int k = startPattern; k < endPattern; k++) {
+        V_Real sum = VEC_SETZERO();
+        int v = k * 4;
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            V_Real p = _mm256_cvtps_pd(_mm_load_ps(partialsParent + v));
+
+            if (transMatrix != NULL) {
+                const double* col = &columns[l * OFFSET * 4];
+                V_Real m;
+                if (subset.statesChild != NULL) { // Column of the state at the child
+                    const int stateChild = BEAGLE_CPU_PACKED_TIP_STATE(subset.statesChild, k);
+                    m = VEC_LOADU(col + stateChild * 4);
+                } else { // Matrix times the partials at the child
+                    const float* q = subset.partialsChild + v;
+                    m = VEC_MULT(VEC_LOADU(col + 0), VEC_SPLAT((double) q[0]));
+                    m = VEC_MADD(VEC_LOADU(col + 4), VEC_SPLAT((double) q[1]), m);
+                    m = VEC_MADD(VEC_LOADU(col + 8), VEC_SPLAT((double) q[2]), m);
+                    m = VEC_MADD(VEC_LOADU(col + 12), VEC_SPLAT((double) q[3]), m);
+                }
+                p = VEC_MULT(p, m);
+            }
+
+            sum = VEC_MADD(p, VEC_SPLAT((double) wt[l]), sum);
+            v += categoryStride;
+        }
+
+        sum = VEC_MULT(sum, freqs);
+        const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+        outSiteLikelihoods[k] = _mm_cvtsd_f64(pair) + _mm_cvtsd_f64(_mm_unpackhi_pd(pair, pair));
+    }
 }
 
 BEAGLE_CPU_4_AVX_TEMPLATE
@@ -581,74 +819,57 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const unsigned char* statesChild = gTipStates[childIndex];
 
+        int v = 0;
         int w = 0;
-        V_Real *vcl_r = (V_Real *)cl_r;
         for(int l = 0; l < kCategoryCount; l++) {
 
-            VecUnion vu_m[OFFSET][2];
+            VecUnion vu_m[OFFSET];
             AVX_PREFETCH_MATRIX(transMatrix + w, vu_m)
 
-           V_Real *vcl_p = (V_Real *)cl_p;
+            const V_Real vwt = VEC_SPLAT(wt[l]);
 
-           for(int k = 0; k < kPatternCount; k++) {
+            for(int k = 0; k < kPatternCount; k++) {
 
-                const int stateChild = statesChild[k];
-                V_Real vwt = VEC_SPLAT(wt[l]);
+                const int stateChild = BEAGLE_CPU_PACKED_TIP_STATE(statesChild, k);
 
-                V_Real wtdPartials = VEC_MULT(*vcl_r++, vwt);
-                *vcl_p++ = VEC_MADD(vu_m[stateChild][0].vx, wtdPartials, *vcl_p);
+                V_Real wtdPartials = VEC_MULT(VEC_LOAD(cl_r + v), vwt);
+                VEC_STORE(cl_p + 4*k, VEC_MADD(vu_m[stateChild].vx, wtdPartials, VEC_LOAD(cl_p + 4*k)));
 
-                wtdPartials = VEC_MULT(*vcl_r++, vwt);
-                *vcl_p++ = VEC_MADD(vu_m[stateChild][1].vx, wtdPartials, *vcl_p);
+                v += 4;
             }
-           w += OFFSET*4;
-           vcl_r += 2 * kExtraPatterns;
+            w += OFFSET*4;
+            v += 4 * kExtraPatterns;
         }
     } else { // Integrate against a partial at the child
 
         const double* cl_q = gPartials[childIndex];
-        V_Real * vcl_r = (V_Real *)cl_r;
         int v = 0;
         int w = 0;
 
         for(int l = 0; l < kCategoryCount; l++) {
 
-            V_Real * vcl_p = (V_Real *)cl_p;
-
-            VecUnion vu_m[OFFSET][2];
+            VecUnion vu_m[OFFSET];
             AVX_PREFETCH_MATRIX(transMatrix + w, vu_m)
 
+            const V_Real vwt = VEC_SPLAT(wt[l]);
+
             for(int k = 0; k < kPatternCount; k++) {
-                V_Real vclp_01, vclp_23;
-                V_Real vwt = VEC_SPLAT(wt[l]);
+                V_Real vclp_0123;
 
                 V_Real vcl_q0, vcl_q1, vcl_q2, vcl_q3;
                 AVX_PREFETCH_PARTIALS(vcl_q,cl_q,v);
 
-                vclp_01 = VEC_MULT(vcl_q0, vu_m[0][0].vx);
-                vclp_01 = VEC_MADD(vcl_q1, vu_m[1][0].vx, vclp_01);
-                vclp_01 = VEC_MADD(vcl_q2, vu_m[2][0].vx, vclp_01);
-                vclp_01 = VEC_MADD(vcl_q3, vu_m[3][0].vx, vclp_01);
-                vclp_23 = VEC_MULT(vcl_q0, vu_m[0][1].vx);
-                vclp_23 = VEC_MADD(vcl_q1, vu_m[1][1].vx, vclp_23);
-                vclp_23 = VEC_MADD(vcl_q2, vu_m[2][1].vx, vclp_23);
-                vclp_23 = VEC_MADD(vcl_q3, vu_m[3][1].vx, vclp_23);
-                vclp_01 = VEC_MULT(vclp_01, vwt);
-                vclp_23 = VEC_MULT(vclp_23, vwt);
+                AVX_MATRIX_PARTIALS(vclp_0123, vu_m, vcl_q);
+                vclp_0123 = VEC_MULT(vclp_0123, vwt);
 
-                *vcl_p++ = VEC_MADD(vclp_01, *vcl_r++, *vcl_p);
-                *vcl_p++ = VEC_MADD(vclp_23, *vcl_r++, *vcl_p);
+                VEC_STORE(cl_p + 4*k, VEC_MADD(vclp_0123, VEC_LOAD(cl_r + v), VEC_LOAD(cl_p + 4*k)));
 
                 v += 4;
             }
             w += 4*OFFSET;
-            if (kExtraPatterns) {
-                vcl_r += 2 * kExtraPatterns;
-                v += 4 * kExtraPatterns;
-            }
-
+            v += 4 * kExtraPatterns;
         }
     }
 
@@ -682,6 +903,64 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
 }
 
 
+BEAGLE_CPU_4_AVX_TEMPLATE
+inline double BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::maxPatternPartials(const double* destP,
+                                                                                  int k) {
+    const double* patternP = destP + 4*k;
+    V_Real max = VEC_SETZERO();
+    for (int l = 0; l < kCategoryCount; l++) {
+        max = VEC_MAX(VEC_LOAD(patternP), max);
+        patternP += 4*kPaddedPatternCount;
+    }
+    __m128d max2 = _mm_max_pd(_mm256_extractf128_pd(max, 1), _mm256_castpd256_pd128(max));
+    max2 = _mm_max_pd(_mm_unpackhi_pd(max2, max2), max2);
+    return _mm_cvtsd_f64(max2);
+}
+
+BEAGLE_CPU_4_AVX_TEMPLATE
+inline void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::scalePatternPartials(double* destP,
+                                                                                  int k,
+                                                                                  double scale) {
+    double* patternP = destP + 4*k;
+    const V_Real vscale = VEC_SPLAT(scale);
+    for (int l = 0; l < kCategoryCount; l++) {
+        VEC_STORE(patternP, VEC_MULT(VEC_LOAD(patternP), vscale));
+        patternP += 4*kPaddedPatternCount;
+    }
+}
+
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::rescalePartials(double* destP,
+                                                                      double* scaleFactors,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+    const bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double max = maxPatternPartials(destP, k);
+        if (max == 0)
+            max = 1.0;
+
+        scalePatternPartials(destP, k, 1.0 / max);
+        scaleFactors[k] = (useLogScalars ? log(max) : max);
+    }
+}
+
+BEAGLE_CPU_4_AVX_TEMPLATE
+void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::autoRescalePartials(double* destP,
+                                                                          signed short* scaleFactors,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
+        int expMax;
+        frexp(maxPatternPartials(destP, k), &expMax);
+        scaleFactors[k] = expMax;
+
+        if (expMax != 0)
+            scalePatternPartials(destP, k, ldexp(1.0, -expMax));
+    }
+}
+
 BEAGLE_CPU_4_AVX_TEMPLATE
 int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
@@ -709,7 +988,7 @@ const char* BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::getName() {
 BEAGLE_CPU_4_AVX_TEMPLATE
 const long BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::getFlags() {
 	return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_SINGLE |
             BEAGLE_FLAG_VECTOR_AVX;
@@ -718,7 +997,7 @@ const long BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::getFlags() {
 BEAGLE_CPU_4_AVX_TEMPLATE
 const long BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::getFlags() {
     return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_DOUBLE |
             BEAGLE_FLAG_VECTOR_AVX;
@@ -782,9 +1061,9 @@ const char* BeagleCPU4StateAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName()
 
 template <>
 const long BeagleCPU4StateAVXImplFactory<double>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -796,12 +1075,12 @@ const long BeagleCPU4StateAVXImplFactory<double>::getFlags() {
 
 template <>
 const long BeagleCPU4StateAVXImplFactory<float>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
-           BEAGLE_FLAG_PRECISION_SINGLE |
+           BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_MIXED |
            BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
            BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
            BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
@@ -65,88 +65,101 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::scalingExponentThreshhold;
 
+    typedef typename BeagleCPUImpl<BEAGLE_CPU_GENERIC>::LikelihoodSubset LikelihoodSubset;
+
 public:
     virtual ~BeagleCPU4StateImpl();
     virtual const char* getName();
 
 
     virtual void calcStatesStates(REALTYPE* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const REALTYPE* matrices1,
-                                    const int* states2,
-                                    const REALTYPE* matrices2);
+                                    const unsigned char* states2,
+                                    const REALTYPE* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
     
     virtual void calcStatesPartials(REALTYPE* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
-                                    const REALTYPE* matrices2);
+                                    const REALTYPE* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
     
     virtual void calcPartialsPartials(REALTYPE* destP,
                                     const REALTYPE* partials1,
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
-                                    const REALTYPE* matrices2);
-    
-    virtual int calcRootLogLikelihoods(const int bufferIndex,
-                                        const int categoryWeightsIndex,
-                                        const int stateFrequenciesIndex,
-                                        const int scalingFactorsIndex,
-                                        double* outSumLogLikelihood);
-    
-    virtual int calcRootLogLikelihoodsMulti(const int* bufferIndices,
-                                             const int* categoryWeightsIndices,
-                                             const int* stateFrequenciesIndices,
-                                             const int* scaleBufferIndices,
-                                             int count,
-                                             double* outSumLogLikelihood);    
-        
-    virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
-                                        const int childBufferIndex,
-                                        const int probabilityIndex,
-                                        const int categoryWeightsIndex,
-                                        const int stateFrequenciesIndex,
-                                        const int scalingFactorsIndex,
-                                        double* outSumLogLikelihood);
+                                    const REALTYPE* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
     
+    virtual void integrateSiteLikelihoods(const LikelihoodSubset& subset,
+                                          REALTYPE* outSiteLikelihoods,
+                                          int startPattern,
+                                          int endPattern);
+
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
-                                           const int *child0States,
+                                           const unsigned char *child0States,
                                         const REALTYPE *child0TransMat,
-                                           const int *child1States,
+                                           const unsigned char *child1States,
                                         const REALTYPE *child1TransMat,
-                                        const REALTYPE *scaleFactors);
+                                        const REALTYPE *scaleFactors,
+                                        int category,
+                                        int startPattern,
+                                        int endPattern);
 
     virtual void calcStatesPartialsFixedScaling(REALTYPE *destP,
-                                             const int *child0States,
+                                             const unsigned char *child0States,
                                           const REALTYPE *child0TransMat,
                                           const REALTYPE *child1Partials,
                                           const REALTYPE *child1TransMat,
-                                          const REALTYPE *scaleFactors);
+                                          const REALTYPE *scaleFactors,
+                                          int category,
+                                          int startPattern,
+                                          int endPattern);
 
     virtual void calcPartialsPartialsFixedScaling(REALTYPE *destP,
                                             const REALTYPE *child0Partials,
                                             const REALTYPE *child0TransMat,
                                             const REALTYPE *child1Partials,
                                             const REALTYPE *child1TransMat,
-                                            const REALTYPE *scaleFactors);
+                                            const REALTYPE *scaleFactors,
+                                            int category,
+                                            int startPattern,
+                                            int endPattern);
     
     virtual void calcPartialsPartialsAutoScaling(REALTYPE *destP,
                                                   const REALTYPE *child0Partials,
                                                   const REALTYPE *child0TransMat,
                                                   const REALTYPE *child1Partials,
                                                   const REALTYPE *child1TransMat,
-                                                  int *activateScaling);
+                                                  int *activateScaling,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern);
     
     
-    inline int integrateOutStatesAndScale(const REALTYPE* integrationTmp,
-                                           const int stateFrequenciesIndex,
-                                           const int scalingFactorsIndex,
-                                           double* outSumLogLikelihood);
-
     virtual void rescalePartials(REALTYPE *destP,
     		                     REALTYPE *scaleFactors,
-                                 REALTYPE *cumulativeScaleFactors,
-                                 const int  fillWithOnes);
+                                 int startPattern,
+                                 int endPattern);
+
+    virtual void autoRescalePartials(REALTYPE *destP,
+    		                     signed short *scaleFactors,
+                                 int startPattern,
+                                 int endPattern);
+
+    virtual bool hasPackedTipStates();
+
+    virtual bool useTipPairTable();
+
+    virtual bool supportsPatternMajorPartials();
 
 };
 
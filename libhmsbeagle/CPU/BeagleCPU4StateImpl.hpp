@@ -147,68 +147,94 @@ BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::~BeagleCPU4StateImpl() {
 ///////////////////////////////////////////////////////////////////////////////
 // private methods
 
+/*
+ * Nucleotide states (and the gap code 4) fit in a nibble, so tips hold two patterns per byte.
+ */
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::hasPackedTipStates() {
+    return true;
+}
+
+/*
+ * The 4-state kernels hold both transition columns in registers, which beats gathering
+ * rows from a tip-pair table.
+ */
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::useTipPairTable() {
+    return false;
+}
+
+/*
+ * The 4-state kernels (and their vectorized subclasses) walk partials in
+ * category-major order.
+ */
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::supportsPatternMajorPartials() {
+    return false;
+}
+
 /*
  * Calculates partial likelihoods at a node when both children have states.
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
-                                     const int* states1,
+                                     const unsigned char* states1,
                                      const REALTYPE* matrices1,
-                                     const int* states2,
-                                     const REALTYPE* matrices2) {
-
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*4*kPaddedPatternCount;
-        int w = l*4*OFFSET;
-
-        for (int k = 0; k < kPatternCount; k++) {
-
-            const int state1 = states1[k];
-            const int state2 = states2[k];
-
-            destP[v    ] = matrices1[w            + state1] * 
-                           matrices2[w            + state2];
-            destP[v + 1] = matrices1[w + OFFSET*1 + state1] * 
-                           matrices2[w + OFFSET*1 + state2];
-            destP[v + 2] = matrices1[w + OFFSET*2 + state1] * 
-                           matrices2[w + OFFSET*2 + state2];
-            destP[v + 3] = matrices1[w + OFFSET*3 + state1] * 
-                           matrices2[w + OFFSET*3 + state2];
-           v += 4;
-        }
+                                     const unsigned char* states2,
+                                     const REALTYPE* matrices2,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+    for (int k = startPattern; k < endPattern; k++) {
+
+        const int state1 = BEAGLE_CPU_PACKED_TIP_STATE(states1, k);
+        const int state2 = BEAGLE_CPU_PACKED_TIP_STATE(states2, k);
+
+        destP[v    ] = matrices1[w            + state1] * 
+                       matrices2[w            + state2];
+        destP[v + 1] = matrices1[w + OFFSET*1 + state1] * 
+                       matrices2[w + OFFSET*1 + state2];
+        destP[v + 2] = matrices1[w + OFFSET*2 + state1] * 
+                       matrices2[w + OFFSET*2 + state2];
+        destP[v + 3] = matrices1[w + OFFSET*3 + state1] * 
+                       matrices2[w + OFFSET*3 + state2];
+       v += 4;
     }
 }
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
-                                     const int* states1,
+                                     const unsigned char* states1,
                                      const REALTYPE* matrices1,
-                                     const int* states2,
+                                     const unsigned char* states2,
                                      const REALTYPE* matrices2,
-                                     const REALTYPE* scaleFactors) {
+                                     const REALTYPE* scaleFactors,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+    
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
     
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*4*kPaddedPatternCount;
-        int w = l*4*OFFSET;
+    for (int k = startPattern; k < endPattern; k++) {
         
-        for (int k = 0; k < kPatternCount; k++) {
-            
-            const int state1 = states1[k];
-            const int state2 = states2[k];
-            const REALTYPE scaleFactor = scaleFactors[k];
-            
-            destP[v    ] = matrices1[w            + state1] * 
-                           matrices2[w            + state2] / scaleFactor;
-            destP[v + 1] = matrices1[w + OFFSET*1 + state1] * 
-                           matrices2[w + OFFSET*1 + state2] / scaleFactor;
-            destP[v + 2] = matrices1[w + OFFSET*2 + state1] * 
-                           matrices2[w + OFFSET*2 + state2] / scaleFactor;
-            destP[v + 3] = matrices1[w + OFFSET*3 + state1] * 
-                           matrices2[w + OFFSET*3 + state2] / scaleFactor;
-            v += 4;
-        }
+        const int state1 = BEAGLE_CPU_PACKED_TIP_STATE(states1, k);
+        const int state2 = BEAGLE_CPU_PACKED_TIP_STATE(states2, k);
+        const REALTYPE scaleFactor = scaleFactors[k];
+        
+        destP[v    ] = matrices1[w            + state1] * 
+                       matrices2[w            + state2] / scaleFactor;
+        destP[v + 1] = matrices1[w + OFFSET*1 + state1] * 
+                       matrices2[w + OFFSET*1 + state2] / scaleFactor;
+        destP[v + 2] = matrices1[w + OFFSET*2 + state1] * 
+                       matrices2[w + OFFSET*2 + state2] / scaleFactor;
+        destP[v + 3] = matrices1[w + OFFSET*3 + state1] * 
+                       matrices2[w + OFFSET*3 + state2] / scaleFactor;
+        v += 4;
     }
 }
 
@@ -217,68 +243,69 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALT
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
-                                       const int* states1,
+                                       const unsigned char* states1,
                                        const REALTYPE* matrices1,
                                        const REALTYPE* partials2,
-                                       const REALTYPE* matrices2) {
-
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
-        int w = l*4*OFFSET;
-                
-        PREFETCH_MATRIX(2,matrices2,w);
-        
-        for (int k = 0; k < kPatternCount; k++) {
-            
-            const int state1 = states1[k];
-            
-            PREFETCH_PARTIALS(2,partials2,u);
-                        
-            DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23;
-                        
-            destP[u    ] = matrices1[w            + state1] * sum20;
-            destP[u + 1] = matrices1[w + OFFSET*1 + state1] * sum21;
-            destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22;
-            destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23;
+                                       const REALTYPE* matrices2,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
+
+    int u = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
             
-            u += 4;
-        }
+    PREFETCH_MATRIX(2,matrices2,w);
+    
+    for (int k = startPattern; k < endPattern; k++) {
+        
+        const int state1 = BEAGLE_CPU_PACKED_TIP_STATE(states1, k);
+        
+        PREFETCH_PARTIALS(2,partials2,u);
+                    
+        DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23;
+                    
+        destP[u    ] = matrices1[w            + state1] * sum20;
+        destP[u + 1] = matrices1[w + OFFSET*1 + state1] * sum21;
+        destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22;
+        destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23;
+        
+        u += 4;
     }
 }
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
-                                       const int* states1,
+                                       const unsigned char* states1,
                                        const REALTYPE* matrices1,
                                        const REALTYPE* partials2,
                                        const REALTYPE* matrices2,
-                                       const REALTYPE* scaleFactors) {
+                                       const REALTYPE* scaleFactors,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
     
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
-        int w = l*4*OFFSET;
-                
-        PREFETCH_MATRIX(2,matrices2,w);
-        
-        for (int k = 0; k < kPatternCount; k++) {
-            
-            const int state1 = states1[k];
-            const REALTYPE scaleFactor = scaleFactors[k];
-            
-            PREFETCH_PARTIALS(2,partials2,u);
-            
-            DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
-            
-            destP[u    ] = matrices1[w            + state1] * sum20 / scaleFactor;
-            destP[u + 1] = matrices1[w + OFFSET*1 + state1] * sum21 / scaleFactor;
-            destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22 / scaleFactor;
-            destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23 / scaleFactor;
+    int u = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
             
-            u += 4;            
-        }
-    }   
+    PREFETCH_MATRIX(2,matrices2,w);
+    
+    for (int k = startPattern; k < endPattern; k++) {
+        
+        const int state1 = BEAGLE_CPU_PACKED_TIP_STATE(states1, k);
+        const REALTYPE scaleFactor = scaleFactors[k];
+        
+        PREFETCH_PARTIALS(2,partials2,u);
+        
+        DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
+        
+        destP[u    ] = matrices1[w            + state1] * sum20 / scaleFactor;
+        destP[u + 1] = matrices1[w + OFFSET*1 + state1] * sum21 / scaleFactor;
+        destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22 / scaleFactor;
+        destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23 / scaleFactor;
+        
+        u += 4;            
+    }
+   
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -286,32 +313,32 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* des
                                          const REALTYPE* partials1,
                                          const REALTYPE* matrices1,
                                          const REALTYPE* partials2,
-                                         const REALTYPE* matrices2) {
+                                         const REALTYPE* matrices2,
+                                         int category,
+                                         int startPattern,
+                                         int endPattern) {
     
  
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
-        int w = l*4*OFFSET;
-                
-        PREFETCH_MATRIX(1,matrices1,w);                
-        PREFETCH_MATRIX(2,matrices2,w);
-        for (int k = 0; k < kPatternCount; k++) {                   
-            PREFETCH_PARTIALS(1,partials1,u);
-            PREFETCH_PARTIALS(2,partials2,u);
-            
-            DO_INTEGRATION(1); // defines sum10, sum11, sum12, sum13
-            DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
+    int u = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
             
-            // Final results
-            destP[u    ] = sum10 * sum20;
-            destP[u + 1] = sum11 * sum21;
-            destP[u + 2] = sum12 * sum22;
-            destP[u + 3] = sum13 * sum23;
+    PREFETCH_MATRIX(1,matrices1,w);                
+    PREFETCH_MATRIX(2,matrices2,w);
+    for (int k = startPattern; k < endPattern; k++) {                   
+        PREFETCH_PARTIALS(1,partials1,u);
+        PREFETCH_PARTIALS(2,partials2,u);
+        
+        DO_INTEGRATION(1); // defines sum10, sum11, sum12, sum13
+        DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
+        
+        // Final results
+        destP[u    ] = sum10 * sum20;
+        destP[u + 1] = sum11 * sum21;
+        destP[u + 2] = sum12 * sum22;
+        destP[u + 3] = sum13 * sum23;
 
-            u += 4;
+        u += 4;
 
-        }
     }
 }
     
@@ -321,51 +348,51 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(RE
                                                                     const REALTYPE* matrices1,
                                                                     const REALTYPE* partials2,
                                                                     const REALTYPE* matrices2,
-                                                                    int* activateScaling) {
+                                                                    int* activateScaling,
+                                                                    int category,
+                                                                    int startPattern,
+                                                                    int endPattern) {
+    
     
+    int u = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
     
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
-        int w = l*4*OFFSET;
+    PREFETCH_MATRIX(1,matrices1,w);                
+    PREFETCH_MATRIX(2,matrices2,w);
+    for (int k = startPattern; k < endPattern; k++) {                   
+        PREFETCH_PARTIALS(1,partials1,u);
+        PREFETCH_PARTIALS(2,partials2,u);
         
-        PREFETCH_MATRIX(1,matrices1,w);                
-        PREFETCH_MATRIX(2,matrices2,w);
-        for (int k = 0; k < kPatternCount; k++) {                   
-            PREFETCH_PARTIALS(1,partials1,u);
-            PREFETCH_PARTIALS(2,partials2,u);
-            
-            DO_INTEGRATION(1); // defines sum10, sum11, sum12, sum13
-            DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
-            
-            // Final results
-            destP[u    ] = sum10 * sum20;
-            destP[u + 1] = sum11 * sum21;
-            destP[u + 2] = sum12 * sum22;
-            destP[u + 3] = sum13 * sum23;
-            
-            if (*activateScaling == 0) {
-                int expTmp;
-                int expMax;
-                frexp(destP[u], &expMax);
-                frexp(destP[u + 1], &expTmp);
-                if (abs(expTmp) > abs(expMax))
-                    expMax = expTmp;
-                frexp(destP[u + 2], &expTmp);
-                if (abs(expTmp) > abs(expMax))
-                    expMax = expTmp;
-                frexp(destP[u + 3], &expTmp);
-                if (abs(expTmp) > abs(expMax))
-                    expMax = expTmp;
-
-                if(abs(expMax) > scalingExponentThreshhold) {
-                    *activateScaling = 1;
-                }
+        DO_INTEGRATION(1); // defines sum10, sum11, sum12, sum13
+        DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
+        
+        // Final results
+        destP[u    ] = sum10 * sum20;
+        destP[u + 1] = sum11 * sum21;
+        destP[u + 2] = sum12 * sum22;
+        destP[u + 3] = sum13 * sum23;
+        
+        if (*activateScaling == 0) {
+            int expTmp;
+            int expMax;
+            frexp(destP[u], &expMax);
+            frexp(destP[u + 1], &expTmp);
+            if (abs(expTmp) > abs(expMax))
+                expMax = expTmp;
+            frexp(destP[u + 2], &expTmp);
+            if (abs(expTmp) > abs(expMax))
+                expMax = expTmp;
+            frexp(destP[u + 3], &expTmp);
+            if (abs(expTmp) > abs(expMax))
+                expMax = expTmp;
+
+            if(abs(expMax) > scalingExponentThreshhold) {
+                *activateScaling = 1;
             }
-            
-            u += 4;
-            
         }
+        
+        u += 4;
+        
     }
 }
     
@@ -376,116 +403,152 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(R
                                          const REALTYPE* matrices1,
                                          const REALTYPE* partials2,
                                          const REALTYPE* matrices2,
-                                         const REALTYPE* scaleFactors) {
+                                         const REALTYPE* scaleFactors,
+                                         int category,
+                                         int startPattern,
+                                         int endPattern) {
+    
+    int u = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
     
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*4*kPaddedPatternCount;
-        int w = l*4*OFFSET;
+    PREFETCH_MATRIX(1,matrices1,w);
+    PREFETCH_MATRIX(2,matrices2,w);
+    
+    for (int k = startPattern; k < endPattern; k++) {
+                    
+        // Prefetch scale factor
+        const REALTYPE scaleFactor = scaleFactors[k];
         
-        PREFETCH_MATRIX(1,matrices1,w);
-        PREFETCH_MATRIX(2,matrices2,w);
+        PREFETCH_PARTIALS(1,partials1,u);
+        PREFETCH_PARTIALS(2,partials2,u);
         
-        for (int k = 0; k < kPatternCount; k++) {
-                        
-            // Prefetch scale factor
-            const REALTYPE scaleFactor = scaleFactors[k];
-            
-            PREFETCH_PARTIALS(1,partials1,u);
-            PREFETCH_PARTIALS(2,partials2,u);
-            
-            DO_INTEGRATION(1); // defines sum10, sum11, sum12, sum13
-            DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
-                                
-            // Final results
-            destP[u    ] = sum10 * sum20 / scaleFactor;
-            destP[u + 1] = sum11 * sum21 / scaleFactor;
-            destP[u + 2] = sum12 * sum22 / scaleFactor;
-            destP[u + 3] = sum13 * sum23 / scaleFactor;
-            
-            u += 4;
-        }
-    }    
+        DO_INTEGRATION(1); // defines sum10, sum11, sum12, sum13
+        DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
+                            
+        // Final results
+        destP[u    ] = sum10 * sum20 / scaleFactor;
+        destP[u + 1] = sum11 * sum21 / scaleFactor;
+        destP[u + 2] = sum12 * sum22 / scaleFactor;
+        destP[u + 3] = sum13 * sum23 / scaleFactor;
+        
+        u += 4;
+    }
+    
 }
 
 BEAGLE_CPU_TEMPLATE
-int inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScale(const REALTYPE* integrationTmp,
-                                                                      const int stateFrequenciesIndex,
-                                                            const int scalingFactorsIndex,
-                                                            double* outSumLogLikelihood) {
-    
-    int returnCode = BEAGLE_SUCCESS;
-    
-    register REALTYPE freq0, freq1, freq2, freq3; // Is it a good idea to specify 'register'?
-    freq0 = gStateFrequencies[stateFrequenciesIndex][0];   
-    freq1 = gStateFrequencies[stateFrequenciesIndex][1];
-    freq2 = gStateFrequencies[stateFrequenciesIndex][2];
-    freq3 = gStateFrequencies[stateFrequenciesIndex][3];
-    
-    int u = 0;
-    for(int k = 0; k < kPatternCount; k++) {
-        REALTYPE sumOverI =
-        freq0 * integrationTmp[u    ] +
-        freq1 * integrationTmp[u + 1] +
-        freq2 * integrationTmp[u + 2] +
-        freq3 * integrationTmp[u + 3];
-        
-        u += 4;
-                        
-        outLogLikelihoodsTmp[k] = log(sumOverI);
-    }        
-
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++) {
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateSiteLikelihoods(const LikelihoodSubset& subset,
+                                                                       REALTYPE* outSiteLikelihoods,
+                                                                       int startPattern,
+                                                                       int endPattern) {
+
+    const REALTYPE* partialsParent = subset.partialsParent;
+    const REALTYPE* transMatrix = subset.transMatrix;
+    const REALTYPE* wt = subset.wt;
+    const int categoryStride = kPaddedPatternCount * 4;
+
+    const REALTYPE freq0 = subset.freqs[0];
+    const REALTYPE freq1 = subset.freqs[1];
+    const REALTYPE freq2 = subset.freqs[2];
+    const REALTYPE freq3 = subset.freqs[3];
+
+    if (transMatrix == NULL) { // Integrate the root partials against the frequencies
+
+        for (int k = startPattern; k < endPattern; k++) {
+            int v = k * 4;
+            const REALTYPE wt0 = wt[0];
+            REALTYPE sum0 = partialsParent[v    ] * wt0;
+            REALTYPE sum1 = partialsParent[v + 1] * wt0;
+            REALTYPE sum2 = partialsParent[v + 2] * wt0;
+            REALTYPE sum3 = partialsParent[v + 3] * wt0;
+            for (int l = 1; l < kCategoryCount; l++) {
+                v += categoryStride;
+                const REALTYPE wtl = wt[l];
+                sum0 += partialsParent[v    ] * wtl;
+                sum1 += partialsParent[v + 1] * wtl;
+                sum2 += partialsParent[v + 2] * wtl;
+                sum3 += partialsParent[v + 3] * wtl;
+            }
+
+            outSiteLikelihoods[k] = freq0 * sum0 + freq1 * sum1 + freq2 * sum2 + freq3 * sum3;
+        }
+
+    } else if (subset.statesChild != NULL) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = subset.statesChild;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const int stateChild = BEAGLE_CPU_PACKED_TIP_STATE(statesChild, k);
+            REALTYPE sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+            int v = k * 4;
+            int w = 0;
+            for (int l = 0; l < kCategoryCount; l++) {
+                const REALTYPE weight = wt[l];
+                sum0 += transMatrix[w            + stateChild] * partialsParent[v    ] * weight;
+                sum1 += transMatrix[w + OFFSET*1 + stateChild] * partialsParent[v + 1] * weight;
+                sum2 += transMatrix[w + OFFSET*2 + stateChild] * partialsParent[v + 2] * weight;
+                sum3 += transMatrix[w + OFFSET*3 + stateChild] * partialsParent[v + 3] * weight;
+                v += categoryStride;
+                w += OFFSET*4;
+            }
+
+            outSiteLikelihoods[k] = freq0 * sum0 + freq1 * sum1 + freq2 * sum2 + freq3 * sum3;
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const REALTYPE* partialsChild = subset.partialsChild;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            REALTYPE sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+            int v = k * 4;
+            int w = 0;
+            for (int l = 0; l < kCategoryCount; l++) {
+                PREFETCH_MATRIX(1,transMatrix,w);
+                PREFETCH_PARTIALS(1,partialsChild,v);
+
+                DO_INTEGRATION(1);
+
+                const REALTYPE weight = wt[l];
+                sum0 += sum10 * partialsParent[v    ] * weight;
+                sum1 += sum11 * partialsParent[v + 1] * weight;
+                sum2 += sum12 * partialsParent[v + 2] * weight;
+                sum3 += sum13 * partialsParent[v + 3] * weight;
+                v += categoryStride;
+                w += OFFSET*4;
+            }
+
+            outSiteLikelihoods[k] = freq0 * sum0 + freq1 * sum1 + freq2 * sum2 + freq3 * sum3;
         }
     }
-    
-    *outSumLogLikelihood = 0.0;    
-    for(int k=0; k < kPatternCount; k++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
-    }    
-    
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
 }
 
 #define FAST_MAX(x,y)	(x > y ? x : y)
-//#define BEAGLE_TEST_OPTIMIZATION
+
 /*
  * Re-scales the partial likelihoods such that the largest is one.
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
 		REALTYPE* scaleFactors,
-		REALTYPE* cumulativeScaleFactors,
-        const int  fillWithOnes) {
+        int startPattern,
+        int endPattern) {
 
 	bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
 
-    for (int k = 0; k < kPatternCount; k++) {
-    	REALTYPE max = 0;    	
+    for (int k = startPattern; k < endPattern; k++) {
+    	REALTYPE max0 = 0, max1 = 0, max2 = 0, max3 = 0;
         const int patternOffset = k * 4;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * 4 + patternOffset;
-
-#ifdef BEAGLE_TEST_OPTIMIZATION
-            REALTYPE max01 = FAST_MAX(destP[offset + 0], destP[offset + 1]);
-            REALTYPE max23 = FAST_MAX(destP[offset + 2], destP[offset + 3]);
-            max = FAST_MAX(max, max01);
-            max = FAST_MAX(max, max23);
-#else
-			#pragma unroll
-            for (int i = 0; i < 4; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
-#endif
+            const int offset = l * kPaddedPatternCount * 4 + patternOffset;
+            max0 = FAST_MAX(destP[offset + 0], max0);
+            max1 = FAST_MAX(destP[offset + 1], max1);
+            max2 = FAST_MAX(destP[offset + 2], max2);
+            max3 = FAST_MAX(destP[offset + 3], max3);
         }
+        REALTYPE max01 = FAST_MAX(max0, max1);
+        REALTYPE max23 = FAST_MAX(max2, max3);
+        REALTYPE max = FAST_MAX(max01, max23);
 
         if (max == 0)
             max = REALTYPE(1.0);
@@ -498,264 +561,54 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
                 destP[offset++] *= oneOverMax;
         }
 
-        if (useLogScalars) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
+        scaleFactors[k] = (useLogScalars ? log(max) : max);
     }
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex,
-                                                           const int childIndex,
-                                                           const int probIndex,
-                                                           const int categoryWeightsIndex,
-                                                           const int stateFrequenciesIndex,
-                                                           const int scalingFactorsIndex,
-                                                           double* outSumLogLikelihood) {
-    // TODO: implement derivatives for calculateEdgeLnL
-    
-    assert(parIndex >= kTipCount);
-    
-    const REALTYPE* partialsParent = gPartials[parIndex];
-    const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
+		signed short* scaleFactors,
+        int startPattern,
+        int endPattern) {
 
-    
-    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-    
-    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-      
-        const int* statesChild = gTipStates[childIndex];    
-        int v = 0; // Index for parent partials
-        int w = 0;
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0; // Index in resulting product-partials (summed over categories)
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
-                
-                const int stateChild = statesChild[k]; 
-                
-                integrationTmp[u    ] += transMatrix[w            + stateChild] * partialsParent[v    ] * weight;                                               
-                integrationTmp[u + 1] += transMatrix[w + OFFSET*1 + stateChild] * partialsParent[v + 1] * weight;
-                integrationTmp[u + 2] += transMatrix[w + OFFSET*2 + stateChild] * partialsParent[v + 2] * weight;
-                integrationTmp[u + 3] += transMatrix[w + OFFSET*3 + stateChild] * partialsParent[v + 3] * weight;
-                
-                u += 4;
-                v += 4;                
-            }
-            w += OFFSET*4;
-            if (kExtraPatterns)
-            	v += 4 * kExtraPatterns;
-        }
-        
-    } else { // Integrate against a partial at the child
-        
-        const REALTYPE* partialsChild = gPartials[childIndex];
-		#if 0//
-        int v = 0;
-		#endif
-        int w = 0;
-        for(int l = 0; l < kCategoryCount; l++) {            
-            int u = 0;
-			#if 1//
-			int v = l*kPaddedPatternCount*4;
-			#endif
-            const REALTYPE weight = wt[l];
-            
-            PREFETCH_MATRIX(1,transMatrix,w);
-            
-            for(int k = 0; k < kPatternCount; k++) {                
-                                 
-                const REALTYPE* partials1 = partialsChild;
-                
-                PREFETCH_PARTIALS(1,partials1,v);
-                
-                DO_INTEGRATION(1);
-                
-                integrationTmp[u    ] += sum10 * partialsParent[v    ] * weight;
-                integrationTmp[u + 1] += sum11 * partialsParent[v + 1] * weight;
-                integrationTmp[u + 2] += sum12 * partialsParent[v + 2] * weight;
-                integrationTmp[u + 3] += sum13 * partialsParent[v + 3] * weight;
-                
-                u += 4;
-                v += 4;
-            } 
-            w += OFFSET*4;
-			#if 0//
-            if (kExtraPatterns)
-            	v += 4 * kExtraPatterns;
-			#endif//
-        }
-    }
-
-    return integrateOutStatesAndScale(integrationTmp, stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
-}
-
-BEAGLE_CPU_TEMPLATE
-int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
-                                                           const int categoryWeightsIndex,
-                                                           const int stateFrequenciesIndex,
-                                                const int scalingFactorsIndex,
-                                                double* outSumLogLikelihood) {
-
-    const REALTYPE* rootPartials = gPartials[bufferIndex];
-    assert(rootPartials);
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    
-    int u = 0;
-    int v = 0;
-    const REALTYPE wt0 = wt[0];
-    for (int k = 0; k < kPatternCount; k++) {
-        integrationTmp[v    ] = rootPartials[v    ] * wt0;
-        integrationTmp[v + 1] = rootPartials[v + 1] * wt0;
-        integrationTmp[v + 2] = rootPartials[v + 2] * wt0;
-        integrationTmp[v + 3] = rootPartials[v + 3] * wt0;
-        v += 4;
-    }
-    for (int l = 1; l < kCategoryCount; l++) {
-        u = 0;
-        const REALTYPE wtl = wt[l];
-        for (int k = 0; k < kPatternCount; k++) {
-            integrationTmp[u    ] += rootPartials[v    ] * wtl;
-            integrationTmp[u + 1] += rootPartials[v + 1] * wtl;
-            integrationTmp[u + 2] += rootPartials[v + 2] * wtl;
-            integrationTmp[u + 3] += rootPartials[v + 3] * wtl;
-             
-            u += 4;
-            v += 4;
-        }
-		v += 4 * kExtraPatterns;
-    }
-    
-    return integrateOutStatesAndScale(integrationTmp, stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
-}
-
-BEAGLE_CPU_TEMPLATE
-int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bufferIndices,
-                                                                const int* categoryWeightsIndices,
-                                                                const int* stateFrequenciesIndices,
-                                                                const int* scaleBufferIndices,
-                                                                int count,
-                                                                double* outSumLogLikelihood) {
-    
-    int returnCode = BEAGLE_SUCCESS;
-    
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
-    
-    for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
-        const int rootPartialIndex = bufferIndices[subsetIndex];
-        const REALTYPE* rootPartials = gPartials[rootPartialIndex];
-        const REALTYPE* frequencies = gStateFrequencies[stateFrequenciesIndices[subsetIndex]];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[subsetIndex]];
-        int u = 0;
-        int v = 0;
-        
-        const REALTYPE wt0 = wt[0];
-        for (int k = 0; k < kPatternCount; k++) {
-            integrationTmp[v    ] = rootPartials[v    ] * wt0;
-            integrationTmp[v + 1] = rootPartials[v + 1] * wt0;
-            integrationTmp[v + 2] = rootPartials[v + 2] * wt0;
-            integrationTmp[v + 3] = rootPartials[v + 3] * wt0;
-            v += 4;
-        }
-        for (int l = 1; l < kCategoryCount; l++) {
-            u = 0;
-            const REALTYPE wtl = wt[l];
-            for (int k = 0; k < kPatternCount; k++) {
-                integrationTmp[u    ] += rootPartials[v    ] * wtl;
-                integrationTmp[u + 1] += rootPartials[v + 1] * wtl;
-                integrationTmp[u + 2] += rootPartials[v + 2] * wtl;
-                integrationTmp[u + 3] += rootPartials[v + 3] * wtl;
-                
-                u += 4;
-                v += 4;
-            }
-            v += 4 * kExtraPatterns;
+    for (int k = startPattern; k < endPattern; k++) {
+    	REALTYPE max0 = 0, max1 = 0, max2 = 0, max3 = 0;
+        const int patternOffset = k * 4;
+        for (int l = 0; l < kCategoryCount; l++) {
+            const int offset = l * kPaddedPatternCount * 4 + patternOffset;
+            max0 = FAST_MAX(destP[offset + 0], max0);
+            max1 = FAST_MAX(destP[offset + 1], max1);
+            max2 = FAST_MAX(destP[offset + 2], max2);
+            max3 = FAST_MAX(destP[offset + 3], max3);
         }
-                
-        register REALTYPE freq0, freq1, freq2, freq3; // Is it a good idea to specify 'register'?
-        freq0 = frequencies[0];   
-        freq1 = frequencies[1];
-        freq2 = frequencies[2];
-        freq3 = frequencies[3];
-        
-        u = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            REALTYPE sum = 
-                freq0 * integrationTmp[u    ] +
-                freq1 * integrationTmp[u + 1] +
-                freq2 * integrationTmp[u + 2] +
-                freq3 * integrationTmp[u + 3];
-            
-            u += 4;     
-            
-            // TODO: allow only some subsets to have scale indices
-            if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-                int cumulativeScalingFactorIndex;
-                if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-                    cumulativeScalingFactorIndex = rootPartialIndex - kTipCount; 
-                else
-                    cumulativeScalingFactorIndex = scaleBufferIndices[subsetIndex];
-                
-                const REALTYPE* cumulativeScaleFactors = gScaleBuffers[cumulativeScalingFactorIndex];
-                
-                if (subsetIndex == 0) {
-                    indexMaxScale[k] = 0;
-                    maxScaleFactor[k] = cumulativeScaleFactors[k];
-                    for (int j = 1; j < count; j++) {
-                        REALTYPE tmpScaleFactor;
-                        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-                            tmpScaleFactor = gScaleBuffers[bufferIndices[j] - kTipCount][k]; 
-                        else
-                            tmpScaleFactor = gScaleBuffers[scaleBufferIndices[j]][k];
-                        
-                        if (tmpScaleFactor > maxScaleFactor[k]) {
-                            indexMaxScale[k] = j;
-                            maxScaleFactor[k] = tmpScaleFactor;
-                        }
-                    }
+        REALTYPE max01 = FAST_MAX(max0, max1);
+        REALTYPE max23 = FAST_MAX(max2, max3);
+
+        int expMax;
+        frexp(FAST_MAX(max01, max23), &expMax);
+        scaleFactors[k] = expMax;
+
+        if (expMax != 0) {
+            // Exact power of two; see BeagleCPUImpl::autoRescalePartials
+            if (DOUBLE_PRECISION || -expMax < FLT_MAX_EXP) {
+                const REALTYPE scale = ldexp(REALTYPE(1.0), -expMax);
+                for (int l = 0; l < kCategoryCount; l++) {
+                    int offset = l * kPaddedPatternCount * 4 + patternOffset;
+                    #pragma unroll
+                    for (int i = 0; i < 4; i++)
+                        destP[offset++] *= scale;
                 }
-                
-                if (subsetIndex != indexMaxScale[k])
-                    sum *= exp((REALTYPE)(cumulativeScaleFactors[k] - maxScaleFactor[k]));
-            }
-            
-            if (subsetIndex == 0) {
-                outLogLikelihoodsTmp[k] = sum;
-            } else if (subsetIndex == count - 1) {
-                REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sum;
-                
-                outLogLikelihoodsTmp[k] = log(tmpSum);
             } else {
-                outLogLikelihoodsTmp[k] += sum;
+                const double scale = ldexp(1.0, -expMax);
+                for (int l = 0; l < kCategoryCount; l++) {
+                    int offset = l * kPaddedPatternCount * 4 + patternOffset;
+                    for (int i = 0; i < 4; i++, offset++)
+                        destP[offset] = REALTYPE(destP[offset] * scale);
+                }
             }
         }
     }
-    
-    if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-        for(int i=0; i<kPatternCount; i++)
-            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
-    }
-    
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
-    
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
 }
-    
 
 BEAGLE_CPU_TEMPLATE
 const char* BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::getName() {
@@ -814,9 +667,9 @@ const char* BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 
 BEAGLE_CPU_FACTORY_TEMPLATE
 const long BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
-    long flags =  BEAGLE_FLAG_COMPUTATION_SYNCH |
+    long flags =  BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
                   BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-                  BEAGLE_FLAG_THREADING_NONE |
+                  BEAGLE_CPU_FACTORY_THREADING_FLAGS |
                   BEAGLE_FLAG_PROCESSOR_CPU |
                   BEAGLE_FLAG_VECTOR_NONE |
                   BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
@@ -827,7 +680,7 @@ const long BeagleCPU4StateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
     if (DOUBLE_PRECISION)
     	flags |= BEAGLE_FLAG_PRECISION_DOUBLE;
     else
-    	flags |= BEAGLE_FLAG_PRECISION_SINGLE;
+    	flags |= BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_MIXED;
     return flags;
 }
 
@@ -85,6 +85,21 @@
 		dest_vu_m1[i][1].x[1] = m1[3*OFFSET]; \
 	}
 
+/* Loads a (transposed) single-precision transition matrix, one column of the
+   four destination states per SSE vector */
+#define SSE_PREFETCH_MATRIX_FLOAT(src_m, dest_vm) \
+	for (int j = 0; j < OFFSET; j++) \
+		dest_vm[j] = _mm_setr_ps((src_m)[0*OFFSET + j], (src_m)[1*OFFSET + j], \
+		                         (src_m)[2*OFFSET + j], (src_m)[3*OFFSET + j]);
+
+/* Multiplies a transposed single-precision matrix by the partials of one pattern */
+#define SSE_SPLAT_FLOAT(p, j)	_mm_shuffle_ps((p), (p), _MM_SHUFFLE(j,j,j,j))
+#define SSE_MATRIX_PARTIALS_FLOAT(dest, vm, p) \
+		dest = VEC_MULT_FLOAT(SSE_SPLAT_FLOAT(p, 0), vm[0]); \
+		dest = VEC_MADD_FLOAT(SSE_SPLAT_FLOAT(p, 1), vm[1], dest); \
+		dest = VEC_MADD_FLOAT(SSE_SPLAT_FLOAT(p, 2), vm[2], dest); \
+		dest = VEC_MADD_FLOAT(SSE_SPLAT_FLOAT(p, 3), vm[3], dest);
+
 namespace beagle {
 namespace cpu {
 
@@ -104,49 +119,53 @@ inline const char* getBeagleCPU4StateSSEName<float>(){ return "CPU-4State-SSE-Si
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesStates(float* destP,
-                                     const int* states_q,
+                                     const unsigned char* states_q,
                                      const float* matrices_q,
-                                     const int* states_r,
-                                     const float* matrices_r) {
-
-									 BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesStates(destP,
-                                     states_q,
-                                     matrices_q,
-                                     states_r,
-                                     matrices_r);
-
-									 }
+                                     const unsigned char* states_r,
+                                     const float* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+
+    int w = category*4*OFFSET;
+	float* destPu = destP + category*4*kPaddedPatternCount + 4*startPattern;
+
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k++) {
+        VEC_STORE_FLOAT(destPu, VEC_MULT_FLOAT(vm_q[BEAGLE_CPU_PACKED_TIP_STATE(states_q, k)], vm_r[BEAGLE_CPU_PACKED_TIP_STATE(states_r, k)]));
+        destPu += 4;
+    }
+}
 
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
+                                     const unsigned char* states_q,
                                      const double* matrices_q,
-                                     const int* states_r,
-                                     const double* matrices_r) {
+                                     const unsigned char* states_r,
+                                     const double* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
 
 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
 
-    int w = 0;
-	V_Real *destPvec = (V_Real *)destP;
+    int w = category*4*OFFSET;
+	V_Real *destPvec = (V_Real *)(destP + category*4*kPaddedPatternCount + 4*startPattern);
 
-    for (int l = 0; l < kCategoryCount; l++) {
-
-    	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
-            const int state_q = states_q[k];
-            const int state_r = states_r[k];
+        const int state_q = BEAGLE_CPU_PACKED_TIP_STATE(states_q, k);
+        const int state_r = BEAGLE_CPU_PACKED_TIP_STATE(states_r, k);
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
-
-        }
+        *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, vu_mr[state_r][0].vx);
+        *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, vu_mr[state_r][1].vx);
 
-        w += OFFSET*4;
-        if (kExtraPatterns)
-        	destPvec += kExtraPatterns * 2;
     }
 }
 
@@ -156,129 +175,146 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* d
  */
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesPartials(float* destP,
-                                       const int* states_q,
+                                       const unsigned char* states_q,
                                        const float* matrices_q,
                                        const float* partials_r,
-                                       const float* matrices_r) {
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesPartials(
-									   destP,
-									   states_q,
-									   matrices_q,
-									   partials_r,
-									   matrices_r);
+                                       const float* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k++) {
+        V_Float vp = VEC_LOAD_FLOAT(partials_r + v);
+        V_Float destr;
+        SSE_MATRIX_PARTIALS_FLOAT(destr, vm_r, vp);
+
+        VEC_STORE_FLOAT(destP + v, VEC_MULT_FLOAT(vm_q[BEAGLE_CPU_PACKED_TIP_STATE(states_q, k)], destr));
+        v += 4;
+    }
 }
 
 
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
+                                       const unsigned char* states_q,
                                        const double* matrices_q,
                                        const double* partials_r,
-                                       const double* matrices_r) {
+                                       const double* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
 
-    int v = 0;
-    int w = 0;
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
  	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
+	V_Real *destPvec = (V_Real *)(destP + v);
 	V_Real destr_01, destr_23;
 
-    for (int l = 0; l < kCategoryCount; l++) {
-
-    	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
-            const int state_q = states_q[k];
-            V_Real vp0, vp1, vp2, vp3;
-            SSE_PREFETCH_PARTIALS(vp,partials_r,v);
+        const int state_q = BEAGLE_CPU_PACKED_TIP_STATE(states_q, k);
+        V_Real vp0, vp1, vp2, vp3;
+        SSE_PREFETCH_PARTIALS(vp,partials_r,v);
 
-			destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
+		destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
+		destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
+		destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
+		destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
+		destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
+		destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
+		destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
+		destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
 
-            *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
-            *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
+        *destPvec++ = VEC_MULT(vu_mq[state_q][0].vx, destr_01);
+        *destPvec++ = VEC_MULT(vu_mq[state_q][1].vx, destr_23);
 
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+        v += 4;
     }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
-                                const int* states1,
-                                const float* __restrict matrices1,
-                                const float* __restrict partials2,
-                                const float* __restrict matrices2,
-                                const float* __restrict scaleFactors) {
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcStatesPartialsFixedScaling(
-									   destP,
-									   states1,
-									   matrices1,
-									   partials2,
-									   matrices2,
-									   scaleFactors);
+                                const unsigned char* states_q,
+                                const float* __restrict matrices_q,
+                                const float* __restrict partials_r,
+                                const float* __restrict matrices_r,
+                                const float* __restrict scaleFactors,
+                                int category,
+                                int startPattern,
+                                int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k++) {
+        const V_Float scaleFactor = VEC_SPLAT_FLOAT(scaleFactors[k]);
+
+        V_Float vp = VEC_LOAD_FLOAT(partials_r + v);
+        V_Float destr;
+        SSE_MATRIX_PARTIALS_FLOAT(destr, vm_r, vp);
+
+        VEC_STORE_FLOAT(destP + v, VEC_DIV_FLOAT(VEC_MULT_FLOAT(vm_q[BEAGLE_CPU_PACKED_TIP_STATE(states_q, k)], destr), scaleFactor));
+        v += 4;
+    }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
-                                const int* states_q,
+                                const unsigned char* states_q,
                                 const double* __restrict matrices_q,
                                 const double* __restrict partials_r,
                                 const double* __restrict matrices_r,
-                                const double* __restrict scaleFactors) {
+                                const double* __restrict scaleFactors,
+                                int category,
+                                int startPattern,
+                                int endPattern) {
 
 
-    int v = 0;
-    int w = 0;
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
  	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
+	V_Real *destPvec = (V_Real *)(destP + v);
 	V_Real destr_01, destr_23;
 
-    for (int l = 0; l < kCategoryCount; l++) {
-
-    	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
-        	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
+    	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
 
-            const int state_q = states_q[k];
-            V_Real vp0, vp1, vp2, vp3;
-            SSE_PREFETCH_PARTIALS(vp,partials_r,v);
+        const int state_q = BEAGLE_CPU_PACKED_TIP_STATE(states_q, k);
+        V_Real vp0, vp1, vp2, vp3;
+        SSE_PREFETCH_PARTIALS(vp,partials_r,v);
 
-			destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
+		destr_01 = VEC_MULT(vp0, vu_mr[0][0].vx);
+		destr_01 = VEC_MADD(vp1, vu_mr[1][0].vx, destr_01);
+		destr_01 = VEC_MADD(vp2, vu_mr[2][0].vx, destr_01);
+		destr_01 = VEC_MADD(vp3, vu_mr[3][0].vx, destr_01);
+		destr_23 = VEC_MULT(vp0, vu_mr[0][1].vx);
+		destr_23 = VEC_MADD(vp1, vu_mr[1][1].vx, destr_23);
+		destr_23 = VEC_MADD(vp2, vu_mr[2][1].vx, destr_23);
+		destr_23 = VEC_MADD(vp3, vu_mr[3][1].vx, destr_23);
 
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
-            *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
+        *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][0].vx, destr_01), scaleFactor);
+        *destPvec++ = VEC_DIV(VEC_MULT(vu_mq[state_q][1].vx, destr_23), scaleFactor);
 
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+        v += 4;
     }
 }
 
@@ -287,13 +323,35 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartials(float*
                                                   const float*  partials_q,
                                                   const float*  matrices_q,
                                                   const float*  partials_r,
-                                                  const float*  matrices_r) {
+                                                  const float*  matrices_r,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	/* Load transition-probability matrices into vectors */
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k++) {
+
+#           if 1 && !defined(_WIN32)
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+        V_Float vpq = VEC_LOAD_FLOAT(partials_q + v);
+        V_Float vpr = VEC_LOAD_FLOAT(partials_r + v);
+        V_Float destq, destr;
+        SSE_MATRIX_PARTIALS_FLOAT(destq, vm_q, vpq);
+        SSE_MATRIX_PARTIALS_FLOAT(destr, vm_r, vpr);
 
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartials(destP,
-                                                  partials_q,
-                                                  matrices_q,
-                                                  partials_r,
-                                                  matrices_r);
+        VEC_STORE_FLOAT(destP + v, VEC_MULT_FLOAT(destq, destr));
+        v += 4;
+    }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -301,123 +359,140 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartials(doubl
                                                   const double*  partials_q,
                                                   const double*  matrices_q,
                                                   const double*  partials_r,
-                                                  const double*  matrices_r) {
+                                                  const double*  matrices_r,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern) {
 
-    int v = 0;
-    int w = 0;
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
     V_Real	destq_01, destq_23, destr_01, destr_23;
  	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
+	V_Real *destPvec = (V_Real *)(destP + v);
 
-    for (int l = 0; l < kCategoryCount; l++) {
+	/* Load transition-probability matrices into vectors */
+	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-		/* Load transition-probability matrices into vectors */
-    	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
-
-        for (int k = 0; k < kPatternCount; k++) {
-            
+    for (int k = startPattern; k < endPattern; k++) {
+        
 #           if 1 && !defined(_WIN32)
-            __builtin_prefetch (&partials_q[v+64]);
-            __builtin_prefetch (&partials_r[v+64]);
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
 //            __builtin_prefetch (destPvec+32,1,0);
 #           endif
 
-        	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
-        	SSE_PREFETCH_PARTIALS(vpq_,partials_q,v);
+    	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
+    	SSE_PREFETCH_PARTIALS(vpq_,partials_q,v);
 
-        	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
-        	SSE_PREFETCH_PARTIALS(vpr_,partials_r,v);
+    	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
+    	SSE_PREFETCH_PARTIALS(vpr_,partials_r,v);
 
 #			if 1	/* This would probably be faster on PPC/Altivec, which has a fused multiply-add
-			           vector instruction */
-
-			destq_01 = VEC_MULT(vpq_0, vu_mq[0][0].vx);
-			destq_01 = VEC_MADD(vpq_1, vu_mq[1][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_2, vu_mq[2][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_3, vu_mq[3][0].vx, destq_01);
-			destq_23 = VEC_MULT(vpq_0, vu_mq[0][1].vx);
-			destq_23 = VEC_MADD(vpq_1, vu_mq[1][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_2, vu_mq[2][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_3, vu_mq[3][1].vx, destq_23);
-
-			destr_01 = VEC_MULT(vpr_0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vpr_1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vpr_0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vpr_1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_3, vu_mr[3][1].vx, destr_23);
+		           vector instruction */
+
+		destq_01 = VEC_MULT(vpq_0, vu_mq[0][0].vx);
+		destq_01 = VEC_MADD(vpq_1, vu_mq[1][0].vx, destq_01);
+		destq_01 = VEC_MADD(vpq_2, vu_mq[2][0].vx, destq_01);
+		destq_01 = VEC_MADD(vpq_3, vu_mq[3][0].vx, destq_01);
+		destq_23 = VEC_MULT(vpq_0, vu_mq[0][1].vx);
+		destq_23 = VEC_MADD(vpq_1, vu_mq[1][1].vx, destq_23);
+		destq_23 = VEC_MADD(vpq_2, vu_mq[2][1].vx, destq_23);
+		destq_23 = VEC_MADD(vpq_3, vu_mq[3][1].vx, destq_23);
+
+		destr_01 = VEC_MULT(vpr_0, vu_mr[0][0].vx);
+		destr_01 = VEC_MADD(vpr_1, vu_mr[1][0].vx, destr_01);
+		destr_01 = VEC_MADD(vpr_2, vu_mr[2][0].vx, destr_01);
+		destr_01 = VEC_MADD(vpr_3, vu_mr[3][0].vx, destr_01);
+		destr_23 = VEC_MULT(vpr_0, vu_mr[0][1].vx);
+		destr_23 = VEC_MADD(vpr_1, vu_mr[1][1].vx, destr_23);
+		destr_23 = VEC_MADD(vpr_2, vu_mr[2][1].vx, destr_23);
+		destr_23 = VEC_MADD(vpr_3, vu_mr[3][1].vx, destr_23);
 
 #			else	/* SSE doesn't have a fused multiply-add, so a slight speed gain should be
-                       achieved by decoupling these operations to avoid dependency stalls */
-
-			V_Real a, b, c, d;
-
-			a = VEC_MULT(vpq_0, vu_mq[0][0].vx);
-			b = VEC_MULT(vpq_2, vu_mq[2][0].vx);
-			c = VEC_MULT(vpq_0, vu_mq[0][1].vx);
-			d = VEC_MULT(vpq_2, vu_mq[2][1].vx);
-			a = VEC_MADD(vpq_1, vu_mq[1][0].vx, a);
-			b = VEC_MADD(vpq_3, vu_mq[3][0].vx, b);
-			c = VEC_MADD(vpq_1, vu_mq[1][1].vx, c);
-			d = VEC_MADD(vpq_3, vu_mq[3][1].vx, d);
-			destq_01 = VEC_ADD(a, b);
-			destq_23 = VEC_ADD(c, d);
-
-			a = VEC_MULT(vpr_0, vu_mr[0][0].vx);
-			b = VEC_MULT(vpr_2, vu_mr[2][0].vx);
-			c = VEC_MULT(vpr_0, vu_mr[0][1].vx);
-			d = VEC_MULT(vpr_2, vu_mr[2][1].vx);
-			a = VEC_MADD(vpr_1, vu_mr[1][0].vx, a);
-			b = VEC_MADD(vpr_3, vu_mr[3][0].vx, b);
-			c = VEC_MADD(vpr_1, vu_mr[1][1].vx, c);
-			d = VEC_MADD(vpr_3, vu_mr[3][1].vx, d);
-			destr_01 = VEC_ADD(a, b);
-			destr_23 = VEC_ADD(c, d);
+                   achieved by decoupling these operations to avoid dependency stalls */
+
+		V_Real a, b, c, d;
+
+		a = VEC_MULT(vpq_0, vu_mq[0][0].vx);
+		b = VEC_MULT(vpq_2, vu_mq[2][0].vx);
+		c = VEC_MULT(vpq_0, vu_mq[0][1].vx);
+		d = VEC_MULT(vpq_2, vu_mq[2][1].vx);
+		a = VEC_MADD(vpq_1, vu_mq[1][0].vx, a);
+		b = VEC_MADD(vpq_3, vu_mq[3][0].vx, b);
+		c = VEC_MADD(vpq_1, vu_mq[1][1].vx, c);
+		d = VEC_MADD(vpq_3, vu_mq[3][1].vx, d);
+		destq_01 = VEC_ADD(a, b);
+		destq_23 = VEC_ADD(c, d);
+
+		a = VEC_MULT(vpr_0, vu_mr[0][0].vx);
+		b = VEC_MULT(vpr_2, vu_mr[2][0].vx);
+		c = VEC_MULT(vpr_0, vu_mr[0][1].vx);
+		d = VEC_MULT(vpr_2, vu_mr[2][1].vx);
+		a = VEC_MADD(vpr_1, vu_mr[1][0].vx, a);
+		b = VEC_MADD(vpr_3, vu_mr[3][0].vx, b);
+		c = VEC_MADD(vpr_1, vu_mr[1][1].vx, c);
+		d = VEC_MADD(vpr_3, vu_mr[3][1].vx, d);
+		destr_01 = VEC_ADD(a, b);
+		destr_23 = VEC_ADD(c, d);
 
 #			endif
 
 #			if 1//
-            destPvec[0] = VEC_MULT(destq_01, destr_01);
-            destPvec[1] = VEC_MULT(destq_23, destr_23);
-            destPvec += 2;
+        destPvec[0] = VEC_MULT(destq_01, destr_01);
+        destPvec[1] = VEC_MULT(destq_23, destr_23);
+        destPvec += 2;
 
 #			else	/* VEC_STORE did demonstrate a measurable performance gain as
-					   it copies all (2/4) values to memory simultaneously;
-					   I can no longer reproduce the performance gain (?) */
+				   it copies all (2/4) values to memory simultaneously;
+				   I can no longer reproduce the performance gain (?) */
 
-			VEC_STORE(destP + v + 0,VEC_MULT(destq_01, destr_01));
-			VEC_STORE(destP + v + 2,VEC_MULT(destq_23, destr_23));
+		VEC_STORE(destP + v + 0,VEC_MULT(destq_01, destr_01));
+		VEC_STORE(destP + v + 2,VEC_MULT(destq_23, destr_23));
 
 #			endif
 
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+        v += 4;
     }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartialsFixedScaling(float* destP,
-                                        const float*  child0Partials,
-                                        const float*  child0TransMat,
-                                        const float*  child1Partials,
-                                        const float*  child1TransMat,
-                                        const float*  scaleFactors) {
-
-	BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartialsFixedScaling(
-			destP,
-			child0Partials,
-			child0TransMat,
-			child1Partials,
-			child1TransMat,
-			scaleFactors);
+                                        const float*  partials_q,
+                                        const float*  matrices_q,
+                                        const float*  partials_r,
+                                        const float*  matrices_r,
+                                        const float*  scaleFactors,
+                                        int category,
+                                        int startPattern,
+                                        int endPattern) {
+
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
+
+	/* Load transition-probability matrices into vectors */
+	V_Float vm_q[OFFSET], vm_r[OFFSET];
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_q + w, vm_q);
+	SSE_PREFETCH_MATRIX_FLOAT(matrices_r + w, vm_r);
+
+    for (int k = startPattern; k < endPattern; k++) {
+
+#           if 1 && !defined(_WIN32)
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
+#           endif
+
+        const V_Float scaleFactor = VEC_SPLAT_FLOAT(scaleFactors[k]);
+
+        V_Float vpq = VEC_LOAD_FLOAT(partials_q + v);
+        V_Float vpr = VEC_LOAD_FLOAT(partials_r + v);
+        V_Float destq, destr;
+        SSE_MATRIX_PARTIALS_FLOAT(destq, vm_q, vpq);
+        SSE_MATRIX_PARTIALS_FLOAT(destr, vm_r, vpr);
+
+        VEC_STORE_FLOAT(destP + v, VEC_DIV_FLOAT(VEC_MULT_FLOAT(destq, destr), scaleFactor));
+        v += 4;
+    }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -426,69 +501,64 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsFixedS
 		                                                        const double* matrices_q,
 		                                                        const double* partials_r,
 		                                                        const double* matrices_r,
-		                                                        const double* scaleFactors) {
+		                                                        const double* scaleFactors,
+		                                                        int category,
+		                                                        int startPattern,
+		                                                        int endPattern) {
 
-    int v = 0;
-    int w = 0;
+    int v = category*4*kPaddedPatternCount + 4*startPattern;
+    int w = category*4*OFFSET;
 
     V_Real	destq_01, destq_23, destr_01, destr_23;
  	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
-	V_Real *destPvec = (V_Real *)destP;
-
-	for (int l = 0; l < kCategoryCount; l++) {
+	V_Real *destPvec = (V_Real *)(destP + v);
 
-		/* Load transition-probability matrices into vectors */
-    	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
+	/* Load transition-probability matrices into vectors */
+	SSE_PREFETCH_MATRICES(matrices_q + w, matrices_r + w, vu_mq, vu_mr);
 
-        for (int k = 0; k < kPatternCount; k++) {
+    for (int k = startPattern; k < endPattern; k++) {
 
 #           if 1 && !defined(_WIN32)
-            __builtin_prefetch (&partials_q[v+64]);
-            __builtin_prefetch (&partials_r[v+64]);
-            //            __builtin_prefetch (destPvec+32,1,0);
+        __builtin_prefetch (&partials_q[v+64]);
+        __builtin_prefetch (&partials_r[v+64]);
+        //            __builtin_prefetch (destPvec+32,1,0);
 #           endif
-            
-            // Prefetch scale factor
+        
+        // Prefetch scale factor
 //            const V_Real scaleFactor = VEC_LOAD_SCALAR(scaleFactors + k);
-        	// Option below appears faster, why?
-        	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
-
-        	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
-        	SSE_PREFETCH_PARTIALS(vpq_,partials_q,v);
-
-        	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
-        	SSE_PREFETCH_PARTIALS(vpr_,partials_r,v);
-
-        	// TODO Make below into macro since this repeats from other calcPPs
-			destq_01 = VEC_MULT(vpq_0, vu_mq[0][0].vx);
-			destq_01 = VEC_MADD(vpq_1, vu_mq[1][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_2, vu_mq[2][0].vx, destq_01);
-			destq_01 = VEC_MADD(vpq_3, vu_mq[3][0].vx, destq_01);
-			destq_23 = VEC_MULT(vpq_0, vu_mq[0][1].vx);
-			destq_23 = VEC_MADD(vpq_1, vu_mq[1][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_2, vu_mq[2][1].vx, destq_23);
-			destq_23 = VEC_MADD(vpq_3, vu_mq[3][1].vx, destq_23);
-
-			destr_01 = VEC_MULT(vpr_0, vu_mr[0][0].vx);
-			destr_01 = VEC_MADD(vpr_1, vu_mr[1][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_2, vu_mr[2][0].vx, destr_01);
-			destr_01 = VEC_MADD(vpr_3, vu_mr[3][0].vx, destr_01);
-			destr_23 = VEC_MULT(vpr_0, vu_mr[0][1].vx);
-			destr_23 = VEC_MADD(vpr_1, vu_mr[1][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_2, vu_mr[2][1].vx, destr_23);
-			destr_23 = VEC_MADD(vpr_3, vu_mr[3][1].vx, destr_23);
-
-            destPvec[0] = VEC_DIV(VEC_MULT(destq_01, destr_01), scaleFactor);
-            destPvec[1] = VEC_DIV(VEC_MULT(destq_23, destr_23), scaleFactor);
-
-            destPvec += 2;
-            v += 4;
-        }
-        w += OFFSET*4;
-        if (kExtraPatterns) {
-        	destPvec += kExtraPatterns * 2;
-        	v += kExtraPatterns * 4;
-        }
+    	// Option below appears faster, why?
+    	const V_Real scaleFactor = VEC_SPLAT(scaleFactors[k]);
+
+    	V_Real vpq_0, vpq_1, vpq_2, vpq_3;
+    	SSE_PREFETCH_PARTIALS(vpq_,partials_q,v);
+
+    	V_Real vpr_0, vpr_1, vpr_2, vpr_3;
+    	SSE_PREFETCH_PARTIALS(vpr_,partials_r,v);
+
+    	// TODO Make below into macro since this repeats from other calcPPs
+		destq_01 = VEC_MULT(vpq_0, vu_mq[0][0].vx);
+		destq_01 = VEC_MADD(vpq_1, vu_mq[1][0].vx, destq_01);
+		destq_01 = VEC_MADD(vpq_2, vu_mq[2][0].vx, destq_01);
+		destq_01 = VEC_MADD(vpq_3, vu_mq[3][0].vx, destq_01);
+		destq_23 = VEC_MULT(vpq_0, vu_mq[0][1].vx);
+		destq_23 = VEC_MADD(vpq_1, vu_mq[1][1].vx, destq_23);
+		destq_23 = VEC_MADD(vpq_2, vu_mq[2][1].vx, destq_23);
+		destq_23 = VEC_MADD(vpq_3, vu_mq[3][1].vx, destq_23);
+
+		destr_01 = VEC_MULT(vpr_0, vu_mr[0][0].vx);
+		destr_01 = VEC_MADD(vpr_1, vu_mr[1][0].vx, destr_01);
+		destr_01 = VEC_MADD(vpr_2, vu_mr[2][0].vx, destr_01);
+		destr_01 = VEC_MADD(vpr_3, vu_mr[3][0].vx, destr_01);
+		destr_23 = VEC_MULT(vpr_0, vu_mr[0][1].vx);
+		destr_23 = VEC_MADD(vpr_1, vu_mr[1][1].vx, destr_23);
+		destr_23 = VEC_MADD(vpr_2, vu_mr[2][1].vx, destr_23);
+		destr_23 = VEC_MADD(vpr_3, vu_mr[3][1].vx, destr_23);
+
+        destPvec[0] = VEC_DIV(VEC_MULT(destq_01, destr_01), scaleFactor);
+        destPvec[1] = VEC_DIV(VEC_MULT(destq_23, destr_23), scaleFactor);
+
+        destPvec += 2;
+        v += 4;
     }
 }
 
@@ -499,13 +569,22 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartialsAutoSca
                                                          const float*  matrices_q,
                                                          const float*  partials_r,
                                                          const float*  matrices_r,
-                                                                 int* activateScaling) {
-    BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcPartialsPartialsAutoScaling(destP,
-                                                     partials_q,
-                                                     matrices_q,
-                                                     partials_r,
-                                                     matrices_r,
-                                                     activateScaling);
+                                                                 int* activateScaling,
+                                                                 int category,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+
+    calcPartialsPartials(destP, partials_q, matrices_q, partials_r, matrices_r,
+                         category, startPattern, endPattern);
+
+    const int u = category*4*kPaddedPatternCount + 4*startPattern;
+    const int uEnd = u + 4*(endPattern - startPattern);
+    for (int v = u; v < uEnd && *activateScaling == 0; v++) {
+        int expTmp;
+        frexp(destP[v], &expTmp);
+        if (abs(expTmp) > scalingExponentThreshhold)
+            *activateScaling = 1;
+    }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -514,14 +593,18 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsAutoSc
                                                                     const double*  matrices_q,
                                                                     const double*  partials_r,
                                                                     const double*  matrices_r,
-                                                                    int* activateScaling) {
+                                                                    int* activateScaling,
+                                                                    int category,
+                                                                    int startPattern,
+                                                                    int endPattern) {
     // TODO: implement calcPartialsPartialsAutoScaling with SSE
     BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcPartialsPartialsAutoScaling(destP,
                                                                 partials_q,
                                                                 matrices_q,
                                                                 partials_r,
                                                                 matrices_r,
-                                                                activateScaling);
+                                                                activateScaling,
+                                                                category, startPattern, endPattern);
 }
     
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -532,14 +615,175 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoods(const
                                                           const int stateFrequenciesIndex,
                                                           const int scalingFactorsIndex,
                                                           double* outSumLogLikelihood) {
-    return BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoods(
-                                                              parIndex,
-                                                              childIndex,
-                                                              probIndex,
-                                                              categoryWeightsIndex,
-                                                              stateFrequenciesIndex,
-                                                              scalingFactorsIndex,
-                                                              outSumLogLikelihood);
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) // Integrated in double by the base class
+        return BeagleCPU4StateImpl<BEAGLE_CPU_4_SSE_FLOAT>::calcEdgeLogLikelihoods(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                                                                                   stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    assert(parIndex >= kTipCount);
+
+    const float* cl_r = gPartials[parIndex];
+    float* cl_p = integrationTmp;
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = gTipStates[childIndex];
+
+        int v = 0;
+        int w = 0;
+        for(int l = 0; l < kCategoryCount; l++) {
+
+            V_Float vm[OFFSET];
+            SSE_PREFETCH_MATRIX_FLOAT(transMatrix + w, vm);
+            const V_Float vwt = VEC_SPLAT_FLOAT(wt[l]);
+
+            for(int k = 0; k < kPatternCount; k++) {
+                V_Float wtdPartials = VEC_MULT_FLOAT(VEC_LOAD_FLOAT(cl_r + v), vwt);
+                VEC_STORE_FLOAT(cl_p + 4*k,
+                        VEC_MADD_FLOAT(vm[BEAGLE_CPU_PACKED_TIP_STATE(statesChild, k)], wtdPartials, VEC_LOAD_FLOAT(cl_p + 4*k)));
+                v += 4;
+            }
+            w += OFFSET*4;
+            v += 4 * kExtraPatterns;
+        }
+    } else { // Integrate against a partial at the child
+
+        const float* cl_q = gPartials[childIndex];
+        int v = 0;
+        int w = 0;
+
+        for(int l = 0; l < kCategoryCount; l++) {
+
+            V_Float vm[OFFSET];
+            SSE_PREFETCH_MATRIX_FLOAT(transMatrix + w, vm);
+            const V_Float vwt = VEC_SPLAT_FLOAT(wt[l]);
+
+            for(int k = 0; k < kPatternCount; k++) {
+                V_Float vcl_q = VEC_LOAD_FLOAT(cl_q + v);
+                V_Float vclp;
+                SSE_MATRIX_PARTIALS_FLOAT(vclp, vm, vcl_q);
+                vclp = VEC_MULT_FLOAT(vclp, vwt);
+
+                VEC_STORE_FLOAT(cl_p + 4*k,
+                        VEC_MADD_FLOAT(vclp, VEC_LOAD_FLOAT(cl_r + v), VEC_LOAD_FLOAT(cl_p + 4*k)));
+                v += 4;
+            }
+            w += 4*OFFSET;
+            v += 4 * kExtraPatterns;
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        float sumOverI = 0.0;
+        for(int i = 0; i < kStateCount; i++) {
+            sumOverI += freqs[i] * cl_p[u];
+            u++;
+        }
+
+        outLogLikelihoodsTmp[k] = log(sumOverI);
+    }
+
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+/*
+ * Site likelihoods with double-precision sums: each pattern's single-precision
+ * partials are widened to two pairs of doubles before they are combined.
+ */
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::integrateSiteLikelihoodsMixed(const LikelihoodSubset& subset,
+                                                                                   double* outSiteLikelihoods,
+                                                                                   int startPattern,
+                                                                                   int endPattern) {
+    const float* partialsParent = subset.partialsParent;
+    const float* transMatrix = subset.transMatrix;
+    const float* wt = subset.wt;
+    const int categoryStride = kPaddedPatternCount * 4;
+
+    const V_Real freq01 = _mm_setr_pd(subset.freqs[0], subset.freqs[1]);
+    const V_Real freq23 = _mm_setr_pd(subset.freqs[2], subset.freqs[3]);
+
+    // Column j of each category's matrix in double: states 0 and 1 then 2 and 3
+    std::vector<double> columns;
+    if (transMatrix != NULL) {
+        columns.resize(kCategoryCount * OFFSET * 4);
+        for (int l = 0; l < kCategoryCount; l++)
+            for (int j = 0; j < OFFSET; j++)
+                for (int i = 0; i < 4; i++)
+                    columns[(l * OFFSET + j) * 4 + i] = transMatrix[l * OFFSET * 4 + i * OFFSET + j];
+    }
+
+    for (int k = startPattern; k < endPattern; k++) {
+        V_Real sum01 = VEC_SETZERO();
+        V_Real sum23 = VEC_SETZERO();
+        int v = k * 4;
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            const V_Float p = VEC_LOAD_FLOAT(partialsParent + v);
+            V_Real p01 = _mm_cvtps_pd(p);
+            V_Real p23 = _mm_cvtps_pd(_mm_movehl_ps(p, p));
+
+            if (transMatrix != NULL) {
+                const double* col = &columns[l * OFFSET * 4];
+                V_Real m01, m23;
+                if (subset.statesChild != NULL) { // Column of the state at the child
+                    const int stateChild = BEAGLE_CPU_PACKED_TIP_STATE(subset.statesChild, k);
+                    m01 = _mm_loadu_pd(col + stateChild * 4);
+                    m23 = _mm_loadu_pd(col + stateChild * 4 + 2);
+                } else { // Matrix times the partials at the child
+                    const V_Float q = VEC_LOAD_FLOAT(subset.partialsChild + v);
+                    const V_Real q01 = _mm_cvtps_pd(q);
+                    const V_Real q23 = _mm_cvtps_pd(_mm_movehl_ps(q, q));
+                    V_Real qj = _mm_unpacklo_pd(q01, q01);
+                    m01 = VEC_MULT(_mm_loadu_pd(col + 0), qj);
+                    m23 = VEC_MULT(_mm_loadu_pd(col + 2), qj);
+                    qj = _mm_unpackhi_pd(q01, q01);
+                    m01 = VEC_MADD(_mm_loadu_pd(col + 4), qj, m01);
+                    m23 = VEC_MADD(_mm_loadu_pd(col + 6), qj, m23);
+                    qj = _mm_unpacklo_pd(q23, q23);
+                    m01 = VEC_MADD(_mm_loadu_pd(col + 8), qj, m01);
+                    m23 = VEC_MADD(_mm_loadu_pd(col + 10), qj, m23);
+                    qj = _mm_unpackhi_pd(q23, q23);
+                    m01 = VEC_MADD(_mm_loadu_pd(col + 12), qj, m01);
+                    m23 = VEC_MADD(_mm_loadu_pd(col + 14), qj, m23);
+                }
+                p01 = VEC_MULT(p01, m01);
+                p23 = VEC_MULT(p23, m23);
+            }
+
+            const V_Real vwt = VEC_SPLAT((double) wt[l]);
+            sum01 = VEC_MADD(p01, vwt, sum01);
+            sum23 = VEC_MADD(p23, vwt, sum23);
+            v += categoryStride;
+        }
+
+        const V_Real sum = VEC_ADD(VEC_MULT(sum01, freq01), VEC_MULT(sum23, freq23));
+        outSiteLikelihoods[k] = _mm_cvtsd_f64(sum) + _mm_cvtsd_f64(_mm_unpackhi_pd(sum, sum));
+    }
 }
 
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -566,7 +810,7 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const unsigned char* statesChild = gTipStates[childIndex];
 
         int w = 0;
         V_Real *vcl_r = (V_Real *)cl_r;
@@ -579,7 +823,7 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
 
            for(int k = 0; k < kPatternCount; k++) {
 
-                const int stateChild = statesChild[k];
+                const int stateChild = BEAGLE_CPU_PACKED_TIP_STATE(statesChild, k);
                 V_Real vwt = VEC_SPLAT(wt[l]);
 
                 V_Real wtdPartials = VEC_MULT(*vcl_r++, vwt);
@@ -667,6 +911,67 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
 }
 
 
+BEAGLE_CPU_4_SSE_TEMPLATE
+inline double BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::maxPatternPartials(const double* destP,
+                                                                                  int k) {
+    const double* patternP = destP + 4*k;
+    V_Real max01 = VEC_SETZERO();
+    V_Real max23 = VEC_SETZERO();
+    for (int l = 0; l < kCategoryCount; l++) {
+        max01 = VEC_MAX(VEC_LOAD(patternP), max01);
+        max23 = VEC_MAX(VEC_LOAD(patternP + 2), max23);
+        patternP += 4*kPaddedPatternCount;
+    }
+    V_Real max = VEC_MAX(max01, max23);
+    max = VEC_MAX(VEC_SWAP(max), max);
+    return _mm_cvtsd_f64(max);
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+inline void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::scalePatternPartials(double* destP,
+                                                                                  int k,
+                                                                                  double scale) {
+    double* patternP = destP + 4*k;
+    const V_Real vscale = VEC_SPLAT(scale);
+    for (int l = 0; l < kCategoryCount; l++) {
+        VEC_STORE(patternP, VEC_MULT(VEC_LOAD(patternP), vscale));
+        VEC_STORE(patternP + 2, VEC_MULT(VEC_LOAD(patternP + 2), vscale));
+        patternP += 4*kPaddedPatternCount;
+    }
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::rescalePartials(double* destP,
+                                                                      double* scaleFactors,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+    const bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double max = maxPatternPartials(destP, k);
+        if (max == 0)
+            max = 1.0;
+
+        scalePatternPartials(destP, k, 1.0 / max);
+        scaleFactors[k] = (useLogScalars ? log(max) : max);
+    }
+}
+
+BEAGLE_CPU_4_SSE_TEMPLATE
+void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::autoRescalePartials(double* destP,
+                                                                          signed short* scaleFactors,
+                                                                          int startPattern,
+                                                                          int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
+        int expMax;
+        frexp(maxPatternPartials(destP, k), &expMax);
+        scaleFactors[k] = expMax;
+
+        if (expMax != 0)
+            scalePatternPartials(destP, k, ldexp(1.0, -expMax));
+    }
+}
+
 BEAGLE_CPU_4_SSE_TEMPLATE
 int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
@@ -694,7 +999,7 @@ const char* BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::getName() {
 BEAGLE_CPU_4_SSE_TEMPLATE
 const long BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::getFlags() {
 	return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_SINGLE |
             BEAGLE_FLAG_VECTOR_SSE |
@@ -704,7 +1009,7 @@ const long BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::getFlags() {
 BEAGLE_CPU_4_SSE_TEMPLATE
 const long BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::getFlags() {
     return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_DOUBLE |
             BEAGLE_FLAG_VECTOR_SSE |
@@ -771,9 +1076,9 @@ const char* BeagleCPU4StateSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName()
 
 template <>
 const long BeagleCPU4StateSSEImplFactory<double>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -785,12 +1090,12 @@ const long BeagleCPU4StateSSEImplFactory<double>::getFlags() {
 
 template <>
 const long BeagleCPU4StateSSEImplFactory<float>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
-           BEAGLE_FLAG_PRECISION_SINGLE |
+           BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_MIXED |
            BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
            BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
            BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
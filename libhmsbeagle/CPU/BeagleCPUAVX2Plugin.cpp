@@ -0,0 +1,59 @@
+/**
+ * libhmsbeagle plugin system
+ * @author Aaron E. Darling
+ * Based on code found in "Dynamic Plugins for C++" by Arthur J. Musgrove
+ * and published in Dr. Dobbs Journal, July 1, 2004.
+ *
+ * The AVX2 plugin compiles the AVX kernels with BEAGLE_CPU_AVX_FMA defined,
+ * so that every multiply-add is a fused multiply-add.
+ */
+
+#include "libhmsbeagle/CPU/BeagleCPUAVX2Plugin.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateAVXImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUAVXImpl.h"
+#include <iostream>
+
+namespace beagle {
+namespace cpu {
+
+
+BeagleCPUAVX2Plugin::BeagleCPUAVX2Plugin() :
+Plugin("CPU-AVX2", "CPU-AVX2")
+{
+	BeagleResource resource;
+        resource.name = (char*) "CPU";
+        resource.description = (char*) "";
+        resource.supportFlags = BEAGLE_FLAG_COMPUTATION_SYNCH |
+                                         BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
+                                         BEAGLE_FLAG_THREADING_NONE |
+                                         BEAGLE_FLAG_PROCESSOR_CPU |
+                                         BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_PRECISION_MIXED |
+                                         BEAGLE_FLAG_VECTOR_NONE |
+                                         BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+                                         BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
+                                         BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+                                         BEAGLE_FLAG_FRAMEWORK_CPU;
+        resource.supportFlags |= BEAGLE_FLAG_VECTOR_AVX;
+        resource.requiredFlags = BEAGLE_FLAG_FRAMEWORK_CPU;
+	beagleResources.push_back(resource);
+
+  beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateAVXImplFactory<double>());
+  beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateAVXImplFactory<float>());
+
+  beagleFactories.push_back(new beagle::cpu::BeagleCPUAVXImplFactory<double>());
+  beagleFactories.push_back(new beagle::cpu::BeagleCPUAVXImplFactory<float>());
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+
+extern "C" {
+
+void* plugin_init(void){
+	if(!CPUSupportsAVX()){
+		return NULL;	// requires AVX2 and FMA
+	}
+	return new beagle::cpu::BeagleCPUAVX2Plugin();
+}
+}
@@ -0,0 +1,181 @@
+/*
+ *  BeagleCPUAVX512Impl.h
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUAVX512Impl__
+#define __BeagleCPUAVX512Impl__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+
+#include <vector>
+
+#define RESTRICT __restrict		/* may need to define this instead to 'restrict' */
+
+// Masked loads cover any state count, so the rows only need the extra 1.0
+#define T_PAD_AVX512_DEFAULT  1
+#define P_PAD_AVX512_DEFAULT  0
+
+#define BEAGLE_CPU_AVX512_DOUBLE	double, T_PAD, P_PAD
+#define BEAGLE_CPU_AVX512_TEMPLATE	template <int T_PAD, int P_PAD>
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_TEMPLATE
+class BeagleCPUAVX512Impl : public BeagleCPUImpl<BEAGLE_CPU_GENERIC> { };
+
+BEAGLE_CPU_AVX512_TEMPLATE
+class BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE> : public BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE> {
+
+protected:
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kTipCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gPartials;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::integrationTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gTransitionMatrices;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kPaddedPatternCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gTipStates;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kCategoryCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kFlags;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gScaleBuffers;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gCategoryWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gStateFrequencies;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kMatrixSize;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::kPartialsPaddedStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::gPatternWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX512_DOUBLE>::scalingExponentThreshhold;
+
+public:
+    virtual const char* getName();
+
+    virtual const long getFlags();
+
+protected:
+    virtual void rescalePartials(double* destP,
+                                 double* scaleFactors,
+                                 int startPattern,
+                                 int endPattern);
+
+    virtual void autoRescalePartials(double* destP,
+                                     signed short* scaleFactors,
+                                     int startPattern,
+                                     int endPattern);
+
+    virtual bool supportsPatternMajorPartials();
+
+private:
+    virtual void calcPartialsPartials(double* __restrict destP,
+                                      const double* __restrict partials1,
+                                      const double* __restrict matrices1,
+                                      const double* __restrict partials2,
+                                      const double* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
+                                      const double* __restrict partials1,
+                                      const double* __restrict matrices1,
+                                      const double* __restrict partials2,
+                                      const double* __restrict matrices2,
+                                      const double* __restrict scaleFactors,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcPartialsPartialsAutoScaling(double* __restrict destP,
+                                                 const double* __restrict partials1,
+                                                 const double* __restrict matrices1,
+                                                 const double* __restrict partials2,
+                                                 const double* __restrict matrices2,
+                                                 int* activateScaling,
+                                                 int category,
+                                                 int startPattern,
+                                                 int endPattern);
+
+    virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
+                                        const int childBufferIndex,
+                                        const int probabilityIndex,
+                                        const int categoryWeightsIndex,
+                                        const int stateFrequenciesIndex,
+                                        const int scalingFactorsIndex,
+                                        double* outSumLogLikelihood);
+
+    // Sums over the kStateCount states of matrix rows times partials; the
+    // last partial vector uses a masked load so no padding is read
+    inline double innerProduct(const double* __restrict matrix,
+                               const double* __restrict partials);
+
+    inline void innerProducts(const double* __restrict matrix1,
+                              const double* __restrict partials1,
+                              const double* __restrict matrix2,
+                              const double* __restrict partials2,
+                              double& sum1,
+                              double& sum2);
+
+    // Largest partial of pattern k over all categories
+    inline double maxPatternPartials(const double* destP,
+                                     int k);
+
+    // Multiplies the partials of pattern k in every category by scale
+    inline void scalePatternPartials(double* destP,
+                                     int k,
+                                     double scale);
+
+};
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+class BeagleCPUAVX512ImplFactory : public BeagleImplFactory {
+public:
+    virtual BeagleImpl* createImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags,
+                                   int* errorCode);
+
+    virtual const char* getName();
+    virtual const long getFlags();
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+// now include the file containing template function implementations
+#include "libhmsbeagle/CPU/BeagleCPUAVX512Impl.hpp"
+
+
+#endif // __BeagleCPUAVX512Impl__
@@ -0,0 +1,419 @@
+/*
+ *  BeagleCPUAVX512Impl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2013 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BEAGLE_CPU_AVX512_IMPL_HPP
+#define BEAGLE_CPU_AVX512_IMPL_HPP
+
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUAVX512Impl.h"
+#include "libhmsbeagle/CPU/AVX512Definitions.h"
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPUAVX512Name(){ return "CPU-AVX512-Unknown"; };
+
+template<>
+inline const char* getBeagleCPUAVX512Name<double>(){ return "CPU-AVX512-Double"; };
+
+BEAGLE_CPU_AVX512_TEMPLATE
+inline double BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::innerProduct(const double* __restrict matrix,
+                                                                          const double* __restrict partials) {
+    const int stateCountModEight = kStateCount & ~7;
+    V_Real sum_vec = VEC_SETZERO();
+    int j = 0;
+    for (; j < stateCountModEight; j += 8)
+        sum_vec = VEC_MADD(VEC_LOADU(matrix + j), VEC_LOADU(partials + j), sum_vec);
+    if (j < kStateCount) {
+        const __mmask8 tail = VEC_TAIL_MASK(kStateCount - j);
+        sum_vec = VEC_MADD(VEC_LOADU_MASK(tail, matrix + j), VEC_LOADU_MASK(tail, partials + j), sum_vec);
+    }
+    return VEC_REDUCE_ADD(sum_vec);
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+inline void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::innerProducts(const double* __restrict matrix1,
+                                                                         const double* __restrict partials1,
+                                                                         const double* __restrict matrix2,
+                                                                         const double* __restrict partials2,
+                                                                         double& sum1,
+                                                                         double& sum2) {
+    const int stateCountModEight = kStateCount & ~7;
+    V_Real sum1_vec = VEC_SETZERO();
+    V_Real sum2_vec = VEC_SETZERO();
+    int j = 0;
+    for (; j < stateCountModEight; j += 8) {
+        sum1_vec = VEC_MADD(VEC_LOADU(matrix1 + j), VEC_LOADU(partials1 + j), sum1_vec);
+        sum2_vec = VEC_MADD(VEC_LOADU(matrix2 + j), VEC_LOADU(partials2 + j), sum2_vec);
+    }
+    if (j < kStateCount) {
+        const __mmask8 tail = VEC_TAIL_MASK(kStateCount - j);
+        sum1_vec = VEC_MADD(VEC_LOADU_MASK(tail, matrix1 + j), VEC_LOADU_MASK(tail, partials1 + j), sum1_vec);
+        sum2_vec = VEC_MADD(VEC_LOADU_MASK(tail, matrix2 + j), VEC_LOADU_MASK(tail, partials2 + j), sum2_vec);
+    }
+    sum1 = VEC_REDUCE_ADD(sum1_vec);
+    sum2 = VEC_REDUCE_ADD(sum2_vec);
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcPartialsPartials(double* __restrict destP,
+                                              const double* __restrict partials1,
+                                              const double* __restrict matrices1,
+                                              const double* __restrict partials2,
+                                              const double* __restrict matrices2,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            double sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcPartialsPartialsFixedScaling(
+													double* __restrict destP,
+                                              const double* __restrict partials1,
+                                              const double* __restrict matrices1,
+                                              const double* __restrict partials2,
+                                              const double* __restrict matrices2,
+                                              const double* __restrict scaleFactors,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        const double scalar = scaleFactors[k];
+        for (int i = 0; i < kStateCount; i++) {
+            double sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2 / scalar;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcPartialsPartialsAutoScaling(double* destP,
+                                                         const double*  partials_q,
+                                                         const double*  matrices_q,
+                                                         const double*  partials_r,
+                                                         const double*  matrices_r,
+                                                                  int* activateScaling,
+                                                                  int category,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            double sum1, sum2;
+            innerProducts(matrices_q + w, partials_q + v, matrices_r + w, partials_r + v, sum1, sum2);
+            *destPu = sum1 * sum2;
+
+            if (*activateScaling == 0) {
+                int expTmp;
+                frexp(*destPu, &expTmp);
+                if (abs(expTmp) > scalingExponentThreshhold)
+                    *activateScaling = 1;
+            }
+            destPu++;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+int BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::calcEdgeLogLikelihoods(const int parIndex,
+                                                           const int childIndex,
+                                                           const int probIndex,
+                                                           const int categoryWeightsIndex,
+                                                           const int stateFrequenciesIndex,
+                                                           const int scalingFactorsIndex,
+                                                           double* outSumLogLikelihood) {
+    int returnCode = BEAGLE_SUCCESS;
+
+    assert(parIndex >= kTipCount);
+
+    const double* partialsParent = gPartials[parIndex];
+    const double* transMatrix = gTransitionMatrices[probIndex];
+    const double* wt = gCategoryWeights[categoryWeightsIndex];
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(double));
+
+    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = gTipStates[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const double weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                const double* transMatrixPtr = transMatrix + l * kMatrixSize + statesChild[k];
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += transMatrixPtr[0] * partialsParent[v + i] * weight;
+                    transMatrixPtr += kStateCount + T_PAD;
+                    u++;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const double* partialsChild = gPartials[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const double weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                int w = l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += innerProduct(transMatrix + w, partialsChild + v) *
+                                         partialsParent[v + i] * weight;
+                    u++;
+
+                    // increment for the extra column at the end
+                    w += kStateCount + T_PAD;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        outLogLikelihoodsTmp[k] = log(innerProduct(freqs, integrationTmp + u));
+        u += kStateCount;
+    }
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+inline double BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::maxPatternPartials(const double* destP,
+                                                                                int k) {
+    const int stateCountModEight = kStateCount & ~7;
+    const __mmask8 tail = VEC_TAIL_MASK(kStateCount - stateCountModEight);
+    const double* patternP = destP + k*kPartialsPaddedStateCount;
+    V_Real max = VEC_SETZERO();
+    for (int l = 0; l < kCategoryCount; l++) {
+        int i = 0;
+        for (; i < stateCountModEight; i += 8)
+            max = VEC_MAX(VEC_LOADU(patternP + i), max);
+        if (i < kStateCount)
+            max = VEC_MAX(VEC_LOADU_MASK(tail, patternP + i), max);
+        patternP += kPaddedPatternCount*kPartialsPaddedStateCount;
+    }
+    return VEC_REDUCE_MAX(max);
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+inline void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::scalePatternPartials(double* destP,
+                                                                                int k,
+                                                                                double scale) {
+    const int stateCountModEight = kStateCount & ~7;
+    const __mmask8 tail = VEC_TAIL_MASK(kStateCount - stateCountModEight);
+    double* patternP = destP + k*kPartialsPaddedStateCount;
+    const V_Real vscale = VEC_SPLAT(scale);
+    for (int l = 0; l < kCategoryCount; l++) {
+        int i = 0;
+        for (; i < stateCountModEight; i += 8)
+            VEC_STOREU(patternP + i, VEC_MULT(VEC_LOADU(patternP + i), vscale));
+        if (i < kStateCount)
+            VEC_STOREU_MASK(patternP + i, tail, VEC_MULT(VEC_LOADU_MASK(tail, patternP + i), vscale));
+        patternP += kPaddedPatternCount*kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::rescalePartials(double* destP,
+                                                                    double* scaleFactors,
+                                                                    int startPattern,
+                                                                    int endPattern) {
+    const bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double max = maxPatternPartials(destP, k);
+        if (max == 0)
+            max = 1.0;
+
+        scalePatternPartials(destP, k, 1.0 / max);
+        scaleFactors[k] = (useLogScalars ? log(max) : max);
+    }
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+void BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::autoRescalePartials(double* destP,
+                                                                        signed short* scaleFactors,
+                                                                        int startPattern,
+                                                                        int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
+        int expMax;
+        frexp(maxPatternPartials(destP, k), &expMax);
+        scaleFactors[k] = expMax;
+
+        if (expMax != 0)
+            scalePatternPartials(destP, k, ldexp(1.0, -expMax));
+    }
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+bool BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::supportsPatternMajorPartials() {
+    return false;  // Vectorized kernels assume category-major partials
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+const char* BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::getName() {
+    return  getBeagleCPUAVX512Name<double>();
+}
+
+BEAGLE_CPU_AVX512_TEMPLATE
+const long BeagleCPUAVX512Impl<BEAGLE_CPU_AVX512_DOUBLE>::getFlags() {
+    return  BEAGLE_FLAG_COMPUTATION_SYNCH |
+            BEAGLE_CPU_THREADING_FLAG |
+            BEAGLE_FLAG_PROCESSOR_CPU |
+            BEAGLE_FLAG_PRECISION_DOUBLE |
+            BEAGLE_FLAG_VECTOR_AVX;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPUAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    if (!CPUSupportsAVX512())
+        return NULL;
+
+    BeagleCPUAVX512Impl<REALTYPE, T_PAD_AVX512_DEFAULT, P_PAD_AVX512_DEFAULT>* impl =
+            new BeagleCPUAVX512Impl<REALTYPE, T_PAD_AVX512_DEFAULT, P_PAD_AVX512_DEFAULT>();
+
+    try {
+        if (impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,  pluginResourceNumber, preferenceFlags, requirementFlags) == 0)
+            return impl;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPUAVX512ImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+	return getBeagleCPUAVX512Name<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+template <>
+const long BeagleCPUAVX512ImplFactory<double>::getFlags() {
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
+           BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
+           BEAGLE_FLAG_PROCESSOR_CPU |
+           BEAGLE_FLAG_VECTOR_AVX |
+           BEAGLE_FLAG_PRECISION_DOUBLE |
+           BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+           BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
+           BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+           BEAGLE_FLAG_FRAMEWORK_CPU;
+}
+
+}
+}
+
+#endif //BEAGLE_CPU_AVX512_IMPL_HPP
@@ -0,0 +1,55 @@
+/**
+ * libhmsbeagle plugin system
+ * @author Aaron E. Darling
+ * Based on code found in "Dynamic Plugins for C++" by Arthur J. Musgrove
+ * and published in Dr. Dobbs Journal, July 1, 2004.
+ */
+
+#include "libhmsbeagle/CPU/BeagleCPUAVX512Plugin.h"
+#include "libhmsbeagle/CPU/BeagleCPU4StateAVX512Impl.h"
+#include "libhmsbeagle/CPU/BeagleCPUAVX512Impl.h"
+#include <iostream>
+
+namespace beagle {
+namespace cpu {
+
+
+BeagleCPUAVX512Plugin::BeagleCPUAVX512Plugin() :
+Plugin("CPU-AVX512", "CPU-AVX512")
+{
+	BeagleResource resource;
+        resource.name = (char*) "CPU";
+        resource.description = (char*) "";
+        resource.supportFlags = BEAGLE_FLAG_COMPUTATION_SYNCH |
+                                         BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
+                                         BEAGLE_FLAG_THREADING_NONE |
+                                         BEAGLE_FLAG_PROCESSOR_CPU |
+                                         BEAGLE_FLAG_PRECISION_DOUBLE |
+                                         BEAGLE_FLAG_VECTOR_NONE |
+                                         BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+                                         BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
+                                         BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+                                         BEAGLE_FLAG_FRAMEWORK_CPU;
+        resource.supportFlags |= BEAGLE_FLAG_VECTOR_AVX;
+        resource.requiredFlags = BEAGLE_FLAG_FRAMEWORK_CPU;
+	beagleResources.push_back(resource);
+
+	// Double precision only; single precision falls through to the AVX2 plugin
+  beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateAVX512ImplFactory<double>());
+
+  beagleFactories.push_back(new beagle::cpu::BeagleCPUAVX512ImplFactory<double>());
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+
+extern "C" {
+
+void* plugin_init(void){
+	if(!CPUSupportsAVX512()){
+		return NULL;	// requires AVX-512 Foundation
+	}
+	return new beagle::cpu::BeagleCPUAVX512Plugin();
+}
+}
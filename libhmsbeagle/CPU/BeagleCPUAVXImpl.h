@@ -61,6 +61,7 @@ class BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT> : public BeagleCPUImpl<BEAGLE_CPU_A
 
 protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kTipCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kFlags;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gPartials;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::integrationTmp;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gTransitionMatrices;
@@ -76,6 +77,9 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::realtypeMin;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kMatrixSize;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::kPartialsPaddedStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::gPatternWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::scalingExponentThreshhold;
 
 public:
     virtual const char* getName();
@@ -85,38 +89,55 @@ public:
 protected:
     virtual int getPaddedPatternsModulus();
 
+    virtual bool supportsPatternMajorPartials();
+
 private:
 	virtual void calcStatesStates(float* destP,
-                                     const int* states1,
+                                     const unsigned char* states1,
                                      const float* matrices1,
-                                     const int* states2,
-                                     const float* matrices2);
+                                     const unsigned char* states2,
+                                     const float* matrices2,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern);
 
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const float* matrices1,
                                     const float* partials2,
-                                    const float* matrices2);
+                                    const float* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
 
     virtual void calcPartialsPartials(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
-                                      const float* __restrict matrices2);
+                                      const float* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
                                       const float* __restrict matrices2,
-                                      const float* __restrict scaleFactors);
+                                      const float* __restrict scaleFactors,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
 
     virtual void calcPartialsPartialsAutoScaling(float* __restrict destP,
                                                  const float* __restrict partials1,
                                                  const float* __restrict matrices1,
                                                  const float* __restrict partials2,
                                                  const float* __restrict matrices2,
-                                                 int* activateScaling);
+                                                 int* activateScaling,
+                                                 int category,
+                                                 int startPattern,
+                                                 int endPattern);
 
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                         const int childBufferIndex,
@@ -126,6 +147,18 @@ private:
                                         const int scalingFactorsIndex,
                                         double* outSumLogLikelihood);
 
+    // Single-precision counterparts of the double helpers; whole octets use
+    // unaligned AVX loads and the remaining states are summed in a scalar tail
+    inline float innerProduct(const float* __restrict matrix,
+                              const float* __restrict partials);
+
+    inline void innerProducts(const float* __restrict matrix1,
+                              const float* __restrict partials1,
+                              const float* __restrict matrix2,
+                              const float* __restrict partials2,
+                              float& sum1,
+                              float& sum2);
+
 
 };
 
@@ -144,12 +177,16 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kStateCount;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gTipStates;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kCategoryCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kFlags;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gScaleBuffers;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gCategoryWeights;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gStateFrequencies;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::realtypeMin;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kMatrixSize;
 	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::kPartialsPaddedStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::gPatternWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::scalingExponentThreshhold;
 
 public:
     virtual const char* getName();
@@ -159,38 +196,65 @@ public:
 protected:
     virtual int getPaddedPatternsModulus();
 
+    virtual bool supportsPatternMajorPartials();
+
+    virtual void rescalePartials(double* destP,
+                                 double* scaleFactors,
+                                 int startPattern,
+                                 int endPattern);
+
+    virtual void autoRescalePartials(double* destP,
+                                     signed short* scaleFactors,
+                                     int startPattern,
+                                     int endPattern);
+
 private:
 	virtual void calcStatesStates(double* destP,
-                                     const int* states1,
+                                     const unsigned char* states1,
                                      const double* matrices1,
-                                     const int* states2,
-                                     const double* matrices2);
+                                     const unsigned char* states2,
+                                     const double* matrices2,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern);
 
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const double* matrices1,
                                     const double* partials2,
-                                    const double* matrices2);
+                                    const double* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
 
     virtual void calcPartialsPartials(double* __restrict destP,
                                       const double* __restrict partials1,
                                       const double* __restrict matrices1,
                                       const double* __restrict partials2,
-                                      const double* __restrict matrices2);
+                                      const double* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
                                       const double* __restrict partials1,
                                       const double* __restrict matrices1,
                                       const double* __restrict partials2,
                                       const double* __restrict matrices2,
-                                      const double* __restrict scaleFactors);
+                                      const double* __restrict scaleFactors,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
 
     virtual void calcPartialsPartialsAutoScaling(double* __restrict destP,
                                                  const double* __restrict partials1,
                                                  const double* __restrict matrices1,
                                                  const double* __restrict partials2,
                                                  const double* __restrict matrices2,
-                                                 int* activateScaling);
+                                                 int* activateScaling,
+                                                 int category,
+                                                 int startPattern,
+                                                 int endPattern);
 
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                         const int childBufferIndex,
@@ -200,6 +264,27 @@ private:
                                         const int scalingFactorsIndex,
                                         double* outSumLogLikelihood);
 
+    // Sums over the kStateCount states of matrix rows times partials; whole
+    // quads use unaligned AVX loads so no padding is read for any state count
+    inline double innerProduct(const double* __restrict matrix,
+                               const double* __restrict partials);
+
+    inline void innerProducts(const double* __restrict matrix1,
+                              const double* __restrict partials1,
+                              const double* __restrict matrix2,
+                              const double* __restrict partials2,
+                              double& sum1,
+                              double& sum2);
+
+    // Largest partial of pattern k over all categories
+    inline double maxPatternPartials(const double* destP,
+                                     int k);
+
+    // Multiplies the partials of pattern k in every category by scale
+    inline void scalePatternPartials(double* destP,
+                                     int k,
+                                     double scale);
+
 };
     
 BEAGLE_CPU_FACTORY_TEMPLATE
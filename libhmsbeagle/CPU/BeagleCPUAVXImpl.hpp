@@ -46,6 +46,16 @@
 namespace beagle {
 namespace cpu {
 
+#if defined(BEAGLE_CPU_AVX_FMA)
+BEAGLE_CPU_FACTORY_TEMPLATE
+inline const char* getBeagleCPUAVXName(){ return "CPU-AVX2-Unknown"; };
+
+template<>
+inline const char* getBeagleCPUAVXName<double>(){ return "CPU-AVX2-Double"; };
+
+template<>
+inline const char* getBeagleCPUAVXName<float>(){ return "CPU-AVX2-Single"; };
+#else
 BEAGLE_CPU_FACTORY_TEMPLATE
 inline const char* getBeagleCPUAVXName(){ return "CPU-AVX-Unknown"; };
 
@@ -54,6 +64,7 @@ inline const char* getBeagleCPUAVXName<double>(){ return "CPU-AVX-Double"; };
 
 template<>
 inline const char* getBeagleCPUAVXName<float>(){ return "CPU-AVX-Single"; };
+#endif
 
 /*
  * Calculates partial likelihoods at a node when both children have states.
@@ -61,24 +72,28 @@ inline const char* getBeagleCPUAVXName<float>(){ return "CPU-AVX-Single"; };
 
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
+                                     const unsigned char* states_q,
                                      const double* matrices_q,
-                                     const int* states_r,
-                                     const double* matrices_r) {
+                                     const unsigned char* states_r,
+                                     const double* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
 
 	BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(destP,
                                      states_q,
                                      matrices_q,
                                      states_r,
-                                     matrices_r);
+                                     matrices_r,
+                                     category, startPattern, endPattern);
 }
 
 
 //template <>
 //void BeagleCPUAVXImpl<double>::calcStatesStates(double* destP,
-//                                     const int* states_q,
+//                                     const unsigned char* states_q,
 //                                     const double* matrices_q,
-//                                     const int* states_r,
+//                                     const unsigned char* states_r,
 //                                     const double* matrices_r) {
 //
 //	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
@@ -112,23 +127,27 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(double* destP,
  */
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
+                                       const unsigned char* states_q,
                                        const double* matrices_q,
                                        const double* partials_r,
-                                       const double* matrices_r) {
+                                       const double* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
 	BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesPartials(
 									   destP,
 									   states_q,
 									   matrices_q,
 									   partials_r,
-									   matrices_r);
+									   matrices_r,
+									   category, startPattern, endPattern);
 }
 
 //
 //
 //template <>
 //void BeagleCPUAVXImpl<double>::calcStatesPartials(double* destP,
-//                                       const int* states_q,
+//                                       const unsigned char* states_q,
 //                                       const double* matrices_q,
 //                                       const double* partials_r,
 //                                       const double* matrices_r) {
@@ -207,82 +226,73 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesPartials(double* destP,
 
 
 
+static inline double horizontalAdd(V_Real a) {
+    __m256d t1 = _mm256_hadd_pd(a, a);
+    __m128d t2 = _mm256_extractf128_pd(t1, 1);
+    __m128d t3 = _mm_add_sd(_mm256_castpd256_pd128(t1), t2);
+    return _mm_cvtsd_f64(t3);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+inline double BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::innerProduct(const double* __restrict matrix,
+                                                                    const double* __restrict partials) {
+    const int stateCountModFour = kStateCount & ~3;
+    V_Real sum_vec = VEC_SETZERO();
+    int j = 0;
+    for (; j < stateCountModFour; j += 4)
+        sum_vec = VEC_MADD(VEC_LOADU(matrix + j), VEC_LOADU(partials + j), sum_vec);
+    double sum = horizontalAdd(sum_vec);
+    for (; j < kStateCount; j++)
+        sum += matrix[j] * partials[j];
+    return sum;
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+inline void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::innerProducts(const double* __restrict matrix1,
+                                                                   const double* __restrict partials1,
+                                                                   const double* __restrict matrix2,
+                                                                   const double* __restrict partials2,
+                                                                   double& sum1,
+                                                                   double& sum2) {
+    const int stateCountModFour = kStateCount & ~3;
+    V_Real sum1_vec = VEC_SETZERO();
+    V_Real sum2_vec = VEC_SETZERO();
+    int j = 0;
+    for (; j < stateCountModFour; j += 4) {
+        sum1_vec = VEC_MADD(VEC_LOADU(matrix1 + j), VEC_LOADU(partials1 + j), sum1_vec);
+        sum2_vec = VEC_MADD(VEC_LOADU(matrix2 + j), VEC_LOADU(partials2 + j), sum2_vec);
+    }
+    sum1 = horizontalAdd(sum1_vec);
+    sum2 = horizontalAdd(sum2_vec);
+    for (; j < kStateCount; j++) {
+        sum1 += matrix1[j] * partials1[j];
+        sum2 += matrix2[j] * partials2[j];
+    }
+}
+
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartials(double* __restrict destP,
                                               const double* __restrict partials1,
                                               const double* __restrict matrices1,
                                               const double* __restrict partials2,
-                                              const double* __restrict matrices2) {
-    int stateCountMinusOne = kPartialsPaddedStateCount - 1;
-
-    struct IO {
-    	void operator()(V_Real v) {
-    		double x[4];
-    		_mm256_storeu_pd(x, v);
-    		fprintf(stderr,"%5.3e %5.3e %5.3e %5.3e\n",x[0],x[1],x[2],x[3]);
-    	}
-    };
-
-    struct math {
-    	static inline double horizontal_add (V_Real & a) {
-    	    __m256d t1 = _mm256_hadd_pd(a,a);
-    	    __m128d t2 = _mm256_extractf128_pd(t1,1);
-    	    __m128d t3 = _mm_add_sd(_mm256_castpd256_pd128(t1),t2);
-    	    return _mm_cvtsd_f64(t3);
-    	}
-    };
-
-
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
-        for (int k = 0; k < kPatternCount; k++) {
-            int w = l * kMatrixSize;
-            for (int i = 0; i < kStateCount; ++i) {
-            	register V_Real sum1_vecA = VEC_SETZERO();
-            	register V_Real sum2_vecA = VEC_SETZERO();
-            	for (int j = 0; j < stateCountMinusOne; j += 4) {
-//            		IO()(VEC_LOAD(matrices1 + w + j));
-//            		IO()(VEC_LOAD(partials1 + v + j));
-
-            		sum1_vecA = VEC_MADD(
-								 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
-								 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
-								 sum1_vecA);
-//            		IO()(sum1_vecA);
-            		sum2_vecA = VEC_MADD(
-								 VEC_LOAD(matrices2 + w + j),
-								 VEC_LOAD(partials2 + v + j),
-								 sum2_vecA);
-//            		fprintf(stderr,"\n");
-            	}
-
-
-//            	sum1_vecA = VEC_MULT(
-//            	               VEC_ADD(sum1_vecA, VEC_SWAP(sum1_vecA)),
-//            	               VEC_ADD(sum2_vecA, VEC_SWAP(sum2_vecA))
-//            	           );
-//            	sum1_vecA = VEC_MULT(math::horizontal_add(sum1_vecA), math::horizontal_add(sum2_vecA));
-//            	IO()(sum1_vecA);
-//            	exit(-1);
-
-                // increment for the extra column at the end
-                w += kStateCount + T_PAD;
-
-                // Store single value
-//                double x[4];
-//                _mm256_storeu_pd(x, VEC_MULT(sum1_vecA,sum2_vecA));
-//                *destPu = x[0];
-                *destPu = math::horizontal_add(sum1_vecA) * math::horizontal_add(sum2_vecA);
-
-//                *destPu = 1.0; //sum1_vecA[0];
-                destPu++;
-//                fprintf(stderr,"clear\n");
-            }
-            destPu += P_PAD;
-            v += kPartialsPaddedStateCount;
+                                              const double* __restrict matrices2,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            double sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
         }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
     }
 }
 
@@ -293,89 +303,63 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartialsFixedScaling(
                                               const double* __restrict matrices1,
                                               const double* __restrict partials2,
                                               const double* __restrict matrices2,
-                                              const double* __restrict scaleFactors) {
-
-	fprintf(stderr, "Not yet implemented: BeagleCPUAVXImpl::calcPartialsPartialsFixedScaling\n");
-	exit(-1);
-
-//    int stateCountMinusOne = kPartialsPaddedStateCount - 1;
-//#pragma omp parallel for num_threads(kCategoryCount)
-//    for (int l = 0; l < kCategoryCount; l++) {
-//    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount;
-//    	int v = l*kPartialsPaddedStateCount*kPatternCount;
-//        for (int k = 0; k < kPatternCount; k++) {
-//            int w = l * kMatrixSize;
-//            const V_Real scalar = VEC_SPLAT(scaleFactors[k]);
-//            for (int i = 0; i < kStateCount; i++) {
-//
-//            	register V_Real sum1_vec;
-//            	register V_Real sum2_vec;
-//
-//              	int j = 0;
-//            	sum1_vec = VEC_SETZERO();
-//            	sum2_vec = VEC_SETZERO();
-//            	for ( ; j < stateCountMinusOne; j += 2) {
-//            		sum1_vec = VEC_MADD(
-//								 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
-//								 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
-//								 sum1_vec);
-//            		sum2_vec = VEC_MADD(
-//								 VEC_LOAD(matrices2 + w + j),
-//								 VEC_LOAD(partials2 + v + j),
-//								 sum2_vec);
-//            	}
-//                		sum1_vec =
-//                		VEC_DIV(VEC_MULT(
-//                				VEC_ADD(sum1_vec, VEC_SWAP(sum1_vec)),
-//                				VEC_ADD(sum2_vec, VEC_SWAP(sum2_vec))
-//                		), scalar);
-//
-//
-//                // increment for the extra column at the end
-//                w += kStateCount + T_PAD;
-//                *destPu = sum1_vec[0];
-//    TODO: Could try
-//  #define VEC_STORE(dest, source) _mm_store_sd(dest, _mm256_castpd256_pd128(source))
-//                destPu++;
-//            }
-//            destPu += P_PAD;
-//            v += kPartialsPaddedStateCount;
-//        }
-//    }
+                                              const double* __restrict scaleFactors,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        const double scalar = scaleFactors[k];
+        for (int i = 0; i < kStateCount; i++) {
+            double sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2 / scalar;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
 }
 
-    
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartialsAutoScaling(double* destP,
                                                          const double*  partials_q,
                                                          const double*  matrices_q,
                                                          const double*  partials_r,
                                                          const double*  matrices_r,
-                                                                  int* activateScaling) {
-    BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcPartialsPartialsAutoScaling(destP,
-                                                     partials_q,
-                                                     matrices_q,
-                                                     partials_r,
-                                                     matrices_r,
-                                                     activateScaling);
+                                                                  int* activateScaling,
+                                                                  int category,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            double sum1, sum2;
+            innerProducts(matrices_q + w, partials_q + v, matrices_r + w, partials_r + v, sum1, sum2);
+            *destPu = sum1 * sum2;
+
+            if (*activateScaling == 0) {
+                int expTmp;
+                frexp(*destPu, &expTmp);
+                if (abs(expTmp) > scalingExponentThreshhold)
+                    *activateScaling = 1;
+            }
+            destPu++;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
 }
 
-//template <>
-//void BeagleCPUAVXImpl<double>::calcPartialsPartialsAutoScaling(double* destP,
-//                                                                    const double*  partials_q,
-//                                                                    const double*  matrices_q,
-//                                                                    const double*  partials_r,
-//                                                                    const double*  matrices_r,
-//                                                                    int* activateScaling) {
-//    // TODO: implement calcPartialsPartialsAutoScaling with AVX
-//    BeagleCPUImpl<double>::calcPartialsPartialsAutoScaling(destP,
-//                                                                partials_q,
-//                                                                matrices_q,
-//                                                                partials_r,
-//                                                                matrices_r,
-//                                                                activateScaling);
-//}
-    
 BEAGLE_CPU_AVX_TEMPLATE
 int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcEdgeLogLikelihoods(const int parIndex,
                                                            const int childIndex,
@@ -384,144 +368,433 @@ int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcEdgeLogLikelihoods(const int pa
                                                            const int stateFrequenciesIndex,
                                                            const int scalingFactorsIndex,
                                                            double* outSumLogLikelihood) {
-return BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcEdgeLogLikelihoods(
-                                                    parIndex,
-                                                    childIndex,
-                                                    probIndex,
-                                                    categoryWeightsIndex,
-                                                    stateFrequenciesIndex,
-                                                    scalingFactorsIndex,
-                                                    outSumLogLikelihood);
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    assert(parIndex >= kTipCount);
+
+    const double* partialsParent = gPartials[parIndex];
+    const double* transMatrix = gTransitionMatrices[probIndex];
+    const double* wt = gCategoryWeights[categoryWeightsIndex];
+    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(double));
+
+    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = gTipStates[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const double weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                const double* transMatrixPtr = transMatrix + l * kMatrixSize + statesChild[k];
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += transMatrixPtr[0] * partialsParent[v + i] * weight;
+                    transMatrixPtr += kStateCount + T_PAD;
+                    u++;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const double* partialsChild = gPartials[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const double weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                int w = l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += innerProduct(transMatrix + w, partialsChild + v) *
+                                         partialsParent[v + i] * weight;
+                    u++;
+
+                    // increment for the extra column at the end
+                    w += kStateCount + T_PAD;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        outLogLikelihoodsTmp[k] = log(innerProduct(freqs, integrationTmp + u));
+        u += kStateCount;
+    }
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
 }
 
-//template <>
-//    int BeagleCPUAVXImpl<double>::calcEdgeLogLikelihoods(const int parIndex,
-//                                                                const int childIndex,
-//                                                                const int probIndex,
-//                                                                const int categoryWeightsIndex,
-//                                                                const int stateFrequenciesIndex,
-//                                                                const int scalingFactorsIndex,
-//                                                                double* outSumLogLikelihood) {
-//    // TODO: implement derivatives for calculateEdgeLnL
-//
-//    int returnCode = BEAGLE_SUCCESS;
-//
-//    assert(parIndex >= kTipCount);
-//
-//    const double* cl_r = gPartials[parIndex];
-//    double* cl_p = integrationTmp;
-//    const double* transMatrix = gTransitionMatrices[probIndex];
-//    const double* wt = gCategoryWeights[categoryWeightsIndex];
-//    const double* freqs = gStateFrequencies[stateFrequenciesIndex];
-//
-//    memset(cl_p, 0, (kPatternCount * kStateCount)*sizeof(double));
-//
-//    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-//
-//        const int* statesChild = gTipStates[childIndex];
-//
-//		int w = 0;
-//		V_Real *vcl_r = (V_Real *)cl_r;
-//		for(int l = 0; l < kCategoryCount; l++) {
-//
-// 			VecUnion vu_m[OFFSET][2];
-// 			AVX_PREFETCH_MATRIX(transMatrix + w, vu_m)
-//
-//           V_Real *vcl_p = (V_Real *)cl_p;
-//
-//           for(int k = 0; k < kPatternCount; k++) {
-//
-//                const int stateChild = statesChild[k];
-//				V_Real vwt = VEC_SPLAT(wt[l]);
-//
-//				V_Real wtdPartials = VEC_MULT(*vcl_r++, vwt);
-//                *vcl_p++ = VEC_MADD(vu_m[stateChild][0].vx, wtdPartials, *vcl_p);
-//
-//				wtdPartials = VEC_MULT(*vcl_r++, vwt);
-//                *vcl_p++ = VEC_MADD(vu_m[stateChild][1].vx, wtdPartials, *vcl_p);
-//            }
-//           w += OFFSET*4;
-//           vcl_r += 2 * kExtraPatterns;
-//        }
-//    } else { // Integrate against a partial at the child
-//
-//        const double* cl_q = gPartials[childIndex];
-//        V_Real * vcl_r = (V_Real *)cl_r;
-//        int v = 0;
-//        int w = 0;
-//
-//        for(int l = 0; l < kCategoryCount; l++) {
-//
-//	        V_Real * vcl_p = (V_Real *)cl_p;
-//
-// 			VecUnion vu_m[OFFSET][2];
-//			AVX_PREFETCH_MATRIX(transMatrix + w, vu_m)
-//
-//            for(int k = 0; k < kPatternCount; k++) {
-//                V_Real vclp_01, vclp_23;
-//				V_Real vwt = VEC_SPLAT(wt[l]);
-//
-//				V_Real vcl_q0, vcl_q1, vcl_q2, vcl_q3;
-//				AVX_PREFETCH_PARTIALS(vcl_q,cl_q,v);
-//
-//				vclp_01 = VEC_MULT(vcl_q0, vu_m[0][0].vx);
-//				vclp_01 = VEC_MADD(vcl_q1, vu_m[1][0].vx, vclp_01);
-//				vclp_01 = VEC_MADD(vcl_q2, vu_m[2][0].vx, vclp_01);
-//				vclp_01 = VEC_MADD(vcl_q3, vu_m[3][0].vx, vclp_01);
-//				vclp_23 = VEC_MULT(vcl_q0, vu_m[0][1].vx);
-//				vclp_23 = VEC_MADD(vcl_q1, vu_m[1][1].vx, vclp_23);
-//				vclp_23 = VEC_MADD(vcl_q2, vu_m[2][1].vx, vclp_23);
-//				vclp_23 = VEC_MADD(vcl_q3, vu_m[3][1].vx, vclp_23);
-//				vclp_01 = VEC_MULT(vclp_01, vwt);
-//				vclp_23 = VEC_MULT(vclp_23, vwt);
-//
-//				*vcl_p++ = VEC_MADD(vclp_01, *vcl_r++, *vcl_p);
-//				*vcl_p++ = VEC_MADD(vclp_23, *vcl_r++, *vcl_p);
-//
-//                v += 4;
-//            }
-//            w += 4*OFFSET;
-//            if (kExtraPatterns) {
-//            	vcl_r += 2 * kExtraPatterns;
-//            	v += 4 * kExtraPatterns;
-//            }
-//
-//        }
-//    }
-//
-//    int u = 0;
-//    for(int k = 0; k < kPatternCount; k++) {
-//        double sumOverI = 0.0;
-//        for(int i = 0; i < kStateCount; i++) {
-//            sumOverI += freqs[i] * cl_p[u];
-//            u++;
-//        }
-//
-//        outLogLikelihoodsTmp[k] = log(sumOverI);
-//    }
-//
-//
-//    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-//        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-//        for(int k=0; k < kPatternCount; k++)
-//            outLogLikelihoodsTmp[k] += scalingFactors[k];
-//    }
-//
-//    *outSumLogLikelihood = 0.0;
-//    for (int i = 0; i < kPatternCount; i++) {
-//        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-//    }
-//    
-//    if (!(*outSumLogLikelihood - *outSumLogLikelihood == 0.0))
-//        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-//
-//    return returnCode;
-//}
+static inline float horizontalAdd(V_Float a) {
+    __m128 t = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1,1,1,1)));
+    return _mm_cvtss_f32(t);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesStates(float* destP,
+                                     const unsigned char* states_q,
+                                     const float* matrices_q,
+                                     const unsigned char* states_r,
+                                     const float* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+
+	BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesStates(destP,
+                                     states_q,
+                                     matrices_q,
+                                     states_r,
+                                     matrices_r,
+                                     category, startPattern, endPattern);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesPartials(float* destP,
+                                       const unsigned char* states_q,
+                                       const float* matrices_q,
+                                       const float* partials_r,
+                                       const float* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
+	BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::calcStatesPartials(
+									   destP,
+									   states_q,
+									   matrices_q,
+									   partials_r,
+									   matrices_r,
+									   category, startPattern, endPattern);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+inline float BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::innerProduct(const float* __restrict matrix,
+                                                                  const float* __restrict partials) {
+    const int stateCountModEight = kStateCount & ~7;
+    V_Float sum_vec = VEC_SETZERO_FLOAT();
+    int j = 0;
+    for (; j < stateCountModEight; j += 8)
+        sum_vec = VEC_MADD_FLOAT(VEC_LOADU_FLOAT(matrix + j), VEC_LOADU_FLOAT(partials + j), sum_vec);
+    float sum = horizontalAdd(sum_vec);
+    for (; j < kStateCount; j++)
+        sum += matrix[j] * partials[j];
+    return sum;
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+inline void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::innerProducts(const float* __restrict matrix1,
+                                                                 const float* __restrict partials1,
+                                                                 const float* __restrict matrix2,
+                                                                 const float* __restrict partials2,
+                                                                 float& sum1,
+                                                                 float& sum2) {
+    const int stateCountModEight = kStateCount & ~7;
+    V_Float sum1_vec = VEC_SETZERO_FLOAT();
+    V_Float sum2_vec = VEC_SETZERO_FLOAT();
+    int j = 0;
+    for (; j < stateCountModEight; j += 8) {
+        sum1_vec = VEC_MADD_FLOAT(VEC_LOADU_FLOAT(matrix1 + j), VEC_LOADU_FLOAT(partials1 + j), sum1_vec);
+        sum2_vec = VEC_MADD_FLOAT(VEC_LOADU_FLOAT(matrix2 + j), VEC_LOADU_FLOAT(partials2 + j), sum2_vec);
+    }
+    sum1 = horizontalAdd(sum1_vec);
+    sum2 = horizontalAdd(sum2_vec);
+    for (; j < kStateCount; j++) {
+        sum1 += matrix1[j] * partials1[j];
+        sum2 += matrix2[j] * partials2[j];
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcPartialsPartials(float* __restrict destP,
+                                              const float* __restrict partials1,
+                                              const float* __restrict matrices1,
+                                              const float* __restrict partials2,
+                                              const float* __restrict matrices2,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	float* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            float sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcPartialsPartialsFixedScaling(
+													float* __restrict destP,
+                                              const float* __restrict partials1,
+                                              const float* __restrict matrices1,
+                                              const float* __restrict partials2,
+                                              const float* __restrict matrices2,
+                                              const float* __restrict scaleFactors,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	float* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        const float scalar = scaleFactors[k];
+        for (int i = 0; i < kStateCount; i++) {
+            float sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2 / scalar;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
+                                                         const float*  partials_q,
+                                                         const float*  matrices_q,
+                                                         const float*  partials_r,
+                                                         const float*  matrices_r,
+                                                                  int* activateScaling,
+                                                                  int category,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+	float* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            float sum1, sum2;
+            innerProducts(matrices_q + w, partials_q + v, matrices_r + w, partials_r + v, sum1, sum2);
+            *destPu = sum1 * sum2;
+
+            if (*activateScaling == 0) {
+                int expTmp;
+                frexp(*destPu, &expTmp);
+                if (abs(expTmp) > scalingExponentThreshhold)
+                    *activateScaling = 1;
+            }
+            destPu++;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
+                                                          const int childIndex,
+                                                          const int probIndex,
+                                                          const int categoryWeightsIndex,
+                                                          const int stateFrequenciesIndex,
+                                                          const int scalingFactorsIndex,
+                                                          double* outSumLogLikelihood) {
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) // Integrated in double by the base class
+        return BeagleCPUImpl<BEAGLE_CPU_AVX_FLOAT>::calcEdgeLogLikelihoods(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                                                                           stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    assert(parIndex >= kTipCount);
+
+    const float* partialsParent = gPartials[parIndex];
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = gTipStates[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const float weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                const float* transMatrixPtr = transMatrix + l * kMatrixSize + statesChild[k];
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += transMatrixPtr[0] * partialsParent[v + i] * weight;
+                    transMatrixPtr += kStateCount + T_PAD;
+                    u++;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const float* partialsChild = gPartials[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const float weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                int w = l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += innerProduct(transMatrix + w, partialsChild + v) *
+                                         partialsParent[v + i] * weight;
+                    u++;
+
+                    // increment for the extra column at the end
+                    w += kStateCount + T_PAD;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        outLogLikelihoodsTmp[k] = log(innerProduct(freqs, integrationTmp + u));
+        u += kStateCount;
+    }
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+inline double BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::maxPatternPartials(const double* destP,
+                                                                          int k) {
+    const int stateCountModFour = kStateCount & ~3;
+    const double* patternP = destP + k*kPartialsPaddedStateCount;
+    V_Real max_vec = VEC_SETZERO();
+    double max = 0;
+    for (int l = 0; l < kCategoryCount; l++) {
+        int i = 0;
+        for (; i < stateCountModFour; i += 4)
+            max_vec = VEC_MAX(VEC_LOADU(patternP + i), max_vec);
+        for (; i < kStateCount; i++)
+            max = (patternP[i] > max ? patternP[i] : max);
+        patternP += kPaddedPatternCount*kPartialsPaddedStateCount;
+    }
+    __m128d max2 = _mm_max_pd(_mm256_extractf128_pd(max_vec, 1), _mm256_castpd256_pd128(max_vec));
+    max2 = _mm_max_pd(_mm_unpackhi_pd(max2, max2), max2);
+    max2 = _mm_max_sd(_mm_set_sd(max), max2);
+    return _mm_cvtsd_f64(max2);
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+inline void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::scalePatternPartials(double* destP,
+                                                                          int k,
+                                                                          double scale) {
+    const int stateCountModFour = kStateCount & ~3;
+    double* patternP = destP + k*kPartialsPaddedStateCount;
+    const V_Real vscale = VEC_SPLAT(scale);
+    for (int l = 0; l < kCategoryCount; l++) {
+        int i = 0;
+        for (; i < stateCountModFour; i += 4)
+            _mm256_storeu_pd(patternP + i, VEC_MULT(VEC_LOADU(patternP + i), vscale));
+        for (; i < kStateCount; i++)
+            patternP[i] *= scale;
+        patternP += kPaddedPatternCount*kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::rescalePartials(double* destP,
+                                                              double* scaleFactors,
+                                                              int startPattern,
+                                                              int endPattern) {
+    const bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
+
+    for (int k = startPattern; k < endPattern; k++) {
+        double max = maxPatternPartials(destP, k);
+        if (max == 0)
+            max = 1.0;
+
+        scalePatternPartials(destP, k, 1.0 / max);
+        scaleFactors[k] = (useLogScalars ? log(max) : max);
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::autoRescalePartials(double* destP,
+                                                                  signed short* scaleFactors,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+    for (int k = startPattern; k < endPattern; k++) {
+        int expMax;
+        frexp(maxPatternPartials(destP, k), &expMax);
+        scaleFactors[k] = expMax;
+
+        if (expMax != 0)
+            scalePatternPartials(destP, k, ldexp(1.0, -expMax));
+    }
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::getPaddedPatternsModulus() {
+	return 1;  // We currently do not vectorize across patterns
+}
+
+BEAGLE_CPU_AVX_TEMPLATE
+bool BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::supportsPatternMajorPartials() {
+	return false;  // Vectorized kernels assume category-major partials
+}
 
 BEAGLE_CPU_AVX_TEMPLATE
 int BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
 }
+
+BEAGLE_CPU_AVX_TEMPLATE
+bool BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::supportsPatternMajorPartials() {
+	return false;  // Vectorized kernels assume category-major partials
+}
     
 BEAGLE_CPU_AVX_TEMPLATE
 const char* BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::getName() {
@@ -536,7 +809,7 @@ const char* BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::getName() {
 BEAGLE_CPU_AVX_TEMPLATE
 const long BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::getFlags() {
 	return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_SINGLE |
             BEAGLE_FLAG_VECTOR_AVX;
@@ -545,7 +818,7 @@ const long BeagleCPUAVXImpl<BEAGLE_CPU_AVX_FLOAT>::getFlags() {
 BEAGLE_CPU_AVX_TEMPLATE
 const long BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::getFlags() {
     return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_DOUBLE |
             BEAGLE_FLAG_VECTOR_AVX;
@@ -624,9 +897,9 @@ const char* BeagleCPUAVXImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 
 template <>
 const long BeagleCPUAVXImplFactory<double>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -638,12 +911,12 @@ const long BeagleCPUAVXImplFactory<double>::getFlags() {
 
 template <>
 const long BeagleCPUAVXImplFactory<float>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_AVX |
-           BEAGLE_FLAG_PRECISION_SINGLE |
+           BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_MIXED |
            BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
            BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
            BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
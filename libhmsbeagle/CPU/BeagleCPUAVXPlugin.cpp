@@ -30,7 +30,7 @@ Plugin("CPU-AVX", "CPU-AVX")
                                          BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
                                          BEAGLE_FLAG_THREADING_NONE |
                                          BEAGLE_FLAG_PROCESSOR_CPU |
-                                         BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE |
+                                         BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_PRECISION_MIXED |
                                          BEAGLE_FLAG_VECTOR_NONE |
                                          BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
                                          BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
@@ -44,8 +44,10 @@ Plugin("CPU-AVX", "CPU-AVX")
 	// list with compatible factories and resources
 	// TODO Write AVX specific implementation
   beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateAVXImplFactory<double>());
+  beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateAVXImplFactory<float>());
 
   beagleFactories.push_back(new beagle::cpu::BeagleCPUAVXImplFactory<double>());
+  beagleFactories.push_back(new beagle::cpu::BeagleCPUAVXImplFactory<float>());
 }
 
 }	// namespace cpu
@@ -160,8 +162,8 @@ bool check_sse2(){
 
 
 void* plugin_init(void){
-	if(!check_sse2()){
-		return NULL;	// no SSE no plugin?! 
+	if(!check_sse2() || !CPUSupportsAVX()){
+		return NULL;	// no AVX no plugin
 	}
 	return new beagle::cpu::BeagleCPUAVXPlugin();
 }
@@ -0,0 +1,194 @@
+/*
+ *  BeagleCPUArena.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUArena__
+#define __BeagleCPUArena__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdlib>
+#include <cstddef>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define BEAGLE_CPU_ARENA_MMAP
+#endif
+
+#define BEAGLE_CPU_ARENA_ALIGNMENT  64                // Every buffer starts on a cache line (and AVX-512 vector)
+#define BEAGLE_CPU_ARENA_PAGE_SIZE  4096              // Slabs are page aligned and sized in whole pages
+#define BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE  (1 << 21)    // Slabs at least this big are aligned for 2 MB pages
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * One contiguous slab holding the buffers of an instance.
+ *
+ * The slab is reserved once, sized from the createInstance arguments, and
+ * handed out front to back in cache-line aligned pieces; nothing is returned
+ * to the arena individually and the whole slab goes back in one call. Pages
+ * are only committed by the OS when first touched, so reserving room for
+ * buffers a client never fills costs address space rather than memory.
+ * Slabs of 2 MB or more are aligned to, and on Linux advised for,
+ * transparent huge pages.
+ */
+class BeagleCPUArena {
+public:
+    BeagleCPUArena()
+        : slab(NULL),
+          base(NULL),
+          capacity(0),
+          mapped(0),
+          used(0) {
+    }
+
+    ~BeagleCPUArena() {
+        release();
+    }
+
+    // Bytes a buffer of the given size takes from the slab
+    static size_t alignedSize(size_t bytes) {
+        return (bytes + BEAGLE_CPU_ARENA_ALIGNMENT - 1) & ~((size_t) BEAGLE_CPU_ARENA_ALIGNMENT - 1);
+    }
+
+    // Reserves a slab of at least the given size, replacing any previous one;
+    // returns false if the memory cannot be obtained
+    bool reserve(size_t bytes) {
+        release();
+        if (bytes == 0)
+            return true;
+
+        const size_t align = (bytes >= BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE ?
+                              BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE : BEAGLE_CPU_ARENA_PAGE_SIZE);
+        const size_t size = (bytes + align - 1) & ~(align - 1);
+
+#ifdef BEAGLE_CPU_ARENA_MMAP
+        // Over-map by one alignment unit and trim, since mmap only promises page alignment
+        mapped = size + (align > BEAGLE_CPU_ARENA_PAGE_SIZE ? align : 0);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE; // commit pages as they are touched, as malloc would
+#endif
+        void* ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            mapped = 0;
+            return false;
+        }
+        char* start = (char*) ptr;
+        char* aligned = (char*) (((size_t) start + align - 1) & ~(align - 1));
+        if (aligned > start)
+            munmap(start, aligned - start);
+        if (start + mapped > aligned + size)
+            munmap(aligned + size, (start + mapped) - (aligned + size));
+        base = aligned;
+        mapped = size;
+#ifdef MADV_HUGEPAGE
+        if (align == BEAGLE_CPU_ARENA_HUGE_PAGE_SIZE)
+            madvise(base, size, MADV_HUGEPAGE);
+#endif
+#else
+        base = (char*) malloc(size + align);
+        if (base == NULL)
+            return false;
+        mapped = size + align;
+#endif
+        slab = (char*) (((size_t) base + align - 1) & ~(align - 1));
+        capacity = size;
+        used = 0;
+        return true;
+    }
+
+    // Hands out the next piece of the slab, or NULL once the slab is exhausted
+    void* allocate(size_t bytes) {
+        const size_t size = alignedSize(bytes);
+        if (slab == NULL || size > capacity - used)
+            return NULL;
+        void* ptr = slab + used;
+        used += size;
+        return ptr;
+    }
+
+    // true if ptr was handed out by this arena
+    bool owns(const void* ptr) const {
+        return slab != NULL && (const char*) ptr >= slab && (const char*) ptr < slab + capacity;
+    }
+
+    // Gives the OS back the pages lying wholly inside a buffer that is no longer
+    // used; they read as zero if touched again
+    void discard(void* ptr,
+                 size_t bytes) {
+#if defined(BEAGLE_CPU_ARENA_MMAP) && defined(MADV_DONTNEED)
+        if (!owns(ptr))
+            return;
+        const size_t start = ((size_t) ptr + BEAGLE_CPU_ARENA_PAGE_SIZE - 1) & ~((size_t) BEAGLE_CPU_ARENA_PAGE_SIZE - 1);
+        const size_t end = ((size_t) ptr + bytes) & ~((size_t) BEAGLE_CPU_ARENA_PAGE_SIZE - 1);
+        if (end > start)
+            madvise((void*) start, end - start, MADV_DONTNEED);
+#endif
+    }
+
+    // Returns the whole slab at once
+    void release() {
+        if (base != NULL) {
+#ifdef BEAGLE_CPU_ARENA_MMAP
+            munmap(base, mapped);
+#else
+            free(base);
+#endif
+        }
+        slab = NULL;
+        base = NULL;
+        capacity = 0;
+        mapped = 0;
+        used = 0;
+    }
+
+    char* getSlab() const {
+        return slab;
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    size_t getUsed() const {
+        return used;
+    }
+
+private:
+    BeagleCPUArena(const BeagleCPUArena&);
+    BeagleCPUArena& operator=(const BeagleCPUArena&);
+
+    char* slab;       // first aligned byte handed out
+    char* base;       // what was obtained from the OS, for release()
+    size_t capacity;
+    size_t mapped;
+    size_t used;
+};
+
+}
+}
+
+#endif // __BeagleCPUArena__
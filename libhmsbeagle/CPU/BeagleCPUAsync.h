@@ -0,0 +1,182 @@
+/*
+ *  BeagleCPUAsync.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUAsync__
+#define __BeagleCPUAsync__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "libhmsbeagle/beagle.h"
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Work an instance has accepted but not yet done (BEAGLE_FLAG_COMPUTATION_ASYNCH).
+ *
+ * Jobs run one after another, in the order they were pushed, on a single
+ * background thread; each job still uses the instance's own threading. A job
+ * names the partials buffers it writes, so that a caller can wait for those
+ * buffers alone while later jobs are still queued.
+ */
+class BeagleCPUAsyncQueue {
+public:
+    class Job {
+    public:
+        virtual ~Job() {}
+        virtual int execute() = 0;
+    };
+
+    BeagleCPUAsyncQueue(int bufferCount)
+        : pendingWrites(bufferCount, 0),
+          running(false),
+          stop(false),
+          error(BEAGLE_SUCCESS) {
+        worker = std::thread(&BeagleCPUAsyncQueue::workerLoop, this);
+    }
+
+    // Finishes the jobs already pushed before returning
+    ~BeagleCPUAsyncQueue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    // Takes ownership of job, which writes the given partials buffers
+    void push(Job* job,
+              const int* destinations,
+              int destinationCount) {
+        QueuedJob queued;
+        queued.job = job;
+        for (int i = 0; i < destinationCount; i++) {
+            if (destinations[i] >= 0 && destinations[i] < (int) pendingWrites.size())
+                queued.destinations.push_back(destinations[i]);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < queued.destinations.size(); i++)
+                pendingWrites[queued.destinations[i]]++;
+            jobs.push_back(queued);
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until no queued job writes any of the given buffers. Waits from a job itself
+    // (public methods it calls internally) return at once
+    void wait(const int* buffers,
+              int count) {
+        if (std::this_thread::get_id() == worker.get_id())
+            return;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (int i = 0; i < count; i++) {
+            if (buffers[i] < 0 || buffers[i] >= (int) pendingWrites.size())
+                continue;
+            while (pendingWrites[buffers[i]] > 0)
+                done.wait(lock);
+        }
+    }
+
+    // Blocks until every job pushed so far has run, then returns and clears the first error
+    // they reported, as takeError does. A job itself gets BEAGLE_SUCCESS at once and leaves
+    // any error for its caller
+    int waitAll() {
+        if (std::this_thread::get_id() == worker.get_id())
+            return BEAGLE_SUCCESS;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running || !jobs.empty())
+            done.wait(lock);
+        int code = error;
+        error = BEAGLE_SUCCESS;
+        return code;
+    }
+
+    // Returns the first error a job has reported since the last call, if any
+    int takeError() {
+        std::lock_guard<std::mutex> lock(mutex);
+        int code = error;
+        error = BEAGLE_SUCCESS;
+        return code;
+    }
+
+private:
+    struct QueuedJob {
+        Job* job;
+        std::vector<int> destinations;
+    };
+
+    void workerLoop() {
+        for (;;) {
+            QueuedJob queued;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stop && jobs.empty())
+                    wake.wait(lock);
+                if (jobs.empty())
+                    return;
+                queued = jobs.front();
+                jobs.pop_front();
+                running = true;
+            }
+
+            int code = queued.job->execute();
+            delete queued.job;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (code != BEAGLE_SUCCESS && error == BEAGLE_SUCCESS)
+                    error = code;
+                for (size_t i = 0; i < queued.destinations.size(); i++)
+                    pendingWrites[queued.destinations[i]]--;
+                running = false;
+            }
+            done.notify_all();
+        }
+    }
+
+    std::deque<QueuedJob> jobs;
+    std::vector<int> pendingWrites; // queued or running jobs writing each buffer
+    bool running;
+    bool stop;
+    int error;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::thread worker;
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // __BeagleCPUAsync__
@@ -0,0 +1,246 @@
+/*
+ *  BeagleCPUCheckpoint.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUCheckpoint__
+#define __BeagleCPUCheckpoint__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "libhmsbeagle/CPU/BeagleCPUArena.h"
+
+#define BEAGLE_CPU_CHECKPOINT_MAGIC      "BGLCKPT"
+#define BEAGLE_CPU_CHECKPOINT_VERSION    2
+#define BEAGLE_CPU_CHECKPOINT_ALIGNMENT  BEAGLE_CPU_ARENA_ALIGNMENT // Sections start where a buffer from the arena would
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Checkpoint files start with this header. The instance's buffers follow as
+ * sections, each starting on an aligned offset, and then a table with the
+ * offset of every section (0 for a buffer the instance never allocated).
+ * Section lengths are not stored; they follow from the counts below, which
+ * must match the instance the checkpoint is read into.
+ */
+struct BeagleCPUCheckpointHeader {
+    char magic[8];
+    int version;
+    int realTypeSize;
+    long long flags;
+    char implName[64];
+    int tipCount;
+    int bufferCount;
+    int stateCount;
+    int patternCount;           // site columns, as passed to createInstance
+    int compressedPatternCount; // unique patterns, if patternsCompressed
+    int paddedPatternCount;
+    int eigenDecompCount;
+    int matrixCount;
+    int categoryCount;
+    int scaleBufferCount;
+    int partialsSize;
+    int compressPatterns;
+    int patternsCompressed;
+    int sectionCount;
+    long long sectionTableOffset;
+};
+
+/*
+ * Writes a checkpoint front to back; the header goes in last, once the
+ * section table is known.
+ */
+class BeagleCPUCheckpointWriter {
+public:
+    BeagleCPUCheckpointWriter()
+        : file(NULL),
+          offset(0),
+          failed(false) {
+    }
+
+    ~BeagleCPUCheckpointWriter() {
+        if (file != NULL)
+            fclose(file);
+    }
+
+    bool open(const char* path,
+              size_t headerBytes) {
+        file = fopen(path, "wb");
+        if (file == NULL)
+            return false;
+        offset = 0;
+        pad(headerBytes);
+        return !failed;
+    }
+
+    // Appends an aligned section and returns its offset; a NULL block is recorded as 0
+    long long append(const void* data,
+                     size_t bytes) {
+        if (data == NULL)
+            return 0;
+        pad(BeagleCPUArena::alignedSize((size_t) offset) - (size_t) offset);
+        const long long start = offset;
+        if (bytes > 0 && fwrite(data, 1, bytes, file) != bytes)
+            failed = true;
+        offset += bytes;
+        return start;
+    }
+
+    // Writes the header over the space reserved by open() and closes the file
+    bool close(const void* header,
+               size_t headerBytes) {
+        if (fseek(file, 0, SEEK_SET) != 0 || fwrite(header, 1, headerBytes, file) != headerBytes)
+            failed = true;
+        if (fclose(file) != 0)
+            failed = true;
+        file = NULL;
+        return !failed;
+    }
+
+private:
+    void pad(size_t bytes) {
+        static const char zeros[BEAGLE_CPU_CHECKPOINT_ALIGNMENT] = {0};
+        while (bytes > 0) {
+            const size_t chunk = (bytes < sizeof(zeros) ? bytes : sizeof(zeros));
+            if (fwrite(zeros, 1, chunk, file) != chunk)
+                failed = true;
+            offset += chunk;
+            bytes -= chunk;
+        }
+    }
+
+    FILE* file;
+    long long offset;
+    bool failed;
+};
+
+/*
+ * A checkpoint file mapped copy-on-write into memory, so that instance
+ * buffers can point straight into it: pages are read from the file as they
+ * are first touched, and writes stay private to the process. Without mmap
+ * the file is read into memory instead.
+ */
+class BeagleCPUCheckpointMapping {
+public:
+    BeagleCPUCheckpointMapping()
+        : base(NULL),
+          size(0) {
+    }
+
+    ~BeagleCPUCheckpointMapping() {
+        release();
+    }
+
+    bool map(const char* path) {
+        release();
+        FILE* file = fopen(path, "rb");
+        if (file == NULL)
+            return false;
+        bool mapped = false;
+        if (fseek(file, 0, SEEK_END) == 0) {
+            const long length = ftell(file);
+            if (length > 0) {
+                size = (size_t) length;
+#ifdef BEAGLE_CPU_ARENA_MMAP
+                void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+                if (ptr != MAP_FAILED) {
+                    base = (char*) ptr;
+                    mapped = true;
+                }
+#else
+                base = (char*) malloc(size);
+                if (base != NULL && fseek(file, 0, SEEK_SET) == 0 && fread(base, 1, size, file) == size)
+                    mapped = true;
+#endif
+            }
+        }
+        fclose(file);
+        if (!mapped)
+            release();
+        return mapped;
+    }
+
+    void release() {
+        if (base != NULL) {
+#ifdef BEAGLE_CPU_ARENA_MMAP
+            munmap(base, size);
+#else
+            free(base);
+#endif
+        }
+        base = NULL;
+        size = 0;
+    }
+
+    // Exchanges mappings, so that buffers from the old one can be let go of first
+    void swap(BeagleCPUCheckpointMapping& other) {
+        char* otherBase = other.base;
+        size_t otherSize = other.size;
+        other.base = base;
+        other.size = size;
+        base = otherBase;
+        size = otherSize;
+    }
+
+    // Section of bytes starting at offset, or NULL if the file does not hold it or the
+    // offset is not one the writer could have produced; buffers pointing into the mapping
+    // are read with aligned vector loads
+    char* section(long long offset,
+                  size_t bytes) const {
+        if (base == NULL || offset <= 0 || (size_t) offset > size || bytes > size - (size_t) offset)
+            return NULL;
+        if (offset % BEAGLE_CPU_CHECKPOINT_ALIGNMENT != 0)
+            return NULL;
+        return base + offset;
+    }
+
+    // true if ptr points into the mapping
+    bool owns(const void* ptr) const {
+        return base != NULL && (const char*) ptr >= base && (const char*) ptr < base + size;
+    }
+
+    char* getBase() const {
+        return base;
+    }
+
+    size_t getSize() const {
+        return size;
+    }
+
+private:
+    BeagleCPUCheckpointMapping(const BeagleCPUCheckpointMapping&);
+    BeagleCPUCheckpointMapping& operator=(const BeagleCPUCheckpointMapping&);
+
+    char* base;
+    size_t size;
+};
+
+}
+}
+
+#endif // __BeagleCPUCheckpoint__
@@ -0,0 +1,199 @@
+/*
+ *  BeagleCPUGemm.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUGemm__
+#define __BeagleCPUGemm__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstring>
+
+#ifdef HAVE_CBLAS
+#include <cblas.h>
+#endif
+
+#define BEAGLE_CPU_GEMM_MR  4   // Rows of C held in registers by the micro-kernel
+#define BEAGLE_CPU_GEMM_KC  256 // Depth of the panels of A and B kept in cache
+#define BEAGLE_CPU_GEMM_NC  512 // Width of the panel of B kept in cache
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Accumulates a BEAGLE_CPU_GEMM_MR x NR tile of C += A * B over kc terms.
+ * NR is a compile-time cache line of REALTYPE, so the inner loop vectorises
+ * and the tile stays in registers.
+ */
+template <typename REALTYPE, int NR>
+inline void gemmMicroKernel(int kc,
+                            const REALTYPE* A,
+                            int lda,
+                            const REALTYPE* B,
+                            int ldb,
+                            REALTYPE* C,
+                            int ldc) {
+    REALTYPE c0[NR], c1[NR], c2[NR], c3[NR];
+    for (int j = 0; j < NR; j++) {
+        c0[j] = C[0 * ldc + j];
+        c1[j] = C[1 * ldc + j];
+        c2[j] = C[2 * ldc + j];
+        c3[j] = C[3 * ldc + j];
+    }
+    for (int p = 0; p < kc; p++) {
+        const REALTYPE* b = B + p * ldb;
+        const REALTYPE a0 = A[0 * lda + p];
+        const REALTYPE a1 = A[1 * lda + p];
+        const REALTYPE a2 = A[2 * lda + p];
+        const REALTYPE a3 = A[3 * lda + p];
+        for (int j = 0; j < NR; j++) {
+            c0[j] += a0 * b[j];
+            c1[j] += a1 * b[j];
+            c2[j] += a2 * b[j];
+            c3[j] += a3 * b[j];
+        }
+    }
+    for (int j = 0; j < NR; j++) {
+        C[0 * ldc + j] = c0[j];
+        C[1 * ldc + j] = c1[j];
+        C[2 * ldc + j] = c2[j];
+        C[3 * ldc + j] = c3[j];
+    }
+}
+
+/*
+ * Edge tiles: C += A * B for an arbitrary (small) mr x nr tile
+ */
+template <typename REALTYPE>
+inline void gemmEdgeKernel(int mr,
+                           int nr,
+                           int kc,
+                           const REALTYPE* A,
+                           int lda,
+                           const REALTYPE* B,
+                           int ldb,
+                           REALTYPE* C,
+                           int ldc) {
+    for (int i = 0; i < mr; i++) {
+        for (int j = 0; j < nr; j++) {
+            REALTYPE sum = C[i * ldc + j];
+            for (int p = 0; p < kc; p++)
+                sum += A[i * lda + p] * B[p * ldb + j];
+            C[i * ldc + j] = sum;
+        }
+    }
+}
+
+/*
+ * Cache-blocked row-major C = A * B, with A m x k, B k x n and C m x n.
+ * Each entry of C is summed in increasing k order, as a naive triple loop would.
+ */
+template <typename REALTYPE>
+void gemmBlocked(int m,
+                 int n,
+                 int k,
+                 const REALTYPE* A,
+                 int lda,
+                 const REALTYPE* B,
+                 int ldb,
+                 REALTYPE* C,
+                 int ldc) {
+    const int NR = 64 / sizeof(REALTYPE);
+
+    for (int i = 0; i < m; i++)
+        memset(C + i * ldc, 0, sizeof(REALTYPE) * n);
+
+    for (int jc = 0; jc < n; jc += BEAGLE_CPU_GEMM_NC) {
+        const int nc = (n - jc < BEAGLE_CPU_GEMM_NC ? n - jc : BEAGLE_CPU_GEMM_NC);
+        for (int pc = 0; pc < k; pc += BEAGLE_CPU_GEMM_KC) {
+            const int kc = (k - pc < BEAGLE_CPU_GEMM_KC ? k - pc : BEAGLE_CPU_GEMM_KC);
+            const REALTYPE* panelB = B + pc * ldb + jc;
+            for (int ic = 0; ic < m; ic += BEAGLE_CPU_GEMM_MR) {
+                const int mr = (m - ic < BEAGLE_CPU_GEMM_MR ? m - ic : BEAGLE_CPU_GEMM_MR);
+                const REALTYPE* panelA = A + ic * lda + pc;
+                REALTYPE* tileC = C + ic * ldc + jc;
+                int j = 0;
+                if (mr == BEAGLE_CPU_GEMM_MR) {
+                    for (; j + NR <= nc; j += NR)
+                        gemmMicroKernel<REALTYPE, NR>(kc, panelA, lda, panelB + j, ldb,
+                                                      tileC + j, ldc);
+                }
+                if (j < nc)
+                    gemmEdgeKernel<REALTYPE>(mr, nc - j, kc, panelA, lda, panelB + j, ldb,
+                                             tileC + j, ldc);
+            }
+        }
+    }
+}
+
+/*
+ * Row-major C = A * B; uses the CBLAS library found at configure time, if any
+ */
+template <typename REALTYPE>
+inline void beagleGemm(int m,
+                       int n,
+                       int k,
+                       const REALTYPE* A,
+                       int lda,
+                       const REALTYPE* B,
+                       int ldb,
+                       REALTYPE* C,
+                       int ldc) {
+    gemmBlocked<REALTYPE>(m, n, k, A, lda, B, ldb, C, ldc);
+}
+
+#ifdef HAVE_CBLAS
+template <>
+inline void beagleGemm<double>(int m,
+                               int n,
+                               int k,
+                               const double* A,
+                               int lda,
+                               const double* B,
+                               int ldb,
+                               double* C,
+                               int ldc) {
+    cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k,
+                1.0, A, lda, B, ldb, 0.0, C, ldc);
+}
+
+template <>
+inline void beagleGemm<float>(int m,
+                              int n,
+                              int k,
+                              const float* A,
+                              int lda,
+                              const float* B,
+                              int ldb,
+                              float* C,
+                              int ldc) {
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k,
+                1.0f, A, lda, B, ldb, 0.0f, C, ldc);
+}
+#endif
+
+}
+}
+
+#endif // __BeagleCPUGemm__
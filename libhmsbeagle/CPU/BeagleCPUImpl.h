@@ -35,8 +35,14 @@
 #include "libhmsbeagle/BeagleImpl.h"
 #include "libhmsbeagle/CPU/Precision.h"
 #include "libhmsbeagle/CPU/EigenDecomposition.h"
+#include "libhmsbeagle/CPU/BeagleCPUArena.h"
+#include "libhmsbeagle/CPU/BeagleCPUSnapshot.h"
+#include "libhmsbeagle/CPU/BeagleCPUCheckpoint.h"
+#include "libhmsbeagle/CPU/BeagleCPUSpill.h"
+#include "libhmsbeagle/CPU/BeagleCPUTreeModel.h"
 
 #include <vector>
+#include <cstring>
 
 #define BEAGLE_CPU_GENERIC	REALTYPE, T_PAD, P_PAD
 #define BEAGLE_CPU_TEMPLATE	template <typename REALTYPE, int T_PAD, int P_PAD>
@@ -48,10 +54,40 @@
 #define T_PAD_DEFAULT   1   // Pad transition matrix rows with an extra 1.0 for ambiguous characters
 #define P_PAD_DEFAULT   0   // No partials padding necessary for non-SSE implementations
 
+#define BEAGLE_CPU_MIN_PATTERN_BLOCK_SIZE  64 // Smallest automatic pattern block handed to a thread
+#define BEAGLE_CPU_MIN_MATRIX_TASK_WORK  (1 << 16) // Fewest multiply-adds of transition matrices handed to a thread
+#define BEAGLE_CPU_FUSED_BLOCK_BYTES  (64 * 1024) // Partials of one fused rescale or integration block, sized for L2
+#define BEAGLE_CPU_TIP_PAIR_TABLE_RATIO  4 // Build a tip-pair table only with this many patterns per (state, state) pair
+#define BEAGLE_CPU_MAX_TIP_STATE_COUNT  255 // Largest state count (plus the gap code) a byte-sized compact tip holds
+#define BEAGLE_CPU_FIRST_TOUCH_BYTES  (1 << 21) // Slab handed to one worker at a time when placing pages
+
+// Compact tip state of pattern k when two patterns share a byte, low nibble first
+#define BEAGLE_CPU_PACKED_TIP_STATE(states, k)  (((states)[(k) >> 1] >> (((k) & 1) << 2)) & 0x0F)
+
+#ifdef _OPENMP
+#define BEAGLE_CPU_THREADING_FLAG   BEAGLE_FLAG_THREADING_OPENMP
+#else
+#define BEAGLE_CPU_THREADING_FLAG   BEAGLE_FLAG_THREADING_NONE
+#endif
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+#include "libhmsbeagle/CPU/BeagleCPUThreadPool.h"
+#include "libhmsbeagle/CPU/BeagleCPUNuma.h"
+#include "libhmsbeagle/CPU/BeagleCPUAsync.h"
+#define BEAGLE_CPU_FACTORY_THREADING_FLAGS  (BEAGLE_CPU_THREADING_FLAG | BEAGLE_FLAG_THREADING_CPP)
+#define BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS  (BEAGLE_FLAG_COMPUTATION_SYNCH | BEAGLE_FLAG_COMPUTATION_ASYNCH)
+#else
+#define BEAGLE_CPU_FACTORY_THREADING_FLAGS  BEAGLE_CPU_THREADING_FLAG
+#define BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS  BEAGLE_FLAG_COMPUTATION_SYNCH
+#endif
+
 
 namespace beagle {
 namespace cpu {
 
+class BeagleCPUThreadPool;
+class BeagleCPUAsyncQueue;
+
 BEAGLE_CPU_TEMPLATE
 class BeagleCPUImpl : public BeagleImpl {
 
@@ -61,12 +97,15 @@ protected:
     int kTipCount; /// after initialize this will be tipStates.size()
     ///   (we don't really need this field, but it is handy)
     int kPatternCount; /// the number of data patterns in each partial and tipStates element
+    int kUncompressedPatternCount; /// the number of site columns clients pass in and get back
     int kPaddedPatternCount; /// the number of data patterns padded to be a multiple of 2 or 4
     int kExtraPatterns; /// kPaddedPatternCount - kPatternCount
     int kMatrixCount; /// the number of transition matrices to alloc and store
     int kStateCount; /// the number of states
     int kTransPaddedStateCount;
     int kPartialsPaddedStateCount;
+    int kPartialsCategoryStride; /// offset between a pattern's partials in consecutive rate categories
+    int kPartialsPatternStride; /// offset between consecutive patterns' partials in one rate category
     int kEigenDecompCount; /// the number of eigen solutions to alloc and store
     int kCategoryCount;
     int kScaleBufferCount;
@@ -77,13 +116,31 @@ protected:
     int kInternalPartialsBufferCount; 
 
     long kFlags;
-    
+
+    int kResourceNumber;
+
+    int kThreadCount; /// number of threads used to compute partials
+    int kPatternBlockSize; /// number of patterns in each (category, pattern block) tile
+    int kPatternBlockCount; /// number of pattern blocks per rate category
+    bool kAutoPatternBlockSize; /// derive kPatternBlockSize from kThreadCount
+    int kFusedBlockSize; /// number of patterns, over all categories, rescaled or integrated by one task
+    int kFusedBlockCount; /// number of fused blocks per operation
+
+    bool kCompressPatterns; /// collapse identical site columns before the first computation
+    bool kPatternsCompressed; /// site columns have been collapsed into kPatternCount unique patterns
+    std::vector<int> gPatternMap; /// unique pattern of each client site column, once compressed
+    std::vector<int> gPatternColumns; /// first client site column of each unique pattern, once compressed
+    std::vector<int> gPatternPartitionStarts; /// first pattern of each partition, then kPatternCount; empty if unpartitioned
+
+    BeagleCPUThreadPool* gThreadPool; /// persistent workers when BEAGLE_FLAG_THREADING_CPP is set, NULL otherwise
+    BeagleCPUAsyncQueue* gAsyncQueue; /// queued updatePartials calls when BEAGLE_FLAG_COMPUTATION_ASYNCH is set, NULL otherwise
+
     REALTYPE realtypeMin;
     int scalingExponentThreshhold;
 
     EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* gEigenDecomposition;
 
-    double* gCategoryRates; // Kept in double-precision until multiplication by edgelength
+    double* gCategoryRates; // Kept in double-precision until multiplication by edgelength; kEigenDecompCount sets
     double* gPatternWeights;
     
     REALTYPE** gCategoryWeights;
@@ -93,8 +150,14 @@ protected:
     //      tipStates field should be switched to vectors of vectors (to make
     //      memory management less error prone
     REALTYPE** gPartials;
-    int** gTipStates;
+    unsigned char** gTipStates; // One byte per pattern, or two per byte if hasPackedTipStates()
     REALTYPE** gScaleBuffers;
+
+    // Double-precision copies of gScaleBuffers under BEAGLE_FLAG_PRECISION_MIXED, kept
+    // in step with them; cumulative factors are summed here and rounded into gScaleBuffers
+    std::vector<std::vector<double> > gMixedScaleBuffers;
+    std::vector<double> gMixedIntegrationTmp; // site likelihoods and their sum over subsets
+    std::vector<double> gMixedLogLikelihoods; // site log likelihoods of the last integration
     
     signed short** gAutoScaleBuffers;
     
@@ -105,6 +168,27 @@ protected:
     //  into a single array
     REALTYPE** gTransitionMatrices;
 
+    // Slab holding the partials, tip states, scale buffers and transition matrices
+    BeagleCPUArena gArena;
+
+    // Checkpoint file the buffers point into after readCheckpoint
+    BeagleCPUCheckpointMapping gCheckpoint;
+
+    // File the partials buffers live in after setCPUPartialsSpill
+    BeagleCPUSpill gSpill;
+
+    // Copy-on-write logs of the buffers written since saveState
+    BeagleCPUSnapshotLog<REALTYPE> gPartialsLog;
+    BeagleCPUSnapshotLog<REALTYPE> gScaleBuffersLog;
+    BeagleCPUSnapshotLog<signed short> gAutoScaleBuffersLog;
+    BeagleCPUSnapshotLog<REALTYPE> gTransitionMatricesLog;
+    std::vector<std::vector<double> > gParkedMixedScaleBuffers; // companions of gScaleBuffersLog
+    std::vector<int> gParkedActiveScalingFactors; // companions of gAutoScaleBuffersLog
+
+    // Tree set by setTreeModel, and its state at saveState
+    BeagleCPUTreeModel gTreeModel;
+    BeagleCPUTreeModel gSavedTreeModel;
+
     REALTYPE* integrationTmp;
     REALTYPE* firstDerivTmp;
     REALTYPE* secondDerivTmp;
@@ -183,6 +267,12 @@ public:
     // categoryRates an array containing categoryCount rate scalers
     int setCategoryRates(const double* inCategoryRates);
 
+    int setCategoryRatesWithIndex(int categoryRatesIndex,
+                                  const double* inCategoryRates);
+
+    int setPatternPartitions(int partitionCount,
+                             const int* inPatternPartitions);
+
     int setTransitionMatrix(int matrixIndex,
                             const double* inMatrix,
                             double paddedValue);
@@ -217,6 +307,14 @@ public:
                                  const double* edgeLengths,
                                  int count);
 
+    int updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                                   const int* categoryRateIndices,
+                                                   const int* probabilityIndices,
+                                                   const int* firstDerivativeIndices,
+                                                   const int* secondDerivativeIndices,
+                                                   const double* edgeLengths,
+                                                   int count);
+
     // calculate or queue for calculation partials using an array of operations
     //
     // operations an array of triplets of indices: the two source partials and the destination
@@ -227,6 +325,11 @@ public:
                        int operationCount,
                        int cumulativeScalingIndex);
 
+    // updatePartials over the patterns of one partition per operation; operations are
+    // BeagleOperationByPartition tuples of 9 ints
+    int updatePartialsByPartition(const int* operations,
+                                  int operationCount);
+
     // Block until all calculations that write to the specified partials have completed.
     //
     // This function is optional and only has to be called by clients that "recycle" partials.
@@ -254,6 +357,19 @@ public:
 
     int resetScaleFactors(int cumulativeScalingIndex);
 
+    int accumulateScaleFactorsByPartition(const int* scalingIndices,
+                                          int count,
+                                          int cumulativeScalingIndex,
+                                          int partitionIndex);
+
+    int removeScaleFactorsByPartition(const int* scalingIndices,
+                                      int count,
+                                      int cumulativeScalingIndex,
+                                      int partitionIndex);
+
+    int resetScaleFactorsByPartition(int cumulativeScalingIndex,
+                                     int partitionIndex);
+
     int copyScaleFactors(int destScalingIndex,
                          int srcScalingIndex);    
     
@@ -268,6 +384,52 @@ public:
                                     int count,
                                     double* outSumLogLikelihood);
 
+    int calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
+                                               const int* categoryWeightsIndices,
+                                               const int* stateFrequenciesIndices,
+                                               const int* cumulativeScaleIndices,
+                                               const int* partitionIndices,
+                                               int partitionCount,
+                                               int count,
+                                               double* outSumLogLikelihoodByPartition,
+                                               double* outSumLogLikelihood);
+
+    // updatePartials then calculateRootLogLikelihoods for treeCount trees at once; the
+    // operations of all trees are levelled together
+    int calculateTreeLogLikelihoods(const int* operations,
+                                    const int* operationCounts,
+                                    const int* rootBufferIndices,
+                                    const int* categoryWeightsIndices,
+                                    const int* stateFrequenciesIndices,
+                                    const int* cumulativeScaleIndices,
+                                    int treeCount,
+                                    double* outLogLikelihoods);
+
+    // Validates and schedules an updatePartials operation list once; returns its plan index
+    int createPlan(const int* operations,
+                   int count,
+                   int cumulativeScaleIndex);
+
+    int executePlan(int planIndex);
+
+    int finalizePlan(int planIndex);
+
+    int setTreeModel(const int* parentIndices,
+                     const double* edgeLengths,
+                     int nodeCount);
+
+    int setTreeModelEdgeLengths(const int* nodeIndices,
+                                const double* edgeLengths,
+                                int count);
+
+    // Updates only the matrices and partials of the tree model that are out of date,
+    // then integrates its root
+    int calculateTreeModelLogLikelihood(int eigenIndex,
+                                        int categoryWeightsIndex,
+                                        int stateFrequenciesIndex,
+                                        int cumulativeScaleIndex,
+                                        double* outLogLikelihood);
+
     // possible nulls: firstDerivativeIndices, secondDerivativeIndices,
     //                 outFirstDerivatives, outSecondDerivatives
     int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
@@ -290,29 +452,54 @@ public:
 
     int block(void);
 
+    int setCPUThreadCount(int threadCount);
+
+    int setCPUPatternBlockSize(int patternBlockSize);
+
+    int setCPUPatternCompression(int compress);
+
+    int setCPUPartialsSpill(const char* directory);
+
+    int saveState();
+
+    int restoreState();
+
+    int writeCheckpoint(const char* fileName);
+
+    int readCheckpoint(const char* fileName);
+
 	virtual const char* getName();
 
 	virtual const long getFlags();
 
 protected:
     virtual void calcStatesStates(REALTYPE* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const REALTYPE* matrices1,
-                                    const int* states2,
-                                    const REALTYPE* matrices2);
+                                    const unsigned char* states2,
+                                    const REALTYPE* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
 
 
     virtual void calcStatesPartials(REALTYPE* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
-                                    const REALTYPE* matrices2);
+                                    const REALTYPE* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
 
     virtual void calcPartialsPartials(REALTYPE* destP,
                                       const REALTYPE* partials1,
                                       const REALTYPE* matrices1,
                                       const REALTYPE* partials2,
-                                      const REALTYPE* matrices2);
+                                      const REALTYPE* matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
 
     virtual int calcRootLogLikelihoods(const int bufferIndex,
                                         const int categoryWeightsIndex,
@@ -367,45 +554,542 @@ protected:
                                                    double* outSumSecondDerivative);
 
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
-                                              const int *child0States,
+                                              const unsigned char *child0States,
                                               const REALTYPE *child0TransMat,
-                                              const int *child1States,
+                                              const unsigned char *child1States,
                                               const REALTYPE *child1TransMat,
-                                              const REALTYPE *scaleFactors);
+                                              const REALTYPE *scaleFactors,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern);
 
     virtual void calcStatesPartialsFixedScaling(REALTYPE *destP,
-                                                const int *child0States,
+                                                const unsigned char *child0States,
                                                 const REALTYPE *child0TransMat,
                                                 const REALTYPE *child1Partials,
                                                 const REALTYPE *child1TransMat,
-                                                const REALTYPE *scaleFactors);
+                                                const REALTYPE *scaleFactors,
+                                                int category,
+                                                int startPattern,
+                                                int endPattern);
 
     virtual void calcPartialsPartialsFixedScaling(REALTYPE *destP,
                                             const REALTYPE *child0States,
                                             const REALTYPE *child0TransMat,
                                             const REALTYPE *child1Partials,
                                             const REALTYPE *child1TransMat,
-                                            const REALTYPE *scaleFactors);
+                                            const REALTYPE *scaleFactors,
+                                            int category,
+                                            int startPattern,
+                                            int endPattern);
     
     virtual void calcPartialsPartialsAutoScaling(REALTYPE* destP,
                                                   const REALTYPE* partials1,
                                                   const REALTYPE* matrices1,
                                                   const REALTYPE* partials2,
                                                   const REALTYPE* matrices2,
-                                                  int* activateScaling);
+                                                  int* activateScaling,
+                                                  int category,
+                                                  int startPattern,
+                                                  int endPattern);
+
+    // Arguments shared by all (category, pattern block) tiles of one partials operation.
+    // fixedScalingFactors is non-NULL only for rescaling with existing factors and
+    // activateScaling is non-NULL only for auto-scaling of partials/partials
+    struct PartialsTileOperation {
+        REALTYPE* destP;
+        const unsigned char* states1;
+        const REALTYPE* partials1;
+        const REALTYPE* matrices1;
+        const unsigned char* states2;
+        const REALTYPE* partials2;
+        const REALTYPE* matrices2;
+        const REALTYPE* fixedScalingFactors;
+        int* activateScaling;
+        const REALTYPE* tipPairTable; // products for every (state1, state2) pair, or NULL
+    };
+
+    // Every tip-pair table of the current updatePartials call
+    std::vector<REALTYPE> gTipPairTables;
+
+    // true if a states/states operation is worth a tip-pair table
+    virtual bool useTipPairTable();
+
+    // Fills the products of both children's transition probabilities for every pair of
+    // states (including the gap code), per category, one padded partials row per pair
+    void fillTipPairTable(REALTYPE* table,
+                          const REALTYPE* matrices1,
+                          const REALTYPE* matrices2);
+
+    // Gathers the rows of a tip-pair table for patterns [startPattern, endPattern) of
+    // one category, dividing by scaleFactors if they are given
+    void calcStatesStatesTable(REALTYPE* destP,
+                               const unsigned char* states1,
+                               const unsigned char* states2,
+                               const REALTYPE* tipPairTable,
+                               const REALTYPE* scaleFactors,
+                               int category,
+                               int startPattern,
+                               int endPattern);
+
+    // Computes one category over patterns [startPattern, endPattern) of a partials
+    // operation, dispatching on which children are compact tip states
+    void calcPartialsTile(const PartialsTileOperation& operation,
+                          int category,
+                          int startPattern,
+                          int endPattern);
+
+    // One entry of an updatePartials operation list, decoded and placed in the
+    // operation dependency DAG. Operations on the same level touch disjoint buffers
+    struct ScheduledPartialsOperation {
+        PartialsTileOperation tiles;
+        const int* operation;       // the caller's 7-int tuple, or 9-int tuple by partition
+        int startPattern;           // patterns [startPattern, endPattern) of the operation's partition
+        int endPattern;
+        int patternBlockCount;      // pattern blocks and fused blocks over those patterns
+        int fusedBlockCount;
+        int cumulativeScaleIndex;   // cumulative scale buffer written factors are added to
+        int rescale;                // BEAGLE_OP_NONE, 0 read factors, 1 write factors, 2 auto-scaling
+        REALTYPE* scalingFactors;
+        int scalingIndex;           // scale buffer read (rescale == 0) or written (rescale == 1)
+        bool removeScaling;         // dynamic scaling removes the read factors from the cumulative buffer
+        int level;
+        int firstTask;              // index of this operation's first task within its level
+    };
+
+    std::vector<ScheduledPartialsOperation> gDecodedOperations;   // in caller order
+    std::vector<ScheduledPartialsOperation> gScheduledOperations; // grouped by level
+    std::vector<int> gScheduleLevelStarts;
+    std::vector<int> gPartialsWriteLevels;  // last level writing / reading each buffer
+    std::vector<int> gPartialsReadLevels;
+    std::vector<int> gScaleWriteLevels;
+    std::vector<int> gScaleReadLevels;
+    std::vector<int> gSpillLastReadLevels;  // last level reading each buffer, when spilled
+    std::vector<char> gScheduleTaskScaling; // auto-scaling activated by each task of the running level
+
+    // An updatePartials operation list validated and scheduled by createPlan. Buffer pointers
+    // are bound again on every run, as snapshots, spill files and checkpoints move buffers
+    struct PartialsPlan {
+        std::vector<int> operations; // the caller's tuples, copied
+        int cumulativeScaleIndex;
+        std::vector<ScheduledPartialsOperation> scheduledOperations; // grouped by level, pointing into operations
+        std::vector<int> levelStarts;
+        int levelCount;
+    };
+
+    std::vector<PartialsPlan*> gPartialsPlans; // NULL once finalized
+
+    // updatePartials, updatePartialsByPartition and calculateTreeLogLikelihoods: schedules
+    // and runs the operations, in tuples of 9 ints if byPartition. Factors written by
+    // operation i go to cumulativeScaleIndices[i], or cumulativeScaleIndex if that is NULL
+    int runPartialsOperations(const int* operations,
+                              int count,
+                              int cumulativeScaleIndex,
+                              const int* cumulativeScaleIndices,
+                              bool byPartition);
+
+    // Runs the levels in gScheduledOperations
+    int runScheduledOperations(int count,
+                               int levelCount);
+
+    // executePlan, once the plan's operations may run
+    int runPartialsPlan(int planIndex);
+
+    // With BEAGLE_FLAG_COMPUTATION_ASYNCH: copies the operations into a job for gAsyncQueue
+    // and returns at once. The job's errors are reported by waitForPartials or block
+    int queuePartialsOperations(const int* operations,
+                                int count,
+                                int cumulativeScaleIndex,
+                                const int* cumulativeScaleIndices,
+                                bool byPartition);
+
+    // Blocks until every queued updatePartials call has run and returns the first error
+    // one of them reported. Each call that reads or changes instance state, other than the
+    // updatePartials calls themselves, starts here and fails with that error
+    int waitForQueuedPartials();
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    class PartialsOperationsJob : public BeagleCPUAsyncQueue::Job {
+    public:
+        PartialsOperationsJob(BeagleCPUImpl* inImpl,
+                              const int* inOperations,
+                              int inCount,
+                              int inCumulativeScaleIndex,
+                              const int* inCumulativeScaleIndices,
+                              bool inByPartition)
+            : impl(inImpl),
+              operations(inOperations, inOperations + inCount * (inByPartition ? 9 : 7)),
+              count(inCount), cumulativeScaleIndex(inCumulativeScaleIndex),
+              byPartition(inByPartition) {
+            if (inCumulativeScaleIndices != NULL)
+                cumulativeScaleIndices.assign(inCumulativeScaleIndices, inCumulativeScaleIndices + inCount);
+        }
+        int execute() {
+            if (impl->kCompressPatterns && !impl->kPatternsCompressed)
+                impl->compressPatterns();
+            return impl->runPartialsOperations(&operations[0], count, cumulativeScaleIndex,
+                                               cumulativeScaleIndices.empty() ? NULL : &cumulativeScaleIndices[0],
+                                               byPartition);
+        }
+    private:
+        BeagleCPUImpl* impl;
+        std::vector<int> operations;
+        int count;
+        int cumulativeScaleIndex;
+        std::vector<int> cumulativeScaleIndices;
+        bool byPartition;
+    };
+
+    class PartialsPlanJob : public BeagleCPUAsyncQueue::Job {
+    public:
+        PartialsPlanJob(BeagleCPUImpl* inImpl,
+                        int inPlanIndex)
+            : impl(inImpl), planIndex(inPlanIndex) {
+        }
+        int execute() {
+            if (impl->kCompressPatterns && !impl->kPatternsCompressed)
+                impl->compressPatterns();
+            return impl->runPartialsPlan(planIndex);
+        }
+    private:
+        BeagleCPUImpl* impl;
+        int planIndex;
+    };
+#endif
 
+    // Decodes and levels the operations into gScheduledOperations; returns the level count.
+    // Operations on different partitions write disjoint patterns, so never depend on each other
+    int schedulePartialsOperations(const int* operations,
+                                   int count,
+                                   int cumulativeScaleIndex,
+                                   const int* cumulativeScaleIndices,
+                                   bool byPartition);
+
+    // Points scheduled operations at the instance's current buffers and fills their tip-pair
+    // tables; done on every run, so a cached schedule stays valid when buffers move
+    void bindScheduledOperations(ScheduledPartialsOperation* scheduledOperations,
+                                 int count,
+                                 bool byPartition);
+
+    // Runs every task of one level in parallel: a (category, pattern block) tile for
+    // operations that do not rescale, a fused rescale block for those that do
+    void runScheduledLevel(const ScheduledPartialsOperation* levelOperations,
+                           int levelOperationCount,
+                           int taskCount);
+
+    void executeScheduledTask(const ScheduledPartialsOperation* levelOperations,
+                              int levelOperationCount,
+                              int task);
+
+    // Computes all categories of one pattern block and rescales it while it is still in cache
+    void calcRescaledPartialsBlock(const ScheduledPartialsOperation& scheduled,
+                                   int block);
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    class ScheduledLevelTask : public BeagleCPUThreadPool::Task {
+    public:
+        ScheduledLevelTask(BeagleCPUImpl* inImpl,
+                           const ScheduledPartialsOperation* inLevelOperations,
+                           int inLevelOperationCount)
+            : impl(inImpl), levelOperations(inLevelOperations),
+              levelOperationCount(inLevelOperationCount) {}
+        void execute(int task) {
+            impl->executeScheduledTask(levelOperations, levelOperationCount, task);
+        }
+    private:
+        BeagleCPUImpl* impl;
+        const ScheduledPartialsOperation* levelOperations;
+        int levelOperationCount;
+    };
+#endif
+
+    // Arguments for integrating one subset of a root or edge likelihood. Root subsets
+    // leave transMatrix NULL, statesChild is non-NULL for a compact tip child and
+    // scaleFactors (cumulative, log scale) is NULL for unscaled subsets; mixedScaleFactors
+    // is its double-precision copy under BEAGLE_FLAG_PRECISION_MIXED
+    struct LikelihoodSubset {
+        const REALTYPE* partialsParent;
+        const REALTYPE* partialsChild;
+        const unsigned char* statesChild;
+        const REALTYPE* transMatrix;
+        const REALTYPE* wt;
+        const REALTYPE* freqs;
+        const REALTYPE* scaleFactors;
+        const double* mixedScaleFactors;
+    };
+
+    LikelihoodSubset rootLikelihoodSubset(int bufferIndex,
+                                          int categoryWeightsIndex,
+                                          int stateFrequenciesIndex,
+                                          int scaleBufferIndex);
+
+    LikelihoodSubset edgeLikelihoodSubset(int parentBufferIndex,
+                                          int childBufferIndex,
+                                          int probabilityIndex,
+                                          int categoryWeightsIndex,
+                                          int stateFrequenciesIndex,
+                                          int scaleBufferIndex);
+
+    // Fills outLogLikelihoodsTmp with the site log likelihoods of count subsets (whose
+    // site likelihoods are summed before the log) and returns their pattern-weighted
+    // sum. Fused blocks run in parallel and their sums are added in block order
+    int integrateLogLikelihoods(const LikelihoodSubset* subsets,
+                                int count,
+                                double* outSumLogLikelihood);
+
+    // Integrates, logs, scales and weights one fused block; returns its weighted sum
+    double integrateLogLikelihoodsBlock(const LikelihoodSubset* subsets,
+                                        int count,
+                                        REALTYPE* maxScaleFactors,
+                                        int block);
+
+    // integrateLogLikelihoodsBlock over patterns [startPattern, endPattern)
+    double integrateLogLikelihoodsRange(const LikelihoodSubset* subsets,
+                                        int count,
+                                        REALTYPE* maxScaleFactors,
+                                        int startPattern,
+                                        int endPattern);
+
+    // Writes the likelihoods of patterns [startPattern, endPattern), integrated over
+    // categories and states but not yet scaled, to outSiteLikelihoods[startPattern...]
+    virtual void integrateSiteLikelihoods(const LikelihoodSubset& subset,
+                                          REALTYPE* outSiteLikelihoods,
+                                          int startPattern,
+                                          int endPattern);
+
+    // integrateLogLikelihoodsRange under BEAGLE_FLAG_PRECISION_MIXED: sums, logs and scale
+    // factors in double, filling gMixedLogLikelihoods
+    double integrateLogLikelihoodsRangeMixed(const LikelihoodSubset* subsets,
+                                             int count,
+                                             int startPattern,
+                                             int endPattern);
+
+    // integrateSiteLikelihoods with every sum carried in double
+    virtual void integrateSiteLikelihoodsMixed(const LikelihoodSubset& subset,
+                                               double* outSiteLikelihoods,
+                                               int startPattern,
+                                               int endPattern);
+
+    // Refreshes the double-precision copy of patterns [startPattern, endPattern) of a
+    // scale buffer the kernels have just written
+    void updateMixedScaleFactors(int scaleBufferIndex,
+                                 int startPattern,
+                                 int endPattern);
+
+    std::vector<double> gBlockLogLikelihoods; // weighted sum of each fused block
+
+    // One fused block of one partition's root likelihood
+    struct PartitionLikelihoodBlock {
+        LikelihoodSubset subset;
+        int partition;              // position in the caller's partition list
+        int startPattern;
+        int endPattern;
+        double logLikelihood;       // weighted sum, once integrated
+    };
+
+    std::vector<PartitionLikelihoodBlock> gPartitionLikelihoodBlocks;
+
+    void integratePartitionLikelihoodBlock(int block);
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    class LikelihoodBlockTask : public BeagleCPUThreadPool::Task {
+    public:
+        LikelihoodBlockTask(BeagleCPUImpl* inImpl,
+                            const LikelihoodSubset* inSubsets,
+                            int inCount,
+                            REALTYPE* inMaxScaleFactors)
+            : impl(inImpl), subsets(inSubsets), count(inCount),
+              maxScaleFactors(inMaxScaleFactors) {}
+        void execute(int block) {
+            impl->gBlockLogLikelihoods[block] =
+                impl->integrateLogLikelihoodsBlock(subsets, count, maxScaleFactors, block);
+        }
+    private:
+        BeagleCPUImpl* impl;
+        const LikelihoodSubset* subsets;
+        int count;
+        REALTYPE* maxScaleFactors;
+    };
+
+    class PartitionLikelihoodTask : public BeagleCPUThreadPool::Task {
+    public:
+        PartitionLikelihoodTask(BeagleCPUImpl* inImpl)
+            : impl(inImpl) {}
+        void execute(int block) {
+            impl->integratePartitionLikelihoodBlock(block);
+        }
+    private:
+        BeagleCPUImpl* impl;
+    };
+#endif
+
+    // Arguments of one updateTransitionMatrices call, split into runs of edges
+    struct TransitionMatrixUpdate {
+        int eigenIndex;
+        const int* eigenIndices;        // per edge, with categoryRateIndices, if not NULL
+        const int* categoryRateIndices;
+        const int* probabilityIndices;
+        const int* firstDerivativeIndices;
+        const int* secondDerivativeIndices;
+        const double* edgeLengths;
+        int count;
+        int edgesPerTask;
+    };
+
+    // Splits an update into runs of edges and computes them in parallel
+    int runTransitionMatrixUpdate(TransitionMatrixUpdate& update);
+
+    void updateTransitionMatricesTask(const TransitionMatrixUpdate& update,
+                                      int task);
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    class TransitionMatrixTask : public BeagleCPUThreadPool::Task {
+    public:
+        TransitionMatrixTask(BeagleCPUImpl* inImpl,
+                             const TransitionMatrixUpdate& inUpdate)
+            : impl(inImpl), update(inUpdate) {}
+        void execute(int task) {
+            impl->updateTransitionMatricesTask(update, task);
+        }
+    private:
+        BeagleCPUImpl* impl;
+        const TransitionMatrixUpdate& update;
+    };
+
+    // Processors of the NUMA node this instance is bound to; empty for the whole machine
+    std::vector<int> gNumaCPUs;
+
+    // Zeroes the buffers taken from gArena so far on the pool's workers, so that each
+    // page is first touched, and so placed, on the NUMA node of a computing thread
+    void firstTouchArena();
+
+    class FirstTouchTask : public BeagleCPUThreadPool::Task {
+    public:
+        FirstTouchTask(char* inStart,
+                       size_t inSize)
+            : start(inStart), size(inSize) {}
+        void execute(int chunk) {
+            const size_t offset = (size_t) chunk * BEAGLE_CPU_FIRST_TOUCH_BYTES;
+            const size_t bytes = (size - offset < BEAGLE_CPU_FIRST_TOUCH_BYTES ?
+                                  size - offset : BEAGLE_CPU_FIRST_TOUCH_BYTES);
+            memset(start + offset, 0, bytes);
+        }
+    private:
+        char* start;
+        size_t size;
+    };
+#endif
+
+    // Recomputes the pattern and fused block sizes from kThreadCount
+    void updatePatternBlocks();
+
+    // Re-scales patterns [startPattern, endPattern) so that the largest partial
+    // over all categories is one, writing one factor per pattern
     virtual void rescalePartials(REALTYPE *destP,
     		                     REALTYPE *scaleFactors,
-                                 REALTYPE *cumulativeScaleFactors,
-                                 const int  fillWithOnes);
+                                 int startPattern,
+                                 int endPattern);
     
+    // Re-scales patterns [startPattern, endPattern) by powers of two, writing the exponents
     virtual void autoRescalePartials(REALTYPE *destP,
-    		                     signed short *scaleFactors);
+    		                     signed short *scaleFactors,
+                                 int startPattern,
+                                 int endPattern);
 
     virtual int getPaddedPatternsModulus();
 
+    // true if compact tip states are packed two patterns to a byte (see BEAGLE_CPU_PACKED_TIP_STATE)
+    virtual bool hasPackedTipStates();
+
+    // Sets kPartialsCategoryStride and kPartialsPatternStride for the current layout and pattern count
+    void updatePartialsStrides();
+
+    // Collapses identical site columns of the tip data into unique patterns with summed weights
+    void compressPatterns();
+
+    // Hash of everything the tips hold for a site column
+    unsigned long long hashPatternColumn(int column);
+
+    // true if every tip holds the same data for both site columns
+    bool samePatternColumns(int column1,
+                            int column2);
+
+    // true if the kernels index partials through kPartialsCategoryStride and
+    // kPartialsPatternStride, and so can use BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR
+    virtual bool supportsPatternMajorPartials();
+
     void* mallocAligned(size_t size);
 
+    // Takes a buffer from gArena, falling back to mallocAligned once the slab is used up
+    void* allocateBuffer(size_t size);
+
+    // Frees a buffer from allocateBuffer; those inside gArena go when the slab does
+    void freeBuffer(void* ptr);
+
+    // A partials buffer for bufferIndex: its slot in gSpill if the partials are
+    // spilled, otherwise one from allocateBuffer
+    REALTYPE* allocatePartials(int bufferIndex);
+
+    // Has the OS start reading the spilled partials of the operations on the level
+    // after level, so that the reads overlap the level's computation
+    void prefetchSpilledLevel(int level,
+                              int levelCount);
+
+    // Lets the OS write back the spilled partials that no operation after level reads
+    void evictSpilledLevel(int level);
+
+    // Before the first write to buffers[index] since saveState, parks its block in the
+    // log and gives the buffer another of length elements, copying the contents if preserve
+    template <typename T>
+    void detachBuffer(BeagleCPUSnapshotLog<T>& log,
+                      T** buffers,
+                      int index,
+                      size_t length,
+                      bool preserve);
+
+    // detachBuffer for a scale buffer and its double-precision copy
+    void detachScaleBuffer(int index,
+                           bool preserve);
+
+    // detachBuffer for the partials an operation writes and the scale buffers it rescales
+    void detachOperationBuffers(const int* operations,
+                                int count,
+                                int cumulativeScaleIndex,
+                                const int* cumulativeScaleIndices,
+                                bool byPartition);
+
+    // Patterns [startPattern, endPattern) of a partition; false if partitionIndex is out of range
+    bool getPartitionPatterns(int partitionIndex,
+                              int& startPattern,
+                              int& endPattern);
+
+    // Scale factor sums over patterns [startPattern, endPattern); not for BEAGLE_FLAG_SCALING_AUTO
+    void accumulateScaleFactorsRange(const int* scalingIndices,
+                                     int count,
+                                     int cumulativeScalingIndex,
+                                     int startPattern,
+                                     int endPattern);
+
+    void removeScaleFactorsRange(const int* scalingIndices,
+                                 int count,
+                                 int cumulativeScalingIndex,
+                                 int startPattern,
+                                 int endPattern);
+
+    // Frees the blocks held by a snapshot log
+    template <typename T>
+    void freeSnapshotLog(BeagleCPUSnapshotLog<T>& log);
+
+    // Contents and sizes of the checkpoint sections, in file order, for the given pattern layout
+    void getCheckpointSections(int paddedPatternCount,
+                               int compressedPatternCount,
+                               bool patternsCompressed,
+                               std::vector<char*>& data,
+                               std::vector<size_t>& bytes);
+
+    // Header describing this instance's shape, as written to checkpoints
+    void fillCheckpointHeader(BeagleCPUCheckpointHeader& header);
+
 };
 
 BEAGLE_CPU_FACTORY_TEMPLATE
@@ -79,8 +79,13 @@
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <algorithm>
 #include <cfloat>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/CPU/Precision.h"
 #include "libhmsbeagle/CPU/BeagleCPUImpl.h"
@@ -110,7 +115,7 @@ inline const long getBeagleCPUFlags(){ return BEAGLE_FLAG_COMPUTATION_SYNCH; };
 
 template<>
 inline const long getBeagleCPUFlags<double>(){ return BEAGLE_FLAG_COMPUTATION_SYNCH |
-                                                      BEAGLE_FLAG_THREADING_NONE |
+                                                      BEAGLE_CPU_THREADING_FLAG |
                                                       BEAGLE_FLAG_PROCESSOR_CPU |
                                                       BEAGLE_FLAG_PRECISION_DOUBLE |
                                                       BEAGLE_FLAG_VECTOR_NONE |
@@ -118,7 +123,7 @@ inline const long getBeagleCPUFlags<double>(){ return BEAGLE_FLAG_COMPUTATION_SY
 
 template<>
 inline const long getBeagleCPUFlags<float>(){ return BEAGLE_FLAG_COMPUTATION_SYNCH |
-                                                     BEAGLE_FLAG_THREADING_NONE |
+                                                     BEAGLE_CPU_THREADING_FLAG |
                                                      BEAGLE_FLAG_PROCESSOR_CPU |
                                                      BEAGLE_FLAG_PRECISION_SINGLE |
                                                      BEAGLE_FLAG_VECTOR_NONE |
@@ -132,6 +137,19 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     // If you delete partials, make sure not to delete the last element
     // which is TEMP_SCRATCH_PARTIAL twice.
 
+#ifdef BEAGLE_CPU_THREAD_POOL
+    // Queued work still uses the buffers below
+    delete gAsyncQueue;
+#endif
+
+    for (size_t i = 0; i < gPartialsPlans.size(); i++)
+        delete gPartialsPlans[i];
+
+    freeSnapshotLog(gPartialsLog);
+    freeSnapshotLog(gScaleBuffersLog);
+    freeSnapshotLog(gAutoScaleBuffersLog);
+    freeSnapshotLog(gTransitionMatricesLog);
+
     for(unsigned int i=0; i<kEigenDecompCount; i++) {
 	    if (gCategoryWeights[i] != NULL)
 		    free(gCategoryWeights[i]);
@@ -141,15 +159,15 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
 
 	for(unsigned int i=0; i<kMatrixCount; i++) {
 	    if (gTransitionMatrices[i] != NULL)
-		    free(gTransitionMatrices[i]);
+		    freeBuffer(gTransitionMatrices[i]);
 	}
     free(gTransitionMatrices);
 
 	for(unsigned int i=0; i<kBufferCount; i++) {
 	    if (gPartials[i] != NULL)
-		    free(gPartials[i]);
+		    freeBuffer(gPartials[i]);
 	    if (gTipStates[i] != NULL)
-		    free(gTipStates[i]);
+		    freeBuffer(gTipStates[i]);
 	}
     free(gPartials);
     free(gTipStates);
@@ -157,17 +175,17 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
             if (gAutoScaleBuffers[i] != NULL)
-                free(gAutoScaleBuffers[i]);
+                freeBuffer(gAutoScaleBuffers[i]);
         }
         if (gAutoScaleBuffers)
             free(gAutoScaleBuffers);
         free(gActiveScalingFactors);
         if (gScaleBuffers[0] != NULL)
-            free(gScaleBuffers[0]);
+            freeBuffer(gScaleBuffers[0]);
     } else {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
             if (gScaleBuffers[i] != NULL)
-                free(gScaleBuffers[i]);
+                freeBuffer(gScaleBuffers[i]);
         }        
     }
     
@@ -189,6 +207,10 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
 	free(zeros);
 
 	delete gEigenDecomposition;
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    delete gThreadPool;
+#endif
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -221,9 +243,14 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     assert(kBufferCount > kTipCount);
     kStateCount = stateCount;
     kPatternCount = patternCount;
+    kUncompressedPatternCount = patternCount;
+    kCompressPatterns = false;
+    kPatternsCompressed = false;
     
     kInternalPartialsBufferCount = kBufferCount - kTipCount;
 
+    kResourceNumber = resourceNumber;
+
     kTransPaddedStateCount = kStateCount + T_PAD;    
     kPartialsPaddedStateCount = kStateCount + P_PAD;
     
@@ -243,6 +270,15 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     kMatrixSize = (T_PAD + kStateCount) * kStateCount;
 
+#ifdef _OPENMP
+    kThreadCount = omp_get_max_threads();
+#else
+    kThreadCount = 1;
+#endif
+
+    gThreadPool = NULL;
+    gAsyncQueue = NULL;
+
     int scaleBufferSize = kPaddedPatternCount;
     
     kFlags = 0;
@@ -275,6 +311,39 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     	kFlags |= BEAGLE_FLAG_INVEVEC_TRANSPOSED;
     else
         kFlags |= BEAGLE_FLAG_INVEVEC_STANDARD;
+
+    if ((requirementFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR || preferenceFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR) &&
+        supportsPatternMajorPartials())
+        kFlags |= BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR;
+
+    if ((requirementFlags & BEAGLE_FLAG_PRECISION_MIXED || preferenceFlags & BEAGLE_FLAG_PRECISION_MIXED) &&
+        !DOUBLE_PRECISION)
+        kFlags |= BEAGLE_FLAG_PRECISION_MIXED;
+
+    updatePartialsStrides();
+
+    kAutoPatternBlockSize = true;
+    updatePatternBlocks();
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    std::vector<BeagleCPUNumaNode> numaNodes = getNumaNodes();
+    if (pluginResourceNumber > 0 && pluginResourceNumber <= (int) numaNodes.size()) {
+        // One NUMA node of the machine (see BeagleCPUOpenMPPlugin): a pool bound to its processors
+        gNumaCPUs = numaNodes[pluginResourceNumber - 1].cpus;
+        kFlags |= BEAGLE_FLAG_THREADING_CPP;
+        kThreadCount = (int) gNumaCPUs.size();
+        updatePatternBlocks();
+        gThreadPool = new BeagleCPUThreadPool(kThreadCount, gNumaCPUs);
+    } else if (requirementFlags & BEAGLE_FLAG_THREADING_CPP || preferenceFlags & BEAGLE_FLAG_THREADING_CPP) {
+        kFlags |= BEAGLE_FLAG_THREADING_CPP;
+        gThreadPool = new BeagleCPUThreadPool(kThreadCount, true);
+    }
+
+    if (requirementFlags & BEAGLE_FLAG_COMPUTATION_ASYNCH || preferenceFlags & BEAGLE_FLAG_COMPUTATION_ASYNCH) {
+        kFlags |= BEAGLE_FLAG_COMPUTATION_ASYNCH;
+        gAsyncQueue = new BeagleCPUAsyncQueue(kBufferCount);
+    }
+#endif
     
     if (kFlags & BEAGLE_FLAG_EIGEN_COMPLEX)
     	gEigenDecomposition = new EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>(kEigenDecompCount,
@@ -283,7 +352,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     	gEigenDecomposition = new EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>(kEigenDecompCount,
     			kStateCount, kCategoryCount,kFlags);
 
-	gCategoryRates = (double*) malloc(sizeof(double) * kCategoryCount);
+	gCategoryRates = (double*) malloc(sizeof(double) * kCategoryCount * kEigenDecompCount);
 	if (gCategoryRates == NULL)
 		throw std::bad_alloc();
 
@@ -308,7 +377,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     // assigning kBufferCount to this array so that we can just check if a tipStateBuffer is
     // allocated
-    gTipStates = (int**) malloc(sizeof(int*) * kBufferCount);
+    gTipStates = (unsigned char**) malloc(sizeof(unsigned char*) * kBufferCount);
     if (gTipStates == NULL)
         throw std::bad_alloc();
 
@@ -317,8 +386,36 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
         gTipStates[i] = NULL;
     }
 
+    // Reserve one slab for every buffer the arguments call for: the internal partials
+    // and scale buffers and transition matrices allocated here, and the tip partials
+    // and states that setTipPartials and setTipStates fill in later
+    const size_t partialsBytes = BeagleCPUArena::alignedSize(sizeof(REALTYPE) * kPartialsSize);
+    const size_t scaleBufferBytes = BeagleCPUArena::alignedSize(sizeof(REALTYPE) * scaleBufferSize);
+    const size_t matrixBytes = BeagleCPUArena::alignedSize(sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+    const size_t tipStatesBytes = BeagleCPUArena::alignedSize(hasPackedTipStates() ?
+                                                              (kPaddedPatternCount + 1) / 2 :
+                                                              kPaddedPatternCount);
+    int tipStatesCount = (compactBufferCount < kTipCount ? compactBufferCount : kTipCount);
+    if (kStateCount > BEAGLE_CPU_MAX_TIP_STATE_COUNT)
+        tipStatesCount = 0; // setTipStates stores these tips as partials
+    const int tipPartialsCount = kTipCount - tipStatesCount;
+
+    size_t arenaBytes = partialsBytes * (kInternalPartialsBufferCount + tipPartialsCount) +
+                        tipStatesBytes * tipStatesCount +
+                        matrixBytes * kMatrixCount;
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        arenaBytes += BeagleCPUArena::alignedSize(sizeof(signed short) * scaleBufferSize) * kScaleBufferCount +
+                      scaleBufferBytes;
+    else
+        arenaBytes += scaleBufferBytes * kScaleBufferCount;
+    gArena.reserve(arenaBytes); // if the slab cannot be had, allocateBuffer falls back to mallocAligned
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gThreadPool != NULL && numaNodes.size() > 1)
+        firstTouchArena();
+#endif
+
     for (int i = kTipCount; i < kBufferCount; i++) {
-        gPartials[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+        gPartials[i] = (REALTYPE*) allocateBuffer(sizeof(REALTYPE) * kPartialsSize);
         if (gPartials[i] == NULL)
             throw std::bad_alloc();
     }
@@ -332,20 +429,20 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
         if (gAutoScaleBuffers == NULL)
             throw std::bad_alloc();        
         for (int i = 0; i < kScaleBufferCount; i++) {
-            gAutoScaleBuffers[i] = (signed short*) malloc(sizeof(signed short) * scaleBufferSize);
+            gAutoScaleBuffers[i] = (signed short*) allocateBuffer(sizeof(signed short) * scaleBufferSize);
             if (gAutoScaleBuffers[i] == 0L)
                 throw std::bad_alloc();
         }
         gActiveScalingFactors = (int*) malloc(sizeof(int) * kInternalPartialsBufferCount);
         gScaleBuffers = (REALTYPE**) malloc(sizeof(REALTYPE*));
-        gScaleBuffers[0] = (REALTYPE*) malloc(sizeof(REALTYPE) * scaleBufferSize);
+        gScaleBuffers[0] = (REALTYPE*) allocateBuffer(sizeof(REALTYPE) * scaleBufferSize);
     } else {
         gScaleBuffers = (REALTYPE**) malloc(sizeof(REALTYPE*) * kScaleBufferCount);
         if (gScaleBuffers == NULL)
             throw std::bad_alloc();
         
         for (int i = 0; i < kScaleBufferCount; i++) {
-            gScaleBuffers[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * scaleBufferSize);
+            gScaleBuffers[i] = (REALTYPE*) allocateBuffer(sizeof(REALTYPE) * scaleBufferSize);
             
             if (gScaleBuffers[i] == 0L)
                 throw std::bad_alloc();
@@ -358,17 +455,36 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
             }
         }
     }
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) {
+        const int mixedScaleBufferCount = (kFlags & BEAGLE_FLAG_SCALING_AUTO ? 1 : kScaleBufferCount);
+        gMixedScaleBuffers.assign(mixedScaleBufferCount,
+                                  std::vector<double>(scaleBufferSize, (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC ? 1.0 : 0.0)));
+        gMixedIntegrationTmp.resize(2 * kPaddedPatternCount);
+        gMixedLogLikelihoods.resize(kPaddedPatternCount);
+    }
         
 
     gTransitionMatrices = (REALTYPE**) malloc(sizeof(REALTYPE*) * kMatrixCount);
     if (gTransitionMatrices == NULL)
         throw std::bad_alloc();
     for (int i = 0; i < kMatrixCount; i++) {
-        gTransitionMatrices[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+        gTransitionMatrices[i] = (REALTYPE*) allocateBuffer(sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
         if (gTransitionMatrices[i] == 0L)
             throw std::bad_alloc();
     }
 
+    gPartialsLog.resize(kBufferCount);
+    gTransitionMatricesLog.resize(kMatrixCount);
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        gScaleBuffersLog.resize(1);
+        gAutoScaleBuffersLog.resize(kScaleBufferCount);
+        gParkedActiveScalingFactors.resize(kScaleBufferCount);
+    } else {
+        gScaleBuffersLog.resize(kScaleBufferCount);
+    }
+    gParkedMixedScaleBuffers.resize(gMixedScaleBuffers.size());
+
     integrationTmp = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPatternCount * kStateCount);
     firstDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
     secondDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * kStateCount);
@@ -400,9 +516,13 @@ const long BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getFlags() {
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getInstanceDetails(BeagleInstanceDetails* returnInfo) {
     if (returnInfo != NULL) {
-        returnInfo->resourceNumber = 0;
+        returnInfo->resourceNumber = kResourceNumber;
         returnInfo->flags = getFlags();
         returnInfo->flags |= kFlags;
+        if (kFlags & BEAGLE_FLAG_THREADING_CPP)
+            returnInfo->flags &= ~BEAGLE_FLAG_THREADING_OPENMP;
+        if (kFlags & BEAGLE_FLAG_COMPUTATION_ASYNCH)
+            returnInfo->flags &= ~BEAGLE_FLAG_COMPUTATION_SYNCH;
 
         returnInfo->implName = (char*) getName();
     }
@@ -413,16 +533,47 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getInstanceDetails(BeagleInstanceDetails*
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
                                 const int* inStates) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
     if (tipIndex < 0 || tipIndex >= kTipCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
-    gTipStates[tipIndex] = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
-    // TODO: What if this throws a memory full error?
-	for (int j = 0; j < kPatternCount; j++) {
-		gTipStates[tipIndex][j] = (inStates[j] < kStateCount ? inStates[j] : kStateCount);
-	}
-	for (int j = kPatternCount; j < kPaddedPatternCount; j++) {
-		gTipStates[tipIndex][j] = kStateCount;
-	}
+    if (kPatternsCompressed)
+        return BEAGLE_ERROR_GENERAL; // columns were collapsed using the current tip data
+
+    if (kStateCount > BEAGLE_CPU_MAX_TIP_STATE_COUNT) {
+        // States do not fit in a byte, so keep this tip as partials instead
+        std::vector<double> tipPartials(kPatternCount * kStateCount, 0.0);
+        for (int j = 0; j < kPatternCount; j++) {
+            if (inStates[j] < kStateCount)
+                tipPartials[j * kStateCount + inStates[j]] = 1.0;
+            else
+                std::fill(tipPartials.begin() + j * kStateCount,
+                          tipPartials.begin() + (j + 1) * kStateCount, 1.0);
+        }
+        return setTipPartials(tipIndex, &tipPartials[0]);
+    }
+
+    const bool packed = hasPackedTipStates();
+    const int stateBytes = (packed ? (kPaddedPatternCount + 1) / 2 : kPaddedPatternCount);
+    if (gTipStates[tipIndex] == NULL) {
+        gTipStates[tipIndex] = (unsigned char*) allocateBuffer(stateBytes);
+        if (gTipStates[tipIndex] == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+
+    unsigned char* tipStates = gTipStates[tipIndex];
+    if (packed)
+        memset(tipStates, 0, stateBytes);
+    for (int j = 0; j < kPaddedPatternCount; j++) {
+        const int state = (j < kPatternCount && inStates[j] < kStateCount ? inStates[j] : kStateCount);
+        if (packed)
+            tipStates[j >> 1] |= (unsigned char) (state << ((j & 1) << 2));
+        else
+            tipStates[j] = (unsigned char) state;
+    }
 
     return BEAGLE_SUCCESS;
 }
@@ -430,28 +581,38 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
                                   const double* inPartials) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
     if (tipIndex < 0 || tipIndex >= kTipCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (kPatternsCompressed)
+        return BEAGLE_ERROR_GENERAL; // columns were collapsed using the current tip data
     if(gPartials[tipIndex] == NULL) {
-        gPartials[tipIndex] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+        gPartials[tipIndex] = allocatePartials(tipIndex);
         // TODO: What if this throws a memory full error?
         if (gPartials[tipIndex] == 0L)
             return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
+    detachBuffer(gPartialsLog, gPartials, tipIndex, kPartialsSize, true);
 
     const double* inPartialsOffset;
-    REALTYPE* tmpRealPartialsOffset = gPartials[tipIndex];
     for (int l = 0; l < kCategoryCount; l++) {
         inPartialsOffset = inPartials;
+        REALTYPE* tmpRealPartialsOffset = gPartials[tipIndex] + l * kPartialsCategoryStride;
         for (int i = 0; i < kPatternCount; i++) {
-        	beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
-            tmpRealPartialsOffset += kPartialsPaddedStateCount;
+            beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
+            tmpRealPartialsOffset += kPartialsPatternStride;
             inPartialsOffset += kStateCount;
         }
-    	// Pad extra buffer with zeros
-    	for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
-    		*tmpRealPartialsOffset++ = 0;
-    	}
+        // Pad extra buffer with zeros
+        for (int i = kPatternCount; i < kPaddedPatternCount; i++) {
+            for (int k = 0; k < kPartialsPaddedStateCount; k++)
+                tmpRealPartialsOffset[k] = 0;
+            tmpRealPartialsOffset += kPartialsPatternStride;
+        }
     }
 
     return BEAGLE_SUCCESS;
@@ -460,26 +621,36 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
                                const double* inPartials) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
     if (bufferIndex < 0 || bufferIndex >= kBufferCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
     if (gPartials[bufferIndex] == NULL) {
-        gPartials[bufferIndex] = (REALTYPE*) malloc(sizeof(REALTYPE) * kPartialsSize);
+        gPartials[bufferIndex] = allocatePartials(bufferIndex);
         if (gPartials[bufferIndex] == 0L)
             return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
+    detachBuffer(gPartialsLog, gPartials, bufferIndex, kPartialsSize, true);
     
     const double* inPartialsOffset = inPartials;
-    REALTYPE* tmpRealPartialsOffset = gPartials[bufferIndex];
     for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE* tmpRealPartialsOffset = gPartials[bufferIndex] + l * kPartialsCategoryStride;
         for (int i = 0; i < kPatternCount; i++) {
-        	beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
-            tmpRealPartialsOffset += kPartialsPaddedStateCount;
+            if (kPatternsCompressed) // each pattern is read from its first column
+                inPartialsOffset = inPartials + (l * kUncompressedPatternCount + gPatternColumns[i]) * kStateCount;
+            beagleMemCpy(tmpRealPartialsOffset, inPartialsOffset, kStateCount);
+            tmpRealPartialsOffset += kPartialsPatternStride;
             inPartialsOffset += kStateCount;
         }
-    	// Pad extra buffer with zeros
-    	for(int k = 0; k < kPartialsPaddedStateCount * (kPaddedPatternCount - kPatternCount); k++) {
-    		*tmpRealPartialsOffset++ = 0;
-    	}
+        // Pad extra buffer with zeros
+        for (int i = kPatternCount; i < kPaddedPatternCount; i++) {
+            for (int k = 0; k < kPartialsPaddedStateCount; k++)
+                tmpRealPartialsOffset[k] = 0;
+            tmpRealPartialsOffset += kPartialsPatternStride;
+        }
     }
 
     return BEAGLE_SUCCESS;
@@ -489,13 +660,45 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
                                int cumulativeScaleIndex,
                                double* outPartials) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
     // TODO: Make this work with partials padding
     
 	// TODO: Test with and without padding
     if (bufferIndex < 0 || bufferIndex >= kBufferCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    if (kPatternCount == kPaddedPatternCount) {
+    if (kPatternsCompressed) { // Every column gets the partials of its pattern
+    	const REALTYPE* cumulativeScaleBuffer = (cumulativeScaleIndex != BEAGLE_OP_NONE ?
+    	                                         gScaleBuffers[cumulativeScaleIndex] : NULL);
+    	double* offsetOutPartials = outPartials;
+    	for (int l = 0; l < kCategoryCount; l++) {
+    		for (int j = 0; j < kUncompressedPatternCount; j++) {
+    			const int k = gPatternMap[j];
+    			const REALTYPE* offsetBeaglePartials = gPartials[bufferIndex] + l * kPartialsCategoryStride +
+    			                                       k * kPartialsPatternStride;
+    			const double scaleFactor = (cumulativeScaleBuffer != NULL ? exp(cumulativeScaleBuffer[k]) : 1.0);
+    			for (int i = 0; i < kStateCount; i++)
+    				offsetOutPartials[i] = offsetBeaglePartials[i] * scaleFactor;
+    			offsetOutPartials += kStateCount;
+    		}
+    	}
+    	return BEAGLE_SUCCESS;
+    }
+
+    if (kFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR) { // Hand back the category-major layout clients use
+    	double* offsetOutPartials = outPartials;
+    	for (int l = 0; l < kCategoryCount; l++) {
+    		const REALTYPE* offsetBeaglePartials = gPartials[bufferIndex] + l * kPartialsCategoryStride;
+    		for (int k = 0; k < kPatternCount; k++) {
+    			beagleMemCpy(offsetOutPartials, offsetBeaglePartials, kStateCount);
+    			offsetOutPartials += kStateCount;
+    			offsetBeaglePartials += kPartialsPatternStride;
+    		}
+    	}
+    } else if (kPatternCount == kPaddedPatternCount) {
     	beagleMemCpy(outPartials, gPartials[bufferIndex], kPartialsSize);
     } else { // Need to remove padding
     	double *offsetOutPartials;
@@ -529,6 +732,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setEigenDecomposition(int eigenIndex,
                                          const double* inEigenVectors,
                                          const double* inInverseEigenVectors,
                                          const double* inEigenValues) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
 
 	gEigenDecomposition->setEigenDecomposition(eigenIndex, inEigenVectors, inInverseEigenVectors, inEigenValues);
 	return BEAGLE_SUCCESS;
@@ -536,20 +743,82 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setEigenDecomposition(int eigenIndex,
 
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRates(const double* inCategoryRates) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
 	memcpy(gCategoryRates, inCategoryRates, sizeof(double) * kCategoryCount);
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryRatesWithIndex(int categoryRatesIndex,
+                                                                 const double* inCategoryRates) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
+    if (categoryRatesIndex < 0 || categoryRatesIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    memcpy(gCategoryRates + categoryRatesIndex * kCategoryCount, inCategoryRates, sizeof(double) * kCategoryCount);
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
+                                                            const int* inPatternPartitions) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (partitionCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (kCompressPatterns)
+        return BEAGLE_ERROR_GENERAL; // collapsed columns would mix partitions
+
+    // Each partition is a run of consecutive patterns
+    std::vector<int> starts(partitionCount + 1, 0);
+    for (int k = 0; k < kPatternCount; k++) {
+        const int partition = inPatternPartitions[k];
+        if (partition < 0 || partition >= partitionCount ||
+            (k > 0 && partition < inPatternPartitions[k - 1]))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        starts[partition + 1]++;
+    }
+    for (int p = 0; p < partitionCount; p++)
+        starts[p + 1] += starts[p];
+    gPatternPartitionStarts.swap(starts);
+
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternWeights(const double* inPatternWeights) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
     assert(inPatternWeights != 0L);
-    memcpy(gPatternWeights, inPatternWeights, sizeof(double) * kPatternCount);
+    if (kPatternsCompressed) { // Columns collapsed into one pattern add their weights
+        for (int k = 0; k < kPatternCount; k++)
+            gPatternWeights[k] = 0.0;
+        for (int j = 0; j < kUncompressedPatternCount; j++)
+            gPatternWeights[gPatternMap[j]] += inPatternWeights[j];
+    } else {
+        memcpy(gPatternWeights, inPatternWeights, sizeof(double) * kPatternCount);
+    }
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
     int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setStateFrequencies(int stateFrequenciesIndex,
                                                      const double* inStateFrequencies) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
     if (stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
     if (gStateFrequencies[stateFrequenciesIndex] == NULL) {
@@ -565,6 +834,10 @@ BEAGLE_CPU_TEMPLATE
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryWeights(int categoryWeightsIndex,
                                                  const double* inCategoryWeights) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
     if (categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
     if (gCategoryWeights[categoryWeightsIndex] == NULL) {
@@ -580,6 +853,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryWeights(int categoryWeightsInd
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getTransitionMatrix(int matrixIndex,
 												 double* outMatrix) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
 	// TODO Test with multiple rate categories
 if (T_PAD != 0) {
 	double* offsetOutMatrix = outMatrix;
@@ -600,6 +877,20 @@ if (T_PAD != 0) {
 
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikelihoods) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) {
+        for (int j = 0; j < (kPatternsCompressed ? kUncompressedPatternCount : kPatternCount); j++)
+            outLogLikelihoods[j] = gMixedLogLikelihoods[kPatternsCompressed ? gPatternMap[j] : j];
+        return BEAGLE_SUCCESS;
+    }
+    if (kPatternsCompressed) {
+        for (int j = 0; j < kUncompressedPatternCount; j++)
+            outLogLikelihoods[j] = outLogLikelihoodsTmp[gPatternMap[j]];
+        return BEAGLE_SUCCESS;
+    }
     beagleMemCpy(outLogLikelihoods, outLogLikelihoodsTmp, kPatternCount);
 
     return BEAGLE_SUCCESS;
@@ -608,6 +899,18 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikel
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getSiteDerivatives(double* outFirstDerivatives,
                                                 double* outSecondDerivatives) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (kPatternsCompressed) {
+        for (int j = 0; j < kUncompressedPatternCount; j++) {
+            outFirstDerivatives[j] = outFirstDerivativesTmp[gPatternMap[j]];
+            if (outSecondDerivatives != NULL)
+                outSecondDerivatives[j] = outSecondDerivativesTmp[gPatternMap[j]];
+        }
+        return BEAGLE_SUCCESS;
+    }
     beagleMemCpy(outFirstDerivatives, outFirstDerivativesTmp, kPatternCount);
     if (outSecondDerivatives != NULL)
         beagleMemCpy(outSecondDerivatives, outSecondDerivativesTmp, kPatternCount);
@@ -620,6 +923,12 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrix(int matrixIndex,
                                        const double* inMatrix,
                                        double paddedValue) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
+    detachBuffer(gTransitionMatricesLog, gTransitionMatrices, matrixIndex, (size_t) kMatrixSize * kCategoryCount, false);
 
 if (T_PAD != 0) {
     const double* offsetInMatrix = inMatrix;
@@ -644,9 +953,15 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrices(const int* matrixIn
                                                              const double* inMatrices,
                                                              const double* paddedValues,
                                                              int count) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
     for (int k = 0; k < count; k++) {
         const double* inMatrix = inMatrices + k*kStateCount*kStateCount*kCategoryCount;
         int matrixIndex = matrixIndices[k];
+        detachBuffer(gTransitionMatricesLog, gTransitionMatrices, matrixIndex, (size_t) kMatrixSize * kCategoryCount, false);
         
 if (T_PAD != 0) {
         const double* offsetInMatrix = inMatrix;
@@ -679,6 +994,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* fir
 		const int* secondIndices,
 		const int* resultIndices,
 		int matrixCount) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
 
 #ifdef BEAGLE_DEBUG_FLOW
 	fprintf(stderr, "\t Entering BeagleCPUImpl::convolveTransitionMatrices \n");
@@ -699,6 +1018,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* fir
 
 		}//END: overwrite check
 
+		detachBuffer(gTransitionMatricesLog, gTransitionMatrices, resultIndices[u], (size_t) kMatrixSize * kCategoryCount, true);
+
 		REALTYPE* C = gTransitionMatrices[resultIndices[u]];
 		REALTYPE* A = gTransitionMatrices[firstIndices[u]];
 		REALTYPE* B = gTransitionMatrices[secondIndices[u]];
@@ -785,379 +1106,2314 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatrices(int eigenIndex,
                                             const int* secondDerivativeIndices,
                                             const double* edgeLengths,
                                             int count) {
-	gEigenDecomposition->updateTransitionMatrices(eigenIndex,probabilityIndices,firstDerivativeIndices,secondDerivativeIndices,
-												  edgeLengths,gCategoryRates,gTransitionMatrices,count);
-	return BEAGLE_SUCCESS;
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
+    TransitionMatrixUpdate update;
+    update.eigenIndex = eigenIndex;
+    update.eigenIndices = NULL;
+    update.categoryRateIndices = NULL;
+    update.probabilityIndices = probabilityIndices;
+    update.firstDerivativeIndices = firstDerivativeIndices;
+    update.secondDerivativeIndices = secondDerivativeIndices;
+    update.edgeLengths = edgeLengths;
+    update.count = count;
+
+    return runTransitionMatrixUpdate(update);
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
-                                  int count,
-                                  int cumulativeScaleIndex) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMultipleModels(const int* eigenIndices,
+                                                                                  const int* categoryRateIndices,
+                                                                                  const int* probabilityIndices,
+                                                                                  const int* firstDerivativeIndices,
+                                                                                  const int* secondDerivativeIndices,
+                                                                                  const double* edgeLengths,
+                                                                                  int count) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
+    for (int i = 0; i < count; i++) {
+        if (eigenIndices[i] < 0 || eigenIndices[i] >= kEigenDecompCount ||
+            categoryRateIndices[i] < 0 || categoryRateIndices[i] >= kEigenDecompCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
 
-    REALTYPE* cumulativeScaleBuffer = NULL;
-    if (cumulativeScaleIndex != BEAGLE_OP_NONE)
-        cumulativeScaleBuffer = gScaleBuffers[cumulativeScaleIndex];
+    TransitionMatrixUpdate update;
+    update.eigenIndex = BEAGLE_OP_NONE;
+    update.eigenIndices = eigenIndices;
+    update.categoryRateIndices = categoryRateIndices;
+    update.probabilityIndices = probabilityIndices;
+    update.firstDerivativeIndices = firstDerivativeIndices;
+    update.secondDerivativeIndices = secondDerivativeIndices;
+    update.edgeLengths = edgeLengths;
+    update.count = count;
+
+    return runTransitionMatrixUpdate(update);
+}
 
-    for (int op = 0; op < count; op++) {
-        if (DEBUGGING_OUTPUT) {
-            std::cerr << "op[0]= " << operations[0] << "\n";
-            std::cerr << "op[1]= " << operations[1] << "\n";
-            std::cerr << "op[2]= " << operations[2] << "\n";
-            std::cerr << "op[3]= " << operations[3] << "\n";
-            std::cerr << "op[4]= " << operations[4] << "\n";
-            std::cerr << "op[5]= " << operations[5] << "\n";
-            std::cerr << "op[6]= " << operations[6] << "\n";
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::runTransitionMatrixUpdate(TransitionMatrixUpdate& update) {
+    const int count = update.count;
+
+    if (gTransitionMatricesLog.isActive()) {
+        const size_t matrixLength = (size_t) kMatrixSize * kCategoryCount;
+        for (int i = 0; i < count; i++) {
+            detachBuffer(gTransitionMatricesLog, gTransitionMatrices, update.probabilityIndices[i], matrixLength, true);
+            if (update.firstDerivativeIndices != NULL)
+                detachBuffer(gTransitionMatricesLog, gTransitionMatrices, update.firstDerivativeIndices[i], matrixLength, true);
+            if (update.secondDerivativeIndices != NULL)
+                detachBuffer(gTransitionMatricesLog, gTransitionMatrices, update.secondDerivativeIndices[i], matrixLength, true);
         }
+    }
 
-        const int parIndex = operations[op * 7];
-        const int writeScalingIndex = operations[op * 7 + 1];
-        const int readScalingIndex = operations[op * 7 + 2];
-        const int child1Index = operations[op * 7 + 3];
-        const int child1TransMatIndex = operations[op * 7 + 4];
-        const int child2Index = operations[op * 7 + 5];
-        const int child2TransMatIndex = operations[op * 7 + 6];
+    // Split the edges into runs that each carry enough work to be worth a thread
+    int taskCount = 1;
+    if (kThreadCount > 1 && gEigenDecomposition->isThreadSafe()) {
+        const long edgeWork = (long) kCategoryCount * kStateCount * kStateCount * kStateCount;
+        const long minEdges = BEAGLE_CPU_MIN_MATRIX_TASK_WORK / edgeWork + 1;
+        taskCount = (int) (count / minEdges);
+        if (taskCount > kThreadCount)
+            taskCount = kThreadCount;
+    }
 
-        const REALTYPE* partials1 = gPartials[child1Index];
-        const REALTYPE* partials2 = gPartials[child2Index];
+    if (taskCount <= 1) {
+        update.edgesPerTask = count;
+        updateTransitionMatricesTask(update, 0);
+        return BEAGLE_SUCCESS;
+    }
 
-        const int* tipStates1 = gTipStates[child1Index];
-        const int* tipStates2 = gTipStates[child2Index];
+    update.edgesPerTask = (count + taskCount - 1) / taskCount;
+    taskCount = (count + update.edgesPerTask - 1) / update.edgesPerTask;
 
-        const REALTYPE* matrices1 = gTransitionMatrices[child1TransMatIndex];
-        const REALTYPE* matrices2 = gTransitionMatrices[child2TransMatIndex];
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gThreadPool != NULL) {
+        TransitionMatrixTask task(this, update);
+        gThreadPool->run(taskCount, &task);
+        return BEAGLE_SUCCESS;
+    }
+#endif
 
-        REALTYPE* destPartials = gPartials[parIndex];
+#pragma omp parallel for num_threads(kThreadCount) schedule(static)
+    for (int task = 0; task < taskCount; task++)
+        updateTransitionMatricesTask(update, task);
 
-        int rescale = BEAGLE_OP_NONE;
-        REALTYPE* scalingFactors = NULL;
-        
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
-            gActiveScalingFactors[parIndex - kTipCount] = 0;
-            if (tipStates1 == 0 && tipStates2 == 0)
-                rescale = 2;
-        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            rescale = 1;
-            scalingFactors = gScaleBuffers[parIndex - kTipCount];
-        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
-            if (tipStates1 == 0 && tipStates2 == 0) {
-                rescale = 1;
-                removeScaleFactors(&readScalingIndex, 1, cumulativeScaleIndex);
-                scalingFactors = gScaleBuffers[writeScalingIndex];
-            }
-        } else if (writeScalingIndex >= 0) {
-            rescale = 1;
-            scalingFactors = gScaleBuffers[writeScalingIndex];
-        } else if (readScalingIndex >= 0) {
-            rescale = 0;
-            scalingFactors = gScaleBuffers[readScalingIndex];
-        }
+    return BEAGLE_SUCCESS;
+}
 
-        if (DEBUGGING_OUTPUT) {
-            std::cerr << "Rescale= " << rescale << " writeIndex= " << writeScalingIndex
-                     << " readIndex = " << readScalingIndex << "\n";
-        }
-
-        if (tipStates1 != NULL) {
-            if (tipStates2 != NULL ) {
-                if (rescale == 0) { // Use fixed scaleFactors
-                    calcStatesStatesFixedScaling(destPartials, tipStates1, matrices1, tipStates2, matrices2,
-                                                 scalingFactors);
-                } else {
-                    // First compute without any scaling
-                    calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2);
-                    if (rescale == 1) // Recompute scaleFactors
-                        rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                }
-            } else {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2, matrices2,
-                                                   scalingFactors);
-                } else {
-                    calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2);
-                    if (rescale == 1)
-                        rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                }
-            }
-        } else {
-            if (tipStates2 != NULL) {
-                if (rescale == 0) {
-                    calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
-                                                   scalingFactors);
-                } else {
-                    calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1);
-                    if (rescale == 1)
-                        rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                }
-            } else {
-                if (rescale == 2) {
-                    int sIndex = parIndex - kTipCount;
-                    calcPartialsPartialsAutoScaling(destPartials,partials1,matrices1,partials2,matrices2,
-                                                     &gActiveScalingFactors[sIndex]);
-                    if (gActiveScalingFactors[sIndex])
-                        autoRescalePartials(destPartials, gAutoScaleBuffers[sIndex]);
-
-                } else if (rescale == 0) {
-                    calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,matrices2,
-                                                     scalingFactors);
-                } else {
-                    calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2);
-                    if (rescale == 1)
-                        rescalePartials(destPartials,scalingFactors,cumulativeScaleBuffer,0);
-                }
-            }
-        }
-        
-        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
-            int parScalingIndex = parIndex - kTipCount;
-            int child1ScalingIndex = child1Index - kTipCount;
-            int child2ScalingIndex = child2Index - kTipCount;
-            if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
-                int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 2, parScalingIndex);
-            } else if (child1ScalingIndex >= 0) {
-                int scalingIndices[1] = {child1ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
-            } else if (child2ScalingIndex >= 0) {
-                int scalingIndices[1] = {child2ScalingIndex};
-                accumulateScaleFactors(scalingIndices, 1, parScalingIndex);
-            }
-        }
-        
-        if (DEBUGGING_OUTPUT) {
-            if (scalingFactors != NULL && rescale == 0) {
-                for(int i=0; i<kPatternCount; i++)
-                    fprintf(stderr,"old scaleFactor[%d] = %.5f\n",i,scalingFactors[i]);
-            }
-            fprintf(stderr,"Result partials:\n");
-            for(int i = 0; i < kPartialsSize; i++)
-                fprintf(stderr,"destP[%d] = %.5f\n",i,destPartials[i]);
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesTask(const TransitionMatrixUpdate& update,
+                                                                     int task) {
+    const int start = task * update.edgesPerTask;
+    int count = update.count - start;
+    if (count > update.edgesPerTask)
+        count = update.edgesPerTask;
+
+    if (update.eigenIndices != NULL) {
+        // Each edge has its own model, so goes through the decomposition on its own
+        for (int i = start; i < start + count; i++) {
+            gEigenDecomposition->updateTransitionMatrices(update.eigenIndices[i],
+                                                          update.probabilityIndices + i,
+                                                          (update.firstDerivativeIndices != NULL ? update.firstDerivativeIndices + i : NULL),
+                                                          (update.secondDerivativeIndices != NULL ? update.secondDerivativeIndices + i : NULL),
+                                                          update.edgeLengths + i,
+                                                          gCategoryRates + update.categoryRateIndices[i] * kCategoryCount,
+                                                          gTransitionMatrices,
+                                                          1);
         }
+        return;
     }
 
-    return BEAGLE_SUCCESS;
+    gEigenDecomposition->updateTransitionMatrices(update.eigenIndex,
+                                                  update.probabilityIndices + start,
+                                                  (update.firstDerivativeIndices != NULL ? update.firstDerivativeIndices + start : NULL),
+                                                  (update.secondDerivativeIndices != NULL ? update.secondDerivativeIndices + start : NULL),
+                                                  update.edgeLengths + start,
+                                                  gCategoryRates,
+                                                  gTransitionMatrices,
+                                                  count);
 }
 
-
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::waitForPartials(const int* destinationPartials,
-                                   int destinationPartialsCount) {
-    return BEAGLE_SUCCESS;
-}
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
+                                  int count,
+                                  int cumulativeScaleIndex) {
 
+    if (gAsyncQueue != NULL)
+        return queuePartialsOperations(operations, count, cumulativeScaleIndex, NULL, false);
 
-BEAGLE_CPU_TEMPLATE
-    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoods(const int* bufferIndices,
-                                                             const int* categoryWeightsIndices,
-                                                             const int* stateFrequenciesIndices,
-                                                             const int* cumulativeScaleIndices,
-                                                             int count,
-                                                             double* outSumLogLikelihood) {
+    if (kCompressPatterns && !kPatternsCompressed)
+        compressPatterns();
 
-    if (count == 1) {
-        // We treat this as a special case so that we don't have convoluted logic
-        //      at the end of the loop over patterns
-        int cumulativeScalingFactorIndex;
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
-            cumulativeScalingFactorIndex = 0;
-        else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-            cumulativeScalingFactorIndex = bufferIndices[0] - kTipCount; 
-        else
-            cumulativeScalingFactorIndex = cumulativeScaleIndices[0];
-        return calcRootLogLikelihoods(bufferIndices[0], categoryWeightsIndices[0], stateFrequenciesIndices[0],
-                               cumulativeScalingFactorIndex, outSumLogLikelihood);
-    }
-    else
-    {
-        return calcRootLogLikelihoodsMulti(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices,
-                                    cumulativeScaleIndices, count, outSumLogLikelihood);
-    }
+    return runPartialsOperations(operations, count, cumulativeScaleIndex, NULL, false);
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bufferIndices,
-                                                         const int* categoryWeightsIndices,
-                                                         const int* stateFrequenciesIndices,
-                                                         const int* scaleBufferIndices,
-                                                         int count,
-                                                         double* outSumLogLikelihood) {
-    // Here we do the 3 similar operations:
-    //              1. to set the lnL to the contribution of the first subset,
-    //              2. to add the lnL for other subsets up to the penultimate
-    //              3. to add the final subset and take the lnL
-    //      This form of the calc would not work when count == 1 because
-    //              we need operation 1 and 3 in the preceding list.  This is not
-    //              a problem, though as we deal with count == 1 in the previous
-    //              branch.
-
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
-
-    int returnCode = BEAGLE_SUCCESS;
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* operations,
+                                                                 int count) {
+    if (gPatternPartitionStarts.empty())
+        return BEAGLE_ERROR_GENERAL; // no partitions set
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION; // these keep per-buffer state that spans every pattern
+    if (count <= 0)
+        return BEAGLE_SUCCESS;
+
+    const int partitionCount = (int) gPatternPartitionStarts.size() - 1;
+    std::vector<int> cumulativeScaleIndices(count);
+    for (int op = 0; op < count; op++) {
+        if (operations[op * 9 + 7] < 0 || operations[op * 9 + 7] >= partitionCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        cumulativeScaleIndices[op] = operations[op * 9 + 8];
+    }
 
-    for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
-        const int rootPartialIndex = bufferIndices[subsetIndex];
-        const REALTYPE* rootPartials = gPartials[rootPartialIndex];
-        const REALTYPE* frequencies = gStateFrequencies[stateFrequenciesIndices[subsetIndex]];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[subsetIndex]];
-        int u = 0;
-        int v = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            for (int i = 0; i < kStateCount; i++) {
-                integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
-                u++;
-                v++;
-            }
-            v += P_PAD;
-        }
-        for (int l = 1; l < kCategoryCount; l++) {
-            u = 0;
-            for (int k = 0; k < kPatternCount; k++) {
-                for (int i = 0; i < kStateCount; i++) {
-                    integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
-                    u++;
-                    v++;
-                }
-                v += P_PAD;
-            }
-        }
-        u = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            REALTYPE sum = 0.0;
-            for (int i = 0; i < kStateCount; i++) {
-                sum += ((REALTYPE)frequencies[i]) * integrationTmp[u];
-                u++;
-            }
+    if (gAsyncQueue != NULL)
+        return queuePartialsOperations(operations, count, BEAGLE_OP_NONE, &cumulativeScaleIndices[0], true);
 
-            // TODO: allow only some subsets to have scale indices
-            if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-                int cumulativeScalingFactorIndex;
-                if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-                    cumulativeScalingFactorIndex = rootPartialIndex - kTipCount; 
-                else
-                    cumulativeScalingFactorIndex = scaleBufferIndices[subsetIndex];
-                
-                const REALTYPE* cumulativeScaleFactors = gScaleBuffers[cumulativeScalingFactorIndex];
-
-                if (subsetIndex == 0) {
-                    indexMaxScale[k] = 0;
-                    maxScaleFactor[k] = cumulativeScaleFactors[k];
-                    for (int j = 1; j < count; j++) {
-                        REALTYPE tmpScaleFactor;
-                        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-                            tmpScaleFactor = gScaleBuffers[bufferIndices[j] - kTipCount][k]; 
-                        else
-                            tmpScaleFactor = gScaleBuffers[scaleBufferIndices[j]][k];
-
-                        if (tmpScaleFactor > maxScaleFactor[k]) {
-                            indexMaxScale[k] = j;
-                            maxScaleFactor[k] = tmpScaleFactor;
-                        }
-                    }
-                }
+    return runPartialsOperations(operations, count, BEAGLE_OP_NONE, &cumulativeScaleIndices[0], true);
+}
 
-                if (subsetIndex != indexMaxScale[k])
-                    sum *= exp((REALTYPE)(cumulativeScaleFactors[k] - maxScaleFactor[k]));
-            }
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::queuePartialsOperations(const int* operations,
+                                                               int count,
+                                                               int cumulativeScaleIndex,
+                                                               const int* cumulativeScaleIndices,
+                                                               bool byPartition) {
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (count <= 0)
+        return BEAGLE_SUCCESS;
+
+    const int stride = (byPartition ? 9 : 7);
+    std::vector<int> destinations(count);
+    for (int op = 0; op < count; op++)
+        destinations[op] = operations[op * stride];
+
+    gAsyncQueue->push(new PartialsOperationsJob(this, operations, count, cumulativeScaleIndex,
+                                                cumulativeScaleIndices, byPartition),
+                      &destinations[0], count);
+    return BEAGLE_SUCCESS;
+#else
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+#endif
+}
 
-            if (subsetIndex == 0) {
-                outLogLikelihoodsTmp[k] = sum;
-            } else if (subsetIndex == count - 1) {
-                REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sum;
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::waitForQueuedPartials() {
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gAsyncQueue != NULL)
+        return gAsyncQueue->waitAll();
+#endif
+    return BEAGLE_SUCCESS;
+}
 
-                outLogLikelihoodsTmp[k] = log(tmpSum);
-            } else {
-                outLogLikelihoodsTmp[k] += sum;
-            }
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createPlan(const int* operations,
+                                                 int count,
+                                                 int cumulativeScaleIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    // Checked once here, so executePlan can skip it
+    const bool scaleIndicesUsed = !(kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS));
+    if (count <= 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE && scaleIndicesUsed &&
+        (cumulativeScaleIndex < 0 || cumulativeScaleIndex >= kScaleBufferCount))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * 7;
+        if (operation[0] < kTipCount || operation[0] >= kBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        for (int c = 3; c <= 5; c += 2) {
+            if (operation[c] < 0 || operation[c] >= kBufferCount || operation[c] == operation[0] ||
+                operation[c + 1] < 0 || operation[c + 1] >= kMatrixCount)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+        }
+        for (int i = 1; i <= 2 && scaleIndicesUsed; i++) {
+            if (operation[i] != BEAGLE_OP_NONE && (operation[i] < 0 || operation[i] >= kScaleBufferCount))
+                return BEAGLE_ERROR_OUT_OF_RANGE;
         }
     }
 
-    if (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)) {
-        for(int i=0; i<kPatternCount; i++)
-            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
-    }
+    PartialsPlan* plan = new PartialsPlan;
+    plan->operations.assign(operations, operations + count * 7);
+    plan->cumulativeScaleIndex = cumulativeScaleIndex;
+    plan->levelCount = schedulePartialsOperations(&plan->operations[0], count, cumulativeScaleIndex,
+                                                  NULL, false);
+    plan->scheduledOperations.swap(gScheduledOperations);
+    plan->levelStarts.swap(gScheduleLevelStarts);
+
+    int planIndex = 0;
+    while (planIndex < (int) gPartialsPlans.size() && gPartialsPlans[planIndex] != NULL)
+        planIndex++;
+    if (planIndex == (int) gPartialsPlans.size())
+        gPartialsPlans.push_back(NULL);
+    gPartialsPlans[planIndex] = plan;
+
+    return planIndex;
+}
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::executePlan(int planIndex) {
+    if (planIndex < 0 || planIndex >= (int) gPartialsPlans.size() || gPartialsPlans[planIndex] == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gAsyncQueue != NULL) {
+        const PartialsPlan& plan = *gPartialsPlans[planIndex];
+        const int count = (int) plan.scheduledOperations.size();
+        std::vector<int> destinations(count);
+        for (int op = 0; op < count; op++)
+            destinations[op] = plan.operations[op * 7];
+        gAsyncQueue->push(new PartialsPlanJob(this, planIndex), &destinations[0], count);
+        return BEAGLE_SUCCESS;
     }
+#endif
 
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
+    if (kCompressPatterns && !kPatternsCompressed)
+        compressPatterns();
 
+    return runPartialsPlan(planIndex);
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
-                            const int categoryWeightsIndex,
-                            const int stateFrequenciesIndex,
-                            const int scalingFactorsIndex,
-                            double* outSumLogLikelihood) {
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::runPartialsPlan(int planIndex) {
+    PartialsPlan& plan = *gPartialsPlans[planIndex];
+    const int count = (int) plan.scheduledOperations.size();
 
-    int returnCode = BEAGLE_SUCCESS;
+    gTreeModel.markAllDirty();
 
-    const REALTYPE* rootPartials = gPartials[bufferIndex];
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
-    int u = 0;
-    int v = 0;
-    for (int k = 0; k < kPatternCount; k++) {
-        for (int i = 0; i < kStateCount; i++) {
-            integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
-            u++;
-            v++;
-        }
-        v += P_PAD;
-    }
-    for (int l = 1; l < kCategoryCount; l++) {
-        u = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            for (int i = 0; i < kStateCount; i++) {
-                integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
-                u++;
-                v++;
-            }
-            v += P_PAD;
-        }
-    }
-    u = 0;
-    for (int k = 0; k < kPatternCount; k++) {
-    	REALTYPE sum = 0.0;
-        for (int i = 0; i < kStateCount; i++) {
-            sum += freqs[i] * integrationTmp[u];
-            u++;
-        }
+    if (gPartialsLog.isActive())
+        detachOperationBuffers(&plan.operations[0], count, plan.cumulativeScaleIndex, NULL, false);
 
-        outLogLikelihoodsTmp[k] = log(sum);
-    }
+    // Lend the schedule to the instance for the run
+    gScheduledOperations.swap(plan.scheduledOperations);
+    gScheduleLevelStarts.swap(plan.levelStarts);
+    bindScheduledOperations(&gScheduledOperations[0], count, false);
 
-    if (scalingFactorsIndex >= 0) {
-    	const REALTYPE* cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
-    	for(int i=0; i<kPatternCount; i++) {
-    		outLogLikelihoodsTmp[i] += cumulativeScaleFactors[i];
-        }
-    }
+    const int returnCode = runScheduledOperations(count, plan.levelCount);
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    gScheduledOperations.swap(plan.scheduledOperations);
+    gScheduleLevelStarts.swap(plan.levelStarts);
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::finalizePlan(int planIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (planIndex < 0 || planIndex >= (int) gPartialsPlans.size() || gPartialsPlans[planIndex] == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    delete gPartialsPlans[planIndex];
+    gPartialsPlans[planIndex] = NULL;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::runPartialsOperations(const int* operations,
+                                                             int count,
+                                                             int cumulativeScaleIndex,
+                                                             const int* cumulativeScaleIndices,
+                                                             bool byPartition) {
+    // calculateTreeModelLogLikelihood marks its own nodes clean again afterwards
+    gTreeModel.markAllDirty();
+
+    // Before scheduling, which takes the buffers' current blocks
+    if (gPartialsLog.isActive())
+        detachOperationBuffers(operations, count, cumulativeScaleIndex, cumulativeScaleIndices, byPartition);
+
+    const int levelCount = schedulePartialsOperations(operations, count, cumulativeScaleIndex,
+                                                      cumulativeScaleIndices, byPartition);
+
+    return runScheduledOperations(count, levelCount);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::runScheduledOperations(int count,
+                                                              int levelCount) {
+    if (gSpill.isOpen()) {
+        gSpillLastReadLevels.assign(kBufferCount, -1);
+        for (int op = 0; op < count; op++) {
+            const ScheduledPartialsOperation& scheduled = gScheduledOperations[op];
+            for (int c = 3; c <= 5; c += 2) {
+                int& lastRead = gSpillLastReadLevels[scheduled.operation[c]];
+                lastRead = std::max(lastRead, scheduled.level);
+            }
+        }
+        prefetchSpilledLevel(0, levelCount);
+    }
+
+    for (int level = 0; level < levelCount; level++) {
+        ScheduledPartialsOperation* levelOperations = &gScheduledOperations[gScheduleLevelStarts[level]];
+        const int levelOperationCount = gScheduleLevelStarts[level + 1] - gScheduleLevelStarts[level];
+
+        // Bookkeeping on shared scaling buffers stays in the caller's operation order
+        int taskCount = 0;
+        for (int i = 0; i < levelOperationCount; i++) {
+            ScheduledPartialsOperation& scheduled = levelOperations[i];
+            const int* operation = scheduled.operation;
+
+            if (DEBUGGING_OUTPUT) {
+                for (int j = 0; j < 7; j++)
+                    std::cerr << "op[" << j << "]= " << operation[j] << "\n";
+                std::cerr << "Rescale= " << scheduled.rescale << " writeIndex= " << operation[1]
+                         << " readIndex = " << operation[2] << " level = " << level << "\n";
+            }
+
+            if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+                gActiveScalingFactors[operation[0] - kTipCount] = 0;
+            if (scheduled.removeScaling)
+                removeScaleFactorsRange(&operation[2], 1, scheduled.cumulativeScaleIndex, 0, kPatternCount);
+
+            // Pattern-major blocks already hold every category of their patterns
+            scheduled.firstTask = taskCount;
+            if (scheduled.rescale == 1 || scheduled.rescale == 2)
+                taskCount += scheduled.fusedBlockCount;
+            else if (kFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR)
+                taskCount += scheduled.patternBlockCount;
+            else
+                taskCount += kCategoryCount * scheduled.patternBlockCount;
+        }
+
+        if (gSpill.isOpen())
+            prefetchSpilledLevel(level + 1, levelCount);
+
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+            gScheduleTaskScaling.assign(taskCount, 0);
+
+        // Operations within a level are independent, so all of their tasks run together
+        runScheduledLevel(levelOperations, levelOperationCount, taskCount);
+
+        if (gSpill.isOpen())
+            evictSpilledLevel(level);
+
+        for (int i = 0; i < levelOperationCount; i++) {
+            const ScheduledPartialsOperation& scheduled = levelOperations[i];
+            const int* operation = scheduled.operation;
+            const int parIndex = operation[0];
+
+            // Blocks of one operation ran in parallel, so each flagged its own task
+            if (scheduled.rescale == 2) {
+                for (int block = 0; block < scheduled.fusedBlockCount; block++) {
+                    if (gScheduleTaskScaling[scheduled.firstTask + block]) {
+                        *scheduled.tiles.activateScaling = 1;
+                        break;
+                    }
+                }
+            }
+
+            if (scheduled.rescale == 1 && (kFlags & BEAGLE_FLAG_PRECISION_MIXED))
+                updateMixedScaleFactors(scheduled.scalingIndex, scheduled.startPattern, scheduled.endPattern);
+
+            // Same additions, in the same order, as rescaling straight into the cumulative buffer
+            if (scheduled.rescale == 1 && scheduled.cumulativeScaleIndex != BEAGLE_OP_NONE)
+                accumulateScaleFactorsRange(&scheduled.scalingIndex, 1, scheduled.cumulativeScaleIndex,
+                                            scheduled.startPattern, scheduled.endPattern);
+
+            if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+                int parScalingIndex = parIndex - kTipCount;
+                int child1ScalingIndex = operation[3] - kTipCount;
+                int child2ScalingIndex = operation[5] - kTipCount;
+                if (child1ScalingIndex >= 0 && child2ScalingIndex >= 0) {
+                    int scalingIndices[2] = {child1ScalingIndex, child2ScalingIndex};
+                    accumulateScaleFactorsRange(scalingIndices, 2, parScalingIndex, 0, kPatternCount);
+                } else if (child1ScalingIndex >= 0) {
+                    int scalingIndices[1] = {child1ScalingIndex};
+                    accumulateScaleFactorsRange(scalingIndices, 1, parScalingIndex, 0, kPatternCount);
+                } else if (child2ScalingIndex >= 0) {
+                    int scalingIndices[1] = {child2ScalingIndex};
+                    accumulateScaleFactorsRange(scalingIndices, 1, parScalingIndex, 0, kPatternCount);
+                }
+            }
+
+            if (DEBUGGING_OUTPUT) {
+                if (scheduled.scalingFactors != NULL && scheduled.rescale == 0) {
+                    for(int j=0; j<kPatternCount; j++)
+                        fprintf(stderr,"old scaleFactor[%d] = %.5f\n",j,scheduled.scalingFactors[j]);
+                }
+                fprintf(stderr,"Result partials:\n");
+                for(int j = 0; j < kPartialsSize; j++)
+                    fprintf(stderr,"destP[%d] = %.5f\n",j,gPartials[parIndex][j]);
+            }
+        }
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::schedulePartialsOperations(const int* operations,
+                                                                  int count,
+                                                                  int cumulativeScaleIndex,
+                                                                  const int* cumulativeScaleIndices,
+                                                                  bool byPartition) {
+    const int operationSize = (byPartition ? 9 : 7);
+
+    // Buffers are tracked per partition, as operations on different partitions touch disjoint patterns
+    const int partitionCount = (byPartition ? (int) gPatternPartitionStarts.size() - 1 : 1);
+    gPartialsWriteLevels.assign(kBufferCount * partitionCount, -1);
+    gPartialsReadLevels.assign(kBufferCount * partitionCount, -1);
+    gScaleWriteLevels.assign(kScaleBufferCount * partitionCount, -1);
+    gScaleReadLevels.assign(kScaleBufferCount * partitionCount, -1);
+    gDecodedOperations.resize(count);
+
+    int levelCount = 0;
+
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * operationSize;
+        const int parIndex = operation[0];
+        const int writeScalingIndex = operation[1];
+        const int readScalingIndex = operation[2];
+        const int child1Index = operation[3];
+        const int child2Index = operation[5];
+        const bool partialsChildren = (gTipStates[child1Index] == NULL && gTipStates[child2Index] == NULL);
+
+        ScheduledPartialsOperation& scheduled = gDecodedOperations[op];
+        scheduled.operation = operation;
+        scheduled.cumulativeScaleIndex = (cumulativeScaleIndices != NULL ? cumulativeScaleIndices[op] :
+                                          cumulativeScaleIndex);
+
+        int rescale = BEAGLE_OP_NONE;
+        int scalingIndex = BEAGLE_OP_NONE;
+        bool removeScaling = false;
+
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+            if (partialsChildren)
+                rescale = 2;
+        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            rescale = 1;
+            scalingIndex = parIndex - kTipCount;
+        } else if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) { // TODO: this is a quick and dirty implementation just so it returns correct results
+            if (partialsChildren) {
+                rescale = 1;
+                removeScaling = true;
+                scalingIndex = writeScalingIndex;
+            }
+        } else if (writeScalingIndex >= 0) {
+            rescale = 1;
+            scalingIndex = writeScalingIndex;
+        } else if (readScalingIndex >= 0) {
+            rescale = 0;
+            scalingIndex = readScalingIndex;
+        }
+
+        scheduled.rescale = rescale;
+        scheduled.removeScaling = removeScaling;
+        scheduled.scalingIndex = scalingIndex;
+
+        // Buffers this operation reads and writes; scale buffers are only tracked
+        // for the indices the instance can actually hold
+        int scaleReads[3] = {-1, -1, -1};
+        int scaleWrite = -1;
+        if (rescale == 0 || removeScaling)
+            scaleReads[0] = readScalingIndex;
+        if (rescale == 1)
+            scaleWrite = scalingIndex;
+        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            scaleReads[1] = child1Index - kTipCount;
+            scaleReads[2] = child2Index - kTipCount;
+        }
+
+        // Levels of this operation's partition
+        const int partitionSlot = (byPartition ? operation[7] : 0);
+        int* partialsWriteLevels = gPartialsWriteLevels.data() + partitionSlot * kBufferCount;
+        int* partialsReadLevels = gPartialsReadLevels.data() + partitionSlot * kBufferCount;
+        int* scaleWriteLevels = gScaleWriteLevels.data() + partitionSlot * kScaleBufferCount;
+        int* scaleReadLevels = gScaleReadLevels.data() + partitionSlot * kScaleBufferCount;
+
+        // Earliest level after every operation this one depends on (RAW, WAW and WAR)
+        int level = 0;
+        level = std::max(level, partialsWriteLevels[child1Index] + 1);
+        level = std::max(level, partialsWriteLevels[child2Index] + 1);
+        level = std::max(level, partialsWriteLevels[parIndex] + 1);
+        level = std::max(level, partialsReadLevels[parIndex] + 1);
+        for (int i = 0; i < 3; i++) {
+            if (scaleReads[i] >= 0 && scaleReads[i] < kScaleBufferCount)
+                level = std::max(level, scaleWriteLevels[scaleReads[i]] + 1);
+        }
+        if (scaleWrite >= 0 && scaleWrite < kScaleBufferCount) {
+            level = std::max(level, scaleWriteLevels[scaleWrite] + 1);
+            level = std::max(level, scaleReadLevels[scaleWrite] + 1);
+        }
+
+        partialsReadLevels[child1Index] = std::max(partialsReadLevels[child1Index], level);
+        partialsReadLevels[child2Index] = std::max(partialsReadLevels[child2Index], level);
+        partialsWriteLevels[parIndex] = level;
+        for (int i = 0; i < 3; i++) {
+            if (scaleReads[i] >= 0 && scaleReads[i] < kScaleBufferCount)
+                scaleReadLevels[scaleReads[i]] = std::max(scaleReadLevels[scaleReads[i]], level);
+        }
+        if (scaleWrite >= 0 && scaleWrite < kScaleBufferCount)
+            scaleWriteLevels[scaleWrite] = level;
+
+        scheduled.level = level;
+        if (level + 1 > levelCount)
+            levelCount = level + 1;
+    }
+
+    // Group operations by level, keeping the caller's order within each level
+    gScheduleLevelStarts.assign(levelCount + 1, 0);
+    for (int op = 0; op < count; op++)
+        gScheduleLevelStarts[gDecodedOperations[op].level + 1]++;
+    for (int level = 0; level < levelCount; level++)
+        gScheduleLevelStarts[level + 1] += gScheduleLevelStarts[level];
+
+    gScheduledOperations.resize(count);
+    std::vector<int>& nextSlot = gPartialsReadLevels; // no longer needed, reuse as scratch
+    nextSlot.assign(gScheduleLevelStarts.begin(), gScheduleLevelStarts.end() - 1);
+    for (int op = 0; op < count; op++)
+        gScheduledOperations[nextSlot[gDecodedOperations[op].level]++] = gDecodedOperations[op];
+
+    if (count > 0)
+        bindScheduledOperations(&gScheduledOperations[0], count, byPartition);
+
+    return levelCount;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::bindScheduledOperations(ScheduledPartialsOperation* scheduledOperations,
+                                                                int count,
+                                                                bool byPartition) {
+    // Cherries get a table of tip-pair products, built once here rather than per pattern
+    const int tipPairTableSize = (kStateCount + 1) * (kStateCount + 1) * kPartialsPaddedStateCount * kCategoryCount;
+    int tipPairTableCount = 0;
+    if (useTipPairTable()) {
+        for (int op = 0; op < count; op++) {
+            const int* operation = scheduledOperations[op].operation;
+            if (gTipStates[operation[3]] != NULL && gTipStates[operation[5]] != NULL)
+                tipPairTableCount++;
+        }
+    }
+    gTipPairTables.resize((size_t) tipPairTableSize * tipPairTableCount);
+    tipPairTableCount = 0;
+
+    for (int op = 0; op < count; op++) {
+        ScheduledPartialsOperation& scheduled = scheduledOperations[op];
+        const int* operation = scheduled.operation;
+        const int parIndex = operation[0];
+        const int child1Index = operation[3];
+        const int child2Index = operation[5];
+
+        if (byPartition) {
+            scheduled.startPattern = gPatternPartitionStarts[operation[7]];
+            scheduled.endPattern = gPatternPartitionStarts[operation[7] + 1];
+        } else {
+            scheduled.startPattern = 0;
+            scheduled.endPattern = kPatternCount;
+        }
+        const int patternCount = scheduled.endPattern - scheduled.startPattern;
+        scheduled.patternBlockCount = (patternCount + kPatternBlockSize - 1) / kPatternBlockSize;
+        scheduled.fusedBlockCount = (patternCount + kFusedBlockSize - 1) / kFusedBlockSize;
+
+        PartialsTileOperation& tiles = scheduled.tiles;
+        tiles.destP = gPartials[parIndex];
+        tiles.states1 = gTipStates[child1Index];
+        tiles.partials1 = gPartials[child1Index];
+        tiles.matrices1 = gTransitionMatrices[operation[4]];
+        tiles.states2 = gTipStates[child2Index];
+        tiles.partials2 = gPartials[child2Index];
+        tiles.matrices2 = gTransitionMatrices[operation[6]];
+        tiles.tipPairTable = NULL;
+        if (tiles.states1 != NULL && tiles.states2 != NULL && !gTipPairTables.empty()) {
+            REALTYPE* table = &gTipPairTables[(size_t) tipPairTableSize * tipPairTableCount++];
+            fillTipPairTable(table, tiles.matrices1, tiles.matrices2);
+            tiles.tipPairTable = table;
+        }
+
+        scheduled.scalingFactors = (scheduled.scalingIndex >= 0 ? gScaleBuffers[scheduled.scalingIndex] : NULL);
+        tiles.fixedScalingFactors = (scheduled.rescale == 0 ? scheduled.scalingFactors : NULL);
+        tiles.activateScaling = (scheduled.rescale == 2 ? &gActiveScalingFactors[parIndex - kTipCount] : NULL);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::prefetchSpilledLevel(int level,
+                                                             int levelCount) {
+    if (level >= levelCount)
+        return;
+    for (int i = gScheduleLevelStarts[level]; i < gScheduleLevelStarts[level + 1]; i++) {
+        const int* operation = gScheduledOperations[i].operation;
+        gSpill.prefetch(gPartials[operation[0]]);
+        gSpill.prefetch(gPartials[operation[3]]); // tip children without partials are not in gSpill
+        gSpill.prefetch(gPartials[operation[5]]);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::evictSpilledLevel(int level) {
+    // Results are left in place for the likelihood calculations that follow
+    for (int i = gScheduleLevelStarts[level]; i < gScheduleLevelStarts[level + 1]; i++) {
+        const int* operation = gScheduledOperations[i].operation;
+        for (int c = 3; c <= 5; c += 2) {
+            const int child = operation[c];
+            if (gSpillLastReadLevels[child] == level)
+                gSpill.evict(gPartials[child]);
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::runScheduledLevel(const ScheduledPartialsOperation* levelOperations,
+                                                          int levelOperationCount,
+                                                          int taskCount) {
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gThreadPool != NULL) {
+        ScheduledLevelTask task(this, levelOperations, levelOperationCount);
+        gThreadPool->run(taskCount, &task);
+        return;
+    }
+#endif
+
+#pragma omp parallel for num_threads(kThreadCount) schedule(dynamic) if(kThreadCount > 1 && taskCount > 1)
+    for (int task = 0; task < taskCount; task++)
+        executeScheduledTask(levelOperations, levelOperationCount, task);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::executeScheduledTask(const ScheduledPartialsOperation* levelOperations,
+                                                             int levelOperationCount,
+                                                             int task) {
+    // Last operation whose first task is not after this one
+    int low = 0;
+    int high = levelOperationCount - 1;
+    while (low < high) {
+        const int mid = (low + high + 1) / 2;
+        if (levelOperations[mid].firstTask <= task)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+    const ScheduledPartialsOperation& scheduled = levelOperations[low];
+    const int operationTask = task - scheduled.firstTask;
+
+    if (scheduled.rescale == 1 || scheduled.rescale == 2) {
+        calcRescaledPartialsBlock(scheduled, operationTask);
+    } else if (kFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR) {
+        const int startPattern = scheduled.startPattern + operationTask * kPatternBlockSize;
+        int endPattern = startPattern + kPatternBlockSize;
+        if (endPattern > scheduled.endPattern)
+            endPattern = scheduled.endPattern;
+        for (int l = 0; l < kCategoryCount; l++)
+            calcPartialsTile(scheduled.tiles, l, startPattern, endPattern);
+    } else {
+        const int category = operationTask / scheduled.patternBlockCount;
+        const int startPattern = scheduled.startPattern + (operationTask % scheduled.patternBlockCount) * kPatternBlockSize;
+        int endPattern = startPattern + kPatternBlockSize;
+        if (endPattern > scheduled.endPattern)
+            endPattern = scheduled.endPattern;
+        calcPartialsTile(scheduled.tiles, category, startPattern, endPattern);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRescaledPartialsBlock(const ScheduledPartialsOperation& scheduled,
+                                                                  int block) {
+    const int startPattern = scheduled.startPattern + block * kFusedBlockSize;
+    int endPattern = startPattern + kFusedBlockSize;
+    if (endPattern > scheduled.endPattern)
+        endPattern = scheduled.endPattern;
+
+    REALTYPE* destP = scheduled.tiles.destP;
+
+    if (scheduled.rescale == 1) {
+        for (int l = 0; l < kCategoryCount; l++)
+            calcPartialsTile(scheduled.tiles, l, startPattern, endPattern);
+
+        // Accumulation into the cumulative buffer happens afterwards, in operation order
+        rescalePartials(destP, scheduled.scalingFactors, startPattern, endPattern);
+    } else {
+        // Each block decides for itself whether to rescale; unscaled blocks get zero
+        // exponents, so the factors stay consistent once any block activates scaling
+        PartialsTileOperation tiles = scheduled.tiles;
+        int activateScaling = 0;
+        tiles.activateScaling = &activateScaling;
+        for (int l = 0; l < kCategoryCount; l++)
+            calcPartialsTile(tiles, l, startPattern, endPattern);
+
+        signed short* scaleFactors = gAutoScaleBuffers[scheduled.operation[0] - kTipCount];
+        if (activateScaling) {
+            autoRescalePartials(destP, scaleFactors, startPattern, endPattern);
+            gScheduleTaskScaling[scheduled.firstTask + block] = 1;
+        } else {
+            for (int k = startPattern; k < endPattern; k++)
+                scaleFactors[k] = 0;
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsTile(const PartialsTileOperation& operation,
+                                                         int category,
+                                                         int startPattern,
+                                                         int endPattern) {
+    REALTYPE* destP = operation.destP;
+    const unsigned char* states1 = operation.states1;
+    const REALTYPE* partials1 = operation.partials1;
+    const REALTYPE* matrices1 = operation.matrices1;
+    const unsigned char* states2 = operation.states2;
+    const REALTYPE* partials2 = operation.partials2;
+    const REALTYPE* matrices2 = operation.matrices2;
+    const REALTYPE* fixedScalingFactors = operation.fixedScalingFactors;
+    int* activateScaling = operation.activateScaling;
+
+    if (states1 != NULL) {
+        if (operation.tipPairTable != NULL)
+            calcStatesStatesTable(destP, states1, states2, operation.tipPairTable,
+                                  fixedScalingFactors, category, startPattern, endPattern);
+        else if (states2 != NULL) {
+            if (fixedScalingFactors != NULL)
+                calcStatesStatesFixedScaling(destP, states1, matrices1, states2, matrices2,
+                                             fixedScalingFactors, category, startPattern, endPattern);
+            else
+                calcStatesStates(destP, states1, matrices1, states2, matrices2,
+                                 category, startPattern, endPattern);
+        } else {
+            if (fixedScalingFactors != NULL)
+                calcStatesPartialsFixedScaling(destP, states1, matrices1, partials2, matrices2,
+                                               fixedScalingFactors, category, startPattern, endPattern);
+            else
+                calcStatesPartials(destP, states1, matrices1, partials2, matrices2,
+                                   category, startPattern, endPattern);
+        }
+    } else {
+        if (states2 != NULL) {
+            if (fixedScalingFactors != NULL)
+                calcStatesPartialsFixedScaling(destP, states2, matrices2, partials1, matrices1,
+                                               fixedScalingFactors, category, startPattern, endPattern);
+            else
+                calcStatesPartials(destP, states2, matrices2, partials1, matrices1,
+                                   category, startPattern, endPattern);
+        } else {
+            if (activateScaling != NULL)
+                calcPartialsPartialsAutoScaling(destP, partials1, matrices1, partials2, matrices2,
+                                                activateScaling, category, startPattern, endPattern);
+            else if (fixedScalingFactors != NULL)
+                calcPartialsPartialsFixedScaling(destP, partials1, matrices1, partials2, matrices2,
+                                                 fixedScalingFactors, category, startPattern, endPattern);
+            else
+                calcPartialsPartials(destP, partials1, matrices1, partials2, matrices2,
+                                     category, startPattern, endPattern);
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::useTipPairTable() {
+    return (kStateCount + 1) * (kStateCount + 1) * BEAGLE_CPU_TIP_PAIR_TABLE_RATIO <= kPatternCount;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::fillTipPairTable(REALTYPE* table,
+                                                         const REALTYPE* matrices1,
+                                                         const REALTYPE* matrices2) {
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int state1 = 0; state1 <= kStateCount; state1++) {
+            for (int state2 = 0; state2 <= kStateCount; state2++) {
+                int w = l * kMatrixSize;
+                for (int i = 0; i < kStateCount; i++) {
+                    table[i] = matrices1[w + state1] * matrices2[w + state2];
+                    w += kTransPaddedStateCount;
+                }
+                for (int i = kStateCount; i < kPartialsPaddedStateCount; i++)
+                    table[i] = 0.0;
+                table += kPartialsPaddedStateCount;
+            }
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesTable(REALTYPE* destP,
+                                                              const unsigned char* states1,
+                                                              const unsigned char* states2,
+                                                              const REALTYPE* tipPairTable,
+                                                              const REALTYPE* scaleFactors,
+                                                              int category,
+                                                              int startPattern,
+                                                              int endPattern) {
+    const int pairCount = kStateCount + 1;
+    const bool packedStates = hasPackedTipStates();
+    const REALTYPE* categoryTable = tipPairTable + category * pairCount * pairCount * kPartialsPaddedStateCount;
+
+    REALTYPE* destPtr = destP + category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    for (int k = startPattern; k < endPattern; k++) {
+        const int state1 = (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(states1, k) : states1[k]);
+        const int state2 = (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(states2, k) : states2[k]);
+        const REALTYPE* row = categoryTable + (state1 * pairCount + state2) * kPartialsPaddedStateCount;
+        if (scaleFactors != NULL) {
+            const REALTYPE scaleFactor = scaleFactors[k];
+            for (int i = 0; i < kStateCount; i++)
+                destPtr[i] = row[i] / scaleFactor;
+        } else {
+            for (int i = 0; i < kStateCount; i++)
+                destPtr[i] = row[i];
+        }
+        destPtr += kPartialsPatternStride;
+    }
+}
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+/*
+ * Pages are placed on the NUMA node of the thread that first writes them, so the slab is
+ * zeroed in chunks by the pool's workers rather than by the thread creating the instance.
+ * An instance bound to a node thereby keeps all its buffers there; one spanning the
+ * machine spreads them over the nodes its workers run on.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::firstTouchArena() {
+    const size_t size = gArena.getCapacity();
+    if (size == 0)
+        return;
+    FirstTouchTask task(gArena.getSlab(), size);
+    gThreadPool->run((int) ((size + BEAGLE_CPU_FIRST_TOUCH_BYTES - 1) / BEAGLE_CPU_FIRST_TOUCH_BYTES), &task);
+}
+#endif
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsStrides() {
+    if (kFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR) {
+        kPartialsCategoryStride = kPartialsPaddedStateCount;
+        kPartialsPatternStride = kPartialsPaddedStateCount * kCategoryCount;
+    } else {
+        kPartialsCategoryStride = kPartialsPaddedStateCount * kPaddedPatternCount;
+        kPartialsPatternStride = kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+unsigned long long BeagleCPUImpl<BEAGLE_CPU_GENERIC>::hashPatternColumn(int column) {
+    // 64-bit FNV-1a over the column's states and tip partials
+    unsigned long long hash = 14695981039346656037ULL;
+    const bool packedStates = hasPackedTipStates();
+    for (int t = 0; t < kTipCount; t++) {
+        if (gTipStates[t] != NULL) {
+            const int state = (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(gTipStates[t], column) :
+                                              gTipStates[t][column]);
+            hash = (hash ^ (unsigned long long) state) * 1099511628211ULL;
+        } else if (gPartials[t] != NULL) {
+            for (int l = 0; l < kCategoryCount; l++) {
+                const unsigned char* bytes = (const unsigned char*)
+                    (gPartials[t] + l * kPartialsCategoryStride + column * kPartialsPatternStride);
+                for (size_t b = 0; b < sizeof(REALTYPE) * kStateCount; b++)
+                    hash = (hash ^ bytes[b]) * 1099511628211ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::samePatternColumns(int column1,
+                                                           int column2) {
+    const bool packedStates = hasPackedTipStates();
+    for (int t = 0; t < kTipCount; t++) {
+        if (gTipStates[t] != NULL) {
+            const unsigned char* states = gTipStates[t];
+            if ((packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(states, column1) : states[column1]) !=
+                (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(states, column2) : states[column2]))
+                return false;
+        } else if (gPartials[t] != NULL) {
+            for (int l = 0; l < kCategoryCount; l++) {
+                const REALTYPE* categoryP = gPartials[t] + l * kPartialsCategoryStride;
+                if (memcmp(categoryP + column1 * kPartialsPatternStride,
+                           categoryP + column2 * kPartialsPatternStride,
+                           sizeof(REALTYPE) * kStateCount) != 0)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Columns are bucketed by hash and compared in full within a bucket. Unique patterns keep
+ * the order of their first columns, so every buffer can be compacted in place front to back.
+ */
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::compressPatterns() {
+    kPatternsCompressed = true;
+    const int columnCount = kUncompressedPatternCount;
+
+    std::vector<std::pair<unsigned long long, int> > hashes(columnCount);
+    for (int j = 0; j < columnCount; j++)
+        hashes[j] = std::make_pair(hashPatternColumn(j), j);
+    std::sort(hashes.begin(), hashes.end());
+
+    // First column with the same data as each column
+    std::vector<int> firstColumn(columnCount);
+    int bucketStart = 0;
+    for (int i = 0; i < columnCount; i++) {
+        if (hashes[i].first != hashes[bucketStart].first)
+            bucketStart = i;
+        const int column = hashes[i].second;
+        firstColumn[column] = column;
+        for (int b = bucketStart; b < i; b++) {
+            const int other = hashes[b].second;
+            if (firstColumn[other] == other && samePatternColumns(other, column)) {
+                firstColumn[column] = other;
+                break;
+            }
+        }
+    }
+
+    gPatternMap.resize(columnCount);
+    gPatternColumns.clear();
+    for (int j = 0; j < columnCount; j++) {
+        if (firstColumn[j] == j) {
+            gPatternMap[j] = (int) gPatternColumns.size();
+            gPatternColumns.push_back(j);
+        } else {
+            gPatternMap[j] = gPatternMap[firstColumn[j]];
+        }
+    }
+
+    std::vector<double> weights(gPatternColumns.size(), 0.0);
+    for (int j = 0; j < columnCount; j++)
+        weights[gPatternMap[j]] += gPatternWeights[j];
+    memcpy(gPatternWeights, &weights[0], sizeof(double) * weights.size());
+
+    if ((int) gPatternColumns.size() == columnCount)
+        return;
+
+    const int oldCategoryStride = kPartialsCategoryStride;
+    const int oldPatternStride = kPartialsPatternStride;
+
+    kPatternCount = (int) gPatternColumns.size();
+    int modulus = getPaddedPatternsModulus();
+    kPaddedPatternCount = kPatternCount;
+    int remainder = kPatternCount % modulus;
+    if (remainder != 0)
+        kPaddedPatternCount += modulus - remainder;
+    kExtraPatterns = kPaddedPatternCount - kPatternCount;
+    updatePartialsStrides();
+
+    // Destinations never pass their sources, so buffers are compacted in place;
+    // blocks parked for a snapshot are compacted after the live ones
+    for (int b = 0; b < 2 * kBufferCount; b++) {
+        REALTYPE* partials = (b < kBufferCount ? gPartials[b] : gPartialsLog.getParked(b - kBufferCount));
+        if (partials == NULL)
+            continue;
+        for (int l = 0; l < kCategoryCount; l++) {
+            for (int k = 0; k < kPaddedPatternCount; k++) {
+                REALTYPE* destP = partials + l * kPartialsCategoryStride + k * kPartialsPatternStride;
+                if (k < kPatternCount)
+                    memmove(destP, partials + l * oldCategoryStride + gPatternColumns[k] * oldPatternStride,
+                            sizeof(REALTYPE) * kPartialsPaddedStateCount);
+                else
+                    memset(destP, 0, sizeof(REALTYPE) * kPartialsPaddedStateCount);
+            }
+        }
+    }
+
+    const bool packedStates = hasPackedTipStates();
+    std::vector<unsigned char> states(kPaddedPatternCount);
+    for (int t = 0; t < kTipCount; t++) {
+        unsigned char* tipStates = gTipStates[t];
+        if (tipStates == NULL)
+            continue;
+        for (int k = 0; k < kPaddedPatternCount; k++) {
+            const int column = (k < kPatternCount ? gPatternColumns[k] : -1);
+            states[k] = (unsigned char) (column < 0 ? kStateCount :
+                                         (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(tipStates, column) :
+                                                         tipStates[column]));
+        }
+        if (packedStates)
+            memset(tipStates, 0, (kPaddedPatternCount + 1) / 2);
+        for (int k = 0; k < kPaddedPatternCount; k++) {
+            if (packedStates)
+                tipStates[k >> 1] |= (unsigned char) (states[k] << ((k & 1) << 2));
+            else
+                tipStates[k] = states[k];
+        }
+    }
+
+    updatePatternBlocks();
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePatternBlocks() {
+    if (kAutoPatternBlockSize) {
+        if (kThreadCount > 1) {
+            // Split each category into enough blocks to give every thread a tile;
+            // pattern-major tiles span all categories, so need a block per thread
+            int blocksPerCategory = (kFlags & BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR ? kThreadCount :
+                                     (kThreadCount + kCategoryCount - 1) / kCategoryCount);
+            kPatternBlockSize = (kPatternCount + blocksPerCategory - 1) / blocksPerCategory;
+            if (kPatternBlockSize < BEAGLE_CPU_MIN_PATTERN_BLOCK_SIZE)
+                kPatternBlockSize = BEAGLE_CPU_MIN_PATTERN_BLOCK_SIZE;
+        } else {
+            kPatternBlockSize = kPatternCount;
+        }
+    }
+    if (kPatternBlockSize > kPatternCount)
+        kPatternBlockSize = kPatternCount;
+    if (kPatternBlockSize < 1)
+        kPatternBlockSize = 1;
+    kPatternBlockCount = (kPatternCount + kPatternBlockSize - 1) / kPatternBlockSize;
+
+    // Fused blocks span every category, so they are split by thread count alone
+    // and capped so that the block is still cached when it is rescaled
+    if (kAutoPatternBlockSize) {
+        kFusedBlockSize = (kPatternCount + kThreadCount - 1) / kThreadCount;
+        if (kThreadCount > 1 && kFusedBlockSize < BEAGLE_CPU_MIN_PATTERN_BLOCK_SIZE)
+            kFusedBlockSize = BEAGLE_CPU_MIN_PATTERN_BLOCK_SIZE;
+    } else {
+        kFusedBlockSize = kPatternBlockSize;
+    }
+    int cachedPatterns = BEAGLE_CPU_FUSED_BLOCK_BYTES /
+                         (kCategoryCount * kPartialsPaddedStateCount * (int) sizeof(REALTYPE));
+    cachedPatterns -= cachedPatterns % 8;
+    if (cachedPatterns < 8)
+        cachedPatterns = 8;
+    if (kFusedBlockSize > cachedPatterns)
+        kFusedBlockSize = cachedPatterns;
+    if (kFusedBlockSize > kPatternCount)
+        kFusedBlockSize = kPatternCount;
+    if (kFusedBlockSize < 1)
+        kFusedBlockSize = 1;
+    kFusedBlockCount = (kPatternCount + kFusedBlockSize - 1) / kFusedBlockSize;
+    gBlockLogLikelihoods.resize(kFusedBlockCount);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUThreadCount(int threadCount) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (threadCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+#ifndef _OPENMP
+    if (threadCount != 1 && gThreadPool == NULL)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+#endif
+    kThreadCount = threadCount;
+    updatePatternBlocks();
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gThreadPool != NULL && gThreadPool->getThreadCount() != kThreadCount) {
+        delete gThreadPool;
+        if (!gNumaCPUs.empty())
+            gThreadPool = new BeagleCPUThreadPool(kThreadCount, gNumaCPUs);
+        else
+            gThreadPool = new BeagleCPUThreadPool(kThreadCount, true);
+    }
+#endif
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUPatternBlockSize(int patternBlockSize) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (patternBlockSize < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    kAutoPatternBlockSize = (patternBlockSize == 0);
+    if (!kAutoPatternBlockSize)
+        kPatternBlockSize = patternBlockSize;
+    updatePatternBlocks();
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUPatternCompression(int compress) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (kPatternsCompressed)
+        return BEAGLE_ERROR_GENERAL; // columns have already been collapsed
+    if (compress != 0 && !gPatternPartitionStarts.empty())
+        return BEAGLE_ERROR_GENERAL; // collapsing would mix patterns of different partitions
+    kCompressPatterns = (compress != 0);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCPUPartialsSpill(const char* directory) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (directory == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (gSpill.isOpen())
+        return BEAGLE_ERROR_GENERAL; // already spilled
+
+    const size_t bytes = sizeof(REALTYPE) * kPartialsSize;
+    if (!gSpill.create(directory, kBufferCount, bytes))
+        return BEAGLE_ERROR_GENERAL;
+
+    // Move the buffers allocated so far into their slots; a snapshot's parked blocks stay put
+    for (int i = 0; i < kBufferCount; i++) {
+        if (gPartials[i] == NULL)
+            continue;
+        REALTYPE* slot = (REALTYPE*) gSpill.slot(i);
+        memcpy(slot, gPartials[i], bytes);
+        if (gArena.owns(gPartials[i]))
+            gArena.discard(gPartials[i], bytes);
+        else
+            freeBuffer(gPartials[i]);
+        gPartials[i] = slot;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::saveState() {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    gPartialsLog.save();
+    gScaleBuffersLog.save();
+    gAutoScaleBuffersLog.save();
+    gTransitionMatricesLog.save();
+    gSavedTreeModel = gTreeModel;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::restoreState() {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (!gPartialsLog.isActive())
+        return BEAGLE_ERROR_GENERAL; // no snapshot to return to
+
+    // Companion state first, while the logs still list what was written
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) {
+        const std::vector<int>& scaleWritten = gScaleBuffersLog.getWritten();
+        for (size_t i = 0; i < scaleWritten.size(); i++)
+            gMixedScaleBuffers[scaleWritten[i]].swap(gParkedMixedScaleBuffers[scaleWritten[i]]);
+    }
+    const std::vector<int>& autoScaleWritten = gAutoScaleBuffersLog.getWritten();
+    for (size_t i = 0; i < autoScaleWritten.size(); i++)
+        gActiveScalingFactors[autoScaleWritten[i]] = gParkedActiveScalingFactors[autoScaleWritten[i]];
+
+    gPartialsLog.restore(gPartials);
+    gScaleBuffersLog.restore(gScaleBuffers);
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        gAutoScaleBuffersLog.restore(gAutoScaleBuffers);
+    gTransitionMatricesLog.restore(gTransitionMatrices);
+
+    // The buffers are again those of the tree as it was; one set since has no such state
+    if (gSavedTreeModel.isSet())
+        gTreeModel = gSavedTreeModel;
+    else
+        gTreeModel.markAllDirty();
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+template <typename T>
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::detachBuffer(BeagleCPUSnapshotLog<T>& log,
+                                                     T** buffers,
+                                                     int index,
+                                                     size_t length,
+                                                     bool preserve) {
+    if (!log.needsDetach(index, buffers[index]))
+        return;
+
+    T* block = log.takeSpare();
+    if (block == NULL) {
+        block = (T*) mallocAligned(sizeof(T) * length);
+        memset(block, 0, sizeof(T) * length);
+    }
+    if (preserve)
+        memcpy(block, buffers[index], sizeof(T) * length);
+
+    log.detach(index, buffers[index]);
+    buffers[index] = block;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::detachScaleBuffer(int index,
+                                                          bool preserve) {
+    if (!gScaleBuffersLog.needsDetach(index, gScaleBuffers[index]))
+        return;
+
+    // The double-precision copy is updated in place, so its snapshot is a copy
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED)
+        gParkedMixedScaleBuffers[index] = gMixedScaleBuffers[index];
+    detachBuffer(gScaleBuffersLog, gScaleBuffers, index, kPaddedPatternCount, preserve);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::detachOperationBuffers(const int* operations,
+                                                               int count,
+                                                               int cumulativeScaleIndex,
+                                                               const int* cumulativeScaleIndices,
+                                                               bool byPartition) {
+    // A buffer read by an earlier operation keeps its contents until that one has run.
+    // An operation on a partition writes only some patterns, so always keeps the rest
+    std::vector<char> partialsRead(kBufferCount, (char) byPartition);
+    std::vector<char> scaleRead(kScaleBufferCount, (char) byPartition);
+
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE && !(kFlags & BEAGLE_FLAG_SCALING_AUTO))
+        detachScaleBuffer(cumulativeScaleIndex, true);
+
+    for (int op = 0; op < count; op++) {
+        const int* operation = operations + op * (byPartition ? 9 : 7);
+        const int parIndex = operation[0];
+
+        if (cumulativeScaleIndices != NULL && cumulativeScaleIndices[op] != BEAGLE_OP_NONE &&
+            !(kFlags & BEAGLE_FLAG_SCALING_AUTO))
+            detachScaleBuffer(cumulativeScaleIndices[op], true);
+
+        detachBuffer(gPartialsLog, gPartials, parIndex, kPartialsSize, partialsRead[parIndex] != 0);
+
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+            const int scaleIndex = parIndex - kTipCount;
+            if (gAutoScaleBuffersLog.needsDetach(scaleIndex, gAutoScaleBuffers[scaleIndex]))
+                gParkedActiveScalingFactors[scaleIndex] = gActiveScalingFactors[scaleIndex];
+            detachBuffer(gAutoScaleBuffersLog, gAutoScaleBuffers, scaleIndex, kPaddedPatternCount, false);
+        } else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+            const int scaleIndex = parIndex - kTipCount;
+            detachScaleBuffer(scaleIndex, scaleRead[scaleIndex] != 0);
+            if (operation[3] >= kTipCount)
+                scaleRead[operation[3] - kTipCount] = 1;
+            if (operation[5] >= kTipCount)
+                scaleRead[operation[5] - kTipCount] = 1;
+        } else {
+            // Dynamic scaling skips some of these writes, so keeps the contents
+            if (operation[1] >= 0 && operation[1] < kScaleBufferCount)
+                detachScaleBuffer(operation[1], (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) || scaleRead[operation[1]]);
+            if (operation[2] >= 0 && operation[2] < kScaleBufferCount)
+                scaleRead[operation[2]] = 1;
+        }
+
+        partialsRead[operation[3]] = 1;
+        partialsRead[operation[5]] = 1;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+template <typename T>
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::freeSnapshotLog(BeagleCPUSnapshotLog<T>& log) {
+    log.save(); // parked blocks join the spares
+    const std::vector<T*>& spare = log.getSpare();
+    for (size_t i = 0; i < spare.size(); i++)
+        freeBuffer(spare[i]);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getCheckpointSections(int paddedPatternCount,
+                                                              int compressedPatternCount,
+                                                              bool patternsCompressed,
+                                                              std::vector<char*>& data,
+                                                              std::vector<size_t>& bytes) {
+    const size_t tipStatesBytes = (hasPackedTipStates() ? (paddedPatternCount + 1) / 2 : paddedPatternCount);
+    const int scaleTableCount = (kFlags & BEAGLE_FLAG_SCALING_AUTO ? 1 : kScaleBufferCount);
+
+    // Buffers the instance can point into the file
+    for (int i = 0; i < kBufferCount; i++) {
+        data.push_back((char*) gPartials[i]);
+        bytes.push_back(sizeof(REALTYPE) * kPartialsSize);
+    }
+    for (int i = 0; i < kBufferCount; i++) {
+        data.push_back((char*) gTipStates[i]);
+        bytes.push_back(tipStatesBytes);
+    }
+    for (int i = 0; i < scaleTableCount; i++) {
+        data.push_back((char*) gScaleBuffers[i]);
+        bytes.push_back(sizeof(REALTYPE) * paddedPatternCount);
+    }
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        for (int i = 0; i < kScaleBufferCount; i++) {
+            data.push_back((char*) gAutoScaleBuffers[i]);
+            bytes.push_back(sizeof(signed short) * paddedPatternCount);
+        }
+    }
+    for (int i = 0; i < kMatrixCount; i++) {
+        data.push_back((char*) gTransitionMatrices[i]);
+        bytes.push_back(sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+    }
+
+    // Everything else is copied
+    data.push_back((char*) gCategoryRates);
+    bytes.push_back(sizeof(double) * kCategoryCount * kEigenDecompCount);
+    data.push_back((char*) gPatternWeights);
+    bytes.push_back(sizeof(double) * kUncompressedPatternCount);
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        data.push_back((char*) gCategoryWeights[i]);
+        bytes.push_back(sizeof(REALTYPE) * kCategoryCount);
+    }
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        data.push_back((char*) gStateFrequencies[i]);
+        bytes.push_back(sizeof(REALTYPE) * kStateCount);
+    }
+    std::vector<REALTYPE*> eigenArrays;
+    std::vector<int> eigenLengths;
+    gEigenDecomposition->getStorage(eigenArrays, eigenLengths);
+    for (size_t i = 0; i < eigenArrays.size(); i++) {
+        data.push_back((char*) eigenArrays[i]);
+        bytes.push_back(sizeof(REALTYPE) * eigenLengths[i]);
+    }
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        data.push_back((char*) gActiveScalingFactors);
+        bytes.push_back(sizeof(int) * kInternalPartialsBufferCount);
+    }
+    for (size_t i = 0; i < gMixedScaleBuffers.size(); i++) {
+        data.push_back((char*) &gMixedScaleBuffers[i][0]);
+        bytes.push_back(sizeof(double) * gMixedScaleBuffers[i].size());
+    }
+    if (patternsCompressed) {
+        data.push_back((char*) (gPatternMap.empty() ? NULL : &gPatternMap[0]));
+        bytes.push_back(sizeof(int) * kUncompressedPatternCount);
+        data.push_back((char*) (gPatternColumns.empty() ? NULL : &gPatternColumns[0]));
+        bytes.push_back(sizeof(int) * compressedPatternCount);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::fillCheckpointHeader(BeagleCPUCheckpointHeader& header) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BEAGLE_CPU_CHECKPOINT_MAGIC, sizeof(BEAGLE_CPU_CHECKPOINT_MAGIC));
+    header.version = BEAGLE_CPU_CHECKPOINT_VERSION;
+    header.realTypeSize = sizeof(REALTYPE);
+    // Threading and asynchronous computation do not change what the buffers hold
+    header.flags = kFlags & ~(BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_OPENMP | BEAGLE_FLAG_THREADING_CPP |
+                              BEAGLE_FLAG_COMPUTATION_ASYNCH);
+    strncpy(header.implName, getName(), sizeof(header.implName) - 1);
+    header.tipCount = kTipCount;
+    header.bufferCount = kBufferCount;
+    header.stateCount = kStateCount;
+    header.patternCount = kUncompressedPatternCount;
+    header.compressedPatternCount = kPatternCount;
+    header.paddedPatternCount = kPaddedPatternCount;
+    header.eigenDecompCount = kEigenDecompCount;
+    header.matrixCount = kMatrixCount;
+    header.categoryCount = kCategoryCount;
+    header.scaleBufferCount = kScaleBufferCount;
+    header.partialsSize = kPartialsSize;
+    header.compressPatterns = kCompressPatterns;
+    header.patternsCompressed = kPatternsCompressed;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::writeCheckpoint(const char* fileName) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    BeagleCPUCheckpointHeader header;
+    fillCheckpointHeader(header);
+
+    std::vector<char*> data;
+    std::vector<size_t> bytes;
+    getCheckpointSections(kPaddedPatternCount, kPatternCount, kPatternsCompressed, data, bytes);
+
+    BeagleCPUCheckpointWriter writer;
+    if (!writer.open(fileName, sizeof(header)))
+        return BEAGLE_ERROR_GENERAL;
+    std::vector<long long> offsets(data.size());
+    for (size_t i = 0; i < data.size(); i++)
+        offsets[i] = writer.append(data[i], bytes[i]);
+    header.sectionCount = (int) offsets.size();
+    header.sectionTableOffset = writer.append(&offsets[0], sizeof(long long) * offsets.size());
+    if (!writer.close(&header, sizeof(header)))
+        return BEAGLE_ERROR_GENERAL;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::readCheckpoint(const char* fileName) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
+    BeagleCPUCheckpointMapping mapping;
+    if (!mapping.map(fileName) || mapping.getSize() < sizeof(BeagleCPUCheckpointHeader))
+        return BEAGLE_ERROR_GENERAL;
+
+    // Everything but the pattern layout has to match this instance
+    BeagleCPUCheckpointHeader header;
+    memcpy(&header, mapping.getBase(), sizeof(header));
+    BeagleCPUCheckpointHeader expected;
+    fillCheckpointHeader(expected);
+    if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.version != expected.version ||
+        header.realTypeSize != expected.realTypeSize ||
+        header.flags != expected.flags ||
+        strncmp(header.implName, expected.implName, sizeof(header.implName)) != 0 ||
+        header.tipCount != expected.tipCount ||
+        header.bufferCount != expected.bufferCount ||
+        header.stateCount != expected.stateCount ||
+        header.patternCount != expected.patternCount ||
+        header.eigenDecompCount != expected.eigenDecompCount ||
+        header.matrixCount != expected.matrixCount ||
+        header.categoryCount != expected.categoryCount ||
+        header.scaleBufferCount != expected.scaleBufferCount ||
+        header.partialsSize != expected.partialsSize)
+        return BEAGLE_ERROR_GENERAL;
+    if (header.patternsCompressed) { // any layout that fits the buffers
+        if (header.compressedPatternCount < 1 || header.compressedPatternCount > header.patternCount ||
+            header.paddedPatternCount < header.compressedPatternCount ||
+            header.paddedPatternCount % getPaddedPatternsModulus() != 0 ||
+            (long) header.paddedPatternCount * kPartialsPaddedStateCount * kCategoryCount > kPartialsSize)
+            return BEAGLE_ERROR_GENERAL;
+    } else if (kPatternsCompressed || header.compressedPatternCount != kPatternCount ||
+               header.paddedPatternCount != kPaddedPatternCount) {
+        return BEAGLE_ERROR_GENERAL; // collapsed columns cannot be expanded again
+    }
+
+    std::vector<char*> data;
+    std::vector<size_t> bytes;
+    getCheckpointSections(header.paddedPatternCount, header.compressedPatternCount,
+                          header.patternsCompressed != 0, data, bytes);
+    const long long* offsets = (const long long*) mapping.section(header.sectionTableOffset,
+                                                                  sizeof(long long) * bytes.size());
+    if (header.sectionCount != (int) bytes.size() || offsets == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    // Only tip buffers, category weights and state frequencies may be missing
+    const int scaleTableCount = (kFlags & BEAGLE_FLAG_SCALING_AUTO ? 1 : kScaleBufferCount);
+    const int autoScaleCount = (kFlags & BEAGLE_FLAG_SCALING_AUTO ? kScaleBufferCount : 0);
+    const size_t mappedCount = 2 * kBufferCount + scaleTableCount + autoScaleCount + kMatrixCount;
+    const size_t weightsStart = mappedCount + 2;
+    const size_t weightsEnd = weightsStart + 2 * kEigenDecompCount;
+    std::vector<char*> sections(bytes.size());
+    for (size_t i = 0; i < bytes.size(); i++) {
+        sections[i] = mapping.section(offsets[i], bytes[i]);
+        const bool optional = (i < (size_t) kTipCount || (i >= (size_t) kBufferCount && i < 2 * (size_t) kBufferCount) ||
+                               (i >= weightsStart && i < weightsEnd));
+        if ((offsets[i] != 0 || !optional) && sections[i] == NULL)
+            return BEAGLE_ERROR_GENERAL;
+    }
+
+    // Snapshots refer to the buffers being replaced
+    freeSnapshotLog(gPartialsLog);
+    freeSnapshotLog(gScaleBuffersLog);
+    freeSnapshotLog(gAutoScaleBuffersLog);
+    freeSnapshotLog(gTransitionMatricesLog);
+    gPartialsLog = BeagleCPUSnapshotLog<REALTYPE>();
+    gScaleBuffersLog = BeagleCPUSnapshotLog<REALTYPE>();
+    gAutoScaleBuffersLog = BeagleCPUSnapshotLog<signed short>();
+    gTransitionMatricesLog = BeagleCPUSnapshotLog<REALTYPE>();
+    gPartialsLog.resize(kBufferCount);
+    gScaleBuffersLog.resize(scaleTableCount);
+    gAutoScaleBuffersLog.resize(autoScaleCount);
+    gTransitionMatricesLog.resize(kMatrixCount);
+
+    if (header.patternsCompressed) {
+        kPatternsCompressed = true;
+        kPatternCount = header.compressedPatternCount;
+        kPaddedPatternCount = header.paddedPatternCount;
+        kExtraPatterns = kPaddedPatternCount - kPatternCount;
+        updatePartialsStrides();
+        updatePatternBlocks();
+    }
+    kCompressPatterns = (header.compressPatterns != 0);
+
+    // Point the buffers into the mapping
+    size_t s = 0;
+    for (int i = 0; i < kBufferCount; i++, s++) {
+        if (gPartials[i] != NULL)
+            freeBuffer(gPartials[i]);
+        gPartials[i] = (REALTYPE*) sections[s];
+    }
+    for (int i = 0; i < kBufferCount; i++, s++) {
+        if (gTipStates[i] != NULL)
+            freeBuffer(gTipStates[i]);
+        gTipStates[i] = (unsigned char*) sections[s];
+    }
+    for (int i = 0; i < scaleTableCount; i++, s++) {
+        freeBuffer(gScaleBuffers[i]);
+        gScaleBuffers[i] = (REALTYPE*) sections[s];
+    }
+    for (int i = 0; i < autoScaleCount; i++, s++) {
+        freeBuffer(gAutoScaleBuffers[i]);
+        gAutoScaleBuffers[i] = (signed short*) sections[s];
+    }
+    for (int i = 0; i < kMatrixCount; i++, s++) {
+        freeBuffer(gTransitionMatrices[i]);
+        gTransitionMatrices[i] = (REALTYPE*) sections[s];
+    }
+
+    // and copy the rest
+    const size_t copiedEnd = bytes.size() - (header.patternsCompressed ? 2 : 0);
+    for (; s < copiedEnd; s++) {
+        if (sections[s] == NULL)
+            continue;
+        if (data[s] == NULL) { // weights or frequencies this instance has not been given yet
+            const int index = (int) (s - weightsStart);
+            if (index < kEigenDecompCount)
+                data[s] = (char*) (gCategoryWeights[index] = (REALTYPE*) malloc(bytes[s]));
+            else
+                data[s] = (char*) (gStateFrequencies[index - kEigenDecompCount] = (REALTYPE*) malloc(bytes[s]));
+        }
+        memcpy(data[s], sections[s], bytes[s]);
+    }
+    if (header.patternsCompressed) {
+        const int* patternMap = (const int*) sections[copiedEnd];
+        const int* patternColumns = (const int*) sections[copiedEnd + 1];
+        gPatternMap.assign(patternMap, patternMap + kUncompressedPatternCount);
+        gPatternColumns.assign(patternColumns, patternColumns + kPatternCount);
+    }
+
+    // Nothing is left in the slab, and the previous mapping goes once its buffers have
+    gArena.release();
+    gCheckpoint.swap(mapping);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::waitForPartials(const int* destinationPartials,
+                                   int destinationPartialsCount) {
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gAsyncQueue != NULL) {
+        gAsyncQueue->wait(destinationPartials, destinationPartialsCount);
+        return gAsyncQueue->takeError();
+    }
+#endif
+    return BEAGLE_SUCCESS;
+}
+
+
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoods(const int* bufferIndices,
+                                                             const int* categoryWeightsIndices,
+                                                             const int* stateFrequenciesIndices,
+                                                             const int* cumulativeScaleIndices,
+                                                             int count,
+                                                             double* outSumLogLikelihood) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (kCompressPatterns && !kPatternsCompressed)
+        compressPatterns();
+
+    if (count == 1) {
+        // We treat this as a special case so that we don't have convoluted logic
+        //      at the end of the loop over patterns
+        int cumulativeScalingFactorIndex;
+        if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+            cumulativeScalingFactorIndex = 0;
+        else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
+            cumulativeScalingFactorIndex = bufferIndices[0] - kTipCount; 
+        else
+            cumulativeScalingFactorIndex = cumulativeScaleIndices[0];
+        return calcRootLogLikelihoods(bufferIndices[0], categoryWeightsIndices[0], stateFrequenciesIndices[0],
+                               cumulativeScalingFactorIndex, outSumLogLikelihood);
+    }
+    else
+    {
+        return calcRootLogLikelihoodsMulti(bufferIndices, categoryWeightsIndices, stateFrequenciesIndices,
+                                    cumulativeScaleIndices, count, outSumLogLikelihood);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsByPartition(const int* bufferIndices,
+                                                                             const int* categoryWeightsIndices,
+                                                                             const int* stateFrequenciesIndices,
+                                                                             const int* cumulativeScaleIndices,
+                                                                             const int* partitionIndices,
+                                                                             int partitionCount,
+                                                                             int count,
+                                                                             double* outSumLogLikelihoodByPartition,
+                                                                             double* outSumLogLikelihood) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (gPatternPartitionStarts.empty())
+        return BEAGLE_ERROR_GENERAL;
+    if (count != 1 || (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_ALWAYS)))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    // Each partition is cut into fused blocks, and the blocks of all partitions run together
+    gPartitionLikelihoodBlocks.clear();
+    for (int p = 0; p < partitionCount; p++) {
+        int startPattern, endPattern;
+        if (!getPartitionPatterns(partitionIndices[p], startPattern, endPattern))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        PartitionLikelihoodBlock block;
+        block.subset = rootLikelihoodSubset(bufferIndices[p], categoryWeightsIndices[p],
+                                            stateFrequenciesIndices[p], cumulativeScaleIndices[p]);
+        block.partition = p;
+        block.logLikelihood = 0.0;
+        for (int k = startPattern; k < endPattern; k += kFusedBlockSize) {
+            block.startPattern = k;
+            block.endPattern = std::min(k + kFusedBlockSize, endPattern);
+            gPartitionLikelihoodBlocks.push_back(block);
+        }
+    }
+
+    const int blockCount = (int) gPartitionLikelihoodBlocks.size();
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gThreadPool != NULL) {
+        PartitionLikelihoodTask task(this);
+        gThreadPool->run(blockCount, &task);
+    } else
+#endif
+    {
+#pragma omp parallel for num_threads(kThreadCount) schedule(dynamic) if(kThreadCount > 1 && blockCount > 1)
+        for (int block = 0; block < blockCount; block++)
+            integratePartitionLikelihoodBlock(block);
+    }
+
+    // Adding the block sums in order keeps the result independent of scheduling
+    for (int p = 0; p < partitionCount; p++)
+        outSumLogLikelihoodByPartition[p] = 0.0;
+    for (int block = 0; block < blockCount; block++)
+        outSumLogLikelihoodByPartition[gPartitionLikelihoodBlocks[block].partition] +=
+            gPartitionLikelihoodBlocks[block].logLikelihood;
+
+    *outSumLogLikelihood = 0.0;
+    for (int p = 0; p < partitionCount; p++)
+        *outSumLogLikelihood += outSumLogLikelihoodByPartition[p];
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    // TODO: merge the three kPatternCount loops above into one
+        return BEAGLE_ERROR_FLOATING_POINT;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateTreeLogLikelihoods(const int* operations,
+                                                                  const int* operationCounts,
+                                                                  const int* rootBufferIndices,
+                                                                  const int* categoryWeightsIndices,
+                                                                  const int* stateFrequenciesIndices,
+                                                                  const int* cumulativeScaleIndices,
+                                                                  int treeCount,
+                                                                  double* outLogLikelihoods) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markAllDirty();
+
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION; // every tree would share cumulative scale buffer 0
+
+    // Trees may share buffers they only read, but a buffer one tree writes must be
+    // neither written nor read by another, or the result would depend on the schedule
+    std::vector<int> partialsWriter(kBufferCount, -1);
+    std::vector<int> scaleWriter(kScaleBufferCount, -1);
+    std::vector<int> operationCumulativeScaleIndices;
+    int operationCount = 0;
+    for (int tree = 0; tree < treeCount; tree++) {
+        const int cumulativeScaleIndex = cumulativeScaleIndices[tree];
+        if (cumulativeScaleIndex != BEAGLE_OP_NONE) {
+            if (cumulativeScaleIndex < 0 || cumulativeScaleIndex >= kScaleBufferCount ||
+                scaleWriter[cumulativeScaleIndex] != -1)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            scaleWriter[cumulativeScaleIndex] = tree;
+        }
+        for (int op = operationCount; op < operationCount + operationCounts[tree]; op++) {
+            const int* operation = operations + op * 7;
+            if (partialsWriter[operation[0]] != -1 && partialsWriter[operation[0]] != tree)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            partialsWriter[operation[0]] = tree;
+            if (operation[1] >= 0 && operation[1] < kScaleBufferCount) {
+                if (scaleWriter[operation[1]] != -1 && scaleWriter[operation[1]] != tree)
+                    return BEAGLE_ERROR_OUT_OF_RANGE;
+                scaleWriter[operation[1]] = tree;
+            }
+            operationCumulativeScaleIndices.push_back(cumulativeScaleIndex);
+        }
+        operationCount += operationCounts[tree];
+    }
+    operationCount = 0;
+    for (int tree = 0; tree < treeCount; tree++) {
+        const int rootWriter = partialsWriter[rootBufferIndices[tree]];
+        if (rootWriter != -1 && rootWriter != tree)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        for (int op = operationCount; op < operationCount + operationCounts[tree]; op++) {
+            const int* operation = operations + op * 7;
+            for (int c = 3; c <= 5; c += 2) {
+                if (partialsWriter[operation[c]] != -1 && partialsWriter[operation[c]] != tree)
+                    return BEAGLE_ERROR_OUT_OF_RANGE;
+            }
+            if (operation[2] >= 0 && operation[2] < kScaleBufferCount &&
+                scaleWriter[operation[2]] != -1 && scaleWriter[operation[2]] != tree)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+        }
+        operationCount += operationCounts[tree];
+    }
+
+    if (kCompressPatterns && !kPatternsCompressed)
+        compressPatterns();
+
+    if (operationCount > 0) {
+        int returnCode = runPartialsOperations(operations, operationCount, BEAGLE_OP_NONE,
+                                               &operationCumulativeScaleIndices[0], false);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+
+    // Each root is integrated over every pattern in parallel, one tree after another,
+    // so the site log likelihoods left behind are those of the last tree
+    int returnCode = BEAGLE_SUCCESS;
+    for (int tree = 0; tree < treeCount; tree++) {
+        int cumulativeScalingFactorIndex = cumulativeScaleIndices[tree];
+        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
+            cumulativeScalingFactorIndex = rootBufferIndices[tree] - kTipCount;
+        LikelihoodSubset subset = rootLikelihoodSubset(rootBufferIndices[tree], categoryWeightsIndices[tree],
+                                                       stateFrequenciesIndices[tree],
+                                                       cumulativeScalingFactorIndex);
+        int treeReturnCode = integrateLogLikelihoods(&subset, 1, &outLogLikelihoods[tree]);
+        if (treeReturnCode != BEAGLE_SUCCESS)
+            returnCode = treeReturnCode;
+    }
 
     return returnCode;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTreeModel(const int* parentIndices,
+                                                   const double* edgeLengths,
+                                                   int nodeCount) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    // Node i lives in partials buffer i and, unless it is the root, transition matrix i
+    if (nodeCount > kBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int node = kMatrixCount; node < nodeCount; node++) {
+        if (parentIndices[node] != BEAGLE_OP_NONE)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    return gTreeModel.set(kTipCount, parentIndices, edgeLengths, nodeCount);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTreeModelEdgeLengths(const int* nodeIndices,
+                                                              const double* edgeLengths,
+                                                              int count) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    return gTreeModel.setEdgeLengths(nodeIndices, edgeLengths, count);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateTreeModelLogLikelihood(int eigenIndex,
+                                                                      int categoryWeightsIndex,
+                                                                      int stateFrequenciesIndex,
+                                                                      int cumulativeScaleIndex,
+                                                                      double* outLogLikelihood) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (!gTreeModel.isSet())
+        return BEAGLE_ERROR_GENERAL; // no tree set
+    if (kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION; // these rescale depending on the operations run
+    if (eigenIndex < 0 || eigenIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // Internal nodes rescale into scale buffers 0 to kTipCount - 2, summed into cumulativeScaleIndex
+    const bool rescale = (cumulativeScaleIndex != BEAGLE_OP_NONE && !(kFlags & BEAGLE_FLAG_SCALING_ALWAYS));
+    if (rescale && (cumulativeScaleIndex < kTipCount - 1 || cumulativeScaleIndex >= kScaleBufferCount))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    if (kCompressPatterns && !kPatternsCompressed)
+        compressPatterns();
+
+    std::vector<int> probabilityIndices;
+    std::vector<double> edgeLengths;
+    std::vector<int> operations;
+    gTreeModel.collectUpdates(eigenIndex, rescale, probabilityIndices, edgeLengths, operations);
+
+    if (!probabilityIndices.empty()) {
+        TransitionMatrixUpdate update;
+        update.eigenIndex = eigenIndex;
+        update.eigenIndices = NULL;
+        update.categoryRateIndices = NULL;
+        update.probabilityIndices = &probabilityIndices[0];
+        update.firstDerivativeIndices = NULL;
+        update.secondDerivativeIndices = NULL;
+        update.edgeLengths = &edgeLengths[0];
+        update.count = (int) probabilityIndices.size();
+        int returnCode = runTransitionMatrixUpdate(update);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+
+    if (!operations.empty()) {
+        int returnCode = runPartialsOperations(&operations[0], (int) operations.size() / 7,
+                                               BEAGLE_OP_NONE, NULL, false);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+
+    const int rootIndex = gTreeModel.getRoot();
+    int cumulativeScalingFactorIndex = BEAGLE_OP_NONE;
+    if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+        cumulativeScalingFactorIndex = rootIndex - kTipCount;
+    } else if (rescale) {
+        // Factors of clean subtrees are still in their scale buffers, so the sum is rebuilt in full
+        std::vector<int> scaleIndices;
+        gTreeModel.collectScaleIndices(scaleIndices);
+        resetScaleFactors(cumulativeScaleIndex);
+        accumulateScaleFactorsRange(&scaleIndices[0], (int) scaleIndices.size(), cumulativeScaleIndex,
+                                    0, kPatternCount);
+        cumulativeScalingFactorIndex = cumulativeScaleIndex;
+    }
+
+    gTreeModel.markClean(eigenIndex, rescale, rescale || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS));
+
+    LikelihoodSubset subset = rootLikelihoodSubset(rootIndex, categoryWeightsIndex, stateFrequenciesIndex,
+                                                   cumulativeScalingFactorIndex);
+
+    return integrateLogLikelihoods(&subset, 1, outLogLikelihood);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integratePartitionLikelihoodBlock(int block) {
+    PartitionLikelihoodBlock& partitionBlock = gPartitionLikelihoodBlocks[block];
+    partitionBlock.logLikelihood = integrateLogLikelihoodsRange(&partitionBlock.subset, 1, NULL,
+                                                                partitionBlock.startPattern,
+                                                                partitionBlock.endPattern);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bufferIndices,
+                                                         const int* categoryWeightsIndices,
+                                                         const int* stateFrequenciesIndices,
+                                                         const int* scaleBufferIndices,
+                                                         int count,
+                                                         double* outSumLogLikelihood) {
+    // TODO: allow only some subsets to have scale indices
+    const bool scaled = (scaleBufferIndices[0] != BEAGLE_OP_NONE || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS));
+
+    std::vector<LikelihoodSubset> subsets(count);
+    for (int subsetIndex = 0; subsetIndex < count; subsetIndex++) {
+        int cumulativeScalingFactorIndex = BEAGLE_OP_NONE;
+        if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
+            cumulativeScalingFactorIndex = bufferIndices[subsetIndex] - kTipCount;
+        else if (scaled)
+            cumulativeScalingFactorIndex = scaleBufferIndices[subsetIndex];
+        subsets[subsetIndex] = rootLikelihoodSubset(bufferIndices[subsetIndex],
+                                                    categoryWeightsIndices[subsetIndex],
+                                                    stateFrequenciesIndices[subsetIndex],
+                                                    cumulativeScalingFactorIndex);
+    }
+
+    return integrateLogLikelihoods(&subsets[0], count, outSumLogLikelihood);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
+                            const int categoryWeightsIndex,
+                            const int stateFrequenciesIndex,
+                            const int scalingFactorsIndex,
+                            double* outSumLogLikelihood) {
+
+    LikelihoodSubset subset = rootLikelihoodSubset(bufferIndex, categoryWeightsIndex,
+                                                   stateFrequenciesIndex, scalingFactorsIndex);
+
+    return integrateLogLikelihoods(&subset, 1, outSumLogLikelihood);
+}
+
+BEAGLE_CPU_TEMPLATE
+typename BeagleCPUImpl<BEAGLE_CPU_GENERIC>::LikelihoodSubset
+BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rootLikelihoodSubset(int bufferIndex,
+                                                        int categoryWeightsIndex,
+                                                        int stateFrequenciesIndex,
+                                                        int scaleBufferIndex) {
+    LikelihoodSubset subset;
+    subset.partialsParent = gPartials[bufferIndex];
+    subset.partialsChild = NULL;
+    subset.statesChild = NULL;
+    subset.transMatrix = NULL;
+    subset.wt = gCategoryWeights[categoryWeightsIndex];
+    subset.freqs = gStateFrequencies[stateFrequenciesIndex];
+    subset.scaleFactors = (scaleBufferIndex >= 0 ? gScaleBuffers[scaleBufferIndex] : NULL);
+    subset.mixedScaleFactors = (scaleBufferIndex >= 0 && !gMixedScaleBuffers.empty() ?
+                                &gMixedScaleBuffers[scaleBufferIndex][0] : NULL);
+    assert(subset.partialsParent);
+    return subset;
+}
+
+BEAGLE_CPU_TEMPLATE
+typename BeagleCPUImpl<BEAGLE_CPU_GENERIC>::LikelihoodSubset
+BeagleCPUImpl<BEAGLE_CPU_GENERIC>::edgeLikelihoodSubset(int parentBufferIndex,
+                                                        int childBufferIndex,
+                                                        int probabilityIndex,
+                                                        int categoryWeightsIndex,
+                                                        int stateFrequenciesIndex,
+                                                        int scaleBufferIndex) {
+    assert(parentBufferIndex >= kTipCount);
+
+    LikelihoodSubset subset;
+    subset.partialsParent = gPartials[parentBufferIndex];
+    if (childBufferIndex < kTipCount && gTipStates[childBufferIndex]) {
+        subset.partialsChild = NULL;
+        subset.statesChild = gTipStates[childBufferIndex];
+    } else {
+        subset.partialsChild = gPartials[childBufferIndex];
+        subset.statesChild = NULL;
+    }
+    subset.transMatrix = gTransitionMatrices[probabilityIndex];
+    subset.wt = gCategoryWeights[categoryWeightsIndex];
+    subset.freqs = gStateFrequencies[stateFrequenciesIndex];
+    subset.scaleFactors = (scaleBufferIndex >= 0 ? gScaleBuffers[scaleBufferIndex] : NULL);
+    subset.mixedScaleFactors = (scaleBufferIndex >= 0 && !gMixedScaleBuffers.empty() ?
+                                &gMixedScaleBuffers[scaleBufferIndex][0] : NULL);
+    return subset;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateLogLikelihoods(const LikelihoodSubset* subsets,
+                                                               int count,
+                                                               double* outSumLogLikelihood) {
+    std::vector<REALTYPE> maxScaleFactors;
+    if (count > 1 && subsets[0].scaleFactors != NULL && !(kFlags & BEAGLE_FLAG_PRECISION_MIXED))
+        maxScaleFactors.resize(kPatternCount);
+    REALTYPE* maxScaleFactorsPtr = (maxScaleFactors.empty() ? NULL : &maxScaleFactors[0]);
+
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gThreadPool != NULL) {
+        LikelihoodBlockTask task(this, subsets, count, maxScaleFactorsPtr);
+        gThreadPool->run(kFusedBlockCount, &task);
+    } else
+#endif
+    {
+#pragma omp parallel for num_threads(kThreadCount) schedule(dynamic) if(kThreadCount > 1 && kFusedBlockCount > 1)
+        for (int block = 0; block < kFusedBlockCount; block++)
+            gBlockLogLikelihoods[block] = integrateLogLikelihoodsBlock(subsets, count, maxScaleFactorsPtr, block);
+    }
+
+    // Adding the block sums in order keeps the result independent of scheduling
+    *outSumLogLikelihood = 0.0;
+    for (int block = 0; block < kFusedBlockCount; block++)
+        *outSumLogLikelihood += gBlockLogLikelihoods[block];
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        return BEAGLE_ERROR_FLOATING_POINT;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateLogLikelihoodsBlock(const LikelihoodSubset* subsets,
+                                                                       int count,
+                                                                       REALTYPE* maxScaleFactors,
+                                                                       int block) {
+    const int startPattern = block * kFusedBlockSize;
+    int endPattern = startPattern + kFusedBlockSize;
+    if (endPattern > kPatternCount)
+        endPattern = kPatternCount;
+
+    return integrateLogLikelihoodsRange(subsets, count, maxScaleFactors, startPattern, endPattern);
+}
+
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateLogLikelihoodsRange(const LikelihoodSubset* subsets,
+                                                                       int count,
+                                                                       REALTYPE* maxScaleFactors,
+                                                                       int startPattern,
+                                                                       int endPattern) {
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED)
+        return integrateLogLikelihoodsRangeMixed(subsets, count, startPattern, endPattern);
+
+    double sumLogLikelihood = 0.0;
+
+    if (count == 1) {
+        integrateSiteLikelihoods(subsets[0], outLogLikelihoodsTmp, startPattern, endPattern);
+
+        const REALTYPE* scaleFactors = subsets[0].scaleFactors;
+        for (int k = startPattern; k < endPattern; k++) {
+            REALTYPE logLikelihood = log(outLogLikelihoodsTmp[k]);
+            if (scaleFactors != NULL)
+                logLikelihood += scaleFactors[k];
+            outLogLikelihoodsTmp[k] = logLikelihood;
+            sumLogLikelihood += logLikelihood * gPatternWeights[k];
+        }
+
+        return sumLogLikelihood;
+    }
+
+    // Subsets are summed relative to the largest scale factor of each pattern
+    if (maxScaleFactors != NULL) {
+        for (int k = startPattern; k < endPattern; k++) {
+            REALTYPE maxScaleFactor = subsets[0].scaleFactors[k];
+            for (int j = 1; j < count; j++) {
+                if (subsets[j].scaleFactors[k] > maxScaleFactor)
+                    maxScaleFactor = subsets[j].scaleFactors[k];
+            }
+            maxScaleFactors[k] = maxScaleFactor;
+        }
+    }
+
+    // Blocks are disjoint, so each uses its own patterns' entries as scratch
+    REALTYPE* siteLikelihoods = integrationTmp;
+
+    for (int subsetIndex = 0; subsetIndex < count; subsetIndex++) {
+        integrateSiteLikelihoods(subsets[subsetIndex], siteLikelihoods, startPattern, endPattern);
+
+        const REALTYPE* scaleFactors = subsets[subsetIndex].scaleFactors;
+        for (int k = startPattern; k < endPattern; k++) {
+            REALTYPE sum = siteLikelihoods[k];
+            if (maxScaleFactors != NULL && scaleFactors[k] != maxScaleFactors[k])
+                sum *= exp((REALTYPE)(scaleFactors[k] - maxScaleFactors[k]));
+
+            if (subsetIndex == 0)
+                outLogLikelihoodsTmp[k] = sum;
+            else if (subsetIndex == count - 1)
+                outLogLikelihoodsTmp[k] = log(outLogLikelihoodsTmp[k] + sum);
+            else
+                outLogLikelihoodsTmp[k] += sum;
+        }
+    }
+
+    for (int k = startPattern; k < endPattern; k++) {
+        if (maxScaleFactors != NULL)
+            outLogLikelihoodsTmp[k] += maxScaleFactors[k];
+        sumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
+    }
+
+    return sumLogLikelihood;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateSiteLikelihoods(const LikelihoodSubset& subset,
+                                                                 REALTYPE* outSiteLikelihoods,
+                                                                 int startPattern,
+                                                                 int endPattern) {
+    const REALTYPE* partialsParent = subset.partialsParent;
+    const REALTYPE* transMatrix = subset.transMatrix;
+    const REALTYPE* wt = subset.wt;
+    const REALTYPE* freqs = subset.freqs;
+    const int categoryStride = kPartialsCategoryStride;
+
+    // Every category of a pattern is integrated before moving on, so each state is
+    // summed over categories in registers instead of through a full-size buffer
+    if (transMatrix == NULL) { // Integrate the root partials against the frequencies
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const REALTYPE* rootPartials = &partialsParent[k * kPartialsPatternStride];
+            REALTYPE sum = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                REALTYPE sumOverL = rootPartials[i] * wt[0];
+                for (int l = 1; l < kCategoryCount; l++)
+                    sumOverL += rootPartials[l * categoryStride + i] * wt[l];
+                sum += freqs[i] * sumOverL;
+            }
+            outSiteLikelihoods[k] = sum;
+        }
+
+    } else if (subset.statesChild != NULL) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = subset.statesChild;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const int stateChild = statesChild[k];
+            const REALTYPE* parentPtr = &partialsParent[k * kPartialsPatternStride];
+            REALTYPE sumOverI = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                REALTYPE sumOverL = 0.0;
+                int w = i * kTransPaddedStateCount + stateChild;
+                for (int l = 0; l < kCategoryCount; l++) {
+                    sumOverL += transMatrix[w] * parentPtr[l * categoryStride + i] * wt[l];
+                    w += kMatrixSize;
+                }
+                sumOverI += freqs[i] * sumOverL;
+            }
+            outSiteLikelihoods[k] = sumOverI;
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const REALTYPE* partialsChild = subset.partialsChild;
+        const int stateCountModFour = (kStateCount / 4) * 4;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const int v = k * kPartialsPatternStride;
+            REALTYPE sumOverI = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                REALTYPE sumOverL = 0.0;
+                for (int l = 0; l < kCategoryCount; l++) {
+                    const REALTYPE* partialsChildPtr = &partialsChild[l * categoryStride + v];
+                    const REALTYPE* transMatrixPtr = &transMatrix[l * kMatrixSize + i * kTransPaddedStateCount];
+                    double sumOverJA = 0.0, sumOverJB = 0.0;
+                    int j = 0;
+                    for (; j < stateCountModFour; j += 4) {
+                        sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
+                        sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
+                        sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
+                        sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
+                    }
+                    for (; j < kStateCount; j++) {
+                        sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
+                    }
+                    sumOverL += (sumOverJA + sumOverJB) * partialsParent[l * categoryStride + v + i] * wt[l];
+                }
+                sumOverI += freqs[i] * sumOverL;
+            }
+            outSiteLikelihoods[k] = sumOverI;
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateLogLikelihoodsRangeMixed(const LikelihoodSubset* subsets,
+                                                                            int count,
+                                                                            int startPattern,
+                                                                            int endPattern) {
+    const bool scaled = (subsets[0].mixedScaleFactors != NULL);
+    double* siteLikelihoods = &gMixedIntegrationTmp[0];
+    double* sumLikelihoods = &gMixedIntegrationTmp[gMixedIntegrationTmp.size() / 2];
+    double* logLikelihoods = &gMixedLogLikelihoods[0];
+
+    // Subsets are summed relative to the largest scale factor of each pattern, held in
+    // logLikelihoods until the logs are taken
+    for (int k = startPattern; k < endPattern; k++) {
+        double maxScaleFactor = 0.0;
+        if (scaled) {
+            maxScaleFactor = subsets[0].mixedScaleFactors[k];
+            for (int j = 1; j < count; j++) {
+                if (subsets[j].mixedScaleFactors[k] > maxScaleFactor)
+                    maxScaleFactor = subsets[j].mixedScaleFactors[k];
+            }
+        }
+        logLikelihoods[k] = maxScaleFactor;
+    }
+
+    for (int subsetIndex = 0; subsetIndex < count; subsetIndex++) {
+        integrateSiteLikelihoodsMixed(subsets[subsetIndex], siteLikelihoods, startPattern, endPattern);
+
+        const double* scaleFactors = subsets[subsetIndex].mixedScaleFactors;
+        for (int k = startPattern; k < endPattern; k++) {
+            double sum = siteLikelihoods[k];
+            if (scaled && scaleFactors[k] != logLikelihoods[k])
+                sum *= exp(scaleFactors[k] - logLikelihoods[k]);
+            sumLikelihoods[k] = (subsetIndex == 0 ? sum : sumLikelihoods[k] + sum);
+        }
+    }
+
+    double sumLogLikelihood = 0.0;
+    for (int k = startPattern; k < endPattern; k++) {
+        logLikelihoods[k] += log(sumLikelihoods[k]);
+        sumLogLikelihood += logLikelihoods[k] * gPatternWeights[k];
+    }
+
+    return sumLogLikelihood;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateSiteLikelihoodsMixed(const LikelihoodSubset& subset,
+                                                                      double* outSiteLikelihoods,
+                                                                      int startPattern,
+                                                                      int endPattern) {
+    const REALTYPE* partialsParent = subset.partialsParent;
+    const REALTYPE* transMatrix = subset.transMatrix;
+    const REALTYPE* wt = subset.wt;
+    const REALTYPE* freqs = subset.freqs;
+    const int categoryStride = kPartialsCategoryStride;
+
+    if (transMatrix == NULL) { // Integrate the root partials against the frequencies
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const REALTYPE* rootPartials = &partialsParent[k * kPartialsPatternStride];
+            double sum = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                double sumOverL = 0.0;
+                for (int l = 0; l < kCategoryCount; l++)
+                    sumOverL += (double) rootPartials[l * categoryStride + i] * wt[l];
+                sum += freqs[i] * sumOverL;
+            }
+            outSiteLikelihoods[k] = sum;
+        }
+
+    } else if (subset.statesChild != NULL) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = subset.statesChild;
+        const bool packedStates = hasPackedTipStates();
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const int stateChild = (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(statesChild, k) : statesChild[k]);
+            const REALTYPE* parentPtr = &partialsParent[k * kPartialsPatternStride];
+            double sumOverI = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                double sumOverL = 0.0;
+                int w = i * kTransPaddedStateCount + stateChild;
+                for (int l = 0; l < kCategoryCount; l++) {
+                    sumOverL += (double) transMatrix[w] * parentPtr[l * categoryStride + i] * wt[l];
+                    w += kMatrixSize;
+                }
+                sumOverI += freqs[i] * sumOverL;
+            }
+            outSiteLikelihoods[k] = sumOverI;
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const REALTYPE* partialsChild = subset.partialsChild;
+
+        for (int k = startPattern; k < endPattern; k++) {
+            const int v = k * kPartialsPatternStride;
+            double sumOverI = 0.0;
+            for (int i = 0; i < kStateCount; i++) {
+                double sumOverL = 0.0;
+                for (int l = 0; l < kCategoryCount; l++) {
+                    const REALTYPE* partialsChildPtr = &partialsChild[l * categoryStride + v];
+                    const REALTYPE* transMatrixPtr = &transMatrix[l * kMatrixSize + i * kTransPaddedStateCount];
+                    double sumOverJ = 0.0;
+                    for (int j = 0; j < kStateCount; j++)
+                        sumOverJ += (double) transMatrixPtr[j] * partialsChildPtr[j];
+                    sumOverL += sumOverJ * partialsParent[l * categoryStride + v + i] * wt[l];
+                }
+                sumOverI += freqs[i] * sumOverL;
+            }
+            outSiteLikelihoods[k] = sumOverI;
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateMixedScaleFactors(int scaleBufferIndex,
+                                                                int startPattern,
+                                                                int endPattern) {
+    const REALTYPE* scaleBuffer = gScaleBuffers[scaleBufferIndex];
+    double* mixedScaleBuffer = &gMixedScaleBuffers[scaleBufferIndex][0];
+    for (int j = startPattern; j < endPattern; j++)
+        mixedScaleBuffer[j] = scaleBuffer[j];
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactors(const int* scalingIndices,
                                                 int  count,
                                                 int  cumulativeScalingIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markScaleBufferWritten(cumulativeScalingIndex);
+
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        detachScaleBuffer(0, false);
         REALTYPE* cumulativeScaleBuffer = gScaleBuffers[0];
         for(int j=0; j<kPatternCount; j++)
             cumulativeScaleBuffer[j] =  0;
@@ -1170,12 +3426,57 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactors(const int* scaling
                 }
             }
         }
+
+        if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) {
+            double* mixedCumulativeScaleBuffer = &gMixedScaleBuffers[0][0];
+            for(int j=0; j<kPatternCount; j++)
+                mixedCumulativeScaleBuffer[j] = 0.0;
+            for(int i=0; i<count; i++) {
+                int sIndex = scalingIndices[i] - kTipCount;
+                if (gActiveScalingFactors[sIndex]) {
+                    const signed short* scaleBuffer = gAutoScaleBuffers[sIndex];
+                    for(int j=0; j<kPatternCount; j++)
+                        mixedCumulativeScaleBuffer[j] += M_LN2 * scaleBuffer[j];
+                }
+            }
+        }
                 
+    } else {
+        accumulateScaleFactorsRange(scalingIndices, count, cumulativeScalingIndex, 0, kPatternCount);
+    }
+    
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactorsRange(const int* scalingIndices,
+                                                                    int count,
+                                                                    int cumulativeScalingIndex,
+                                                                    int startPattern,
+                                                                    int endPattern) {
+    detachScaleBuffer(cumulativeScalingIndex, true);
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) { // Sum the double-precision copies and round the result
+        double* mixedCumulativeScaleBuffer = &gMixedScaleBuffers[cumulativeScalingIndex][0];
+        for(int i=0; i<count; i++) {
+            const double* scaleBuffer = &gMixedScaleBuffers[scalingIndices[i]][0];
+            for(int j=startPattern; j<endPattern; j++) {
+                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+                    mixedCumulativeScaleBuffer[j] += scaleBuffer[j];
+                else
+                    mixedCumulativeScaleBuffer[j] += log(scaleBuffer[j]);
+            }
+        }
+
+        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
+        for(int j=startPattern; j<endPattern; j++)
+            cumulativeScaleBuffer[j] = (REALTYPE) mixedCumulativeScaleBuffer[j];
+
     } else {
         REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
         for(int i=0; i<count; i++) {
             const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-            for(int j=0; j<kPatternCount; j++) {
+            for(int j=startPattern; j<endPattern; j++) {
                 if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
                     cumulativeScaleBuffer[j] += scaleBuffer[j];
                 else
@@ -1185,12 +3486,31 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactors(const int* scaling
 
         if (DEBUGGING_OUTPUT) {
             fprintf(stderr,"Accumulating %d scale buffers into #%d\n",count,cumulativeScalingIndex);
-            for(int j=0; j<kPatternCount; j++) {
+            for(int j=startPattern; j<endPattern; j++) {
                 fprintf(stderr,"cumulativeScaleBuffer[%d] = %2.5e\n",j,cumulativeScaleBuffer[j]);
             }
         }
     }
-    
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateScaleFactorsByPartition(const int* scalingIndices,
+                                                                         int count,
+                                                                         int cumulativeScalingIndex,
+                                                                         int partitionIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markScaleBufferWritten(cumulativeScalingIndex);
+
+    int startPattern, endPattern;
+    if (!getPartitionPatterns(partitionIndex, startPattern, endPattern))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    accumulateScaleFactorsRange(scalingIndices, count, cumulativeScalingIndex, startPattern, endPattern);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -1198,36 +3518,141 @@ BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactors(const int* scalingIndices,
                                             int  count,
                                             int  cumulativeScalingIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markScaleBufferWritten(cumulativeScalingIndex);
+
+    removeScaleFactorsRange(scalingIndices, count, cumulativeScalingIndex, 0, kPatternCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactorsRange(const int* scalingIndices,
+                                                                int count,
+                                                                int cumulativeScalingIndex,
+                                                                int startPattern,
+                                                                int endPattern) {
+    detachScaleBuffer(cumulativeScalingIndex, true);
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) {
+        double* mixedCumulativeScaleBuffer = &gMixedScaleBuffers[cumulativeScalingIndex][0];
+        for(int i=0; i<count; i++) {
+            const double* scaleBuffer = &gMixedScaleBuffers[scalingIndices[i]][0];
+            for(int j=startPattern; j<endPattern; j++) {
+                if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
+                    mixedCumulativeScaleBuffer[j] -= scaleBuffer[j];
+                else
+                    mixedCumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
+            }
+        }
+
+        REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
+        for(int j=startPattern; j<endPattern; j++)
+            cumulativeScaleBuffer[j] = (REALTYPE) mixedCumulativeScaleBuffer[j];
+
+        return;
+    }
+
 	REALTYPE* cumulativeScaleBuffer = gScaleBuffers[cumulativeScalingIndex];
     for(int i=0; i<count; i++) {
         const REALTYPE* scaleBuffer = gScaleBuffers[scalingIndices[i]];
-        for(int j=0; j<kPatternCount; j++) {
+        for(int j=startPattern; j<endPattern; j++) {
             if (kFlags & BEAGLE_FLAG_SCALERS_LOG)
                 cumulativeScaleBuffer[j] -= scaleBuffer[j];
             else
                 cumulativeScaleBuffer[j] -= log(scaleBuffer[j]);
         }
     }
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::removeScaleFactorsByPartition(const int* scalingIndices,
+                                                                     int count,
+                                                                     int cumulativeScalingIndex,
+                                                                     int partitionIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markScaleBufferWritten(cumulativeScalingIndex);
+
+    int startPattern, endPattern;
+    if (!getPartitionPatterns(partitionIndex, startPattern, endPattern))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    removeScaleFactorsRange(scalingIndices, count, cumulativeScalingIndex, startPattern, endPattern);
 
     return BEAGLE_SUCCESS;
 }
 
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactors(int cumulativeScalingIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markScaleBufferWritten(cumulativeScalingIndex);
+
     //memcpy(gScaleBuffers[cumulativeScalingIndex],zeros,sizeof(double) * kPatternCount);
+    detachScaleBuffer(cumulativeScalingIndex, false);
 	
 	 if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
 		 memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(signed short) * kPaddedPatternCount);
 	 } else {	        
 		 memset(gScaleBuffers[cumulativeScalingIndex], 0, sizeof(REALTYPE) * kPaddedPatternCount);
 	 }
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED && cumulativeScalingIndex < (int) gMixedScaleBuffers.size())
+        std::fill(gMixedScaleBuffers[cumulativeScalingIndex].begin(), gMixedScaleBuffers[cumulativeScalingIndex].end(), 0.0);
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetScaleFactorsByPartition(int cumulativeScalingIndex,
+                                                                    int partitionIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markScaleBufferWritten(cumulativeScalingIndex);
+
+    int startPattern, endPattern;
+    if (!getPartitionPatterns(partitionIndex, startPattern, endPattern))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    // The other partitions' factors stay
+    detachScaleBuffer(cumulativeScalingIndex, true);
+    std::fill(gScaleBuffers[cumulativeScalingIndex] + startPattern, gScaleBuffers[cumulativeScalingIndex] + endPattern, (REALTYPE) 0);
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED)
+        std::fill(gMixedScaleBuffers[cumulativeScalingIndex].begin() + startPattern,
+                  gMixedScaleBuffers[cumulativeScalingIndex].begin() + endPattern, 0.0);
+
     return BEAGLE_SUCCESS;
 }
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartitionPatterns(int partitionIndex,
+                                                             int& startPattern,
+                                                             int& endPattern) {
+    if (partitionIndex < 0 || partitionIndex + 1 >= (int) gPatternPartitionStarts.size())
+        return false;
+    startPattern = gPatternPartitionStarts[partitionIndex];
+    endPattern = gPatternPartitionStarts[partitionIndex + 1];
+    return true;
+}
     
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::copyScaleFactors(int destScalingIndex,
                                                         int srcScalingIndex) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+    gTreeModel.markScaleBufferWritten(destScalingIndex);
+
+    detachScaleBuffer(destScalingIndex, false);
     memcpy(gScaleBuffers[destScalingIndex],gScaleBuffers[srcScalingIndex],sizeof(REALTYPE) * kPatternCount);
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED)
+        gMixedScaleBuffers[destScalingIndex] = gMixedScaleBuffers[srcScalingIndex];
 
     return BEAGLE_SUCCESS;
 }
@@ -1245,6 +3670,13 @@ BEAGLE_CPU_TEMPLATE
                                                              double* outSumLogLikelihood,
                                                              double* outSumFirstDerivative,
                                                              double* outSumSecondDerivative) {
+    int queuedError = waitForQueuedPartials();
+    if (queuedError != BEAGLE_SUCCESS)
+        return queuedError;
+
+    if (kCompressPatterns && !kPatternsCompressed)
+        compressPatterns();
+
     // TODO: implement for count > 1
 
     if (count == 1) {
@@ -1307,111 +3739,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
 													 const int scalingFactorsIndex,
                                                      double* outSumLogLikelihood) {
 
-	assert(parIndex >= kTipCount);
-
-    int returnCode = BEAGLE_SUCCESS;
-
-	const REALTYPE* partialsParent = gPartials[parIndex];
-	const REALTYPE* transMatrix = gTransitionMatrices[probIndex];
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
-
-	memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-
-    
-	if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-
-		const int* statesChild = gTipStates[childIndex];
-		int v = 0; // Index for parent partials
-
-		for(int l = 0; l < kCategoryCount; l++) {
-			int u = 0; // Index in resulting product-partials (summed over categories)
-			const REALTYPE weight = wt[l];
-			for(int k = 0; k < kPatternCount; k++) {
-
-				const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-				// so we can interchange the patterCount and categoryCount loop order?
-				int w =  l * kMatrixSize;
-				for(int i = 0; i < kStateCount; i++) {
-					integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-					u++;
-
-					w += kTransPaddedStateCount;
-				}
-				v += kPartialsPaddedStateCount;
-			}
-		}
-
-	} else { // Integrate against a partial at the child
-
-        const REALTYPE* partialsChild = gPartials[childIndex];
-        int v = 0;
-        int stateCountModFour = (kStateCount / 4) * 4;
-        
-        for(int l = 0; l < kCategoryCount; l++) {
-            int u = 0;
-            const REALTYPE weight = wt[l];
-            for(int k = 0; k < kPatternCount; k++) {
-                int w = l * kMatrixSize;
-                const REALTYPE* partialsChildPtr = &partialsChild[v];
-                for(int i = 0; i < kStateCount; i++) {
-                    double sumOverJA = 0.0, sumOverJB = 0.0;
-                    int j = 0;
-                    const REALTYPE* transMatrixPtr = &transMatrix[w];
-                    for (; j < stateCountModFour; j += 4) {
-                        sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
-                        sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
-                        sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
-                        sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
-                        
-                    }
-                    for (; j < kStateCount; j++) {
-                        sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
-                    }
-                    //                        for(int j = 0; j < kStateCount; j++) {
-                    //                            sumOverJ += transMatrix[w] * partialsChild[v + j];
-                    //                            w++;
-                    //                        }
-                    integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
-                    u++;
-                    
-                    w += kStateCount;
-
-                    // increment for the extra column at the end
-                    w += T_PAD;
-                }
-                v += kPartialsPaddedStateCount;
-            }
-        }
-    }
-    
-	int u = 0;
-	for(int k = 0; k < kPatternCount; k++) {
-		REALTYPE sumOverI = 0.0;
-		for(int i = 0; i < kStateCount; i++) {
-			sumOverI += freqs[i] * integrationTmp[u];
-			u++;
-		}
-
-        outLogLikelihoodsTmp[k] = log(sumOverI);
-	}
-
-
-	if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-		const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-		for(int k=0; k < kPatternCount; k++)
-			outLogLikelihoodsTmp[k] += scalingFactors[k];
-	}
-
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    LikelihoodSubset subset = edgeLikelihoodSubset(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                                                   stateFrequenciesIndex, scalingFactorsIndex);
 
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
+    return integrateLogLikelihoods(&subset, 1, outSumLogLikelihood);
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -1424,150 +3755,21 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
                                                                    int count,
                                                                    double* outSumLogLikelihood) {
 
-    std::vector<int> indexMaxScale(kPatternCount);
-    std::vector<REALTYPE> maxScaleFactor(kPatternCount);
-    
-    int returnCode = BEAGLE_SUCCESS;
-    
-    for (int subsetIndex = 0 ; subsetIndex < count; ++subsetIndex ) {
-        const REALTYPE* partialsParent = gPartials[parentBufferIndices[subsetIndex]];
-        const REALTYPE* transMatrix = gTransitionMatrices[probabilityIndices[subsetIndex]];
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[subsetIndex]];
-        const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[subsetIndex]];
-        int childIndex = childBufferIndices[subsetIndex];
-
-        memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(REALTYPE));
-        
-        if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-            
-            const int* statesChild = gTipStates[childIndex];
-            int v = 0; // Index for parent partials
-            
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = 0; // Index in resulting product-partials (summed over categories)
-                const REALTYPE weight = wt[l];
-                for(int k = 0; k < kPatternCount; k++) {
-                    
-                    const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
-                    // so we can interchange the patterCount and categoryCount loop order?
-                    int w =  l * kMatrixSize;
-                    for(int i = 0; i < kStateCount; i++) {
-                        integrationTmp[u] += transMatrix[w + stateChild] * partialsParent[v + i] * weight;
-                        u++;
-                        
-                        w += kTransPaddedStateCount;
-                    }
-                    v += kPartialsPaddedStateCount;
-                }
-            }                
-        } else {
-            const REALTYPE* partialsChild = gPartials[childIndex];
-            int v = 0;
-            int stateCountModFour = (kStateCount / 4) * 4;
-            
-            for(int l = 0; l < kCategoryCount; l++) {
-                int u = 0;
-                const REALTYPE weight = wt[l];
-                for(int k = 0; k < kPatternCount; k++) {
-                    int w = l * kMatrixSize;
-                    const REALTYPE* partialsChildPtr = &partialsChild[v];
-                    for(int i = 0; i < kStateCount; i++) {
-                        double sumOverJA = 0.0, sumOverJB = 0.0;
-                        int j = 0;
-                        const REALTYPE* transMatrixPtr = &transMatrix[w];
-                        for (; j < stateCountModFour; j += 4) {
-                            sumOverJA += transMatrixPtr[j + 0] * partialsChildPtr[j + 0];
-                            sumOverJB += transMatrixPtr[j + 1] * partialsChildPtr[j + 1];
-                            sumOverJA += transMatrixPtr[j + 2] * partialsChildPtr[j + 2];
-                            sumOverJB += transMatrixPtr[j + 3] * partialsChildPtr[j + 3];
-                            
-                        }
-                        for (; j < kStateCount; j++) {
-                            sumOverJA += transMatrixPtr[j] * partialsChildPtr[j];
-                        }
-//                        for(int j = 0; j < kStateCount; j++) {
-//                            sumOverJ += transMatrix[w] * partialsChild[v + j];
-//                            w++;
-//                        }
-                        integrationTmp[u] += (sumOverJA + sumOverJB) * partialsParent[v + i] * weight;
-                        u++;
-                        
-                        w += kStateCount;
-
-                        // increment for the extra column at the end
-                        w += T_PAD;
-                    }
-                    v += kPartialsPaddedStateCount;
-                }
-            }
-                            
-        }
-        int u = 0;
-        for(int k = 0; k < kPatternCount; k++) {
-            REALTYPE sumOverI = 0.0;
-            for(int i = 0; i < kStateCount; i++) {
-                sumOverI += freqs[i] * integrationTmp[u];
-                u++;
-            }            
-            
-            if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
-                int cumulativeScalingFactorIndex;
-                cumulativeScalingFactorIndex = scalingFactorsIndices[subsetIndex];
-                
-                const REALTYPE* cumulativeScaleFactors = gScaleBuffers[cumulativeScalingFactorIndex];
-                
-                if (subsetIndex == 0) {
-                    indexMaxScale[k] = 0;
-                    maxScaleFactor[k] = cumulativeScaleFactors[k];
-                    for (int j = 1; j < count; j++) {
-                        REALTYPE tmpScaleFactor;
-                        tmpScaleFactor = gScaleBuffers[scalingFactorsIndices[j]][k];
-                        
-                        if (tmpScaleFactor > maxScaleFactor[k]) {
-                            indexMaxScale[k] = j;
-                            maxScaleFactor[k] = tmpScaleFactor;
-                        }
-                    }
-                }
-                
-                if (subsetIndex != indexMaxScale[k])
-                    sumOverI *= exp((REALTYPE)(cumulativeScaleFactors[k] - maxScaleFactor[k]));
-            }
-
+    const bool scaled = (scalingFactorsIndices[0] != BEAGLE_OP_NONE);
 
-            
-            if (subsetIndex == 0) {
-                outLogLikelihoodsTmp[k] = sumOverI;
-            } else if (subsetIndex == count - 1) {
-                REALTYPE tmpSum = outLogLikelihoodsTmp[k] + sumOverI;
-                
-                outLogLikelihoodsTmp[k] = log(tmpSum);
-            } else {
-                outLogLikelihoodsTmp[k] += sumOverI;
-            }
-                        
-        }        
-        
+    std::vector<LikelihoodSubset> subsets(count);
+    for (int subsetIndex = 0; subsetIndex < count; subsetIndex++) {
+        subsets[subsetIndex] = edgeLikelihoodSubset(parentBufferIndices[subsetIndex],
+                                                    childBufferIndices[subsetIndex],
+                                                    probabilityIndices[subsetIndex],
+                                                    categoryWeightsIndices[subsetIndex],
+                                                    stateFrequenciesIndices[subsetIndex],
+                                                    scaled ? scalingFactorsIndices[subsetIndex] : BEAGLE_OP_NONE);
     }
-    
-    if (scalingFactorsIndices[0] != BEAGLE_OP_NONE) {
-        for(int i=0; i<kPatternCount; i++)
-            outLogLikelihoodsTmp[i] += maxScaleFactor[i];
-    }
-    
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
-    
-    if (*outSumLogLikelihood != *outSumLogLikelihood)
-        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    return returnCode;
+    return integrateLogLikelihoods(&subsets[0], count, outSumLogLikelihood);
 }
 
-    
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const int parIndex,
                                                                const int childIndex,
@@ -1595,15 +3797,15 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
 
 	if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-		const int* statesChild = gTipStates[childIndex];
-		int v = 0; // Index for parent partials
-
+		const unsigned char* statesChild = gTipStates[childIndex];
+		const bool packedStates = hasPackedTipStates();
 		for(int l = 0; l < kCategoryCount; l++) {
+			int v = l * kPartialsCategoryStride; // Index for parent partials
 			int u = 0; // Index in resulting product-partials (summed over categories)
 			const REALTYPE weight = wt[l];
 			for(int k = 0; k < kPatternCount; k++) {
 
-				const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+				const int stateChild = (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(statesChild, k) : statesChild[k]);  // DISCUSSION PT: Does it make sense to change the order of the partials,
 				// so we can interchange the patterCount and categoryCount loop order?
 				int w =  l * kMatrixSize;
 				for(int i = 0; i < kStateCount; i++) {
@@ -1613,16 +3815,15 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
 
 					w += kTransPaddedStateCount;
 				}
-				v += kPartialsPaddedStateCount;
+				v += kPartialsPatternStride;
 			}
 		}
 
 	} else { // Integrate against a partial at the child
 
 		const REALTYPE* partialsChild = gPartials[childIndex];
-		int v = 0;
-
 		for(int l = 0; l < kCategoryCount; l++) {
+			int v = l * kPartialsCategoryStride;
 			int u = 0;
 			const REALTYPE weight = wt[l];
 			for(int k = 0; k < kPatternCount; k++) {
@@ -1643,7 +3844,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
 					firstDerivTmp[u] += sumOverJD1 * partialsParent[v + i] * weight;
 					u++;
 				}
-				v += kPartialsPaddedStateCount;
+				v += kPartialsPatternStride;
 			}
 		}
 	}
@@ -1677,6 +3878,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
         *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
     }
     
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) // Derivatives are summed on the single-precision path
+        std::copy(outLogLikelihoodsTmp, outLogLikelihoodsTmp + kPatternCount, gMixedLogLikelihoods.begin());
+
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
 
@@ -1714,15 +3918,15 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
 
 	if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-		const int* statesChild = gTipStates[childIndex];
-		int v = 0; // Index for parent partials
-
+		const unsigned char* statesChild = gTipStates[childIndex];
+		const bool packedStates = hasPackedTipStates();
 		for(int l = 0; l < kCategoryCount; l++) {
+			int v = l * kPartialsCategoryStride; // Index for parent partials
 			int u = 0; // Index in resulting product-partials (summed over categories)
 			const REALTYPE weight = wt[l];
 			for(int k = 0; k < kPatternCount; k++) {
 
-				const int stateChild = statesChild[k];  // DISCUSSION PT: Does it make sense to change the order of the partials,
+				const int stateChild = (packedStates ? BEAGLE_CPU_PACKED_TIP_STATE(statesChild, k) : statesChild[k]);  // DISCUSSION PT: Does it make sense to change the order of the partials,
 				// so we can interchange the patterCount and categoryCount loop order?
 				int w =  l * kMatrixSize;
 				for(int i = 0; i < kStateCount; i++) {
@@ -1733,16 +3937,15 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
 
 					w += kTransPaddedStateCount;
 				}
-				v += kPartialsPaddedStateCount;
+				v += kPartialsPatternStride;
 			}
 		}
 
 	} else { // Integrate against a partial at the child
 
 		const REALTYPE* partialsChild = gPartials[childIndex];
-		int v = 0;
-
 		for(int l = 0; l < kCategoryCount; l++) {
+			int v = l * kPartialsCategoryStride;
 			int u = 0;
 			const REALTYPE weight = wt[l];
 			for(int k = 0; k < kPatternCount; k++) {
@@ -1766,7 +3969,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
 					secondDerivTmp[u] += sumOverJD2 * partialsParent[v + i] * weight;
 					u++;
 				}
-				v += kPartialsPaddedStateCount;
+				v += kPartialsPatternStride;
 			}
 		}
 	}
@@ -1806,6 +4009,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
         *outSumSecondDerivative += outSecondDerivativesTmp[i] * gPatternWeights[i];
     }
 
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) // Derivatives are summed on the single-precision path
+        std::copy(outLogLikelihoodsTmp, outLogLikelihoodsTmp + kPatternCount, gMixedLogLikelihoods.begin());
+
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
     
@@ -1816,7 +4022,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
 
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::block(void) {
-	// Do nothing.
+#ifdef BEAGLE_CPU_THREAD_POOL
+    if (gAsyncQueue != NULL)
+        return gAsyncQueue->waitAll();
+#endif
 	return BEAGLE_SUCCESS;
 }
 
@@ -1829,69 +4038,58 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::block(void) {
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::rescalePartials(REALTYPE* destP,
 		REALTYPE* scaleFactors,
-		REALTYPE* cumulativeScaleFactors,
-        const int  fillWithOnes) {
+        int startPattern,
+        int endPattern) {
     if (DEBUGGING_OUTPUT) {
         std::cerr << "destP (before rescale): \n";// << destP << "\n";
         for(int i=0; i<kPartialsSize; i++)
             fprintf(stderr,"destP[%d] = %.5f\n",i,destP[i]);
     }
 
-    // TODO None of the code below has been optimized.
-    for (int k = 0; k < kPatternCount; k++) {
+    const bool useLogScalars = kFlags & BEAGLE_FLAG_SCALERS_LOG;
+    const int categoryStride = kPartialsCategoryStride;
+
+    for (int k = startPattern; k < endPattern; k++) {
     	REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
+        REALTYPE* patternP = destP + k * kPartialsPatternStride;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
+            const REALTYPE* categoryP = patternP + l * categoryStride;
+            for (int i = 0; i < kStateCount; i++)
+                max = (categoryP[i] > max ? categoryP[i] : max);
         }
         
         if (max == 0)
             max = 1.0;
 			
-        REALTYPE oneOverMax = REALTYPE(1.0) / max;
+        const REALTYPE oneOverMax = REALTYPE(1.0) / max;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
+            REALTYPE* categoryP = patternP + l * categoryStride;
             for (int i = 0; i < kStateCount; i++)
-                destP[offset++] *= oneOverMax;
+                categoryP[i] *= oneOverMax;
         }
 
-        if (kFlags & BEAGLE_FLAG_SCALERS_LOG) {
-            REALTYPE logMax = log(max);
-            scaleFactors[k] = logMax;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += logMax;
-        } else {
-            scaleFactors[k] = max;
-            if( cumulativeScaleFactors != NULL )
-                cumulativeScaleFactors[k] += log(max);
-        }
+        scaleFactors[k] = (useLogScalars ? log(max) : max);
     }
     if (DEBUGGING_OUTPUT) {
-        for(int i=0; i<kPatternCount; i++)
+        for(int i=startPattern; i<endPattern; i++)
             fprintf(stderr,"new scaleFactor[%d] = %.5f\n",i,scaleFactors[i]);
     }
 }
     
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
-                                              signed short* scaleFactors) {
-    
-    
-    for (int k = 0; k < kPatternCount; k++) {
+                                              signed short* scaleFactors,
+                                              int startPattern,
+                                              int endPattern) {
+    const int categoryStride = kPartialsCategoryStride;
+
+    for (int k = startPattern; k < endPattern; k++) {
         REALTYPE max = 0;
-        const int patternOffset = k * kPartialsPaddedStateCount;
+        REALTYPE* patternP = destP + k * kPartialsPatternStride;
         for (int l = 0; l < kCategoryCount; l++) {
-            int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-            for (int i = 0; i < kStateCount; i++) {
-                if(destP[offset] > max)
-                    max = destP[offset];
-                offset++;
-            }
+            const REALTYPE* categoryP = patternP + l * categoryStride;
+            for (int i = 0; i < kStateCount; i++)
+                max = (categoryP[i] > max ? categoryP[i] : max);
         }
         
         int expMax;
@@ -1899,10 +4097,22 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
         scaleFactors[k] = expMax;
         
         if (expMax != 0) {
-            for (int l = 0; l < kCategoryCount; l++) {
-                int offset = l * kPaddedPatternCount * kPartialsPaddedStateCount + patternOffset;
-                for (int i = 0; i < kStateCount; i++)
-                    destP[offset++] *= pow(2.0, -expMax);
+            // Exact power of two, computed once per pattern; the factor for a
+            // subnormal single-precision maximum only exists in double
+            if (DOUBLE_PRECISION || -expMax < FLT_MAX_EXP) {
+                const REALTYPE scale = ldexp(REALTYPE(1.0), -expMax);
+                for (int l = 0; l < kCategoryCount; l++) {
+                    REALTYPE* categoryP = patternP + l * categoryStride;
+                    for (int i = 0; i < kStateCount; i++)
+                        categoryP[i] *= scale;
+                }
+            } else {
+                const double scale = ldexp(1.0, -expMax);
+                for (int l = 0; l < kCategoryCount; l++) {
+                    REALTYPE* categoryP = patternP + l * categoryStride;
+                    for (int i = 0; i < kStateCount; i++)
+                        categoryP[i] = REALTYPE(categoryP[i] * scale);
+                }
             }
         }
     }
@@ -1913,57 +4123,57 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::autoRescalePartials(REALTYPE* destP,
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
-                                     const int* states1,
+                                     const unsigned char* states1,
                                      const REALTYPE* matrices1,
-                                     const int* states2,
-                                     const REALTYPE* matrices2) {
-
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
-        for (int k = 0; k < kPatternCount; k++) {
-            const int state1 = states1[k];
-            const int state2 = states2[k];
-            if (DEBUGGING_OUTPUT) {
-                std::cerr << "calcStatesStates s1 = " << state1 << '\n';
-                std::cerr << "calcStatesStates s2 = " << state2 << '\n';
-            }
-            int w = l * kMatrixSize;
-            for (int i = 0; i < kStateCount; i++) {
-                destP[v] = matrices1[w + state1] * matrices2[w + state2];
-                v++;
+                                     const unsigned char* states2,
+                                     const REALTYPE* matrices2,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+
+    int v = category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    for (int k = startPattern; k < endPattern; k++) {
+        const int state1 = states1[k];
+        const int state2 = states2[k];
+        if (DEBUGGING_OUTPUT) {
+            std::cerr << "calcStatesStates s1 = " << state1 << '\n';
+            std::cerr << "calcStatesStates s2 = " << state2 << '\n';
+        }
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            destP[v] = matrices1[w + state1] * matrices2[w + state2];
+            v++;
 
-                w += kTransPaddedStateCount;
-            }
-            v += P_PAD;
+            w += kTransPaddedStateCount;
         }
+        v += kPartialsPatternStride - kStateCount;
     }
 }
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
-                                              const int* child1States,
+                                              const unsigned char* child1States,
                                            const REALTYPE* child1TransMat,
-                                              const int* child2States,
+                                              const unsigned char* child2States,
                                            const REALTYPE* child2TransMat,
-                                           const REALTYPE* scaleFactors) {
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-	int v = l*kPartialsPaddedStateCount*kPatternCount;
-        for (int k = 0; k < kPatternCount; k++) {
-            const int state1 = child1States[k];
-            const int state2 = child2States[k];
-            int w = l * kMatrixSize;
-            REALTYPE scaleFactor = scaleFactors[k];
-            for (int i = 0; i < kStateCount; i++) {
-                destP[v] = child1TransMat[w + state1] *
-                           child2TransMat[w + state2] / scaleFactor;
-                v++;
+                                           const REALTYPE* scaleFactors,
+                                           int category,
+                                           int startPattern,
+                                           int endPattern) {
+    int v = category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    for (int k = startPattern; k < endPattern; k++) {
+        const int state1 = child1States[k];
+        const int state2 = child2States[k];
+        int w = category * kMatrixSize;
+        REALTYPE scaleFactor = scaleFactors[k];
+        for (int i = 0; i < kStateCount; i++) {
+            destP[v] = child1TransMat[w + state1] *
+                       child2TransMat[w + state2] / scaleFactor;
+            v++;
 
-                w += kTransPaddedStateCount;
-            }
-            v += P_PAD;
+            w += kTransPaddedStateCount;
         }
+        v += kPartialsPatternStride - kStateCount;
     }
 }
 
@@ -1972,10 +4182,13 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* d
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
-                                       const int* states1,
+                                       const unsigned char* states1,
                                        const REALTYPE* matrices1,
                                        const REALTYPE* partials2,
-                                       const REALTYPE* matrices2) {
+                                       const REALTYPE* matrices2,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
     int matrixIncr = kStateCount;
 
     // increment for the extra column at the end
@@ -1984,48 +4197,48 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
 
 	int stateCountModFour = (kStateCount / 4) * 4;
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = 0; k < kPatternCount; k++) {
-            int w = l * kMatrixSize;
-            int state1 = states1[k];
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE tmp = matrices1[w + state1];
-            	REALTYPE sumA = 0.0;
-				REALTYPE sumB = 0.0;				
-				int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];					
-					sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-					sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];					
-					sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];					
-                }
-				for (; j < kStateCount; j++) {
-					sumA += matrices2Ptr[j] * partials2Ptr[j];					
-				}				
-                
-                w += matrixIncr;
-                
-                *(destPtr++) = tmp * (sumA + sumB);
+    int v = category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    int matrixOffset = category*kMatrixSize;
+    const REALTYPE* partials2Ptr = &partials2[v];
+    REALTYPE* destPtr = &destP[v];
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        int state1 = states1[k];
+        for (int i = 0; i < kStateCount; i++) {
+            const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+            REALTYPE tmp = matrices1[w + state1];
+            REALTYPE sumA = 0.0;
+            REALTYPE sumB = 0.0;
+            int j = 0;
+            for (; j < stateCountModFour; j += 4) {
+                sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+                sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+                sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+                sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];
+            }
+            for (; j < kStateCount; j++) {
+                sumA += matrices2Ptr[j] * partials2Ptr[j];
             }
-            destPtr += P_PAD;
-            partials2Ptr += kPartialsPaddedStateCount;
+
+            w += matrixIncr;
+
+            *(destPtr++) = tmp * (sumA + sumB);
         }
+        destPtr += kPartialsPatternStride - kStateCount;
+        partials2Ptr += kPartialsPatternStride;
     }
 }
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
-                                                const int* states1,
+                                                const unsigned char* states1,
                                              const REALTYPE* matrices1,
                                              const REALTYPE* partials2,
                                              const REALTYPE* matrices2,
-                                             const REALTYPE* scaleFactors) {
+                                             const REALTYPE* scaleFactors,
+                                             int category,
+                                             int startPattern,
+                                             int endPattern) {
     int matrixIncr = kStateCount;
 
     // increment for the extra column at the end
@@ -2033,40 +4246,37 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE*
 
 	int stateCountModFour = (kStateCount / 4) * 4;
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = 0; k < kPatternCount; k++) {
-            int w = l * kMatrixSize;
-            int state1 = states1[k];
-			REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE tmp = matrices1[w + state1];
-            	REALTYPE sumA = 0.0;
-				REALTYPE sumB = 0.0;				
-				int j = 0;
-                for (; j < stateCountModFour; j += 4) {
-                    sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];					
-					sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-					sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];					
-					sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];					
-                }
-				for (; j < kStateCount; j++) {
-					sumA += matrices2Ptr[j] * partials2Ptr[j];					
-				}				
-                
-                w += matrixIncr;
-                
-                *(destPtr++) = tmp * (sumA + sumB) * oneOverScaleFactor;
+    int v = category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    int matrixOffset = category*kMatrixSize;
+    const REALTYPE* partials2Ptr = &partials2[v];
+    REALTYPE* destPtr = &destP[v];
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        int state1 = states1[k];
+        REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+        for (int i = 0; i < kStateCount; i++) {
+            const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+            REALTYPE tmp = matrices1[w + state1];
+            REALTYPE sumA = 0.0;
+            REALTYPE sumB = 0.0;
+            int j = 0;
+            for (; j < stateCountModFour; j += 4) {
+                sumA += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+                sumB += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+                sumA += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+                sumB += matrices2Ptr[j + 3] * partials2Ptr[j + 3];
             }
-			destPtr += P_PAD;
-            partials2Ptr += kPartialsPaddedStateCount;
+            for (; j < kStateCount; j++) {
+                sumA += matrices2Ptr[j] * partials2Ptr[j];
+            }
+
+            w += matrixIncr;
+
+            *(destPtr++) = tmp * (sumA + sumB) * oneOverScaleFactor;
         }
-    }											 
+        destPtr += kPartialsPatternStride - kStateCount;
+        partials2Ptr += kPartialsPatternStride;
+    }
 }
 
 /*
@@ -2077,7 +4287,10 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
                                          const REALTYPE* partials1,
                                          const REALTYPE* matrices1,
                                          const REALTYPE* partials2,
-                                         const REALTYPE* matrices2) {
+                                         const REALTYPE* matrices2,
+                                         int category,
+                                         int startPattern,
+                                         int endPattern) {
     int matrixIncr = kStateCount;
 
     // increment for the extra column at the end
@@ -2085,46 +4298,43 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
 
 	int stateCountModFour = (kStateCount / 4) * 4;
 
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials1Ptr = &partials1[v];
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = 0; k < kPatternCount; k++) {
+    int v = category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    int matrixOffset = category*kMatrixSize;
+    const REALTYPE* partials1Ptr = &partials1[v];
+    const REALTYPE* partials2Ptr = &partials2[v];
+    REALTYPE* destPtr = &destP[v];
+    for (int k = startPattern; k < endPattern; k++) {
 
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE sum1A = 0.0, sum2A = 0.0;
-				REALTYPE sum1B = 0.0, sum2B = 0.0;
-				int j = 0;
-				for (; j < stateCountModFour; j += 4) {
-					sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
-					sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
-					
-					sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
-					sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-
-					sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
-					sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
-					
-					sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
-					sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];										
-				}				
-				
-                for (; j < kStateCount; j++) {
-                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
-                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
-                }
+        for (int i = 0; i < kStateCount; i++) {
+            const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
+            const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+            REALTYPE sum1A = 0.0, sum2A = 0.0;
+            REALTYPE sum1B = 0.0, sum2B = 0.0;
+            int j = 0;
+            for (; j < stateCountModFour; j += 4) {
+                sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
+                sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+
+                sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
+                sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+
+                sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
+                sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+
+                sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
+                sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];
+            }
 
-                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B);
+            for (; j < kStateCount; j++) {
+                sum1A += matrices1Ptr[j] * partials1Ptr[j];
+                sum2A += matrices2Ptr[j] * partials2Ptr[j];
             }
-            destPtr += P_PAD;
-            partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
+
+            *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B);
         }
+        destPtr += kPartialsPatternStride - kStateCount;
+        partials1Ptr += kPartialsPatternStride;
+        partials2Ptr += kPartialsPatternStride;
     }
 }
     
@@ -2134,7 +4344,10 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
                                                const REALTYPE* matrices1,
                                                const REALTYPE* partials2,
                                                const REALTYPE* matrices2,
-                                               const REALTYPE* scaleFactors) {
+                                               const REALTYPE* scaleFactors,
+                                               int category,
+                                               int startPattern,
+                                               int endPattern) {
     int matrixIncr = kStateCount;
 
     // increment for the extra column at the end
@@ -2142,46 +4355,43 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsFixedScaling(REALTYP
 
 	int stateCountModFour = (kStateCount / 4) * 4;
     
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
-        int matrixOffset = l*kMatrixSize;
-        const REALTYPE* partials1Ptr = &partials1[v];
-        const REALTYPE* partials2Ptr = &partials2[v];
-        REALTYPE* destPtr = &destP[v];
-        for (int k = 0; k < kPatternCount; k++) {
-            REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
-            for (int i = 0; i < kStateCount; i++) {
-                const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
-                const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
-                REALTYPE sum1A = 0.0, sum2A = 0.0;
-				REALTYPE sum1B = 0.0, sum2B = 0.0;
-				int j = 0;
-				for (; j < stateCountModFour; j += 4) {
-					sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
-					sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
-					
-					sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
-					sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
-
-					sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
-					sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
-					
-					sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
-					sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];										
-				}				
-				
-                for (; j < kStateCount; j++) {
-                    sum1A += matrices1Ptr[j] * partials1Ptr[j];
-                    sum2A += matrices2Ptr[j] * partials2Ptr[j];
-                }
+    int v = category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    int matrixOffset = category*kMatrixSize;
+    const REALTYPE* partials1Ptr = &partials1[v];
+    const REALTYPE* partials2Ptr = &partials2[v];
+    REALTYPE* destPtr = &destP[v];
+    for (int k = startPattern; k < endPattern; k++) {
+        REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+        for (int i = 0; i < kStateCount; i++) {
+            const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
+            const REALTYPE* matrices2Ptr = matrices2 + matrixOffset + i * matrixIncr;
+            REALTYPE sum1A = 0.0, sum2A = 0.0;
+            REALTYPE sum1B = 0.0, sum2B = 0.0;
+            int j = 0;
+            for (; j < stateCountModFour; j += 4) {
+                sum1A += matrices1Ptr[j + 0] * partials1Ptr[j + 0];
+                sum2A += matrices2Ptr[j + 0] * partials2Ptr[j + 0];
+
+                sum1B += matrices1Ptr[j + 1] * partials1Ptr[j + 1];
+                sum2B += matrices2Ptr[j + 1] * partials2Ptr[j + 1];
+
+                sum1A += matrices1Ptr[j + 2] * partials1Ptr[j + 2];
+                sum2A += matrices2Ptr[j + 2] * partials2Ptr[j + 2];
+
+                sum1B += matrices1Ptr[j + 3] * partials1Ptr[j + 3];
+                sum2B += matrices2Ptr[j + 3] * partials2Ptr[j + 3];
+            }
 
-                *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B) * oneOverScaleFactor;
+            for (; j < kStateCount; j++) {
+                sum1A += matrices1Ptr[j] * partials1Ptr[j];
+                sum2A += matrices2Ptr[j] * partials2Ptr[j];
             }
-			destPtr += P_PAD;
-			partials1Ptr += kPartialsPaddedStateCount;
-            partials2Ptr += kPartialsPaddedStateCount;
+
+            *(destPtr++) = (sum1A + sum1B) * (sum2A + sum2B) * oneOverScaleFactor;
         }
+        destPtr += kPartialsPatternStride - kStateCount;
+        partials1Ptr += kPartialsPatternStride;
+        partials2Ptr += kPartialsPatternStride;
     }
 }
     
@@ -2191,39 +4401,39 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartialsAutoScaling(REALTYPE
                                                                const REALTYPE* matrices1,
                                                                const REALTYPE* partials2,
                                                                const REALTYPE* matrices2,
-                                                               int* activateScaling) {
+                                                               int* activateScaling,
+                                                               int category,
+                                                               int startPattern,
+                                                               int endPattern) {
     
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-        int u = l*kPartialsPaddedStateCount*kPatternCount;
-        int v = l*kPartialsPaddedStateCount*kPatternCount;
-        for (int k = 0; k < kPatternCount; k++) {
-            int w = l * kMatrixSize;
-            for (int i = 0; i < kStateCount; i++) {
-                REALTYPE sum1 = 0.0, sum2 = 0.0;
-                for (int j = 0; j < kStateCount; j++) {
-                    sum1 += matrices1[w] * partials1[v + j];
-                    sum2 += matrices2[w] * partials2[v + j];
-                    w++;
-                }
+    int u = category * kPartialsCategoryStride + startPattern * kPartialsPatternStride;
+    int v = u;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            REALTYPE sum1 = 0.0, sum2 = 0.0;
+            for (int j = 0; j < kStateCount; j++) {
+                sum1 += matrices1[w] * partials1[v + j];
+                sum2 += matrices2[w] * partials2[v + j];
+                w++;
+            }
 
-                // increment for the extra column at the end
-                w += T_PAD;
+            // increment for the extra column at the end
+            w += T_PAD;
 
-                destP[u] = sum1 * sum2;
+            destP[u] = sum1 * sum2;
 
-                if (*activateScaling == 0) {
-                    int expTmp;
-                    frexp(destP[u], &expTmp);
-                    if (abs(expTmp) > scalingExponentThreshhold) 
-                        *activateScaling = 1;
-                }
-                
-                u++;
+            if (*activateScaling == 0) {
+                int expTmp;
+                frexp(destP[u], &expTmp);
+                if (abs(expTmp) > scalingExponentThreshhold) 
+                    *activateScaling = 1;
             }
-            u += P_PAD;
-            v += kPartialsPaddedStateCount;
+            
+            u++;
         }
+        u += kPartialsPatternStride - kStateCount;
+        v += kPartialsPatternStride;
     }
 }
 
@@ -2233,6 +4443,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPaddedPatternsModulus() {
 	return 1;  // No padding
 }
 
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::hasPackedTipStates() {
+	return false;
+}
+
+BEAGLE_CPU_TEMPLATE
+bool BeagleCPUImpl<BEAGLE_CPU_GENERIC>::supportsPatternMajorPartials() {
+	return true;
+}
+
 BEAGLE_CPU_TEMPLATE
 void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::mallocAligned(size_t size) {
 	void *ptr = (void *) NULL;
@@ -2264,6 +4484,27 @@ void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::mallocAligned(size_t size) {
 	return ptr;
 }
 
+BEAGLE_CPU_TEMPLATE
+void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocateBuffer(size_t size) {
+    void* ptr = gArena.allocate(size);
+    if (ptr == NULL)
+        ptr = mallocAligned(size);
+    return ptr;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::freeBuffer(void* ptr) {
+    if (!gArena.owns(ptr) && !gCheckpoint.owns(ptr) && !gSpill.owns(ptr))
+        free(ptr);
+}
+
+BEAGLE_CPU_TEMPLATE
+REALTYPE* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::allocatePartials(int bufferIndex) {
+    if (gSpill.isOpen())
+        return (REALTYPE*) gSpill.slot(bufferIndex);
+    return (REALTYPE*) allocateBuffer(sizeof(REALTYPE) * kPartialsSize);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // BeagleCPUImplFactory public methods
 BEAGLE_CPU_FACTORY_TEMPLATE
@@ -2317,19 +4558,20 @@ const char* BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 
 BEAGLE_CPU_FACTORY_TEMPLATE
 const long BeagleCPUImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
-    long flags = BEAGLE_FLAG_COMPUTATION_SYNCH |
+    long flags = BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
                  BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC |
-                 BEAGLE_FLAG_THREADING_NONE |
+                 BEAGLE_CPU_FACTORY_THREADING_FLAGS |
                  BEAGLE_FLAG_PROCESSOR_CPU |
                  BEAGLE_FLAG_VECTOR_NONE |
                  BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
                  BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
                  BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+                 BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR |
                  BEAGLE_FLAG_FRAMEWORK_CPU;
 	if (DOUBLE_PRECISION)
 		flags |= BEAGLE_FLAG_PRECISION_DOUBLE;
 	else
-		flags |= BEAGLE_FLAG_PRECISION_SINGLE;
+		flags |= BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_MIXED;
     return flags;
 }
 
@@ -0,0 +1,123 @@
+/*
+ *  BeagleCPUNuma.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUNuma__
+#define __BeagleCPUNuma__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#ifndef BEAGLE_CPU_NUMA_SYSFS_PATH
+#define BEAGLE_CPU_NUMA_SYSFS_PATH  "/sys/devices/system/node" // Where Linux describes the NUMA layout
+#endif
+
+namespace beagle {
+namespace cpu {
+
+struct BeagleCPUNumaNode {
+    int node;              // NUMA node number, as the OS counts them
+    std::vector<int> cpus; // processors of the node this process may run on
+};
+
+/*
+ * Parses a Linux CPU or node list such as "0-7,16-23" into its members.
+ */
+inline bool parseCPUList(const char* path,
+                         std::vector<int>& members) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+    char line[4096];
+    bool ok = (fgets(line, sizeof(line), file) != NULL);
+    fclose(file);
+    if (!ok)
+        return false;
+
+    char* p = line;
+    while (*p != '\0' && *p != '\n') {
+        char* end;
+        int first = (int) strtol(p, &end, 10);
+        if (end == p)
+            return false;
+        int last = first;
+        p = end;
+        if (*p == '-') {
+            last = (int) strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (int i = first; i <= last; i++)
+            members.push_back(i);
+        if (*p == ',')
+            p++;
+    }
+    return true;
+}
+
+/*
+ * The NUMA nodes holding processors this process may run on, in node order.
+ * Empty when the layout cannot be read (e.g. on platforms other than Linux).
+ */
+inline std::vector<BeagleCPUNumaNode> getNumaNodes() {
+    std::vector<BeagleCPUNumaNode> nodes;
+#if defined(__linux__)
+    cpu_set_t available;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &available) != 0)
+        return nodes;
+
+    std::vector<int> online;
+    if (!parseCPUList(BEAGLE_CPU_NUMA_SYSFS_PATH "/online", online))
+        return nodes;
+
+    for (size_t i = 0; i < online.size(); i++) {
+        char path[256];
+        snprintf(path, sizeof(path), BEAGLE_CPU_NUMA_SYSFS_PATH "/node%d/cpulist", online[i]);
+        std::vector<int> cpus;
+        if (!parseCPUList(path, cpus))
+            continue;
+
+        BeagleCPUNumaNode node;
+        node.node = online[i];
+        for (size_t j = 0; j < cpus.size(); j++) {
+            if (cpus[j] >= 0 && cpus[j] < CPU_SETSIZE && CPU_ISSET(cpus[j], &available))
+                node.cpus.push_back(cpus[j]);
+        }
+        if (!node.cpus.empty()) // memory-only nodes cannot run an instance
+            nodes.push_back(node);
+    }
+#endif
+    return nodes;
+}
+
+}
+}
+
+#endif // __BeagleCPUNuma__
@@ -12,6 +12,8 @@
 #include "libhmsbeagle/CPU/BeagleCPU4StateSSEImpl.h"
 #include "libhmsbeagle/CPU/BeagleCPUSSEImpl.h"
 #include <iostream>
+#include <sstream>
+#include <cstring>
 
 namespace beagle {
 namespace cpu {
@@ -26,17 +28,43 @@ Plugin("CPU-SSE-OpenMP", "CPU-SSE-OpenMP")
                                          BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
                                          BEAGLE_FLAG_THREADING_NONE |
                                          BEAGLE_FLAG_PROCESSOR_CPU |
-                                         BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE |
+                                         BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE | BEAGLE_FLAG_PRECISION_MIXED |
                                          BEAGLE_FLAG_VECTOR_NONE |
                                          BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
                                          BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
                                          BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+                                         BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR |
                                          BEAGLE_FLAG_FRAMEWORK_CPU;
         resource.supportFlags |= BEAGLE_FLAG_VECTOR_SSE;
         resource.supportFlags |= BEAGLE_FLAG_THREADING_OPENMP;
+#ifdef BEAGLE_CPU_THREAD_POOL
+        resource.supportFlags |= BEAGLE_FLAG_THREADING_CPP;
+        resource.supportFlags |= BEAGLE_FLAG_COMPUTATION_ASYNCH;
+#endif
         resource.requiredFlags = BEAGLE_FLAG_FRAMEWORK_CPU;
 	beagleResources.push_back(resource);
 
+#ifdef BEAGLE_CPU_THREAD_POOL
+	// On a multi-socket machine each NUMA node is also a resource of its own (plugin
+	// resource number node + 1), served by a thread pool bound to the node's processors
+	std::vector<BeagleCPUNumaNode> numaNodes = getNumaNodes();
+	if (numaNodes.size() > 1) {
+		for (size_t i = 0; i < numaNodes.size(); i++) {
+			std::ostringstream name, description;
+			name << "CPU-Node" << numaNodes[i].node;
+			description << "NUMA node " << numaNodes[i].node << ", processors";
+			for (size_t j = 0; j < numaNodes[i].cpus.size(); j++)
+				description << (j == 0 ? " " : ",") << numaNodes[i].cpus[j];
+
+			BeagleResource nodeResource = resource;
+			nodeResource.name = strdup(name.str().c_str());
+			nodeResource.description = strdup(description.str().c_str());
+			nodeResource.requiredFlags = BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_THREADING_CPP;
+			beagleResources.push_back(nodeResource);
+		}
+	}
+#endif
+
 	// Optional for plugins: check if the hardware is compatible and only populate
 	// list with compatible factories
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateImplFactory<double>());
@@ -46,8 +74,9 @@ Plugin("CPU-SSE-OpenMP", "CPU-SSE-OpenMP")
 
 	// FIXME: the SSE plugin currently assumes all hardware is compatible
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<double>());
-//	implFactory->push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<float>()); // TODO Not yet written
+	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateSSEImplFactory<float>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<double>()); // TODO In process of writing
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUSSEImplFactory<float>());
 
 }
 
@@ -73,6 +73,7 @@ class BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT> : public BeagleCPUImpl<BEAGLE_CPU_S
 
 protected:
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kTipCount;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kFlags;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gPartials;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::integrationTmp;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gTransitionMatrices;
@@ -88,6 +89,9 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::realtypeMin;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kMatrixSize;
 	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::kPartialsPaddedStateCount;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::outLogLikelihoodsTmp;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::gPatternWeights;
+	using BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::scalingExponentThreshhold;
 
 public:
     virtual const char* getName();
@@ -97,38 +101,55 @@ public:
 protected:
     virtual int getPaddedPatternsModulus();
 
+    virtual bool supportsPatternMajorPartials();
+
 private:
 	virtual void calcStatesStates(float* destP,
-                                     const int* states1,
+                                     const unsigned char* states1,
                                      const float* matrices1,
-                                     const int* states2,
-                                     const float* matrices2);
+                                     const unsigned char* states2,
+                                     const float* matrices2,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern);
 
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const float* matrices1,
                                     const float* partials2,
-                                    const float* matrices2);
+                                    const float* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
 
     virtual void calcPartialsPartials(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
-                                      const float* __restrict matrices2);
+                                      const float* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(float* __restrict destP,
                                       const float* __restrict partials1,
                                       const float* __restrict matrices1,
                                       const float* __restrict partials2,
                                       const float* __restrict matrices2,
-                                      const float* __restrict scaleFactors);
+                                      const float* __restrict scaleFactors,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
 
     virtual void calcPartialsPartialsAutoScaling(float* __restrict destP,
                                                  const float* __restrict partials1,
                                                  const float* __restrict matrices1,
                                                  const float* __restrict partials2,
                                                  const float* __restrict matrices2,
-                                                 int* activateScaling);
+                                                 int* activateScaling,
+                                                 int category,
+                                                 int startPattern,
+                                                 int endPattern);
 
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                         const int childBufferIndex,
@@ -138,6 +159,18 @@ private:
                                         const int scalingFactorsIndex,
                                         double* outSumLogLikelihood);
 
+    // Sums over the kStateCount states of matrix rows times partials; whole
+    // quads use unaligned SSE loads and any remaining states a scalar tail
+    inline float innerProduct(const float* __restrict matrix,
+                              const float* __restrict partials);
+
+    inline void innerProducts(const float* __restrict matrix1,
+                              const float* __restrict partials1,
+                              const float* __restrict matrix2,
+                              const float* __restrict partials2,
+                              float& sum1,
+                              float& sum2);
+
 
 };
 
@@ -171,38 +204,55 @@ public:
 protected:
     virtual int getPaddedPatternsModulus();
 
+    virtual bool supportsPatternMajorPartials();
+
 private:
 	virtual void calcStatesStates(double* destP,
-                                     const int* states1,
+                                     const unsigned char* states1,
                                      const double* matrices1,
-                                     const int* states2,
-                                     const double* matrices2);
+                                     const unsigned char* states2,
+                                     const double* matrices2,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern);
 
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const unsigned char* states1,
                                     const double* matrices1,
                                     const double* partials2,
-                                    const double* matrices2);
+                                    const double* matrices2,
+                                    int category,
+                                    int startPattern,
+                                    int endPattern);
 
     virtual void calcPartialsPartials(double* __restrict destP,
                                       const double* __restrict partials1,
                                       const double* __restrict matrices1,
                                       const double* __restrict partials2,
-                                      const double* __restrict matrices2);
+                                      const double* __restrict matrices2,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
     
     virtual void calcPartialsPartialsFixedScaling(double* __restrict destP,
                                       const double* __restrict partials1,
                                       const double* __restrict matrices1,
                                       const double* __restrict partials2,
                                       const double* __restrict matrices2,
-                                      const double* __restrict scaleFactors);
+                                      const double* __restrict scaleFactors,
+                                      int category,
+                                      int startPattern,
+                                      int endPattern);
 
     virtual void calcPartialsPartialsAutoScaling(double* __restrict destP,
                                                  const double* __restrict partials1,
                                                  const double* __restrict matrices1,
                                                  const double* __restrict partials2,
                                                  const double* __restrict matrices2,
-                                                 int* activateScaling);
+                                                 int* activateScaling,
+                                                 int category,
+                                                 int startPattern,
+                                                 int endPattern);
 
     virtual int calcEdgeLogLikelihoods(const int parentBufferIndex,
                                         const int childBufferIndex,
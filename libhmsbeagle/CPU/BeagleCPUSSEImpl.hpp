@@ -62,24 +62,28 @@ inline const char* getBeagleCPUSSEName<float>(){ return "CPU-SSE-Single"; };
 
 BEAGLE_CPU_SSE_TEMPLATE
 void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
+                                     const unsigned char* states_q,
                                      const double* matrices_q,
-                                     const int* states_r,
-                                     const double* matrices_r) {
+                                     const unsigned char* states_r,
+                                     const double* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
 
 	BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(destP,
                                      states_q,
                                      matrices_q,
                                      states_r,
-                                     matrices_r);
+                                     matrices_r,
+                                     category, startPattern, endPattern);
 }
 
 
 //template <>
 //void BeagleCPUSSEImpl<double>::calcStatesStates(double* destP,
-//                                     const int* states_q,
+//                                     const unsigned char* states_q,
 //                                     const double* matrices_q,
-//                                     const int* states_r,
+//                                     const unsigned char* states_r,
 //                                     const double* matrices_r) {
 //
 //	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
@@ -113,23 +117,27 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
  */
 BEAGLE_CPU_SSE_TEMPLATE
 void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
+                                       const unsigned char* states_q,
                                        const double* matrices_q,
                                        const double* partials_r,
-                                       const double* matrices_r) {
+                                       const double* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
 	BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesPartials(
 									   destP,
 									   states_q,
 									   matrices_q,
 									   partials_r,
-									   matrices_r);
+									   matrices_r,
+									   category, startPattern, endPattern);
 }
 
 //
 //
 //template <>
 //void BeagleCPUSSEImpl<double>::calcStatesPartials(double* destP,
-//                                       const int* states_q,
+//                                       const unsigned char* states_q,
 //                                       const double* matrices_q,
 //                                       const double* partials_r,
 //                                       const double* matrices_r) {
@@ -211,79 +219,79 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartials(double* __res
                                               const double* __restrict partials1,
                                               const double* __restrict matrices1,
                                               const double* __restrict partials2,
-                                              const double* __restrict matrices2) {
+                                              const double* __restrict matrices2,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
     int stateCountMinusOne = kPartialsPaddedStateCount - 1;
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
-        for (int k = 0; k < kPatternCount; k++) {
-            int w = l * kMatrixSize;
-            for (int i = 0; i < kStateCount;
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount;
 #ifdef DOUBLE_UNROLL
-            		i += 2 // TODO This only works if stateCount is even
+        		i += 2 // TODO This only works if stateCount is even
 #else
-            		++i
+        		++i
 #endif
-            ) {
-            	register V_Real sum1_vecA = VEC_SETZERO();
-            	register V_Real sum2_vecA = VEC_SETZERO();
-            	for (int j = 0; j < stateCountMinusOne; j += 2) {
-            		sum1_vecA = VEC_MADD(
-								 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
-								 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
-								 sum1_vecA);
-            		sum2_vecA = VEC_MADD(
-								 VEC_LOAD(matrices2 + w + j),
-								 VEC_LOAD(partials2 + v + j),
-								 sum2_vecA);
-            	}
-
-            	sum1_vecA = VEC_MULT(
-            	               VEC_ADD(sum1_vecA, VEC_SWAP(sum1_vecA)),
-            	               VEC_ADD(sum2_vecA, VEC_SWAP(sum2_vecA))
-            	           );
-
-                // increment for the extra column at the end
-                w += kStateCount + T_PAD;
+        ) {
+        	register V_Real sum1_vecA = VEC_SETZERO();
+        	register V_Real sum2_vecA = VEC_SETZERO();
+        	for (int j = 0; j < stateCountMinusOne; j += 2) {
+        		sum1_vecA = VEC_MADD(
+							 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
+							 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
+							 sum1_vecA);
+        		sum2_vecA = VEC_MADD(
+							 VEC_LOAD(matrices2 + w + j),
+							 VEC_LOAD(partials2 + v + j),
+							 sum2_vecA);
+        	}
+
+        	sum1_vecA = VEC_MULT(
+        	               VEC_ADD(sum1_vecA, VEC_SWAP(sum1_vecA)),
+        	               VEC_ADD(sum2_vecA, VEC_SWAP(sum2_vecA))
+        	           );
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
 
 #ifndef DOUBLE_UNROLL
-                // Store single value
-                VEC_STORE_SCALAR(destPu, sum1_vecA);
-                destPu++;
+            // Store single value
+            VEC_STORE_SCALAR(destPu, sum1_vecA);
+            destPu++;
 #endif
 
 #ifdef DOUBLE_UNROLL
-            	register V_Real sum1_vecB = VEC_SETZERO();
-            	register V_Real sum2_vecB = VEC_SETZERO();
-            	for (int j = 0; j < stateCountMinusOne; j += 2) {
-            		sum1_vecB = VEC_MADD(
-								 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
-								 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
-								 sum1_vecB);
-            		sum2_vecB = VEC_MADD(
-								 VEC_LOAD(matrices2 + w + j),
-								 VEC_LOAD(partials2 + v + j),
-								 sum2_vecB);
-            	}
-
-            	sum1_vecB = VEC_MULT(
-            	               VEC_ADD(sum1_vecB, VEC_SWAP(sum1_vecB)),
-            	               VEC_ADD(sum2_vecB, VEC_SWAP(sum2_vecB))
-            	           );
-
-                // increment for the extra column at the end
-                w += kStateCount + T_PAD;
-
-                // Store both partials in one transaction
-                VEC_STORE(destPu, VEC_MOVE(sum1_vecA, sum1_vecB));
-                destPu += 2;
+        	register V_Real sum1_vecB = VEC_SETZERO();
+        	register V_Real sum2_vecB = VEC_SETZERO();
+        	for (int j = 0; j < stateCountMinusOne; j += 2) {
+        		sum1_vecB = VEC_MADD(
+							 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
+							 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
+							 sum1_vecB);
+        		sum2_vecB = VEC_MADD(
+							 VEC_LOAD(matrices2 + w + j),
+							 VEC_LOAD(partials2 + v + j),
+							 sum2_vecB);
+        	}
+
+        	sum1_vecB = VEC_MULT(
+        	               VEC_ADD(sum1_vecB, VEC_SWAP(sum1_vecB)),
+        	               VEC_ADD(sum2_vecB, VEC_SWAP(sum2_vecB))
+        	           );
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+
+            // Store both partials in one transaction
+            VEC_STORE(destPu, VEC_MOVE(sum1_vecA, sum1_vecB));
+            destPu += 2;
 #endif
 
-            }
-            destPu += P_PAD;
-            v += kPartialsPaddedStateCount;
         }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
     }
 }
 
@@ -294,48 +302,48 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsFixedScaling(
                                               const double* __restrict matrices1,
                                               const double* __restrict partials2,
                                               const double* __restrict matrices2,
-                                              const double* __restrict scaleFactors) {
+                                              const double* __restrict scaleFactors,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
     int stateCountMinusOne = kPartialsPaddedStateCount - 1;
-#pragma omp parallel for num_threads(kCategoryCount)
-    for (int l = 0; l < kCategoryCount; l++) {
-    	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
-        for (int k = 0; k < kPatternCount; k++) {
-            int w = l * kMatrixSize;
-            const V_Real scalar = VEC_SPLAT(scaleFactors[k]);
-            for (int i = 0; i < kStateCount; i++) {
-
-            	register V_Real sum1_vec;
-            	register V_Real sum2_vec;
-
-              	int j = 0;
-            	sum1_vec = VEC_SETZERO();
-            	sum2_vec = VEC_SETZERO();
-            	for ( ; j < stateCountMinusOne; j += 2) {
-            		sum1_vec = VEC_MADD(
-								 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
-								 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
-								 sum1_vec);
-            		sum2_vec = VEC_MADD(
-								 VEC_LOAD(matrices2 + w + j),
-								 VEC_LOAD(partials2 + v + j),
-								 sum2_vec);
-            	}
-                VEC_STORE_SCALAR(destPu,
-                		VEC_DIV(VEC_MULT(
-                				VEC_ADD(sum1_vec, VEC_SWAP(sum1_vec)),
-                				VEC_ADD(sum2_vec, VEC_SWAP(sum2_vec))
-                		), scalar));
-
-
-                // increment for the extra column at the end
-                w += kStateCount + T_PAD;
-
-                destPu++;
-            }
-            destPu += P_PAD;
-            v += kPartialsPaddedStateCount;
+	double* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        const V_Real scalar = VEC_SPLAT(scaleFactors[k]);
+        for (int i = 0; i < kStateCount; i++) {
+
+        	register V_Real sum1_vec;
+        	register V_Real sum2_vec;
+
+          	int j = 0;
+        	sum1_vec = VEC_SETZERO();
+        	sum2_vec = VEC_SETZERO();
+        	for ( ; j < stateCountMinusOne; j += 2) {
+        		sum1_vec = VEC_MADD(
+							 VEC_LOAD(matrices1 + w + j),  // TODO This only works if w is even
+							 VEC_LOAD(partials1 + v + j),  // TODO This only works if v is even
+							 sum1_vec);
+        		sum2_vec = VEC_MADD(
+							 VEC_LOAD(matrices2 + w + j),
+							 VEC_LOAD(partials2 + v + j),
+							 sum2_vec);
+        	}
+            VEC_STORE_SCALAR(destPu,
+            		VEC_DIV(VEC_MULT(
+            				VEC_ADD(sum1_vec, VEC_SWAP(sum1_vec)),
+            				VEC_ADD(sum2_vec, VEC_SWAP(sum2_vec))
+            		), scalar));
+
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+
+            destPu++;
         }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
     }
 }
 
@@ -346,13 +354,17 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsAutoScaling(do
                                                          const double*  matrices_q,
                                                          const double*  partials_r,
                                                          const double*  matrices_r,
-                                                                  int* activateScaling) {
+                                                                  int* activateScaling,
+                                                                  int category,
+                                                                  int startPattern,
+                                                                  int endPattern) {
     BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsAutoScaling(destP,
                                                      partials_q,
                                                      matrices_q,
                                                      partials_r,
                                                      matrices_r,
-                                                     activateScaling);
+                                                     activateScaling,
+                                                     category, startPattern, endPattern);
 }
 
 //template <>
@@ -413,7 +425,7 @@ return BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcEdgeLogLikelihoods(
 //
 //    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 //
-//        const int* statesChild = gTipStates[childIndex];
+//        const unsigned char* statesChild = gTipStates[childIndex];
 //
 //		int w = 0;
 //		V_Real *vcl_r = (V_Real *)cl_r;
@@ -513,10 +525,284 @@ return BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcEdgeLogLikelihoods(
 //    return returnCode;
 //}
 
+static inline float horizontalAdd(V_Float a) {
+    V_Float t = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1,1,1,1)));
+    return _mm_cvtss_f32(t);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesStates(float* destP,
+                                     const unsigned char* states_q,
+                                     const float* matrices_q,
+                                     const unsigned char* states_r,
+                                     const float* matrices_r,
+                                     int category,
+                                     int startPattern,
+                                     int endPattern) {
+
+	BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesStates(destP,
+                                     states_q,
+                                     matrices_q,
+                                     states_r,
+                                     matrices_r,
+                                     category, startPattern, endPattern);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesPartials(float* destP,
+                                       const unsigned char* states_q,
+                                       const float* matrices_q,
+                                       const float* partials_r,
+                                       const float* matrices_r,
+                                       int category,
+                                       int startPattern,
+                                       int endPattern) {
+	BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::calcStatesPartials(
+									   destP,
+									   states_q,
+									   matrices_q,
+									   partials_r,
+									   matrices_r,
+									   category, startPattern, endPattern);
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+inline float BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::innerProduct(const float* __restrict matrix,
+                                                                  const float* __restrict partials) {
+    const int stateCountModFour = kStateCount & ~3;
+    V_Float sum_vec = VEC_SETZERO_FLOAT();
+    int j = 0;
+    for (; j < stateCountModFour; j += 4)
+        sum_vec = VEC_MADD_FLOAT(VEC_LOADU_FLOAT(matrix + j), VEC_LOADU_FLOAT(partials + j), sum_vec);
+    float sum = horizontalAdd(sum_vec);
+    for (; j < kStateCount; j++)
+        sum += matrix[j] * partials[j];
+    return sum;
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+inline void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::innerProducts(const float* __restrict matrix1,
+                                                                 const float* __restrict partials1,
+                                                                 const float* __restrict matrix2,
+                                                                 const float* __restrict partials2,
+                                                                 float& sum1,
+                                                                 float& sum2) {
+    const int stateCountModFour = kStateCount & ~3;
+    V_Float sum1_vec = VEC_SETZERO_FLOAT();
+    V_Float sum2_vec = VEC_SETZERO_FLOAT();
+    int j = 0;
+    for (; j < stateCountModFour; j += 4) {
+        sum1_vec = VEC_MADD_FLOAT(VEC_LOADU_FLOAT(matrix1 + j), VEC_LOADU_FLOAT(partials1 + j), sum1_vec);
+        sum2_vec = VEC_MADD_FLOAT(VEC_LOADU_FLOAT(matrix2 + j), VEC_LOADU_FLOAT(partials2 + j), sum2_vec);
+    }
+    sum1 = horizontalAdd(sum1_vec);
+    sum2 = horizontalAdd(sum2_vec);
+    for (; j < kStateCount; j++) {
+        sum1 += matrix1[j] * partials1[j];
+        sum2 += matrix2[j] * partials2[j];
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartials(float* __restrict destP,
+                                              const float* __restrict partials1,
+                                              const float* __restrict matrices1,
+                                              const float* __restrict partials2,
+                                              const float* __restrict matrices2,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	float* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            float sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsFixedScaling(
+													float* __restrict destP,
+                                              const float* __restrict partials1,
+                                              const float* __restrict matrices1,
+                                              const float* __restrict partials2,
+                                              const float* __restrict matrices2,
+                                              const float* __restrict scaleFactors,
+                                              int category,
+                                              int startPattern,
+                                              int endPattern) {
+	float* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        const float scalar = scaleFactors[k];
+        for (int i = 0; i < kStateCount; i++) {
+            float sum1, sum2;
+            innerProducts(matrices1 + w, partials1 + v, matrices2 + w, partials2 + v, sum1, sum2);
+            *destPu++ = sum1 * sum2 / scalar;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcPartialsPartialsAutoScaling(float* destP,
+                                                         const float*  partials_q,
+                                                         const float*  matrices_q,
+                                                         const float*  partials_r,
+                                                         const float*  matrices_r,
+                                                                  int* activateScaling,
+                                                                  int category,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+	float* destPu = destP + (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+	int v = (category*kPaddedPatternCount + startPattern)*kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        int w = category * kMatrixSize;
+        for (int i = 0; i < kStateCount; i++) {
+            float sum1, sum2;
+            innerProducts(matrices_q + w, partials_q + v, matrices_r + w, partials_r + v, sum1, sum2);
+            *destPu = sum1 * sum2;
+
+            if (*activateScaling == 0) {
+                int expTmp;
+                frexp(*destPu, &expTmp);
+                if (abs(expTmp) > scalingExponentThreshhold)
+                    *activateScaling = 1;
+            }
+            destPu++;
+
+            // increment for the extra column at the end
+            w += kStateCount + T_PAD;
+        }
+        destPu += P_PAD;
+        v += kPartialsPaddedStateCount;
+    }
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::calcEdgeLogLikelihoods(const int parIndex,
+                                                          const int childIndex,
+                                                          const int probIndex,
+                                                          const int categoryWeightsIndex,
+                                                          const int stateFrequenciesIndex,
+                                                          const int scalingFactorsIndex,
+                                                          double* outSumLogLikelihood) {
+    // TODO: implement derivatives for calculateEdgeLnL
+
+    if (kFlags & BEAGLE_FLAG_PRECISION_MIXED) // Integrated in double by the base class
+        return BeagleCPUImpl<BEAGLE_CPU_SSE_FLOAT>::calcEdgeLogLikelihoods(parIndex, childIndex, probIndex, categoryWeightsIndex,
+                                                                           stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
+
+    int returnCode = BEAGLE_SUCCESS;
+
+    assert(parIndex >= kTipCount);
+
+    const float* partialsParent = gPartials[parIndex];
+    const float* transMatrix = gTransitionMatrices[probIndex];
+    const float* wt = gCategoryWeights[categoryWeightsIndex];
+    const float* freqs = gStateFrequencies[stateFrequenciesIndex];
+
+    memset(integrationTmp, 0, (kPatternCount * kStateCount)*sizeof(float));
+
+    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
+
+        const unsigned char* statesChild = gTipStates[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const float weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                const float* transMatrixPtr = transMatrix + l * kMatrixSize + statesChild[k];
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += transMatrixPtr[0] * partialsParent[v + i] * weight;
+                    transMatrixPtr += kStateCount + T_PAD;
+                    u++;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+
+    } else { // Integrate against a partial at the child
+
+        const float* partialsChild = gPartials[childIndex];
+
+        for(int l = 0; l < kCategoryCount; l++) {
+            int u = 0;
+            int v = l * kPaddedPatternCount * kPartialsPaddedStateCount;
+            const float weight = wt[l];
+            for(int k = 0; k < kPatternCount; k++) {
+                int w = l * kMatrixSize;
+                for(int i = 0; i < kStateCount; i++) {
+                    integrationTmp[u] += innerProduct(transMatrix + w, partialsChild + v) *
+                                         partialsParent[v + i] * weight;
+                    u++;
+
+                    // increment for the extra column at the end
+                    w += kStateCount + T_PAD;
+                }
+                v += kPartialsPaddedStateCount;
+            }
+        }
+    }
+
+    int u = 0;
+    for(int k = 0; k < kPatternCount; k++) {
+        outLogLikelihoodsTmp[k] = log(innerProduct(freqs, integrationTmp + u));
+        u += kStateCount;
+    }
+
+    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
+        const float* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for(int k=0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    *outSumLogLikelihood = 0.0;
+    for (int i = 0; i < kPatternCount; i++) {
+        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        returnCode = BEAGLE_ERROR_FLOATING_POINT;
+
+    return returnCode;
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getPaddedPatternsModulus() {
+	return 1;  // We currently do not vectorize across patterns
+}
+
+BEAGLE_CPU_SSE_TEMPLATE
+bool BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::supportsPatternMajorPartials() {
+	return false;  // Vectorized kernels assume category-major partials
+}
+
 BEAGLE_CPU_SSE_TEMPLATE
 int BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
 }
+
+BEAGLE_CPU_SSE_TEMPLATE
+bool BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::supportsPatternMajorPartials() {
+	return false;  // Vectorized kernels assume category-major partials
+}
     
 BEAGLE_CPU_SSE_TEMPLATE
 const char* BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getName() {
@@ -531,7 +817,7 @@ const char* BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::getName() {
 BEAGLE_CPU_SSE_TEMPLATE
 const long BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getFlags() {
 	return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_SINGLE |
             BEAGLE_FLAG_VECTOR_SSE |
@@ -541,7 +827,7 @@ const long BeagleCPUSSEImpl<BEAGLE_CPU_SSE_FLOAT>::getFlags() {
 BEAGLE_CPU_SSE_TEMPLATE
 const long BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::getFlags() {
     return  BEAGLE_FLAG_COMPUTATION_SYNCH |
-            BEAGLE_FLAG_THREADING_NONE |
+            BEAGLE_CPU_THREADING_FLAG |
             BEAGLE_FLAG_PROCESSOR_CPU |
             BEAGLE_FLAG_PRECISION_DOUBLE |
             BEAGLE_FLAG_VECTOR_SSE |
@@ -625,9 +911,9 @@ const char* BeagleCPUSSEImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
 
 template <>
 const long BeagleCPUSSEImplFactory<double>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
            BEAGLE_FLAG_PRECISION_DOUBLE |
@@ -639,12 +925,12 @@ const long BeagleCPUSSEImplFactory<double>::getFlags() {
 
 template <>
 const long BeagleCPUSSEImplFactory<float>::getFlags() {
-    return BEAGLE_FLAG_COMPUTATION_SYNCH |
+    return BEAGLE_CPU_FACTORY_COMPUTATION_FLAGS |
            BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO |
-           BEAGLE_FLAG_THREADING_NONE |
+           BEAGLE_CPU_FACTORY_THREADING_FLAGS |
            BEAGLE_FLAG_PROCESSOR_CPU |
            BEAGLE_FLAG_VECTOR_SSE |
-           BEAGLE_FLAG_PRECISION_SINGLE |
+           BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_MIXED |
            BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
            BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
            BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
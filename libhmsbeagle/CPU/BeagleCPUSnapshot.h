@@ -0,0 +1,130 @@
+/*
+ *  BeagleCPUSnapshot.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUSnapshot__
+#define __BeagleCPUSnapshot__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <vector>
+#include <cstddef>
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Copy-on-write log of one table of instance buffers (partials, scale
+ * buffers, transition matrices) since the last snapshot.
+ *
+ * Taking a snapshot copies nothing. The first write to a buffer afterwards
+ * parks the buffer's block in the log and points the table entry at a spare
+ * block; restoring points the entries of the written buffers back at their
+ * parked blocks, so it costs one pointer swap per buffer written. Blocks
+ * move between the table, the log and the spare list but are never freed
+ * here, so once a few proposals have been made no memory is allocated.
+ */
+template <typename T>
+class BeagleCPUSnapshotLog {
+public:
+    BeagleCPUSnapshotLog()
+        : active(false) {
+    }
+
+    void resize(int count) {
+        parked.assign(count, (T*) NULL);
+    }
+
+    bool isActive() const {
+        return active;
+    }
+
+    // true if a block must be parked before the buffer at index is written
+    bool needsDetach(int index, const T* block) const {
+        return active && block != NULL && parked[index] == NULL;
+    }
+
+    // A block to hand a detached buffer, or NULL if the caller has to allocate one
+    T* takeSpare() {
+        if (spare.empty())
+            return NULL;
+        T* block = spare.back();
+        spare.pop_back();
+        return block;
+    }
+
+    // Parks the snapshot block of the buffer at index, which is about to be replaced
+    void detach(int index, T* block) {
+        parked[index] = block;
+        written.push_back(index);
+    }
+
+    // Starts a new snapshot of the current contents; parked blocks become spares
+    void save() {
+        for (size_t i = 0; i < written.size(); i++) {
+            spare.push_back(parked[written[i]]);
+            parked[written[i]] = NULL;
+        }
+        written.clear();
+        active = true;
+    }
+
+    // Returns the buffers written since the snapshot to their parked blocks; the
+    // blocks they were written in become spares and the snapshot stays in place
+    void restore(T** buffers) {
+        for (size_t i = 0; i < written.size(); i++) {
+            const int index = written[i];
+            spare.push_back(buffers[index]);
+            buffers[index] = parked[index];
+            parked[index] = NULL;
+        }
+        written.clear();
+    }
+
+    // Indices of the buffers written since the snapshot, in order of first write
+    const std::vector<int>& getWritten() const {
+        return written;
+    }
+
+    // Snapshot block of the buffer at index, or NULL if it has not been written
+    T* getParked(int index) const {
+        return parked[index];
+    }
+
+    // Blocks no buffer holds; the owner frees them after a final save()
+    const std::vector<T*>& getSpare() const {
+        return spare;
+    }
+
+private:
+    bool active;
+    std::vector<T*> parked;
+    std::vector<int> written;
+    std::vector<T*> spare;
+};
+
+}
+}
+
+#endif // __BeagleCPUSnapshot__
@@ -0,0 +1,172 @@
+/*
+ *  BeagleCPUSpill.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUSpill__
+#define __BeagleCPUSpill__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdlib>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "libhmsbeagle/CPU/BeagleCPUArena.h"
+
+#ifdef BEAGLE_CPU_ARENA_MMAP
+#include <unistd.h>
+#endif
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Partials buffers kept in a file rather than in memory.
+ *
+ * The file is created in a given directory, unlinked straight away so that
+ * it goes when the instance does, and mapped shared: the OS writes pages
+ * back to it and drops them under memory pressure, so the buffers can be
+ * larger than RAM. Each buffer index has its own page-aligned slot, which
+ * lets prefetch() and evict() advise the OS about one buffer at a time.
+ */
+class BeagleCPUSpill {
+public:
+    BeagleCPUSpill()
+        : base(NULL),
+          size(0),
+          slotBytes(0),
+          slotCount(0) {
+    }
+
+    ~BeagleCPUSpill() {
+        release();
+    }
+
+    // Creates a file of slotCount slots of at least bytes each in directory;
+    // returns false if the platform cannot map files or the file cannot be made
+    bool create(const char* directory,
+                int count,
+                size_t bytes) {
+        release();
+#ifdef BEAGLE_CPU_ARENA_MMAP
+        const size_t slot = (bytes + BEAGLE_CPU_ARENA_PAGE_SIZE - 1) & ~((size_t) BEAGLE_CPU_ARENA_PAGE_SIZE - 1);
+        const size_t length = slot * count;
+        if (length == 0)
+            return false;
+
+        std::string path = std::string(directory) + "/beagle-partials-XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        const int fd = mkstemp(&name[0]);
+        if (fd < 0)
+            return false;
+        unlink(&name[0]);
+
+        void* ptr = MAP_FAILED;
+        if (ftruncate(fd, (off_t) length) == 0)
+            ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd); // the mapping keeps the file open
+        if (ptr == MAP_FAILED)
+            return false;
+
+        base = (char*) ptr;
+        size = length;
+        slotBytes = slot;
+        slotCount = count;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void release() {
+#ifdef BEAGLE_CPU_ARENA_MMAP
+        if (base != NULL)
+            munmap(base, size);
+#endif
+        base = NULL;
+        size = 0;
+        slotBytes = 0;
+        slotCount = 0;
+    }
+
+    bool isOpen() const {
+        return base != NULL;
+    }
+
+    // Slot of the buffer at index
+    void* slot(int index) const {
+        return base + slotBytes * index;
+    }
+
+    // true if ptr points into one of the slots
+    bool owns(const void* ptr) const {
+        return base != NULL && (const char*) ptr >= base && (const char*) ptr < base + size;
+    }
+
+    // Starts reading the slot holding ptr from the file ahead of its use
+    void prefetch(const void* ptr) const {
+#if defined(BEAGLE_CPU_ARENA_MMAP) && defined(MADV_WILLNEED)
+        if (owns(ptr))
+            madvise(slotOf(ptr), slotBytes, MADV_WILLNEED);
+#endif
+    }
+
+    // Marks the slot holding ptr as the first to go back to the file; its
+    // contents stay valid and are read in again when next touched
+    void evict(const void* ptr) const {
+#ifdef BEAGLE_CPU_ARENA_MMAP
+        if (owns(ptr)) {
+#if defined(MADV_COLD)
+            madvise(slotOf(ptr), slotBytes, MADV_COLD);
+#elif defined(MADV_DONTNEED)
+            madvise(slotOf(ptr), slotBytes, MADV_DONTNEED); // pages of a shared file mapping survive in the file
+#endif
+        }
+#endif
+    }
+
+    int getSlotCount() const {
+        return slotCount;
+    }
+
+private:
+    BeagleCPUSpill(const BeagleCPUSpill&);
+    BeagleCPUSpill& operator=(const BeagleCPUSpill&);
+
+    char* slotOf(const void* ptr) const {
+        return base + (((const char*) ptr - base) / slotBytes) * slotBytes;
+    }
+
+    char* base;
+    size_t size;
+    size_t slotBytes;
+    int slotCount;
+};
+
+}
+}
+
+#endif // __BeagleCPUSpill__
@@ -0,0 +1,282 @@
+/*
+ *  BeagleCPUThreadPool.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUThreadPool__
+#define __BeagleCPUThreadPool__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#define BEAGLE_CPU_THREAD_POOL_PAUSE()  _mm_pause()
+#else
+#define BEAGLE_CPU_THREAD_POOL_PAUSE()  std::this_thread::yield()
+#endif
+
+#define BEAGLE_CPU_THREAD_POOL_SPIN_COUNT   (1 << 16) // Polls before an idle worker goes to sleep
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * A persistent pool of worker threads owned by a single instance.
+ *
+ * Between jobs the workers spin on a generation counter for a short while
+ * before blocking, so back-to-back jobs (e.g. the operations of one
+ * updatePartials call) do not pay for waking threads up; the caller waits
+ * for a job the same way.
+ *
+ * Pools bound to processors take them in turn from a process-wide count, so
+ * that instances running side by side do not share processors while others
+ * sit idle.
+ */
+class BeagleCPUThreadPool {
+public:
+    class Task {
+    public:
+        virtual ~Task() {}
+        virtual void execute(int taskIndex) = 0;
+    };
+
+    // threadCount includes the calling thread, which takes part in every job
+    BeagleCPUThreadPool(int threadCount,
+                        bool pinThreads)
+        : kThreadCount(threadCount < 1 ? 1 : threadCount),
+          kCallerRuns(true),
+          kSpinCount(BEAGLE_CPU_THREAD_POOL_SPIN_COUNT),
+          generation(0),
+          sleepingWorkers(0),
+          activeWorkers(0),
+          callerSleeping(false),
+          nextTask(0),
+          stop(false),
+          taskCount(0),
+          task(NULL) {
+        // Spinning only pays off while every thread has a processor to itself
+        unsigned int processorCount = std::thread::hardware_concurrency();
+        if (processorCount > 0 && (unsigned int) kThreadCount > processorCount)
+            kSpinCount = 0;
+
+        // The calling thread is left where it is but still counts as the first of the pool's
+        const int firstCPU = (pinThreads ? claimCPUs(-1, kThreadCount) : 0);
+        for (int i = 1; i < kThreadCount; i++) {
+            workers.push_back(std::thread(&BeagleCPUThreadPool::workerLoop, this));
+            if (pinThreads)
+                pinWorker(workers.back(), availableCPU(firstCPU + i));
+        }
+    }
+
+    // threadCount workers bound round robin to the given processors (e.g. those of one
+    // NUMA node); the calling thread only waits, so every task runs on one of them
+    BeagleCPUThreadPool(int threadCount,
+                        const std::vector<int>& cpus)
+        : kThreadCount(threadCount < 1 ? 1 : threadCount),
+          kCallerRuns(false),
+          kSpinCount(BEAGLE_CPU_THREAD_POOL_SPIN_COUNT),
+          generation(0),
+          sleepingWorkers(0),
+          activeWorkers(0),
+          callerSleeping(false),
+          nextTask(0),
+          stop(false),
+          taskCount(0),
+          task(NULL) {
+        if (cpus.empty() || (size_t) kThreadCount > cpus.size())
+            kSpinCount = 0;
+
+        const int firstCPU = (cpus.empty() ? 0 : claimCPUs(cpus[0], kThreadCount));
+        for (int i = 0; i < kThreadCount; i++) {
+            workers.push_back(std::thread(&BeagleCPUThreadPool::workerLoop, this));
+            if (!cpus.empty())
+                pinWorker(workers.back(), cpus[(firstCPU + i) % cpus.size()]);
+        }
+    }
+
+    ~BeagleCPUThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop.store(true);
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    int getThreadCount() const { return kThreadCount; }
+
+    // Calls inTask->execute(i) for every i in [0, inTaskCount) and returns
+    // once all of them have completed
+    void run(int inTaskCount,
+             Task* inTask) {
+        if (kCallerRuns && (kThreadCount == 1 || inTaskCount == 1)) {
+            for (int i = 0; i < inTaskCount; i++)
+                inTask->execute(i);
+            return;
+        }
+
+        task = inTask;
+        taskCount = inTaskCount;
+        nextTask.store(0, std::memory_order_relaxed);
+        activeWorkers.store((int) workers.size(), std::memory_order_relaxed);
+        generation.fetch_add(1);
+        if (sleepingWorkers.load() > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_all();
+        }
+
+        if (kCallerRuns)
+            executeTasks();
+
+        int spins = 0;
+        while (activeWorkers.load(std::memory_order_acquire) != 0) {
+            if (++spins < kSpinCount) {
+                BEAGLE_CPU_THREAD_POOL_PAUSE();
+            } else {
+                std::unique_lock<std::mutex> lock(mutex);
+                callerSleeping.store(true);
+                while (activeWorkers.load() != 0)
+                    finished.wait(lock);
+                callerSleeping.store(false);
+            }
+        }
+    }
+
+private:
+    void executeTasks() {
+        int i;
+        while ((i = nextTask.fetch_add(1, std::memory_order_relaxed)) < taskCount)
+            task->execute(i);
+    }
+
+    void workerLoop() {
+        unsigned int seen = 0;
+        while (true) {
+            int spins = 0;
+            unsigned int current;
+            while ((current = generation.load()) == seen && !stop.load(std::memory_order_relaxed)) {
+                if (++spins < kSpinCount) {
+                    BEAGLE_CPU_THREAD_POOL_PAUSE();
+                } else {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    sleepingWorkers.fetch_add(1);
+                    while (generation.load() == seen && !stop.load())
+                        wake.wait(lock);
+                    sleepingWorkers.fetch_sub(1);
+                    spins = 0;
+                }
+            }
+            if (stop.load())
+                return;
+            seen = current;
+            executeTasks();
+            if (activeWorkers.fetch_sub(1) == 1 && callerSleeping.load()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.notify_one();
+            }
+        }
+    }
+
+    // The first of count processor slots that no pool bound to the same processors has
+    // taken yet; setKey names the processors (-1 for all those of the process). Slots wrap
+    // around the processors, so pools beyond them share again
+    static int claimCPUs(int setKey,
+                         int count) {
+        static std::mutex claimMutex;
+        static std::map<int, int> nextCPU;
+        std::lock_guard<std::mutex> lock(claimMutex);
+        int first = nextCPU[setKey];
+        nextCPU[setKey] = first + count;
+        return first;
+    }
+
+    // The workerIndex-th processor available to this process, or -1 if unknown
+    static int availableCPU(int workerIndex) {
+#if defined(__linux__)
+        cpu_set_t available;
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &available) != 0)
+            return -1;
+        int cpuCount = CPU_COUNT(&available);
+        if (cpuCount < 1)
+            return -1;
+        int target = workerIndex % cpuCount;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &available) && target-- == 0)
+                return cpu;
+        }
+#endif
+        return -1;
+    }
+
+    // Binds a worker to one processor
+    static void pinWorker(std::thread& worker,
+                          int cpu) {
+#if defined(__linux__)
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(worker.native_handle(), sizeof(cpu_set_t), &set);
+#endif
+    }
+
+    BeagleCPUThreadPool(const BeagleCPUThreadPool&);            // disallow copy
+    BeagleCPUThreadPool& operator=(const BeagleCPUThreadPool&);
+
+    const int kThreadCount;
+    const bool kCallerRuns; // the thread calling run() executes tasks too
+    int kSpinCount;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished; // signalled when the last worker of a job is done
+    std::atomic<unsigned int> generation;
+    std::atomic<int> sleepingWorkers;
+    std::atomic<int> activeWorkers;
+    std::atomic<bool> callerSleeping;
+    std::atomic<int> nextTask;
+    std::atomic<bool> stop;
+
+    int taskCount;
+    Task* task;
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // __BeagleCPUThreadPool__
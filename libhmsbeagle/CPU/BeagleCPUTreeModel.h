@@ -0,0 +1,259 @@
+/*
+ *  BeagleCPUTreeModel.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUTreeModel__
+#define __BeagleCPUTreeModel__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <vector>
+#include <algorithm>
+
+#include "libhmsbeagle/beagle.h"
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * A rooted binary tree registered with an instance, and what of it is stale.
+ *
+ * Node i keeps its partials in buffer i and the matrix of the edge above it
+ * in matrix i; tips are nodes 0 to tipCount - 1. Edges whose length changed
+ * need their matrix recomputed, and an internal node needs its partials
+ * recomputed when its children changed or the matrix or partials of one of
+ * them did, so a local change costs the path from it to the root.
+ */
+class BeagleCPUTreeModel {
+public:
+    BeagleCPUTreeModel()
+        : tipCount(0),
+          root(BEAGLE_OP_NONE),
+          allDirty(true),
+          computedEigenIndex(BEAGLE_OP_NONE),
+          computedRescaled(false),
+          computedScaleBuffers(false) {
+    }
+
+    bool isSet() const {
+        return !parents.empty();
+    }
+
+    int getRoot() const {
+        return root;
+    }
+
+    // Checks that parentIndices describe a rooted binary tree over 2 * inTipCount - 1
+    // nodes, then marks what differs from the current tree
+    int set(int inTipCount,
+            const int* parentIndices,
+            const double* edgeLengths,
+            int nodeCount) {
+        if (inTipCount < 2 || nodeCount != 2 * inTipCount - 1)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        int newRoot = BEAGLE_OP_NONE;
+        newChildren.assign(2 * (inTipCount - 1), BEAGLE_OP_NONE);
+        for (int node = 0; node < nodeCount; node++) {
+            const int parent = parentIndices[node];
+            if (parent == BEAGLE_OP_NONE) {
+                if (newRoot != BEAGLE_OP_NONE || node < inTipCount)
+                    return BEAGLE_ERROR_OUT_OF_RANGE;
+                newRoot = node;
+                continue;
+            }
+            if (parent < inTipCount || parent >= nodeCount)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            int* slot = &newChildren[2 * (parent - inTipCount)];
+            if (slot[0] == BEAGLE_OP_NONE)
+                slot[0] = node;
+            else if (slot[1] == BEAGLE_OP_NONE)
+                slot[1] = node;
+            else
+                return BEAGLE_ERROR_OUT_OF_RANGE; // more than two children
+        }
+        if (newRoot == BEAGLE_OP_NONE)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+
+        // Internal nodes, children first; a node left unvisited is on a cycle
+        newPostorder.clear();
+        stack.assign(1, newRoot);
+        while (!stack.empty()) {
+            const int node = stack.back();
+            stack.pop_back();
+            if (node < inTipCount)
+                continue;
+            const int* nodeChildren = &newChildren[2 * (node - inTipCount)];
+            if (nodeChildren[1] == BEAGLE_OP_NONE)
+                return BEAGLE_ERROR_OUT_OF_RANGE; // fewer than two children
+            newPostorder.push_back(node);
+            stack.push_back(nodeChildren[0]);
+            stack.push_back(nodeChildren[1]);
+        }
+        if ((int) newPostorder.size() != inTipCount - 1)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        for (size_t i = 0; i < newPostorder.size() / 2; i++)
+            std::swap(newPostorder[i], newPostorder[newPostorder.size() - 1 - i]);
+
+        if (!isSet() || inTipCount != tipCount) {
+            tipCount = inTipCount;
+            lengths.assign(edgeLengths, edgeLengths + nodeCount);
+            matrixDirty.assign(nodeCount, 1);
+            partialsDirty.assign(nodeCount, 1);
+            allDirty = true;
+        } else {
+            for (int node = 0; node < nodeCount; node++) {
+                if (edgeLengths[node] != lengths[node]) {
+                    lengths[node] = edgeLengths[node];
+                    matrixDirty[node] = 1;
+                }
+            }
+            for (int node = tipCount; node < nodeCount; node++) {
+                const int* oldChildren = &children[2 * (node - tipCount)];
+                const int* nodeChildren = &newChildren[2 * (node - tipCount)];
+                if (!((oldChildren[0] == nodeChildren[0] && oldChildren[1] == nodeChildren[1]) ||
+                      (oldChildren[0] == nodeChildren[1] && oldChildren[1] == nodeChildren[0])))
+                    partialsDirty[node] = 1;
+            }
+        }
+
+        parents.assign(parentIndices, parentIndices + nodeCount);
+        children.swap(newChildren);
+        postorder.swap(newPostorder);
+        root = newRoot;
+
+        return BEAGLE_SUCCESS;
+    }
+
+    int setEdgeLengths(const int* nodeIndices,
+                       const double* edgeLengths,
+                       int count) {
+        if (!isSet())
+            return BEAGLE_ERROR_GENERAL;
+        for (int i = 0; i < count; i++) {
+            if (nodeIndices[i] < 0 || nodeIndices[i] >= (int) parents.size())
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+        }
+        for (int i = 0; i < count; i++) {
+            if (edgeLengths[i] != lengths[nodeIndices[i]]) {
+                lengths[nodeIndices[i]] = edgeLengths[i];
+                matrixDirty[nodeIndices[i]] = 1;
+            }
+        }
+        return BEAGLE_SUCCESS;
+    }
+
+    // Buffers were written behind the tree's back, or the model or tip data changed
+    void markAllDirty() {
+        allDirty = true;
+    }
+
+    // Only the scale buffers of internal nodes, once the tree's partials rely on them, matter
+    void markScaleBufferWritten(int scaleIndex) {
+        if (computedScaleBuffers && scaleIndex >= 0 && scaleIndex < tipCount - 1)
+            allDirty = true;
+    }
+
+    // Lists the matrices and the operations, in postorder, that bring the tree up to date
+    // for the given eigen decomposition and rescaling; markClean once they have run
+    void collectUpdates(int eigenIndex,
+                        bool rescale,
+                        std::vector<int>& matrixIndices,
+                        std::vector<double>& matrixLengths,
+                        std::vector<int>& operations) {
+        const bool allMatrices = allDirty || eigenIndex != computedEigenIndex;
+        const bool allPartials = allDirty || rescale != computedRescaled;
+
+        matrixIndices.clear();
+        matrixLengths.clear();
+        operations.clear();
+
+        const int nodeCount = (int) parents.size();
+        stale.assign(nodeCount, 0);
+        for (int node = 0; node < nodeCount; node++) {
+            if (node != root && (allMatrices || matrixDirty[node])) {
+                matrixIndices.push_back(node);
+                matrixLengths.push_back(lengths[node]);
+                stale[node] = 1;
+            }
+        }
+
+        for (size_t i = 0; i < postorder.size(); i++) {
+            const int node = postorder[i];
+            const int* nodeChildren = &children[2 * (node - tipCount)];
+            if (allPartials || partialsDirty[node] || stale[nodeChildren[0]] || stale[nodeChildren[1]]) {
+                stale[node] = 1;
+                const int operation[7] = {node,
+                                          (rescale ? node - tipCount : BEAGLE_OP_NONE),
+                                          BEAGLE_OP_NONE,
+                                          nodeChildren[0], nodeChildren[0],
+                                          nodeChildren[1], nodeChildren[1]};
+                operations.insert(operations.end(), operation, operation + 7);
+            }
+        }
+    }
+
+    // Scale buffers of the internal nodes, in postorder
+    void collectScaleIndices(std::vector<int>& scaleIndices) const {
+        scaleIndices.resize(postorder.size());
+        for (size_t i = 0; i < postorder.size(); i++)
+            scaleIndices[i] = postorder[i] - tipCount;
+    }
+
+    void markClean(int eigenIndex,
+                   bool rescale,
+                   bool usesScaleBuffers) {
+        matrixDirty.assign(matrixDirty.size(), 0);
+        partialsDirty.assign(partialsDirty.size(), 0);
+        allDirty = false;
+        computedEigenIndex = eigenIndex;
+        computedRescaled = rescale;
+        computedScaleBuffers = usesScaleBuffers;
+    }
+
+private:
+    int tipCount;
+    int root;
+    std::vector<int> parents;
+    std::vector<double> lengths;        // of the edge above each node
+    std::vector<int> children;          // two per internal node, at 2 * (node - tipCount)
+    std::vector<int> postorder;         // internal nodes, children before parents
+    std::vector<char> matrixDirty;      // edge length changed
+    std::vector<char> partialsDirty;    // children changed
+    bool allDirty;
+    int computedEigenIndex;             // model the clean matrices were computed with
+    bool computedRescaled;              // whether the clean partials were rescaled on request
+    bool computedScaleBuffers;          // whether they hold factors in the nodes' scale buffers
+
+    // Scratch, kept to avoid allocating on every call
+    std::vector<int> newChildren;
+    std::vector<int> newPostorder;
+    std::vector<int> stack;
+    std::vector<char> stale;
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // __BeagleCPUTreeModel__
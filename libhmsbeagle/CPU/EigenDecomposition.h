@@ -31,9 +31,6 @@ protected:
     int kEigenDecompCount;
     int kCategoryCount;
 	long kFlags;
-    REALTYPE* matrixTmp;
-    REALTYPE* firstDerivTmp;
-    REALTYPE* secondDerivTmp;
     
 public:
 	EigenDecomposition(int decompositionCount,
@@ -76,6 +73,14 @@ public:
                                  REALTYPE** transitionMatrices,
                                  int count) = 0;
 
+    // true if updateTransitionMatrices may be called concurrently for disjoint
+    // lists of matrices
+    virtual bool isThreadSafe() { return false; }
+
+    // Every array the decompositions are kept in, with its length, for checkpointing
+    virtual void getStorage(std::vector<REALTYPE*>& arrays,
+                            std::vector<int>& lengths) = 0;
+
 };
 
 }
@@ -10,6 +10,8 @@
 
 #include "libhmsbeagle/CPU/EigenDecomposition.h"
 
+#define BEAGLE_CPU_EIGEN_MATRIX_BLOCK  8 // (edge, category) matrices contracted together against each C-cube row
+
 namespace beagle {
 namespace cpu {
 
@@ -20,9 +22,6 @@ class EigenDecompositionCube : public EigenDecomposition<BEAGLE_CPU_EIGEN_GENERI
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kStateCount;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kEigenDecompCount;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kCategoryCount;
-	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::matrixTmp;
-	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::firstDerivTmp;
-	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::secondDerivTmp;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kFlags;
 
 protected:
@@ -49,6 +48,12 @@ public:
                                  const double* categoryRates,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    // Scratch space is per call, so disjoint edge lists may be updated concurrently
+    virtual bool isThreadSafe() { return true; }
+
+    virtual void getStorage(std::vector<REALTYPE*>& arrays,
+                            std::vector<int>& lengths);
 	
 };
 
@@ -45,10 +45,6 @@ EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::EigenDecompositionCube(int dec
     	if (gEigenValues[i] == NULL)
     		throw std::bad_alloc();
     }
-    
-    matrixTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
-    firstDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
-    secondDerivTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
 }
 
 BEAGLE_CPU_EIGEN_TEMPLATE
@@ -60,9 +56,6 @@ EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::~EigenDecompositionCube() {
 	}
 	free(gCMatrices);
 	free(gEigenValues);
-	free(matrixTmp);
-	free(firstDerivTmp);
-	free(secondDerivTmp);
 }
 
 BEAGLE_CPU_EIGEN_TEMPLATE
@@ -98,9 +91,18 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(int
     }
 
 }
-    
-#define UNROLL
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::getStorage(std::vector<REALTYPE*>& arrays,
+                                                                  std::vector<int>& lengths) {
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        arrays.push_back(gCMatrices[i]);
+        lengths.push_back(kStateCount * kStateCount * kStateCount);
+        arrays.push_back(gEigenValues[i]);
+        lengths.push_back(kStateCount);
+    }
+}
+    
 BEAGLE_CPU_EIGEN_TEMPLATE
 void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(int eigenIndex,
                                                       const int* probabilityIndices,
@@ -110,150 +112,148 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(
                                                       const double* categoryRates,
                                                       REALTYPE** transitionMatrices,
                                                       int count) {
-#ifdef UNROLL													  
-	int stateCountModFour = (kStateCount / 4) * 4;
-#endif
-													  
-	if (firstDerivativeIndices == NULL && secondDerivativeIndices == NULL) {
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
+
+    const int derivativeCount = (firstDerivativeIndices == NULL ? 0 : (secondDerivativeIndices == NULL ? 1 : 2));
+    const int matrixCount = count * kCategoryCount;
+    const int paddedStateCount = kStateCount + T_PAD;
+    const int blockExpSize = BEAGLE_CPU_EIGEN_MATRIX_BLOCK * kStateCount;
+    const REALTYPE* eigenValues = gEigenValues[eigenIndex];
+    const REALTYPE* cMatrices = gCMatrices[eigenIndex];
+
+    // exp(lambda t) and its derivative terms for every matrix of one block
+    std::vector<REALTYPE> expTmp(blockExpSize * (derivativeCount + 1));
+    REALTYPE* matrixExp = &expTmp[0];
+    REALTYPE* firstDerivExp = (derivativeCount > 0 ? matrixExp + blockExpSize : NULL);
+    REALTYPE* secondDerivExp = (derivativeCount > 1 ? matrixExp + 2 * blockExpSize : NULL);
+
+    REALTYPE* blockMatrices[BEAGLE_CPU_EIGEN_MATRIX_BLOCK];
+    REALTYPE* blockFirstDerivs[BEAGLE_CPU_EIGEN_MATRIX_BLOCK];
+    REALTYPE* blockSecondDerivs[BEAGLE_CPU_EIGEN_MATRIX_BLOCK];
+
+    // Matrices are taken in (edge, category) order, a block at a time
+    for (int blockStart = 0; blockStart < matrixCount; blockStart += BEAGLE_CPU_EIGEN_MATRIX_BLOCK) {
+        int blockSize = matrixCount - blockStart;
+        if (blockSize > BEAGLE_CPU_EIGEN_MATRIX_BLOCK)
+            blockSize = BEAGLE_CPU_EIGEN_MATRIX_BLOCK;
+
+        for (int b = 0; b < blockSize; b++) {
+            const int u = (blockStart + b) / kCategoryCount;
+            const int l = (blockStart + b) % kCategoryCount;
+            const int offset = l * kStateCount * paddedStateCount;
+            REALTYPE* expB = matrixExp + b * kStateCount;
+
+            blockMatrices[b] = transitionMatrices[probabilityIndices[u]] + offset;
+            if (derivativeCount == 0) {
+                for (int i = 0; i < kStateCount; i++)
+                    expB[i] = exp(eigenValues[i] * ((REALTYPE)edgeLengths[u] * categoryRates[l]));
+            } else {
+                REALTYPE* firstDerivB = firstDerivExp + b * kStateCount;
+                REALTYPE* secondDerivB = NULL;
+                blockFirstDerivs[b] = transitionMatrices[firstDerivativeIndices[u]] + offset;
+                if (derivativeCount > 1) {
+                    secondDerivB = secondDerivExp + b * kStateCount;
+                    blockSecondDerivs[b] = transitionMatrices[secondDerivativeIndices[u]] + offset;
+                }
                 for (int i = 0; i < kStateCount; i++) {
-					matrixTmp[i] = exp(gEigenValues[eigenIndex][i] * ((REALTYPE)edgeLengths[u] * categoryRates[l]));
+                    REALTYPE scaledEigenValue = eigenValues[i] * ((REALTYPE)categoryRates[l]);
+                    expB[i] = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
+                    firstDerivB[i] = scaledEigenValue * expB[i];
+                    if (secondDerivB != NULL)
+                        secondDerivB[i] = scaledEigenValue * firstDerivB[i];
                 }
-				
-                REALTYPE* tmpCMatrices = gCMatrices[eigenIndex];
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-#ifdef UNROLL						
-						int k = 0;
-						for (; k < stateCountModFour; k += 4) {
-							sum += tmpCMatrices[k + 0] * matrixTmp[k + 0];
-							sum += tmpCMatrices[k + 1] * matrixTmp[k + 1];
-							sum += tmpCMatrices[k + 2] * matrixTmp[k + 2];
-							sum += tmpCMatrices[k + 3] * matrixTmp[k + 3];
-						}
-						for (; k < kStateCount; k++) {
-							sum += tmpCMatrices[k] * matrixTmp[k];
-						}
-						tmpCMatrices += kStateCount;
-#else
-						for (int k = 0; k < kStateCount; k++) {
-							sum += *tmpCMatrices++ * matrixTmp[k];
-						}
-#endif						
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						n++;
-					}
-if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-					n += T_PAD;
-}
-				}
-			}
-			
-			if (DEBUGGING_OUTPUT) {
-                int kMatrixSize = kStateCount * kStateCount;
-				fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u]);
-				for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
-					fprintf(stderr,"transitionMat[%d] = %.5f\n", w, transitionMat[w]);
-			}
-		}
-        
+            }
+        }
 
-	} else if (secondDerivativeIndices == NULL) {
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			REALTYPE* firstDerivMat = transitionMatrices[firstDerivativeIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-				for (int i = 0; i < kStateCount; i++) {
-					REALTYPE scaledEigenValue = gEigenValues[eigenIndex][i] * ((REALTYPE)categoryRates[l]);
-					matrixTmp[i] = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
-					firstDerivTmp[i] = scaledEigenValue * matrixTmp[i];
-				}
-				
-				int m = 0;
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-						REALTYPE sumD1 = 0.0;
-						for (int k = 0; k < kStateCount; k++) {
-							sum += gCMatrices[eigenIndex][m] * matrixTmp[k];
-							sumD1 += gCMatrices[eigenIndex][m] * firstDerivTmp[k];
-							m++;
-						}
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						firstDerivMat[n] = sumD1;
-						n++;
-					}
-if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-                    firstDerivMat[n] = 0.0;
-					n += T_PAD;
-}
-				}
-			}
-		}
-	} else {		
-		for (int u = 0; u < count; u++) {
-			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-			REALTYPE* firstDerivMat = transitionMatrices[firstDerivativeIndices[u]];
-			REALTYPE* secondDerivMat = transitionMatrices[secondDerivativeIndices[u]];
-			int n = 0;
-			for (int l = 0; l < kCategoryCount; l++) {
-				
-				for (int i = 0; i < kStateCount; i++) {
-					REALTYPE scaledEigenValue = gEigenValues[eigenIndex][i] * ((REALTYPE)categoryRates[l]);
-					matrixTmp[i] = exp(scaledEigenValue * ((REALTYPE)edgeLengths[u]));
-					firstDerivTmp[i] = scaledEigenValue * matrixTmp[i];
-					secondDerivTmp[i] = scaledEigenValue * firstDerivTmp[i];
-				}
-				
-				int m = 0;
-				for (int i = 0; i < kStateCount; i++) {
-					for (int j = 0; j < kStateCount; j++) {
-						REALTYPE sum = 0.0;
-						REALTYPE sumD1 = 0.0;
-						REALTYPE sumD2 = 0.0;
-						for (int k = 0; k < kStateCount; k++) {
-							sum += gCMatrices[eigenIndex][m] * matrixTmp[k];
-							sumD1 += gCMatrices[eigenIndex][m] * firstDerivTmp[k];
-							sumD2 += gCMatrices[eigenIndex][m] * secondDerivTmp[k];
-							m++;
-						}
-						if (sum > 0)
-							transitionMat[n] = sum;
-						else
-							transitionMat[n] = 0;
-						firstDerivMat[n] = sumD1;
-						secondDerivMat[n] = sumD2;
-						n++;
-					}
+        // Each row of the C-cube is read once per block; within a matrix the sum over k
+        // keeps its sequential order
+        const REALTYPE* cRow = cMatrices;
+        for (int i = 0; i < kStateCount; i++) {
+            for (int j = 0; j < kStateCount; j++, cRow += kStateCount) {
+                const int n = i * paddedStateCount + j;
+
+                if (derivativeCount == 0) {
+                    int b = 0;
+                    for (; b + 4 <= blockSize; b += 4) {
+                        const REALTYPE* exp0 = matrixExp + (b + 0) * kStateCount;
+                        const REALTYPE* exp1 = matrixExp + (b + 1) * kStateCount;
+                        const REALTYPE* exp2 = matrixExp + (b + 2) * kStateCount;
+                        const REALTYPE* exp3 = matrixExp + (b + 3) * kStateCount;
+                        REALTYPE sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+                        for (int k = 0; k < kStateCount; k++) {
+                            sum0 += cRow[k] * exp0[k];
+                            sum1 += cRow[k] * exp1[k];
+                            sum2 += cRow[k] * exp2[k];
+                            sum3 += cRow[k] * exp3[k];
+                        }
+                        blockMatrices[b + 0][n] = (sum0 > 0 ? sum0 : 0);
+                        blockMatrices[b + 1][n] = (sum1 > 0 ? sum1 : 0);
+                        blockMatrices[b + 2][n] = (sum2 > 0 ? sum2 : 0);
+                        blockMatrices[b + 3][n] = (sum3 > 0 ? sum3 : 0);
+                    }
+                    for (; b < blockSize; b++) {
+                        const REALTYPE* expB = matrixExp + b * kStateCount;
+                        REALTYPE sum = 0.0;
+                        for (int k = 0; k < kStateCount; k++)
+                            sum += cRow[k] * expB[k];
+                        blockMatrices[b][n] = (sum > 0 ? sum : 0);
+                    }
+                } else if (derivativeCount == 1) {
+                    for (int b = 0; b < blockSize; b++) {
+                        const REALTYPE* expB = matrixExp + b * kStateCount;
+                        const REALTYPE* firstDerivB = firstDerivExp + b * kStateCount;
+                        REALTYPE sum = 0.0;
+                        REALTYPE sumD1 = 0.0;
+                        for (int k = 0; k < kStateCount; k++) {
+                            sum += cRow[k] * expB[k];
+                            sumD1 += cRow[k] * firstDerivB[k];
+                        }
+                        blockMatrices[b][n] = (sum > 0 ? sum : 0);
+                        blockFirstDerivs[b][n] = sumD1;
+                    }
+                } else {
+                    for (int b = 0; b < blockSize; b++) {
+                        const REALTYPE* expB = matrixExp + b * kStateCount;
+                        const REALTYPE* firstDerivB = firstDerivExp + b * kStateCount;
+                        const REALTYPE* secondDerivB = secondDerivExp + b * kStateCount;
+                        REALTYPE sum = 0.0;
+                        REALTYPE sumD1 = 0.0;
+                        REALTYPE sumD2 = 0.0;
+                        for (int k = 0; k < kStateCount; k++) {
+                            sum += cRow[k] * expB[k];
+                            sumD1 += cRow[k] * firstDerivB[k];
+                            sumD2 += cRow[k] * secondDerivB[k];
+                        }
+                        blockMatrices[b][n] = (sum > 0 ? sum : 0);
+                        blockFirstDerivs[b][n] = sumD1;
+                        blockSecondDerivs[b][n] = sumD2;
+                    }
+                }
+            }
 if (T_PAD != 0) {
-					transitionMat[n] = 1.0;
-                    firstDerivMat[n] = 0.0;
-                    secondDerivMat[n] = 0.0;
-					n += T_PAD;
+            const int n = i * paddedStateCount + kStateCount;
+            for (int b = 0; b < blockSize; b++) {
+                blockMatrices[b][n] = 1.0;
+                if (derivativeCount > 0)
+                    blockFirstDerivs[b][n] = 0.0;
+                if (derivativeCount > 1)
+                    blockSecondDerivs[b][n] = 0.0;
+            }
 }
-				}
-			}
-		}
-	}
+        }
+    }
+
+    if (DEBUGGING_OUTPUT) {
+        for (int u = 0; u < count; u++) {
+            const REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
+            int kMatrixSize = kStateCount * kStateCount;
+            fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u]);
+            for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
+                fprintf(stderr,"transitionMat[%d] = %.5f\n", w, transitionMat[w]);
+        }
+    }
 }
 
 } // cpu
 } // beagle
 
 #endif	// _EigenDecompositionCube_hpp_
-
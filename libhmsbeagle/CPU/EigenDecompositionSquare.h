@@ -10,6 +10,8 @@
 
 #include "EigenDecomposition.h"
 
+#define BEAGLE_CPU_EIGEN_GEMM_ENTRIES  (1 << 18) // Matrix entries stacked into one multiply
+
 namespace beagle {
 namespace cpu {
 
@@ -20,7 +22,6 @@ class EigenDecompositionSquare: public EigenDecomposition<BEAGLE_CPU_EIGEN_GENER
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kStateCount;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kEigenDecompCount;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kCategoryCount;
-	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::matrixTmp;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kFlags;
 
 protected:
@@ -50,6 +51,11 @@ public:
                                  const double* categoryRates,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual bool isThreadSafe() { return true; }
+
+    virtual void getStorage(std::vector<REALTYPE*>& arrays,
+                            std::vector<int>& lengths);
 };
 
 }
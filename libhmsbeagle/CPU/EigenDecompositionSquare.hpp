@@ -8,6 +8,7 @@
 #define _EigenDecompositionSquare_hpp_
 #include "EigenDecompositionSquare.h"
 #include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPUGemm.h"
 
 //#if defined (BEAGLE_IMPL_DEBUGGING_OUTPUT) && BEAGLE_IMPL_DEBUGGING_OUTPUT
 //const bool DEBUGGING_OUTPUT = true;
@@ -59,8 +60,6 @@ EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::EigenDecompositionSquare(int
     	if (gEigenValues[i] == NULL)
     		throw std::bad_alloc();
     }
-
-    matrixTmp = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount * kStateCount);
 }
 
 BEAGLE_CPU_EIGEN_TEMPLATE
@@ -74,7 +73,6 @@ EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::~EigenDecompositionSquare()
 	free(gEMatrices);
 	free(gIMatrices);
 	free(gEigenValues);
-	free(matrixTmp);
 }
     
 /**
@@ -106,6 +104,19 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(i
         transposeSquareMatrix(gIMatrices[eigenIndex], kStateCount);
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::getStorage(std::vector<REALTYPE*>& arrays,
+                                                                    std::vector<int>& lengths) {
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        arrays.push_back(gEMatrices[i]);
+        lengths.push_back(kStateCount * kStateCount);
+        arrays.push_back(gIMatrices[i]);
+        lengths.push_back(kStateCount * kStateCount);
+        arrays.push_back(gEigenValues[i]);
+        lengths.push_back(kEigenValuesSize);
+    }
+}
+
 BEAGLE_CPU_EIGEN_TEMPLATE
 void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(int eigenIndex,
                                                         const int* probabilityIndices,
@@ -120,17 +131,35 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrice
 	const REALTYPE* Evec = gEMatrices[eigenIndex];
 	const REALTYPE* Eval = gEigenValues[eigenIndex];
 	const REALTYPE* EvalImag = Eval + kStateCount;
-    for (int u = 0; u < count; u++) {
-        REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
-        const double edgeLength = edgeLengths[u];
-        int n = 0;
-        for (int l = 0; l < kCategoryCount; l++) {
-			const REALTYPE distance = categoryRates[l] * edgeLength;
+
+	const int matrixSize = kStateCount * kStateCount;
+	const int matrixCount = count * kCategoryCount;
+	int blockCount = BEAGLE_CPU_EIGEN_GEMM_ENTRIES / matrixSize;
+	if (blockCount < 1)
+		blockCount = 1;
+	if (blockCount > matrixCount)
+		blockCount = matrixCount;
+
+	// diag(exp(lambda t)) * E^-1 for a block of (edge, category) matrices, stacked
+	// side by side so E * [D_1 E^-1 | D_2 E^-1 | ...] is a single multiply
+	std::vector<REALTYPE> gemmTmp(2 * matrixSize * blockCount);
+	REALTYPE* scaledIevc = &gemmTmp[0];
+	REALTYPE* products = scaledIevc + matrixSize * blockCount;
+
+	for (int blockStart = 0; blockStart < matrixCount; blockStart += blockCount) {
+		const int blockSize = (matrixCount - blockStart < blockCount ? matrixCount - blockStart : blockCount);
+		const int ld = blockSize * kStateCount;
+
+		for (int m = 0; m < blockSize; m++) {
+			const int u = (blockStart + m) / kCategoryCount;
+			const int l = (blockStart + m) % kCategoryCount;
+			const REALTYPE distance = categoryRates[l] * edgeLengths[u];
+			REALTYPE* scaledB = scaledIevc + m * kStateCount;
         	for(int i=0; i<kStateCount; i++) {
         		if (!isComplex || EvalImag[i] == 0) {
         			const REALTYPE tmp = exp(Eval[i] * distance);
         			for(int j=0; j<kStateCount; j++) {
-        				matrixTmp[i*kStateCount+j] = Ievc[i*kStateCount+j] * tmp;
+        				scaledB[i*ld+j] = Ievc[i*kStateCount+j] * tmp;
         			}
         		} else {
         			// 2 x 2 conjugate block
@@ -140,29 +169,37 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrice
         			const REALTYPE expatcosbt = expat * cos(b * distance);
         			const REALTYPE expatsinbt = expat * sin(b * distance);
         			for(int j=0; j<kStateCount; j++) {
-        				matrixTmp[ i*kStateCount+j] = expatcosbt * Ievc[ i*kStateCount+j] +
-        						                      expatsinbt * Ievc[i2*kStateCount+j];
-        				matrixTmp[i2*kStateCount+j] = expatcosbt * Ievc[i2*kStateCount+j] -
-												      expatsinbt * Ievc[ i*kStateCount+j];
+        				scaledB[ i*ld+j] = expatcosbt * Ievc[ i*kStateCount+j] +
+        						           expatsinbt * Ievc[i2*kStateCount+j];
+        				scaledB[i2*ld+j] = expatcosbt * Ievc[i2*kStateCount+j] -
+										   expatsinbt * Ievc[ i*kStateCount+j];
         			}
         			i++; // processed two conjugate rows
         		}
         	}
+		}
 
 #ifdef DEBUG_COMPLEX
            	fprintf(stderr,"[");
             	for(int i=0; i<16; i++)
-            		fprintf(stderr," %7.5e,",matrixTmp[i]);
+            		fprintf(stderr," %7.5e,",scaledIevc[i]);
             	fprintf(stderr,"] -- complex debug\n");
             	exit(0);
 #endif
 
+		beagleGemm<REALTYPE>(kStateCount, ld, kStateCount, Evec, kStateCount,
+		                     scaledIevc, ld, products, ld);
 
+		for (int m = 0; m < blockSize; m++) {
+			const int u = (blockStart + m) / kCategoryCount;
+			const int l = (blockStart + m) % kCategoryCount;
+			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]] +
+			                          l * kStateCount * (kStateCount + T_PAD);
+			const REALTYPE* productB = products + m * kStateCount;
+			int n = 0;
             for (int i = 0; i < kStateCount; i++) {
                 for (int j = 0; j < kStateCount; j++) {
-                    REALTYPE sum = 0.0;
-                    for (int k = 0; k < kStateCount; k++)
-                        sum += Evec[i*kStateCount+k] * matrixTmp[k*kStateCount+j];
+                    const REALTYPE sum = productB[i*ld+j];
                     if (sum > 0)
                         transitionMat[n] = sum;
                     else
@@ -174,9 +211,12 @@ if (T_PAD != 0) {
                 n += T_PAD;
 }
             }
-        }
+		}
+	}
 
-        if (DEBUGGING_OUTPUT) {
+    if (DEBUGGING_OUTPUT) {
+        for (int u = 0; u < count; u++) {
+        	const REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
         	int kMatrixSize = kStateCount * kStateCount;
             fprintf(stderr,"transitionMat index=%d brlen=%.5f\n", probabilityIndices[u], edgeLengths[u]);
             for ( int w = 0; w < (20 > kMatrixSize ? 20 : kMatrixSize); ++w)
@@ -60,6 +60,7 @@ typedef double VecEl_t;
 #	define VEC_MADD(a, b, c)	_mm_add_pd(_mm_mul_pd((a), (b)), (c))
 #	define VEC_SPLAT(a)			_mm_set1_pd(a)
 #	define VEC_ADD(a, b)		_mm_add_pd(a, b)
+#	define VEC_MAX(a, b)		_mm_max_pd((a), (b))
 #   define VEC_SWAP(a)			_mm_shuffle_pd(a, a, _MM_SHUFFLE2(0,1))
 # 	define VEC_SETZERO()		_mm_setzero_pd()
 #	define VEC_SET1(a)			_mm_set_sd((a))
@@ -81,6 +82,20 @@ typedef union 			/* for copying individual elements to and from vector floats */
 	}
 	VecUnion;
 
+/* Single-precision vectors, used by the float specializations */
+typedef __m128	V_Float;
+#define FLOATS_PER_VEC			4	/* number of elements per vector */
+#define VEC_LOAD_FLOAT(a)		_mm_load_ps(a)
+#define VEC_LOADU_FLOAT(a)		_mm_loadu_ps(a)
+#define VEC_STORE_FLOAT(a, b)	_mm_store_ps((a), (b))
+#define VEC_STOREU_FLOAT(a, b)	_mm_storeu_ps((a), (b))
+#define VEC_MULT_FLOAT(a, b)	_mm_mul_ps((a), (b))
+#define VEC_DIV_FLOAT(a, b)		_mm_div_ps((a), (b))
+#define VEC_MADD_FLOAT(a, b, c)	_mm_add_ps(_mm_mul_ps((a), (b)), (c))
+#define VEC_SPLAT_FLOAT(a)		_mm_set1_ps(a)
+#define VEC_ADD_FLOAT(a, b)		_mm_add_ps(a, b)
+#define VEC_SETZERO_FLOAT()		_mm_setzero_ps()
+
 #ifdef __GNUC__
     #define cpuid(func,ax,bx,cx,dx)\
             __asm__ __volatile__ ("cpuid":\
@@ -104,6 +104,29 @@ void beagleLoadPlugins(void) {
 
 	beagle::plugin::PluginManager& pm = beagle::plugin::PluginManager::instance();
 
+	// Vectorized CPU plugins come first, widest instruction set first, so that
+	// when implementations score equally the widest one the processor
+	// supports is tried first; each plugin refuses to load without its ISA
+	try{
+		beagle::plugin::Plugin* avx512plug = pm.findPlugin("hmsbeagle-cpu-avx512");
+		plugins->push_back(avx512plug);
+	}catch(beagle::plugin::SharedLibraryException sle){}
+
+	try{
+		beagle::plugin::Plugin* avx2plug = pm.findPlugin("hmsbeagle-cpu-avx2");
+		plugins->push_back(avx2plug);
+	}catch(beagle::plugin::SharedLibraryException sle){}
+
+	try{
+		beagle::plugin::Plugin* avxplug = pm.findPlugin("hmsbeagle-cpu-avx");
+		plugins->push_back(avxplug);
+	}catch(beagle::plugin::SharedLibraryException sle){}
+
+	try{
+		beagle::plugin::Plugin* sseplug = pm.findPlugin("hmsbeagle-cpu-sse");
+		plugins->push_back(sseplug);
+	}catch(beagle::plugin::SharedLibraryException sle){}
+
 	try{
 		beagle::plugin::Plugin* cpuplug = pm.findPlugin("hmsbeagle-cpu");
 		plugins->push_back(cpuplug);
@@ -128,16 +151,6 @@ void beagleLoadPlugins(void) {
 		plugins->push_back(openclalteraplug);
 	}catch(beagle::plugin::SharedLibraryException sle){}
 
-	try{
-		beagle::plugin::Plugin* sseplug = pm.findPlugin("hmsbeagle-cpu-sse");
-		plugins->push_back(sseplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}
-	
-	try{
-		beagle::plugin::Plugin* avxplug = pm.findPlugin("hmsbeagle-cpu-avx");
-		plugins->push_back(avxplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}	
-
 	try{
 		beagle::plugin::Plugin* openmpplug = pm.findPlugin("hmsbeagle-cpu-openmp");
 		plugins->push_back(openmpplug);
@@ -261,7 +274,8 @@ BeagleResourceList* beagleGetResourceList() {
             std::list<BeagleResource> rList = (*plugin_iter)->getBeagleResources();
             std::list<BeagleResource>::iterator r_iter = rList.begin();
             int prev_rI = rI;
-            for(; r_iter != rList.end(); r_iter++){
+            int pluginResource = 0; // index of the resource within its plugin
+            for(; r_iter != rList.end(); r_iter++, pluginResource++){
                 bool rsrcExists = false;
                 for(int i=0; i<prev_rI; i++){         
                     if (strcmp(rsrcList->list[i].name, r_iter->name) == 0) {
@@ -274,7 +288,7 @@ BeagleResourceList* beagleGetResourceList() {
                 }
                 
                 if (!rsrcExists) {
-                    ResourceMap.insert(std::pair<int, int>(rI, (rI - prev_rI)));
+                    ResourceMap.insert(std::pair<int, int>(rI, pluginResource));
                     rsrcList->list[rI++] = *r_iter;
                 }
             }
@@ -669,6 +683,24 @@ int beagleSetCategoryRates(int instance,
 //    }
 }
 
+int beagleSetCategoryRatesWithIndex(int instance,
+                                    int categoryRatesIndex,
+                                    const double* inCategoryRates) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setCategoryRatesWithIndex(categoryRatesIndex, inCategoryRates);
+}
+
+int beagleSetPatternPartitions(int instance,
+                               int partitionCount,
+                               const int* inPatternPartitions) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setPatternPartitions(partitionCount, inPatternPartitions);
+}
+
 int beagleSetTransitionMatrix(int instance,
                         int matrixIndex,
                         const double* inMatrix,
@@ -772,6 +804,24 @@ int beagleUpdateTransitionMatrices(int instance,
 //    }
 }
 
+int beagleUpdateTransitionMatricesWithMultipleModels(int instance,
+                                                     const int* eigenIndices,
+                                                     const int* categoryRateIndices,
+                                                     const int* probabilityIndices,
+                                                     const int* firstDerivativeIndices,
+                                                     const int* secondDerivativeIndices,
+                                                     const double* edgeLengths,
+                                                     int count) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->updateTransitionMatricesWithMultipleModels(eigenIndices, categoryRateIndices,
+                                                                      probabilityIndices,
+                                                                      firstDerivativeIndices,
+                                                                      secondDerivativeIndices,
+                                                                      edgeLengths, count);
+}
+
 int beagleUpdatePartials(const int instance,
                    const BeagleOperation* operations,
                    int operationCount,
@@ -794,6 +844,41 @@ int beagleUpdatePartials(const int instance,
 //    }
 }
 
+int beagleUpdatePartialsByPartition(const int instance,
+                                    const BeagleOperationByPartition* operations,
+                                    int operationCount) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->updatePartialsByPartition((const int*)operations, operationCount);
+}
+
+int beagleCreatePlan(const int instance,
+                     const BeagleOperation* operations,
+                     int operationCount,
+                     int cumulativeScaleIndex) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->createPlan((const int*)operations, operationCount, cumulativeScaleIndex);
+}
+
+int beagleExecutePlan(const int instance,
+                      int plan) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->executePlan(plan);
+}
+
+int beagleFinalizePlan(const int instance,
+                       int plan) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->finalizePlan(plan);
+}
+
 int beagleWaitForPartials(const int instance,
                     const int* destinationPartials,
                     int destinationPartialsCount) {
@@ -877,6 +962,39 @@ int beagleResetScaleFactors(int instance,
 //    }
 }
 
+int beagleAccumulateScaleFactorsByPartition(int instance,
+                                            const int* scalingIndices,
+                                            int count,
+                                            int cumulativeScalingIndex,
+                                            int partitionIndex) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->accumulateScaleFactorsByPartition(scalingIndices, count,
+                                                             cumulativeScalingIndex, partitionIndex);
+}
+
+int beagleRemoveScaleFactorsByPartition(int instance,
+                                        const int* scalingIndices,
+                                        int count,
+                                        int cumulativeScalingIndex,
+                                        int partitionIndex) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->removeScaleFactorsByPartition(scalingIndices, count,
+                                                         cumulativeScalingIndex, partitionIndex);
+}
+
+int beagleResetScaleFactorsByPartition(int instance,
+                                       int cumulativeScalingIndex,
+                                       int partitionIndex) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->resetScaleFactorsByPartition(cumulativeScalingIndex, partitionIndex);
+}
+
 int beagleCopyScaleFactors(int instance,
                            int destScalingIndex,
                            int srcScalingIndex) {
@@ -928,6 +1046,80 @@ int beagleCalculateRootLogLikelihoods(int instance,
 
 }
 
+int beagleCalculateRootLogLikelihoodsByPartition(int instance,
+                                                 const int* bufferIndices,
+                                                 const int* categoryWeightsIndices,
+                                                 const int* stateFrequenciesIndices,
+                                                 const int* cumulativeScaleIndices,
+                                                 const int* partitionIndices,
+                                                 int partitionCount,
+                                                 int count,
+                                                 double* outSumLogLikelihoodByPartition,
+                                                 double* outSumLogLikelihood) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->calculateRootLogLikelihoodsByPartition(bufferIndices, categoryWeightsIndices,
+                                                                  stateFrequenciesIndices,
+                                                                  cumulativeScaleIndices,
+                                                                  partitionIndices, partitionCount,
+                                                                  count,
+                                                                  outSumLogLikelihoodByPartition,
+                                                                  outSumLogLikelihood);
+}
+
+int beagleCalculateTreeLogLikelihoods(int instance,
+                                      const BeagleOperation* operations,
+                                      const int* operationCounts,
+                                      const int* rootBufferIndices,
+                                      const int* categoryWeightsIndices,
+                                      const int* stateFrequenciesIndices,
+                                      const int* cumulativeScaleIndices,
+                                      int treeCount,
+                                      double* outLogLikelihoods) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->calculateTreeLogLikelihoods((const int*)operations, operationCounts,
+                                                       rootBufferIndices, categoryWeightsIndices,
+                                                       stateFrequenciesIndices, cumulativeScaleIndices,
+                                                       treeCount, outLogLikelihoods);
+}
+
+int beagleSetTreeModel(int instance,
+                       const int* parentIndices,
+                       const double* edgeLengths,
+                       int nodeCount) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setTreeModel(parentIndices, edgeLengths, nodeCount);
+}
+
+int beagleSetTreeModelEdgeLengths(int instance,
+                                  const int* nodeIndices,
+                                  const double* edgeLengths,
+                                  int count) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setTreeModelEdgeLengths(nodeIndices, edgeLengths, count);
+}
+
+int beagleCalculateTreeModelLogLikelihood(int instance,
+                                          int eigenIndex,
+                                          int categoryWeightsIndex,
+                                          int stateFrequenciesIndex,
+                                          int cumulativeScaleIndex,
+                                          double* outLogLikelihood) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->calculateTreeModelLogLikelihood(eigenIndex, categoryWeightsIndex,
+                                                           stateFrequenciesIndex, cumulativeScaleIndex,
+                                                           outLogLikelihood);
+}
+
 int beagleCalculateEdgeLogLikelihoods(int instance,
                                       const int* parentBufferIndices,
                                       const int* childBufferIndices,
@@ -983,3 +1175,65 @@ int beagleGetSiteDerivatives(int instance,
     return beagleInstance->getSiteDerivatives(outFirstDerivatives, outSecondDerivatives);        
 }
 
+int beagleSetCPUThreadCount(int instance,
+                            int threadCount) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setCPUThreadCount(threadCount);
+}
+
+int beagleSetCPUPatternBlockSize(int instance,
+                                 int patternBlockSize) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setCPUPatternBlockSize(patternBlockSize);
+}
+
+int beagleSetCPUPatternCompression(int instance,
+                                   int compress) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setCPUPatternCompression(compress);
+}
+
+int beagleSetCPUPartialsSpill(int instance,
+                              const char* directory) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->setCPUPartialsSpill(directory);
+}
+
+int beagleSaveState(int instance) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->saveState();
+}
+
+int beagleRestoreState(int instance) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->restoreState();
+}
+
+int beagleWriteCheckpoint(int instance,
+                          const char* fileName) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->writeCheckpoint(fileName);
+}
+
+int beagleReadCheckpoint(int instance,
+                         const char* fileName) {
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    return beagleInstance->readCheckpoint(fileName);
+}
+
@@ -166,6 +166,7 @@ enum BeagleFlags {
     
     BEAGLE_FLAG_THREADING_OPENMP    = 1 << 13,   /**< OpenMP threading */
     BEAGLE_FLAG_THREADING_NONE      = 1 << 14,   /**< No threading */
+    BEAGLE_FLAG_THREADING_CPP       = 1 << 28,   /**< Persistent C++ thread pool threading */
     
     BEAGLE_FLAG_PROCESSOR_CPU       = 1 << 15,   /**< Use CPU as main processor */
     BEAGLE_FLAG_PROCESSOR_GPU       = 1 << 16,   /**< Use GPU as main processor */
@@ -176,7 +177,10 @@ enum BeagleFlags {
     
     BEAGLE_FLAG_FRAMEWORK_CUDA      = 1 << 22,   /**< Use CUDA implementation with GPU resources */
     BEAGLE_FLAG_FRAMEWORK_OPENCL    = 1 << 23,   /**< Use OpenCL implementation with GPU resources */
-    BEAGLE_FLAG_FRAMEWORK_CPU       = 1 << 27    /**< Use CPU implementation */
+    BEAGLE_FLAG_FRAMEWORK_CPU       = 1 << 27,   /**< Use CPU implementation */
+
+    BEAGLE_FLAG_PARTIALS_PATTERN_MAJOR = 1 << 29, /**< Store the partials of all rate categories of a pattern together (CPU, general state counts) */
+    BEAGLE_FLAG_PRECISION_MIXED     = 1 << 30    /**< Single precision partials and matrices, double precision sums and scale factors (CPU) */
 };
 
 /**
@@ -458,6 +462,42 @@ BEAGLE_DLLEXPORT int beagleSetCategoryWeights(int instance,
  */
 BEAGLE_DLLEXPORT int beagleSetCategoryRates(int instance,
                            const double* inCategoryRates);
+
+/**
+ * @brief Set a set of category rates
+ *
+ * This function sets one of eigenBufferCount vectors of category rates for an instance,
+ * for use with beagleUpdateTransitionMatricesWithMultipleModels. Index 0 is the vector
+ * set by beagleSetCategoryRates.
+ *
+ * @param instance              Instance number (input)
+ * @param categoryRatesIndex    Index of category rates buffer (input)
+ * @param inCategoryRates       Array containing categoryCount rate scalers (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCategoryRatesWithIndex(int instance,
+                                                     int categoryRatesIndex,
+                                                     const double* inCategoryRates);
+
+/**
+ * @brief Set pattern partitions
+ *
+ * This function assigns each pattern of an instance to one of partitionCount partitions,
+ * which the ByPartition functions then update and integrate independently. Partitions
+ * must be runs of consecutive patterns in increasing order of partition index, and
+ * cannot be combined with pattern compression.
+ *
+ * @param instance              Instance number (input)
+ * @param partitionCount        Number of partitions (input)
+ * @param inPatternPartitions   Array containing the partition index of each of patternCount
+ *                               patterns (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetPatternPartitions(int instance,
+                                                int partitionCount,
+                                                const int* inPatternPartitions);
 /**
  * @brief Set pattern weights
  *
@@ -523,6 +563,35 @@ BEAGLE_DLLEXPORT int beagleUpdateTransitionMatrices(int instance,
                                    const double* edgeLengths,
                                    int count);
 
+/**
+ * @brief Calculate a list of transition probability matrices with a model for each
+ *
+ * This function calculates a list of transition probabilities matrices and their first and
+ * second derivatives (if requested), each from its own eigen-decomposition and category rates.
+ *
+ * @param instance                  Instance number (input)
+ * @param eigenIndices              List of indices of eigen-decomposition buffers (input)
+ * @param categoryRateIndices       List of indices of category rates buffers (input)
+ * @param probabilityIndices        List of indices of transition probability matrices to update
+ *                                   (input)
+ * @param firstDerivativeIndices    List of indices of first derivative matrices to update
+ *                                   (input, NULL implies no calculation)
+ * @param secondDerivativeIndices   List of indices of second derivative matrices to update
+ *                                   (input, NULL implies no calculation)
+ * @param edgeLengths               List of edge lengths with which to perform calculations (input)
+ * @param count                     Length of lists
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateTransitionMatricesWithMultipleModels(int instance,
+                                                                      const int* eigenIndices,
+                                                                      const int* categoryRateIndices,
+                                                                      const int* probabilityIndices,
+                                                                      const int* firstDerivativeIndices,
+                                                                      const int* secondDerivativeIndices,
+                                                                      const double* edgeLengths,
+                                                                      int count);
+
 /**
  * @brief Set a finite-time transition probability matrix
  *
@@ -596,6 +665,21 @@ typedef struct {
 	int child2TransitionMatrix; /**< index of transition matrix of second partials child buffer */
 } BeagleOperation;
 
+/**
+ * @brief A list of integer indices which specify a partial likelihoods operation on one partition.
+ */
+typedef struct {
+	int destinationPartials;    /**< index of destination, or parent, partials buffer  */
+	int destinationScaleWrite;  /**< index of scaling buffer to write to (if set to BEAGLE_OP_NONE then calculation of new scalers is disabled)  */
+	int destinationScaleRead;   /**< index of scaling buffer to read from (if set to BEAGLE_OP_NONE then use of existing scale factors is disabled)  */
+	int child1Partials;         /**< index of first child partials buffer */
+	int child1TransitionMatrix; /**< index of transition matrix of first partials child buffer  */
+	int child2Partials;         /**< index of second child partials buffer */
+	int child2TransitionMatrix; /**< index of transition matrix of second partials child buffer */
+	int partition;              /**< index of partition whose patterns are calculated */
+	int cumulativeScaleIndex;   /**< index number of scaleBuffer to store accumulated factors */
+} BeagleOperationByPartition;
+
 /**
  * @brief Calculate or queue for calculation partials using a list of operations
  *
@@ -615,6 +699,70 @@ BEAGLE_DLLEXPORT int beagleUpdatePartials(const int instance,
                          int operationCount,
                          int cumulativeScaleIndex);
 
+/**
+ * @brief Calculate partials for partitions using a list of operations
+ *
+ * This function calculates a list of partials, each operation only over the patterns of
+ * its partition. Operations on different partitions are independent of one another and
+ * may run together. Patterns outside an operation's partition keep their values.
+ *
+ * @param instance                  Instance number (input)
+ * @param operations                BeagleOperationByPartition list specifying operations (input)
+ * @param operationCount            Number of operations (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdatePartialsByPartition(const int instance,
+                                                     const BeagleOperationByPartition* operations,
+                                                     int operationCount);
+
+/**
+ * @brief Prepare a list of operations for repeated calculation
+ *
+ * This function checks a list of operations and works out once what beagleUpdatePartials
+ * would on every call: the order the operations run in, which of them run together and how
+ * each is rescaled. The returned plan is then run by beagleExecutePlan, as often as needed,
+ * with the contents of the buffers at that time. Tip states and tip partials should be set
+ * before the plan is created.
+ *
+ * @param instance              Instance number (input)
+ * @param operations            BeagleOperation list specifying operations (input)
+ * @param operationCount        Number of operations (input)
+ * @param cumulativeScaleIndex  Index number of scaleBuffer to store accumulated factors (input)
+ *
+ * @return the plan number on success, or an error code
+ */
+BEAGLE_DLLEXPORT int beagleCreatePlan(const int instance,
+                                      const BeagleOperation* operations,
+                                      int operationCount,
+                                      int cumulativeScaleIndex);
+
+/**
+ * @brief Calculate partials using a plan
+ *
+ * This function calculates the partials of a plan made by beagleCreatePlan, as a
+ * beagleUpdatePartials call with the plan's operations would. With
+ * BEAGLE_FLAG_COMPUTATION_ASYNCH, the calculation is queued as beagleUpdatePartials is.
+ *
+ * @param instance  Instance number (input)
+ * @param plan      Plan number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleExecutePlan(const int instance,
+                                       int plan);
+
+/**
+ * @brief Free a plan
+ *
+ * @param instance  Instance number (input)
+ * @param plan      Plan number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleFinalizePlan(const int instance,
+                                        int plan);
+
 /**
  * @brief Block until all calculations that write to the specified partials have completed.
  *
@@ -624,6 +772,10 @@ BEAGLE_DLLEXPORT int beagleUpdatePartials(const int instance,
  * indices of "destinationPartials" that were used in a previous beagleUpdatePartials
  * call.  The library will block until those partials have been calculated.
  *
+ * With BEAGLE_FLAG_COMPUTATION_ASYNCH, CPU instances queue each beagleUpdatePartials call and
+ * return at once; other calls on the instance wait for the whole queue. An error raised by
+ * queued operations is returned by the next beagleWaitForPartials call.
+ *
  * @param instance                  Instance number (input)
  * @param destinationPartials       List of the indices of destinationPartials that must be
  *                                   calculated before the function returns
@@ -678,6 +830,53 @@ BEAGLE_DLLEXPORT int beagleRemoveScaleFactors(int instance,
 BEAGLE_DLLEXPORT int beagleResetScaleFactors(int instance,
                             int cumulativeScaleIndex);
 
+/**
+ * @brief Accumulate scale factors of one partition
+ *
+ * This function is beagleAccumulateScaleFactors over the patterns of one partition.
+ *
+ * @param instance                  Instance number (input)
+ * @param scaleIndices            	List of scaleBuffers to add (input)
+ * @param count                     Number of scaleBuffers in list (input)
+ * @param cumulativeScaleIndex      Index number of scaleBuffer to accumulate factors into (input)
+ * @param partitionIndex            Index of partition (input)
+ */
+BEAGLE_DLLEXPORT int beagleAccumulateScaleFactorsByPartition(int instance,
+                                                             const int* scaleIndices,
+                                                             int count,
+                                                             int cumulativeScaleIndex,
+                                                             int partitionIndex);
+
+/**
+ * @brief Remove scale factors of one partition
+ *
+ * This function is beagleRemoveScaleFactors over the patterns of one partition.
+ *
+ * @param instance                  Instance number (input)
+ * @param scaleIndices            	List of scaleBuffers to remove (input)
+ * @param count                     Number of scaleBuffers in list (input)
+ * @param cumulativeScaleIndex    	Index number of scaleBuffer containing accumulated factors (input)
+ * @param partitionIndex            Index of partition (input)
+ */
+BEAGLE_DLLEXPORT int beagleRemoveScaleFactorsByPartition(int instance,
+                                                         const int* scaleIndices,
+                                                         int count,
+                                                         int cumulativeScaleIndex,
+                                                         int partitionIndex);
+
+/**
+ * @brief Reset scalefactors of one partition
+ *
+ * This function resets the patterns of one partition in a cumulative scale buffer.
+ *
+ * @param instance                  Instance number (input)
+ * @param cumulativeScaleIndex    	Index number of cumulative scaleBuffer (input)
+ * @param partitionIndex            Index of partition (input)
+ */
+BEAGLE_DLLEXPORT int beagleResetScaleFactorsByPartition(int instance,
+                                                        int cumulativeScaleIndex,
+                                                        int partitionIndex);
+
 /**
  * @brief Copy scale factors
  *
@@ -721,6 +920,139 @@ BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoods(int instance,
                                       int count,
                                       double* outSumLogLikelihood);
 
+/**
+ * @brief Calculate site log likelihoods at a root node for a list of partitions
+ *
+ * This function integrates the partials of each listed partition at a node with respect to
+ * that partition's weights and state frequencies, returning a log likelihood sum per partition
+ * and their total. The index lists hold one entry per partition.
+ *
+ * @param instance                        Instance number (input)
+ * @param bufferIndices                   List of partialsBuffer indices to integrate (input)
+ * @param categoryWeightsIndices          List of weights to apply to each partialsBuffer (input)
+ * @param stateFrequenciesIndices         List of state frequencies for each partialsBuffer (input)
+ * @param cumulativeScaleIndices          List of scaleBuffers containing accumulated factors to
+ *                                         apply to each partialsBuffer (input)
+ * @param partitionIndices                List of partitions to integrate (input)
+ * @param partitionCount                  Number of partitions (input)
+ * @param count                           Number of partialsBuffer to integrate per partition,
+ *                                         currently 1 (input)
+ * @param outSumLogLikelihoodByPartition  Array of partitionCount log likelihoods (output)
+ * @param outSumLogLikelihood             Pointer to destination for the summed log likelihood
+ *                                         (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoodsByPartition(int instance,
+                                                                  const int* bufferIndices,
+                                                                  const int* categoryWeightsIndices,
+                                                                  const int* stateFrequenciesIndices,
+                                                                  const int* cumulativeScaleIndices,
+                                                                  const int* partitionIndices,
+                                                                  int partitionCount,
+                                                                  int count,
+                                                                  double* outSumLogLikelihoodByPartition,
+                                                                  double* outSumLogLikelihood);
+
+/**
+ * @brief Calculate partials and root log likelihoods for a batch of trees
+ *
+ * This function evaluates treeCount trees, such as candidate proposals, in one call. Each
+ * tree has its own list of operations, performed as by beagleUpdatePartials, and its own
+ * root, integrated as by beagleCalculateRootLogLikelihoods. The operations of all trees are
+ * scheduled together, so independent operations from different trees run concurrently.
+ * Trees may share partials buffers that none of them writes; a buffer written by one tree
+ * must not be written or read by another. Transition matrices of all trees should be updated
+ * beforehand, for example in a single beagleUpdateTransitionMatrices call. Site log
+ * likelihoods retrieved afterwards are those of the last tree.
+ *
+ * @param instance                 Instance number (input)
+ * @param operations               BeagleOperation lists of all trees, one after another (input)
+ * @param operationCounts          Number of operations of each tree (input)
+ * @param rootBufferIndices        Root partialsBuffer index of each tree (input)
+ * @param categoryWeightsIndices   Category weights index of each tree (input)
+ * @param stateFrequenciesIndices  State frequencies index of each tree (input)
+ * @param cumulativeScaleIndices   Index of the scaleBuffer each tree accumulates factors into
+ *                                  and integrates with, or BEAGLE_OP_NONE (input)
+ * @param treeCount                Number of trees (input)
+ * @param outLogLikelihoods        Array of treeCount log likelihoods (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateTreeLogLikelihoods(int instance,
+                                                       const BeagleOperation* operations,
+                                                       const int* operationCounts,
+                                                       const int* rootBufferIndices,
+                                                       const int* categoryWeightsIndices,
+                                                       const int* stateFrequenciesIndices,
+                                                       const int* cumulativeScaleIndices,
+                                                       int treeCount,
+                                                       double* outLogLikelihoods);
+
+/**
+ * @brief Set the tree whose likelihood beagleCalculateTreeModelLogLikelihood computes
+ *
+ * This function registers a rooted binary tree with the instance. Node i stores its partials
+ * in partialsBuffer i and the transition probability matrix of the edge above it in matrix i,
+ * with nodes 0 to tipCount - 1 being the tips. When rescaling, internal node i uses
+ * scaleBuffer i - tipCount. The instance keeps track of which of these are out of date:
+ * changing the length of an edge or the children of a node only recomputes the path from there
+ * to the root. Any other call writing tip data, models, partials, matrices or scale buffers
+ * makes the next calculation recompute the whole tree.
+ *
+ * @param instance       Instance number (input)
+ * @param parentIndices  Parent node of each node, BEAGLE_OP_NONE for the root (input)
+ * @param edgeLengths    Length of the edge above each node; ignored for the root (input)
+ * @param nodeCount      Number of nodes, 2 * tipCount - 1 (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTreeModel(int instance,
+                                        const int* parentIndices,
+                                        const double* edgeLengths,
+                                        int nodeCount);
+
+/**
+ * @brief Change edge lengths of the tree set by beagleSetTreeModel
+ *
+ * @param instance     Instance number (input)
+ * @param nodeIndices  Nodes whose edges change (input)
+ * @param edgeLengths  New length of the edge above each node (input)
+ * @param count        Number of edges (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTreeModelEdgeLengths(int instance,
+                                                   const int* nodeIndices,
+                                                   const double* edgeLengths,
+                                                   int count);
+
+/**
+ * @brief Calculate the log likelihood of the tree set by beagleSetTreeModel
+ *
+ * This function updates the transition probability matrices and partials of the tree that are
+ * out of date, then integrates the root partials as beagleCalculateRootLogLikelihoods does.
+ * Passing a cumulativeScaleIndex rescales the partials of every internal node and sums their
+ * factors into that scaleBuffer, which must not be one the tree uses. It is ignored under
+ * BEAGLE_FLAG_SCALING_ALWAYS.
+ *
+ * @param instance               Instance number (input)
+ * @param eigenIndex             Index of eigen-decomposition buffer (input)
+ * @param categoryWeightsIndex   Index of category weights (input)
+ * @param stateFrequenciesIndex  Index of state frequencies (input)
+ * @param cumulativeScaleIndex   Index of scaleBuffer to accumulate factors into, or
+ *                                BEAGLE_OP_NONE (input)
+ * @param outLogLikelihood       Pointer to destination for the log likelihood (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateTreeModelLogLikelihood(int instance,
+                                                           int eigenIndex,
+                                                           int categoryWeightsIndex,
+                                                           int stateFrequenciesIndex,
+                                                           int cumulativeScaleIndex,
+                                                           double* outLogLikelihood);
+
 /**
  * @brief Calculate site log likelihoods and derivatives along an edge
  *
@@ -790,6 +1122,139 @@ BEAGLE_DLLEXPORT int beagleGetSiteLogLikelihoods(int instance,
 BEAGLE_DLLEXPORT int beagleGetSiteDerivatives(int instance,
                                     double* outFirstDerivatives,
                                     double* outSecondDerivatives);    
+
+/**
+ * @brief Set the number of threads used by a CPU instance
+ *
+ * This function sets the number of threads used to compute partials. Work is divided into
+ * tiles of one rate category by one block of site patterns, so more threads than rate
+ * categories can be used. By default an instance uses all available threads.
+ *
+ * @param instance               Instance number (input)
+ * @param threadCount            Number of threads, must be at least 1 (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUThreadCount(int instance,
+                                             int threadCount);
+
+/**
+ * @brief Set the number of site patterns per thread work unit for a CPU instance
+ *
+ * This function sets the number of site patterns in each block of a rate category handed to
+ * a thread when computing partials. A value of 0 chooses the block size automatically from
+ * the thread count.
+ *
+ * @param instance               Instance number (input)
+ * @param patternBlockSize       Number of site patterns per block, or 0 for automatic (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUPatternBlockSize(int instance,
+                                                  int patternBlockSize);
+
+/**
+ * @brief Collapse identical site columns of a CPU instance into unique patterns
+ *
+ * When enabled, the instance compares the tip data of every site column before its first
+ * likelihood computation and keeps one pattern for each distinct column, with the pattern
+ * weights of its columns summed. Clients keep passing and receiving one value per column:
+ * beagleSetPatternWeights, beagleSetPartials, beagleGetPartials, beagleGetSiteLogLikelihoods
+ * and beagleGetSiteDerivatives map between columns and patterns. Tip data cannot be changed
+ * once the columns have been collapsed, and this setting cannot be changed either.
+ *
+ * @param instance               Instance number (input)
+ * @param compress               1 to collapse identical columns, 0 (default) to keep them (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUPatternCompression(int instance,
+                                                    int compress);
+
+/**
+ * @brief Keep the partials buffers of a CPU instance in a file instead of memory
+ *
+ * For alignments whose partials do not fit in RAM. The instance moves its partials buffers
+ * into a temporary file created in the given directory and maps it into memory, so that the
+ * operating system writes pages back to the file and reads them in again as needed. While
+ * updating partials the instance asks for the buffers of upcoming operations to be read ahead
+ * and lets go of buffers no later operation in the list reads. Creating an instance only
+ * reserves address space for its partials, so call this straight after beagleCreateInstance.
+ * The file is removed when the instance is finalized. Tip states, scale buffers, transition
+ * matrices and snapshot copies stay in memory.
+ *
+ * @param instance               Instance number (input)
+ * @param directory              Directory to create the file in, on a disk with room for all
+ *                               the partials buffers (input)
+ *
+ * @return error code, BEAGLE_ERROR_GENERAL if the file cannot be created or mapped or the
+ *         partials are already in a file
+ */
+BEAGLE_DLLEXPORT int beagleSetCPUPartialsSpill(int instance,
+                                               const char* directory);
+
+/**
+ * @brief Take a snapshot of the partials, scale buffers and transition matrices of an instance
+ *
+ * Nothing is copied when the snapshot is taken. The first time a buffer is written afterwards,
+ * its contents are set aside and the write goes to another block of memory, so the cost is
+ * proportional to the number of buffers changed. This lets an MCMC client propose changes
+ * without keeping a second set of buffer indices: call beagleSaveState before a proposal and
+ * again once it is accepted, or beagleRestoreState if it is rejected. Taking a new snapshot
+ * discards the previous one. Tip states, eigen decompositions, weights and frequencies are
+ * not part of the snapshot.
+ *
+ * @param instance               Instance number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSaveState(int instance);
+
+/**
+ * @brief Return an instance to its last snapshot
+ *
+ * Every partials buffer, scale buffer and transition matrix written since the last
+ * beagleSaveState call gets back the contents it had then. Only pointers are swapped, one per
+ * buffer written. The snapshot stays in place, so the next proposal can start straight away.
+ *
+ * @param instance               Instance number (input)
+ *
+ * @return error code, BEAGLE_ERROR_GENERAL if no snapshot has been taken
+ */
+BEAGLE_DLLEXPORT int beagleRestoreState(int instance);
+
+/**
+ * @brief Write the complete state of an instance to a checkpoint file
+ *
+ * The file holds the partials, tip data, scale buffers, transition matrices, eigen
+ * decompositions, category rates and weights, state frequencies and pattern weights of the
+ * instance, in its own precision and memory layout. It can only be read back into an instance
+ * created with the same arguments on the same implementation.
+ *
+ * @param instance               Instance number (input)
+ * @param fileName               Path of the file to create or overwrite (input)
+ *
+ * @return error code, BEAGLE_ERROR_GENERAL if the file cannot be written
+ */
+BEAGLE_DLLEXPORT int beagleWriteCheckpoint(int instance,
+                                           const char* fileName);
+
+/**
+ * @brief Restore the state of an instance from a checkpoint file
+ *
+ * The instance must have been created with the same arguments, and must be on the same
+ * implementation, as the instance that wrote the file. Where the platform supports it the file
+ * is memory-mapped and the instance's buffers point straight into the mapping, so pages are
+ * only read as the computation touches them. Writes to the buffers are never written back to
+ * the file. Any snapshot taken with beagleSaveState is discarded.
+ *
+ * @param instance               Instance number (input)
+ * @param fileName               Path of a file written by beagleWriteCheckpoint (input)
+ *
+ * @return error code, BEAGLE_ERROR_GENERAL if the file cannot be read or does not match the instance
+ */
+BEAGLE_DLLEXPORT int beagleReadCheckpoint(int instance,
+                                          const char* fileName);
     
 /* using C calling conventions so that C programs can successfully link the beagle library
  * (closing brace)
@@ -52,8 +52,13 @@
 
 
 #else // not windows
+#if defined(__GNUC__) && __GNUC__ >= 4
+// keep exported symbols visible in modules built with -fvisibility=hidden
+#define BEAGLE_DLLEXPORT __attribute__ ((visibility("default")))
+#else
 #define BEAGLE_DLLEXPORT
 #endif
+#endif
 
 #ifndef M_LN2 /* Work around for OS X 10.8 and gcc 4.7.1 */
 #define M_LN2   0.693147180559945309417232121458176568  /* log_e 2 */